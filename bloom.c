@@ -0,0 +1,120 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* A simple Bloom filter keyed on 64-bit string hashes. Ten bits per
+ * element and seven probes gives a false-positive rate of just under 1%
+ * while the filter is within its capacity.
+ */
+
+#define BLOOM_BITS_PER_ELEMENT          10
+#define BLOOM_PROBES                    7
+#define BLOOM_MINCAPACITY               1024
+
+/* Allocate an empty filter large enough for capacity elements */
+int
+lod_bloom_init_(LODBLOOM *bloom, size_t capacity)
+{
+	size_t nbits;
+
+	free(bloom->bits);
+	bloom->bits = NULL;
+	if(capacity < BLOOM_MINCAPACITY)
+	{
+		capacity = BLOOM_MINCAPACITY;
+	}
+	for(nbits = 64; nbits < capacity * BLOOM_BITS_PER_ELEMENT; nbits *= 2)
+	{
+	}
+	bloom->bits = (uint64_t *) calloc(nbits / 64, sizeof(uint64_t));
+	if(!bloom->bits)
+	{
+		bloom->nbits = 0;
+		bloom->capacity = 0;
+		bloom->count = 0;
+		return -1;
+	}
+	bloom->nbits = nbits;
+	bloom->capacity = capacity;
+	bloom->count = 0;
+	return 0;
+}
+
+/* Free the filter's storage (the statistics are retained) */
+void
+lod_bloom_reset_(LODBLOOM *bloom)
+{
+	free(bloom->bits);
+	bloom->bits = NULL;
+	bloom->nbits = 0;
+	bloom->capacity = 0;
+	bloom->count = 0;
+}
+
+/* Add a hash to the filter; if it was definitely not previously present,
+ * the element count is incremented
+ */
+void
+lod_bloom_add_(LODBLOOM *bloom, uint64_t hash)
+{
+	uint64_t h1, h2, bit;
+	int c, added;
+
+	h1 = hash & 0xffffffff;
+	h2 = (hash >> 32) | 1;
+	added = 0;
+	for(c = 0; c < BLOOM_PROBES; c++)
+	{
+		bit = (h1 + c * h2) & (bloom->nbits - 1);
+		if(!(bloom->bits[bit / 64] & (UINT64_C(1) << (bit % 64))))
+		{
+			bloom->bits[bit / 64] |= (UINT64_C(1) << (bit % 64));
+			added = 1;
+		}
+	}
+	if(added)
+	{
+		bloom->count++;
+	}
+}
+
+/* Test a hash against the filter: returns 0 if it is definitely not
+ * present, 1 if it might be
+ */
+int
+lod_bloom_test_(LODBLOOM *bloom, uint64_t hash)
+{
+	uint64_t h1, h2, bit;
+	int c;
+
+	h1 = hash & 0xffffffff;
+	h2 = (hash >> 32) | 1;
+	for(c = 0; c < BLOOM_PROBES; c++)
+	{
+		bit = (h1 + c * h2) & (bloom->nbits - 1);
+		if(!(bloom->bits[bit / 64] & (UINT64_C(1) << (bit % 64))))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,1084 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* A librdf storage module optimised for liblod's access pattern, which is
+ * overwhelmingly "all of the triples whose subject is S". Terms are
+ * interned, and each subject's triples are held contiguously, ordered by
+ * (predicate, object, graph), so that finding them is a single hash probe
+ * followed by a sequential scan. Queries which don't specify a subject
+ * scan every cluster.
+ *
+ * A store may also be layered over an immutable snapshot (see
+ * lod_create_overlay()), in which case queries return the triples held by
+ * the store followed by those in the snapshot, and triples which are
+ * already in the snapshot are not added to the store.
+ */
+
+#define CLUSTERED_MINTERMS              256
+#define CLUSTERED_MINCLUSTERS           64
+#define CLUSTERED_MINTRIPLES            4
+
+static void lod_clustered_factory_(librdf_storage_factory *factory);
+static int lod_clustered_init_(librdf_storage *storage, const char *name, librdf_hash *options);
+static void lod_clustered_terminate_(librdf_storage *storage);
+static int lod_clustered_open_(librdf_storage *storage, librdf_model *model);
+static int lod_clustered_close_(librdf_storage *storage);
+static int lod_clustered_size_(librdf_storage *storage);
+static int lod_clustered_add_statement_(librdf_storage *storage, librdf_statement *statement);
+static int lod_clustered_add_statements_(librdf_storage *storage, librdf_stream *stream);
+static int lod_clustered_remove_statement_(librdf_storage *storage, librdf_statement *statement);
+static int lod_clustered_contains_statement_(librdf_storage *storage, librdf_statement *statement);
+static librdf_stream *lod_clustered_serialise_(librdf_storage *storage);
+static librdf_stream *lod_clustered_find_statements_(librdf_storage *storage, librdf_statement *statement);
+static int lod_clustered_context_add_statement_(librdf_storage *storage, librdf_node *context, librdf_statement *statement);
+static int lod_clustered_context_add_statements_(librdf_storage *storage, librdf_node *context, librdf_stream *stream);
+static int lod_clustered_context_remove_statement_(librdf_storage *storage, librdf_node *context, librdf_statement *statement);
+static int lod_clustered_context_remove_statements_(librdf_storage *storage, librdf_node *context);
+static librdf_stream *lod_clustered_context_serialise_(librdf_storage *storage, librdf_node *context);
+static librdf_stream *lod_clustered_find_statements_in_context_(librdf_storage *storage, librdf_statement *statement, librdf_node *context);
+static librdf_iterator *lod_clustered_get_contexts_(librdf_storage *storage);
+static librdf_node *lod_clustered_get_feature_(librdf_storage *storage, librdf_uri *feature);
+
+static uint64_t lod_clustered_hash_(librdf_node *node);
+static LODTERMID lod_clustered_term_(LODCLSTORE *store, librdf_node *node, int create);
+static LODCLUSTER *lod_clustered_cluster_(LODCLSTORE *store, LODTERMID subject, int create);
+static int lod_clustered_compare_(const void *a, const void *b);
+static size_t lod_clustered_lower_(LODCLUSTER *cluster, const LODCLTRIPLE *key);
+static int lod_clustered_insert_(LODCLSTORE *store, librdf_statement *statement, librdf_node *context, int append);
+static int lod_clustered_add_stream_(LODCLSTORE *store, librdf_stream *stream, librdf_node *context);
+static void lod_clustered_settle_(LODCLSTORE *store);
+static int lod_clustered_remove_(LODCLSTORE *store, librdf_statement *statement, librdf_node *context);
+static int lod_clustered_in_base_(LODCLSTORE *store, librdf_statement *statement);
+static void lod_clustered_base_range_(LODCLSTREAM *stream, librdf_statement *pattern);
+static librdf_stream *lod_clustered_stream_(librdf_storage *storage, librdf_statement *pattern, librdf_node *context);
+static void lod_clustered_seek_(LODCLSTREAM *stream);
+static int lod_clustered_stream_end_(void *context);
+static int lod_clustered_stream_next_(void *context);
+static void *lod_clustered_stream_get_(void *context, int flags);
+static void *lod_clustered_base_get_(LODCLSTREAM *stream, int flags);
+static void lod_clustered_stream_done_(void *context);
+static int lod_clustered_graphs_next_(void *context);
+static void *lod_clustered_graphs_get_(void *context, int flags);
+
+/* Register the subject-clustered storage module with a librdf world, if it
+ * hasn't been already
+ */
+int
+lod_clustered_register_(librdf_world *world)
+{
+	if(librdf_get_storage_factory(world, LOD_CLUSTERED_STORAGE))
+	{
+		return 0;
+	}
+	return librdf_storage_register_factory(world, LOD_CLUSTERED_STORAGE, "liblod subject-clustered storage", lod_clustered_factory_);
+}
+
+/* Layer a clustered storage instance over a snapshot, which must be done
+ * before anything is added to it
+ */
+int
+lod_clustered_attach_(librdf_storage *storage, LODSNAPSHOT *base)
+{
+	LODCLSTORE *store;
+
+	store = (LODCLSTORE *) librdf_storage_get_instance(storage);
+	if(store->base)
+	{
+		lod_snapshot_release(store->base);
+	}
+	store->base = base ? lod_snapshot_retain(base) : NULL;
+	return 0;
+}
+
+/* Return a count of the changes made to a clustered storage, which is
+ * bumped whenever a triple is added or removed
+ */
+unsigned long
+lod_clustered_changes_(librdf_storage *storage)
+{
+	return ((LODCLSTORE *) librdf_storage_get_instance(storage))->changes;
+}
+
+static void
+lod_clustered_factory_(librdf_storage_factory *factory)
+{
+	factory->version = LIBRDF_STORAGE_INTERFACE_VERSION;
+	factory->init = lod_clustered_init_;
+	factory->terminate = lod_clustered_terminate_;
+	factory->open = lod_clustered_open_;
+	factory->close = lod_clustered_close_;
+	factory->size = lod_clustered_size_;
+	factory->add_statement = lod_clustered_add_statement_;
+	factory->add_statements = lod_clustered_add_statements_;
+	factory->remove_statement = lod_clustered_remove_statement_;
+	factory->contains_statement = lod_clustered_contains_statement_;
+	factory->serialise = lod_clustered_serialise_;
+	factory->find_statements = lod_clustered_find_statements_;
+	factory->context_add_statement = lod_clustered_context_add_statement_;
+	factory->context_add_statements = lod_clustered_context_add_statements_;
+	factory->context_remove_statement = lod_clustered_context_remove_statement_;
+	factory->context_remove_statements = lod_clustered_context_remove_statements_;
+	factory->context_serialise = lod_clustered_context_serialise_;
+	factory->find_statements_in_context = lod_clustered_find_statements_in_context_;
+	factory->get_contexts = lod_clustered_get_contexts_;
+	factory->get_feature = lod_clustered_get_feature_;
+}
+
+static int
+lod_clustered_init_(librdf_storage *storage, const char *name, librdf_hash *options)
+{
+	LODCLSTORE *store;
+
+	/* The module has no options, but is responsible for freeing them */
+	if(options)
+	{
+		librdf_free_hash(options);
+	}
+	store = (LODCLSTORE *) calloc(1, sizeof(LODCLSTORE));
+	if(!store)
+	{
+		return 1;
+	}
+	store->world = librdf_storage_get_world(storage);
+	librdf_storage_set_instance(storage, store);
+	return 0;
+}
+
+static void
+lod_clustered_terminate_(librdf_storage *storage)
+{
+	LODCLSTORE *store;
+	size_t c;
+
+	store = (LODCLSTORE *) librdf_storage_get_instance(storage);
+	if(!store)
+	{
+		return;
+	}
+	for(c = 0; c < store->nterms; c++)
+	{
+		librdf_free_node(store->terms[c].node);
+	}
+	for(c = 0; c < store->nclusters; c++)
+	{
+		free(store->clusters[c].triples);
+	}
+	free(store->terms);
+	free(store->slots);
+	free(store->clusters);
+	free(store->dirty);
+	if(store->base)
+	{
+		lod_snapshot_release(store->base);
+	}
+	free(store);
+}
+
+static int
+lod_clustered_open_(librdf_storage *storage, librdf_model *model)
+{
+	return 0;
+}
+
+static int
+lod_clustered_close_(librdf_storage *storage)
+{
+	return 0;
+}
+
+static int
+lod_clustered_size_(librdf_storage *storage)
+{
+	LODCLSTORE *store;
+
+	store = (LODCLSTORE *) librdf_storage_get_instance(storage);
+	return (int) (store->count + (store->base ? store->base->ntriples : 0));
+}
+
+static int
+lod_clustered_add_statement_(librdf_storage *storage, librdf_statement *statement)
+{
+	return lod_clustered_insert_((LODCLSTORE *) librdf_storage_get_instance(storage), statement, NULL, 0);
+}
+
+static int
+lod_clustered_add_statements_(librdf_storage *storage, librdf_stream *stream)
+{
+	return lod_clustered_add_stream_((LODCLSTORE *) librdf_storage_get_instance(storage), stream, NULL);
+}
+
+static int
+lod_clustered_remove_statement_(librdf_storage *storage, librdf_statement *statement)
+{
+	return lod_clustered_remove_((LODCLSTORE *) librdf_storage_get_instance(storage), statement, NULL);
+}
+
+static int
+lod_clustered_contains_statement_(librdf_storage *storage, librdf_statement *statement)
+{
+	LODCLSTORE *store;
+	LODCLUSTER *cluster;
+	LODCLTRIPLE key;
+	LODTERMID subject;
+	size_t pos;
+
+	store = (LODCLSTORE *) librdf_storage_get_instance(storage);
+	if(store->base && lod_clustered_in_base_(store, statement))
+	{
+		return 1;
+	}
+	subject = lod_clustered_term_(store, librdf_statement_get_subject(statement), 0);
+	key.predicate = lod_clustered_term_(store, librdf_statement_get_predicate(statement), 0);
+	key.object = lod_clustered_term_(store, librdf_statement_get_object(statement), 0);
+	key.graph = 0;
+	if(subject == LOD_NOTERM || key.predicate == LOD_NOTERM || key.object == LOD_NOTERM)
+	{
+		return 0;
+	}
+	cluster = lod_clustered_cluster_(store, subject, 0);
+	if(!cluster)
+	{
+		return 0;
+	}
+	/* Matches in any graph */
+	pos = lod_clustered_lower_(cluster, &key);
+	return pos < cluster->count &&
+		cluster->triples[pos].predicate == key.predicate &&
+		cluster->triples[pos].object == key.object;
+}
+
+static librdf_stream *
+lod_clustered_serialise_(librdf_storage *storage)
+{
+	return lod_clustered_stream_(storage, NULL, NULL);
+}
+
+static librdf_stream *
+lod_clustered_find_statements_(librdf_storage *storage, librdf_statement *statement)
+{
+	return lod_clustered_stream_(storage, statement, NULL);
+}
+
+static int
+lod_clustered_context_add_statement_(librdf_storage *storage, librdf_node *context, librdf_statement *statement)
+{
+	return lod_clustered_insert_((LODCLSTORE *) librdf_storage_get_instance(storage), statement, context, 0);
+}
+
+static int
+lod_clustered_context_add_statements_(librdf_storage *storage, librdf_node *context, librdf_stream *stream)
+{
+	return lod_clustered_add_stream_((LODCLSTORE *) librdf_storage_get_instance(storage), stream, context);
+}
+
+static int
+lod_clustered_context_remove_statement_(librdf_storage *storage, librdf_node *context, librdf_statement *statement)
+{
+	return lod_clustered_remove_((LODCLSTORE *) librdf_storage_get_instance(storage), statement, context);
+}
+
+static int
+lod_clustered_context_remove_statements_(librdf_storage *storage, librdf_node *context)
+{
+	LODCLSTORE *store;
+	LODCLUSTER *cluster;
+	LODTERMID graph;
+	size_t c, from, to;
+
+	store = (LODCLSTORE *) librdf_storage_get_instance(storage);
+	graph = lod_clustered_term_(store, context, 0);
+	if(graph == LOD_NOTERM || !store->terms[graph].graph_count)
+	{
+		return 0;
+	}
+	store->changes++;
+	for(c = 0; c < store->nclusters && store->terms[graph].graph_count; c++)
+	{
+		cluster = &(store->clusters[c]);
+		for(from = to = 0; from < cluster->count; from++)
+		{
+			if(cluster->triples[from].graph == graph)
+			{
+				store->count--;
+				store->terms[graph].graph_count--;
+				continue;
+			}
+			cluster->triples[to] = cluster->triples[from];
+			to++;
+		}
+		cluster->count = to;
+	}
+	return 0;
+}
+
+static librdf_stream *
+lod_clustered_context_serialise_(librdf_storage *storage, librdf_node *context)
+{
+	return lod_clustered_stream_(storage, NULL, context);
+}
+
+static librdf_stream *
+lod_clustered_find_statements_in_context_(librdf_storage *storage, librdf_statement *statement, librdf_node *context)
+{
+	return lod_clustered_stream_(storage, statement, context);
+}
+
+static librdf_iterator *
+lod_clustered_get_contexts_(librdf_storage *storage)
+{
+	LODCLSTREAM *stream;
+	librdf_iterator *iterator;
+
+	stream = (LODCLSTREAM *) calloc(1, sizeof(LODCLSTREAM));
+	if(!stream)
+	{
+		return NULL;
+	}
+	stream->storage = storage;
+	stream->store = (LODCLSTORE *) librdf_storage_get_instance(storage);
+	/* pos is the term being visited */
+	for(; stream->pos < stream->store->nterms && !stream->store->terms[stream->pos].graph_count; stream->pos++)
+	{
+	}
+	stream->done = (stream->pos >= stream->store->nterms);
+	librdf_storage_add_reference(storage);
+	iterator = librdf_new_iterator(stream->store->world, (void *) stream, lod_clustered_stream_end_, lod_clustered_graphs_next_, lod_clustered_graphs_get_, lod_clustered_stream_done_);
+	if(!iterator)
+	{
+		lod_clustered_stream_done_(stream);
+	}
+	return iterator;
+}
+
+static librdf_node *
+lod_clustered_get_feature_(librdf_storage *storage, librdf_uri *feature)
+{
+	LODCLSTORE *store;
+
+	store = (LODCLSTORE *) librdf_storage_get_instance(storage);
+	if(feature && !strcmp((const char *) librdf_uri_as_string(feature), LIBRDF_MODEL_FEATURE_CONTEXTS))
+	{
+		return librdf_new_node_from_typed_literal(store->world, (const unsigned char *) "1", NULL, NULL);
+	}
+	return NULL;
+}
+
+/* Hash a node's kind and value */
+static uint64_t
+lod_clustered_hash_(librdf_node *node)
+{
+	const char *str;
+	librdf_uri *uri;
+	uint64_t hash;
+	size_t len;
+
+	if(librdf_node_is_resource(node))
+	{
+		str = (const char *) librdf_uri_as_counted_string(librdf_node_get_uri(node), &len);
+		return lod_hash_(str, len) * 3 + 1;
+	}
+	if(librdf_node_is_blank(node))
+	{
+		str = (const char *) librdf_node_get_counted_blank_identifier(node, &len);
+		return lod_hash_(str, len) * 3 + 2;
+	}
+	str = (const char *) librdf_node_get_literal_value_as_counted_string(node, &len);
+	hash = lod_hash_(str, len);
+	str = librdf_node_get_literal_value_language(node);
+	if(str)
+	{
+		hash = (hash * 31) ^ lod_hash_(str, strlen(str));
+	}
+	uri = librdf_node_get_literal_value_datatype_uri(node);
+	if(uri)
+	{
+		str = (const char *) librdf_uri_as_counted_string(uri, &len);
+		hash = (hash * 31) ^ lod_hash_(str, len);
+	}
+	return hash * 3;
+}
+
+/* Locate a term, interning it if create is set; returns LOD_NOTERM if the
+ * term doesn't exist (or can't be added)
+ */
+static LODTERMID
+lod_clustered_term_(LODCLSTORE *store, librdf_node *node, int create)
+{
+	LODCLTERM *term;
+	LODTERMID *slots, id;
+	uint64_t hash;
+	size_t slot, size, mask, c;
+
+	if(!node || (!store->nslots && !create))
+	{
+		return LOD_NOTERM;
+	}
+	if(create && (store->nterms + 1) * 2 > store->nslots)
+	{
+		size = store->nslots ? store->nslots * 2 : CLUSTERED_MINTERMS * 2;
+		slots = (LODTERMID *) calloc(size, sizeof(LODTERMID));
+		if(!slots)
+		{
+			return LOD_NOTERM;
+		}
+		for(c = 0; c < store->nterms; c++)
+		{
+			for(slot = (size_t) (store->terms[c].hash & (size - 1)); slots[slot]; slot = (slot + 1) & (size - 1))
+			{
+			}
+			slots[slot] = (LODTERMID) (c + 1);
+		}
+		free(store->slots);
+		store->slots = slots;
+		store->nslots = size;
+	}
+	hash = lod_clustered_hash_(node);
+	mask = store->nslots - 1;
+	for(slot = (size_t) (hash & mask); store->slots[slot]; slot = (slot + 1) & mask)
+	{
+		id = store->slots[slot] - 1;
+		if(store->terms[id].hash == hash && librdf_node_equals(store->terms[id].node, node))
+		{
+			return id;
+		}
+	}
+	if(!create)
+	{
+		return LOD_NOTERM;
+	}
+	if(store->nterms + 1 > store->termsize)
+	{
+		size = store->termsize ? store->termsize * 2 : CLUSTERED_MINTERMS;
+		term = (LODCLTERM *) realloc(store->terms, size * sizeof(LODCLTERM));
+		if(!term)
+		{
+			return LOD_NOTERM;
+		}
+		store->terms = term;
+		store->termsize = size;
+	}
+	term = &(store->terms[store->nterms]);
+	term->node = librdf_new_node_from_node(node);
+	if(!term->node)
+	{
+		return LOD_NOTERM;
+	}
+	term->hash = hash;
+	term->cluster = LOD_NOTERM;
+	term->graph_count = 0;
+	store->slots[slot] = (LODTERMID) (store->nterms + 1);
+	store->nterms++;
+	return (LODTERMID) (store->nterms - 1);
+}
+
+/* Locate the cluster of a subject, creating it if create is set */
+static LODCLUSTER *
+lod_clustered_cluster_(LODCLSTORE *store, LODTERMID subject, int create)
+{
+	LODCLUSTER *p;
+	size_t size;
+
+	if(store->terms[subject].cluster != LOD_NOTERM)
+	{
+		return &(store->clusters[store->terms[subject].cluster]);
+	}
+	if(!create)
+	{
+		return NULL;
+	}
+	if(store->nclusters + 1 > store->clustersize)
+	{
+		size = store->clustersize ? store->clustersize * 2 : CLUSTERED_MINCLUSTERS;
+		p = (LODCLUSTER *) realloc(store->clusters, size * sizeof(LODCLUSTER));
+		if(!p)
+		{
+			return NULL;
+		}
+		store->clusters = p;
+		store->clustersize = size;
+	}
+	p = &(store->clusters[store->nclusters]);
+	memset(p, 0, sizeof(LODCLUSTER));
+	p->subject = subject;
+	store->terms[subject].cluster = (LODTERMID) store->nclusters;
+	store->nclusters++;
+	return p;
+}
+
+static int
+lod_clustered_compare_(const void *a, const void *b)
+{
+	const LODCLTRIPLE *ta, *tb;
+
+	ta = (const LODCLTRIPLE *) a;
+	tb = (const LODCLTRIPLE *) b;
+	if(ta->predicate != tb->predicate)
+	{
+		return ta->predicate < tb->predicate ? -1 : 1;
+	}
+	if(ta->object != tb->object)
+	{
+		return ta->object < tb->object ? -1 : 1;
+	}
+	if(ta->graph != tb->graph)
+	{
+		return ta->graph < tb->graph ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Return the position of the first triple in a cluster which doesn't sort
+ * before key
+ */
+static size_t
+lod_clustered_lower_(LODCLUSTER *cluster, const LODCLTRIPLE *key)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = cluster->count;
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if(lod_clustered_compare_(&(cluster->triples[mid]), key) < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* Add a statement to the store. If append is set, the triple is appended
+ * to its cluster, which is sorted (and any duplicates removed) by
+ * lod_clustered_settle_(); otherwise it's inserted in order, unless it's
+ * already present.
+ */
+static int
+lod_clustered_insert_(LODCLSTORE *store, librdf_statement *statement, librdf_node *context, int append)
+{
+	LODCLUSTER *cluster;
+	LODCLTRIPLE triple, *p;
+	LODTERMID subject, *dirty;
+	size_t pos, size;
+	int cmp;
+
+	if(!context && store->base && lod_clustered_in_base_(store, statement))
+	{
+		return 0;
+	}
+	subject = lod_clustered_term_(store, librdf_statement_get_subject(statement), 1);
+	triple.predicate = lod_clustered_term_(store, librdf_statement_get_predicate(statement), 1);
+	triple.object = lod_clustered_term_(store, librdf_statement_get_object(statement), 1);
+	triple.graph = context ? lod_clustered_term_(store, context, 1) : LOD_NOTERM;
+	if(subject == LOD_NOTERM || triple.predicate == LOD_NOTERM || triple.object == LOD_NOTERM ||
+	   (context && triple.graph == LOD_NOTERM))
+	{
+		return 1;
+	}
+	cluster = lod_clustered_cluster_(store, subject, 1);
+	if(!cluster)
+	{
+		return 1;
+	}
+	if(append)
+	{
+		pos = cluster->count;
+		cmp = pos ? lod_clustered_compare_(&(cluster->triples[pos - 1]), &triple) : -1;
+		if(!cmp)
+		{
+			return 0;
+		}
+		if(cmp > 0 && !cluster->unsorted)
+		{
+			if(store->ndirty + 1 > store->dirtysize)
+			{
+				size = store->dirtysize ? store->dirtysize * 2 : CLUSTERED_MINCLUSTERS;
+				dirty = (LODTERMID *) realloc(store->dirty, size * sizeof(LODTERMID));
+				if(!dirty)
+				{
+					return 1;
+				}
+				store->dirty = dirty;
+				store->dirtysize = size;
+			}
+			store->dirty[store->ndirty] = store->terms[subject].cluster;
+			store->ndirty++;
+			cluster->unsorted = 1;
+		}
+	}
+	else
+	{
+		pos = lod_clustered_lower_(cluster, &triple);
+		if(pos < cluster->count && !lod_clustered_compare_(&(cluster->triples[pos]), &triple))
+		{
+			return 0;
+		}
+	}
+	if(cluster->count + 1 > cluster->size)
+	{
+		size = cluster->size ? cluster->size * 2 : CLUSTERED_MINTRIPLES;
+		p = (LODCLTRIPLE *) realloc(cluster->triples, size * sizeof(LODCLTRIPLE));
+		if(!p)
+		{
+			return 1;
+		}
+		cluster->triples = p;
+		cluster->size = size;
+	}
+	if(pos < cluster->count)
+	{
+		memmove(&(cluster->triples[pos + 1]), &(cluster->triples[pos]), (cluster->count - pos) * sizeof(LODCLTRIPLE));
+	}
+	cluster->triples[pos] = triple;
+	cluster->count++;
+	store->count++;
+	store->changes++;
+	if(triple.graph != LOD_NOTERM)
+	{
+		store->terms[triple.graph].graph_count++;
+	}
+	return 0;
+}
+
+/* Add the statements from a stream, deferring ordering until the end */
+static int
+lod_clustered_add_stream_(LODCLSTORE *store, librdf_stream *stream, librdf_node *context)
+{
+	librdf_statement *statement;
+	int r;
+
+	r = 0;
+	for(; !librdf_stream_end(stream); librdf_stream_next(stream))
+	{
+		statement = librdf_stream_get_object(stream);
+		if(statement && lod_clustered_insert_(store, statement, context, 1))
+		{
+			r = 1;
+			break;
+		}
+	}
+	lod_clustered_settle_(store);
+	return r;
+}
+
+/* Sort the clusters which have had triples appended out of order, removing
+ * any duplicates
+ */
+static void
+lod_clustered_settle_(LODCLSTORE *store)
+{
+	LODCLUSTER *cluster;
+	size_t c, from, to;
+
+	for(c = 0; c < store->ndirty; c++)
+	{
+		cluster = &(store->clusters[store->dirty[c]]);
+		qsort(cluster->triples, cluster->count, sizeof(LODCLTRIPLE), lod_clustered_compare_);
+		for(from = to = 1; from < cluster->count; from++)
+		{
+			if(!lod_clustered_compare_(&(cluster->triples[from]), &(cluster->triples[to - 1])))
+			{
+				store->count--;
+				if(cluster->triples[from].graph != LOD_NOTERM)
+				{
+					store->terms[cluster->triples[from].graph].graph_count--;
+				}
+				continue;
+			}
+			cluster->triples[to] = cluster->triples[from];
+			to++;
+		}
+		if(cluster->count)
+		{
+			cluster->count = to;
+		}
+		cluster->unsorted = 0;
+	}
+	store->ndirty = 0;
+}
+
+/* Remove a statement (in the supplied graph, or in no graph) */
+static int
+lod_clustered_remove_(LODCLSTORE *store, librdf_statement *statement, librdf_node *context)
+{
+	LODCLUSTER *cluster;
+	LODCLTRIPLE triple;
+	LODTERMID subject;
+	size_t pos;
+
+	subject = lod_clustered_term_(store, librdf_statement_get_subject(statement), 0);
+	triple.predicate = lod_clustered_term_(store, librdf_statement_get_predicate(statement), 0);
+	triple.object = lod_clustered_term_(store, librdf_statement_get_object(statement), 0);
+	triple.graph = context ? lod_clustered_term_(store, context, 0) : LOD_NOTERM;
+	if(subject == LOD_NOTERM || triple.predicate == LOD_NOTERM || triple.object == LOD_NOTERM ||
+	   (context && triple.graph == LOD_NOTERM))
+	{
+		return 0;
+	}
+	cluster = lod_clustered_cluster_(store, subject, 0);
+	if(!cluster)
+	{
+		return 0;
+	}
+	pos = lod_clustered_lower_(cluster, &triple);
+	if(pos >= cluster->count || lod_clustered_compare_(&(cluster->triples[pos]), &triple))
+	{
+		return 0;
+	}
+	memmove(&(cluster->triples[pos]), &(cluster->triples[pos + 1]), (cluster->count - pos - 1) * sizeof(LODCLTRIPLE));
+	cluster->count--;
+	store->count--;
+	store->changes++;
+	if(triple.graph != LOD_NOTERM)
+	{
+		store->terms[triple.graph].graph_count--;
+	}
+	return 0;
+}
+
+/* Determine whether a statement is present in a store's base snapshot */
+static int
+lod_clustered_in_base_(LODCLSTORE *store, librdf_statement *statement)
+{
+	LODSNAPID subject, predicate, object;
+	size_t start, end;
+	int order;
+
+	subject = lod_snapshot_find_(store->base, librdf_statement_get_subject(statement));
+	predicate = lod_snapshot_find_(store->base, librdf_statement_get_predicate(statement));
+	object = lod_snapshot_find_(store->base, librdf_statement_get_object(statement));
+	if(subject == LODSNAP_ANY || predicate == LODSNAP_ANY || object == LODSNAP_ANY)
+	{
+		return 0;
+	}
+	lod_snapshot_match_(store->base, subject, predicate, object, &start, &end, &order);
+	return start < end;
+}
+
+/* Find the rows of a store's base snapshot which match a pattern (which
+ * may be NULL), leaving the range empty if there are none
+ */
+static void
+lod_clustered_base_range_(LODCLSTREAM *stream, librdf_statement *pattern)
+{
+	LODSNAPID id[3];
+	librdf_node *node;
+	int c;
+
+	for(c = 0; c < 3; c++)
+	{
+		id[c] = LODSNAP_ANY;
+		if(!pattern)
+		{
+			continue;
+		}
+		node = (c == 0 ? librdf_statement_get_subject(pattern) :
+			(c == 1 ? librdf_statement_get_predicate(pattern) : librdf_statement_get_object(pattern)));
+		if(node)
+		{
+			id[c] = lod_snapshot_find_(stream->store->base, node);
+			if(id[c] == LODSNAP_ANY)
+			{
+				/* A term which isn't in the dictionary matches nothing */
+				return;
+			}
+		}
+	}
+	stream->rows = lod_snapshot_match_(stream->store->base, id[0], id[1], id[2], &(stream->row), &(stream->end), &(stream->order));
+}
+
+/* Create a stream over the triples matching a pattern (which may be NULL),
+ * optionally limited to a single graph
+ */
+static librdf_stream *
+lod_clustered_stream_(librdf_storage *storage, librdf_statement *pattern, librdf_node *context)
+{
+	LODCLSTREAM *stream;
+	LODCLSTORE *store;
+	librdf_stream *s;
+	librdf_node *node;
+	LODTERMID subject;
+
+	store = (LODCLSTORE *) librdf_storage_get_instance(storage);
+	stream = (LODCLSTREAM *) calloc(1, sizeof(LODCLSTREAM));
+	if(!stream)
+	{
+		return NULL;
+	}
+	stream->storage = storage;
+	stream->store = store;
+	stream->statement = librdf_new_statement(store->world);
+	if(!stream->statement)
+	{
+		free(stream);
+		return NULL;
+	}
+	librdf_storage_add_reference(storage);
+	stream->last = store->nclusters;
+	stream->predicate = LOD_NOTERM;
+	stream->object = LOD_NOTERM;
+	stream->graph = LOD_NOTERM;
+	if(pattern)
+	{
+		if((node = librdf_statement_get_subject(pattern)))
+		{
+			subject = lod_clustered_term_(store, node, 0);
+			if(subject == LOD_NOTERM || store->terms[subject].cluster == LOD_NOTERM)
+			{
+				stream->done = 1;
+			}
+			else
+			{
+				stream->cluster = store->terms[subject].cluster;
+				stream->last = stream->cluster + 1;
+			}
+		}
+		if((node = librdf_statement_get_predicate(pattern)))
+		{
+			stream->predicate = lod_clustered_term_(store, node, 0);
+			stream->done |= (stream->predicate == LOD_NOTERM);
+		}
+		if((node = librdf_statement_get_object(pattern)))
+		{
+			stream->object = lod_clustered_term_(store, node, 0);
+			stream->done |= (stream->object == LOD_NOTERM);
+		}
+	}
+	if(context)
+	{
+		stream->match_graph = 1;
+		stream->graph = lod_clustered_term_(store, context, 0);
+		stream->done |= (stream->graph == LOD_NOTERM);
+	}
+	/* Triples in the base snapshot don't belong to any graph */
+	if(store->base && !context)
+	{
+		lod_clustered_base_range_(stream, pattern);
+	}
+	if(stream->done)
+	{
+		/* Nothing matches in the store itself */
+		stream->last = 0;
+		stream->done = 0;
+	}
+	lod_clustered_seek_(stream);
+	s = librdf_new_stream(store->world, (void *) stream, lod_clustered_stream_end_, lod_clustered_stream_next_, lod_clustered_stream_get_, lod_clustered_stream_done_);
+	if(!s)
+	{
+		lod_clustered_stream_done_(stream);
+	}
+	return s;
+}
+
+/* Advance a stream to the next matching triple, starting from the current
+ * position
+ */
+static void
+lod_clustered_seek_(LODCLSTREAM *stream)
+{
+	LODCLUSTER *cluster;
+	LODCLTRIPLE *triple, key;
+
+	for(; stream->cluster < stream->last && stream->cluster < stream->store->nclusters; stream->cluster++, stream->pos = 0)
+	{
+		cluster = &(stream->store->clusters[stream->cluster]);
+		if(!stream->pos && stream->predicate != LOD_NOTERM)
+		{
+			key.predicate = stream->predicate;
+			key.object = (stream->object == LOD_NOTERM) ? 0 : stream->object;
+			key.graph = 0;
+			stream->pos = lod_clustered_lower_(cluster, &key);
+		}
+		for(; stream->pos < cluster->count; stream->pos++)
+		{
+			triple = &(cluster->triples[stream->pos]);
+			if(stream->predicate != LOD_NOTERM && triple->predicate != stream->predicate)
+			{
+				/* Triples are ordered by predicate first */
+				if(triple->predicate > stream->predicate)
+				{
+					break;
+				}
+				continue;
+			}
+			if((stream->object != LOD_NOTERM && triple->object != stream->object) ||
+			   (stream->match_graph && triple->graph != stream->graph))
+			{
+				continue;
+			}
+			return;
+		}
+	}
+	if(stream->row < stream->end)
+	{
+		stream->in_base = 1;
+		return;
+	}
+	stream->done = 1;
+}
+
+static int
+lod_clustered_stream_end_(void *context)
+{
+	return ((LODCLSTREAM *) context)->done;
+}
+
+static int
+lod_clustered_stream_next_(void *context)
+{
+	LODCLSTREAM *stream;
+
+	stream = (LODCLSTREAM *) context;
+	if(stream->in_base)
+	{
+		stream->row++;
+		stream->done = (stream->row >= stream->end);
+	}
+	else if(!stream->done)
+	{
+		stream->pos++;
+		lod_clustered_seek_(stream);
+	}
+	return stream->done;
+}
+
+static void *
+lod_clustered_stream_get_(void *context, int flags)
+{
+	LODCLSTREAM *stream;
+	LODCLSTORE *store;
+	LODCLUSTER *cluster;
+	LODCLTRIPLE *triple;
+
+	stream = (LODCLSTREAM *) context;
+	store = stream->store;
+	if(stream->in_base)
+	{
+		return lod_clustered_base_get_(stream, flags);
+	}
+	if(stream->done || stream->cluster >= store->nclusters ||
+	   stream->pos >= store->clusters[stream->cluster].count)
+	{
+		return NULL;
+	}
+	cluster = &(store->clusters[stream->cluster]);
+	triple = &(cluster->triples[stream->pos]);
+	if(flags == LIBRDF_STREAM_GET_METHOD_GET_CONTEXT)
+	{
+		return triple->graph == LOD_NOTERM ? NULL : (void *) store->terms[triple->graph].node;
+	}
+	if(flags != LIBRDF_STREAM_GET_METHOD_GET_OBJECT)
+	{
+		return NULL;
+	}
+	librdf_statement_clear(stream->statement);
+	librdf_statement_set_subject(stream->statement, librdf_new_node_from_node(store->terms[cluster->subject].node));
+	librdf_statement_set_predicate(stream->statement, librdf_new_node_from_node(store->terms[triple->predicate].node));
+	librdf_statement_set_object(stream->statement, librdf_new_node_from_node(store->terms[triple->object].node));
+	return (void *) stream->statement;
+}
+
+/* Obtain the current triple of a stream which has moved on to the rows of
+ * the base snapshot
+ */
+static void *
+lod_clustered_base_get_(LODCLSTREAM *stream, int flags)
+{
+	LODSNAPSHOT *base;
+	LODSNAPROW *row;
+	LODSNAPID subject, predicate, object;
+
+	if(stream->done || flags != LIBRDF_STREAM_GET_METHOD_GET_OBJECT)
+	{
+		return NULL;
+	}
+	base = stream->store->base;
+	row = &(stream->rows[stream->row]);
+	switch(stream->order)
+	{
+	case 0:
+		subject = row->k[0];
+		predicate = row->k[1];
+		object = row->k[2];
+		break;
+	case 1:
+		subject = row->k[2];
+		predicate = row->k[0];
+		object = row->k[1];
+		break;
+	default:
+		subject = row->k[1];
+		predicate = row->k[2];
+		object = row->k[0];
+		break;
+	}
+	librdf_statement_clear(stream->statement);
+	librdf_statement_set_subject(stream->statement, lod_snapshot_node(base, stream->store->world, subject));
+	librdf_statement_set_predicate(stream->statement, lod_snapshot_node(base, stream->store->world, predicate));
+	librdf_statement_set_object(stream->statement, lod_snapshot_node(base, stream->store->world, object));
+	return (void *) stream->statement;
+}
+
+static void
+lod_clustered_stream_done_(void *context)
+{
+	LODCLSTREAM *stream;
+
+	stream = (LODCLSTREAM *) context;
+	if(stream->statement)
+	{
+		librdf_free_statement(stream->statement);
+	}
+	librdf_storage_remove_reference(stream->storage);
+	free(stream);
+}
+
+static int
+lod_clustered_graphs_next_(void *context)
+{
+	LODCLSTREAM *stream;
+
+	stream = (LODCLSTREAM *) context;
+	for(stream->pos++; stream->pos < stream->store->nterms && !stream->store->terms[stream->pos].graph_count; stream->pos++)
+	{
+	}
+	stream->done = (stream->pos >= stream->store->nterms);
+	return stream->done;
+}
+
+static void *
+lod_clustered_graphs_get_(void *context, int flags)
+{
+	LODCLSTREAM *stream;
+
+	stream = (LODCLSTREAM *) context;
+	if(stream->done || flags != LIBRDF_ITERATOR_GET_METHOD_GET_OBJECT)
+	{
+		return NULL;
+	}
+	return (void *) stream->store->terms[stream->pos].node;
+}
@@ -23,26 +23,135 @@
 
 #define MAX_REDIRECTS                   32
 
+/* A single thread-specific key is shared by every context (the number of
+ * keys a process can create is limited), and maps to the list of the
+ * thread's states; the states lock is held while any state is added to or
+ * removed from the lists
+ */
+static pthread_once_t lod_state_once_ = PTHREAD_ONCE_INIT;
+static pthread_key_t lod_state_key_;
+static int lod_state_key_ok_;
+static pthread_mutex_t lod_states_lock_ = PTHREAD_MUTEX_INITIALIZER;
+
+static void lod_state_key_init_(void);
+static void lod_thread_destroy_(void *ptr);
+static void lod_state_free_(LODSTATE *state);
+static librdf_world *lod_world_locked_(LODCONTEXT *context);
+static int lod_set_world_locked_(LODCONTEXT *context, librdf_world *world);
+static librdf_storage *lod_storage_locked_(LODCONTEXT *context);
+static int lod_set_storage_locked_(LODCONTEXT *context, librdf_storage *storage);
+static librdf_model *lod_model_locked_(LODCONTEXT *context);
+static int lod_set_model_locked_(LODCONTEXT *context, librdf_model *model);
+static unsigned long lod_generation_locked_(LODCONTEXT *context);
+static int lod_set_curl_locked_(LODCONTEXT *context, CURL *ch);
+static size_t lod_spill_threshold_locked_(LODCONTEXT *context);
+static int lod_set_spill_threshold_locked_(LODCONTEXT *context, size_t threshold);
+static LODINSTANCE *lod_document_primarytopic_locked_(LODCONTEXT *context);
+static const char *lod_accept_locked_(LODCONTEXT *context);
+
 /* Create a new LOD context */
 LODCONTEXT *
 lod_create(void)
 {
 	LODCONTEXT *p;
+	pthread_mutexattr_t attr;
+	pthread_condattr_t cattr;
 
 	p = (LODCONTEXT *) calloc(1, sizeof(LODCONTEXT));
 	if(!p)
 	{
 		return NULL;
 	}
+	/* The context lock is recursive, so that public functions can be
+	 * called while it's held (including from callbacks)
+	 */
+	if(pthread_mutexattr_init(&attr))
+	{
+		free(p);
+		return NULL;
+	}
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	if(pthread_mutex_init(&(p->lock), &attr))
+	{
+		pthread_mutexattr_destroy(&attr);
+		free(p);
+		return NULL;
+	}
+	pthread_mutexattr_destroy(&attr);
+	pthread_once(&lod_state_once_, lod_state_key_init_);
+	if(!lod_state_key_ok_)
+	{
+		pthread_mutex_destroy(&(p->lock));
+		free(p);
+		return NULL;
+	}
+	if(pthread_mutex_init(&(p->publish_lock), NULL))
+	{
+		pthread_mutex_destroy(&(p->lock));
+		free(p);
+		return NULL;
+	}
+	/* Threads waiting for another's fetch give up at their deadline,
+	 * which is measured on the monotonic clock
+	 */
+	if(pthread_condattr_init(&cattr))
+	{
+		pthread_mutex_destroy(&(p->publish_lock));
+		pthread_mutex_destroy(&(p->lock));
+		free(p);
+		return NULL;
+	}
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	if(pthread_cond_init(&(p->flight_cond), &cattr))
+	{
+		pthread_condattr_destroy(&cattr);
+		pthread_mutex_destroy(&(p->publish_lock));
+		pthread_mutex_destroy(&(p->lock));
+		free(p);
+		return NULL;
+	}
+	pthread_condattr_destroy(&cattr);
+	if(lod_parse_init_(p))
+	{
+		pthread_cond_destroy(&(p->flight_cond));
+		pthread_mutex_destroy(&(p->publish_lock));
+		pthread_mutex_destroy(&(p->lock));
+		free(p);
+		return NULL;
+	}
+	if(lod_sched_init_(p))
+	{
+		lod_parse_free_(p);
+		pthread_cond_destroy(&(p->flight_cond));
+		pthread_mutex_destroy(&(p->publish_lock));
+		pthread_mutex_destroy(&(p->lock));
+		free(p);
+		return NULL;
+	}
+	p->fallback.context = p;
 	p->max_redirects = MAX_REDIRECTS;
+	p->index.flags = LODI_DEFAULT;
+	p->index.size = -1;
+	p->generation = 1;
+	p->generation_size = -1;
+	p->journal.fd = -1;
 	return p;
 }
 
-/* Free a LOD context */
+/* Free a LOD context; no other thread may be using it */
 int
 lod_destroy(LODCONTEXT *context)
 {
-	lod_reset_(context);
+	LODSTATE *state, *states, **sp;
+
+	/* Anything already submitted is processed first */
+	lod_parse_free_(context);
+	lod_set_bulk_load(context, 0);
+	lod_journal_close_(context);
+	lod_index_free_(context);
+	lod_intern_reset_(context);
+	lod_languages_free_(context);
+	lod_documents_free_(context);
 	if(context->model && context->model_alloc)
 	{
 		librdf_free_model(context->model);
@@ -51,18 +160,57 @@ lod_destroy(LODCONTEXT *context)
 	{
 		librdf_free_storage(context->storage);
 	}
+	lod_storage_free_(context);
+	if(context->overlay)
+	{
+		lod_snapshot_release(context->overlay);
+	}
+	if(context->published)
+	{
+		lod_snapshot_release(context->published);
+	}
 	if(context->world && context->world_alloc)
 	{
 		librdf_free_world(context->world);
 	}
-	if(context->headers)
+	/* Threads which have used the context may not have exited yet, and
+	 * so their states must be removed from their lists and freed here
+	 */
+	pthread_mutex_lock(&lod_states_lock_);
+	states = context->states;
+	context->states = NULL;
+	for(state = states; state; state = state->next)
 	{
-		curl_slist_free_all(context->headers);
+		pthread_mutex_lock(&(state->thread->lock));
+		for(sp = &(state->thread->states); *sp != state; sp = &((*sp)->thread_next))
+		{
+		}
+		*sp = state->thread_next;
+		pthread_mutex_unlock(&(state->thread->lock));
+	}
+	pthread_mutex_unlock(&lod_states_lock_);
+	while((state = states))
+	{
+		states = state->next;
+		lod_state_free_(state);
 	}
-	if(context->ch && context->ch_alloc)
+	lod_reset_state_(&(context->fallback));
+	if(context->fallback.ch)
 	{
-		curl_easy_cleanup(context->ch);
+		curl_easy_cleanup(context->fallback.ch);
 	}
+	if(context->fallback.world)
+	{
+		librdf_free_world(context->fallback.world);
+	}
+	if(context->headers)
+	{
+		curl_slist_free_all(context->headers);
+	}
+	lod_sched_free_(context);
+	pthread_cond_destroy(&(context->flight_cond));
+	pthread_mutex_destroy(&(context->publish_lock));
+	pthread_mutex_destroy(&(context->lock));
 	free(context->accept);
 	free(context);
 	return 0;
@@ -72,7 +220,19 @@ lod_destroy(LODCONTEXT *context)
 librdf_world *
 lod_world(LODCONTEXT *context)
 {
-	context->error = 0;
+	librdf_world *r;
+
+	lod_lock_(context);
+	r = lod_world_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_world(), with the context lock held */
+static librdf_world *
+lod_world_locked_(LODCONTEXT *context)
+{
+	lod_state_(context)->error = 0;
 	if(context->world)
 	{
 		return context->world;
@@ -86,14 +246,34 @@ lod_world(LODCONTEXT *context)
 	}
 	librdf_world_open(context->world);
 	librdf_world_set_logger(context->world, (void *) context, lod_librdf_logger);
+	if(lod_clustered_register_(context->world))
+	{
+		lod_set_error_(context, "failed to register storage module");
+		return NULL;
+	}
 	return context->world;
 }
 
 /* Set the librdf world which will be used by the context */
 int
 lod_set_world(LODCONTEXT *context, librdf_world *world)
-{	
-	context->error = 0;
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_world_locked_(context, world);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_world(), with the context lock held */
+static int
+lod_set_world_locked_(LODCONTEXT *context, librdf_world *world)
+{
+	lod_state_(context)->error = 0;
+	lod_set_bulk_load(context, 0);
+	lod_index_reset_(context);
+	lod_generation_bump_(context, NULL);
 	if(context->model && context->model_alloc)
 	{
 		librdf_free_model(context->model);
@@ -104,6 +284,8 @@ lod_set_world(LODCONTEXT *context, librdf_world *world)
 		librdf_free_storage(context->storage);
 	}
 	context->storage = NULL;
+	/* Interned nodes belong to the old world */
+	lod_intern_reset_(context);
 	if(context->world && context->world_alloc)
 	{
 		librdf_free_world(context->world);
@@ -116,10 +298,22 @@ lod_set_world(LODCONTEXT *context, librdf_world *world)
 /* Obtain the librdf storage used by the context */
 librdf_storage *
 lod_storage(LODCONTEXT *context)
+{
+	librdf_storage *r;
+
+	lod_lock_(context);
+	r = lod_storage_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_storage(), with the context lock held */
+static librdf_storage *
+lod_storage_locked_(LODCONTEXT *context)
 {
 	librdf_world *world;
 
-	context->error = 0;	
+	lod_state_(context)->error = 0;	
 	if(context->storage)
 	{
 		return context->storage;
@@ -130,11 +324,7 @@ lod_storage(LODCONTEXT *context)
 	{
 		return NULL;
 	}
-	context->storage = librdf_new_storage(world, "hashes", NULL, "hash-type='memory',contexts='yes'");
-	if(!context->storage)
-	{
-		return NULL;
-	}
+	context->storage = lod_storage_open_(context, world);
 	return context->storage;
 }
 
@@ -146,7 +336,22 @@ lod_storage(LODCONTEXT *context)
 int
 lod_set_storage(LODCONTEXT *context, librdf_storage *storage)
 {
-	context->error = 0;
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_storage_locked_(context, storage);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_storage(), with the context lock held */
+static int
+lod_set_storage_locked_(LODCONTEXT *context, librdf_storage *storage)
+{
+	lod_state_(context)->error = 0;
+	lod_set_bulk_load(context, 0);
+	lod_index_reset_(context);
+	lod_generation_bump_(context, NULL);
 	if(context->model && context->model_alloc)
 	{
 		librdf_free_model(context->model);
@@ -157,17 +362,30 @@ lod_set_storage(LODCONTEXT *context, librdf_storage *storage)
 		librdf_free_storage(context->storage);
 	}
 	context->storage = storage;
+	context->storage_alloc = 0;
 	return 0;
 }
 
 /* Obtain the librdf model used by the context */
 librdf_model *
 lod_model(LODCONTEXT *context)
+{
+	librdf_model *r;
+
+	lod_lock_(context);
+	r = lod_model_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_model(), with the context lock held */
+static librdf_model *
+lod_model_locked_(LODCONTEXT *context)
 {
 	librdf_world *world;
 	librdf_storage *storage;
 
-	context->error = 0;
+	lod_state_(context)->error = 0;
 	if(context->model)
 	{
 		return context->model;
@@ -197,7 +415,22 @@ lod_model(LODCONTEXT *context)
 int
 lod_set_model(LODCONTEXT *context, librdf_model *model)
 {
-	context->error = 0;
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_model_locked_(context, model);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_model(), with the context lock held */
+static int
+lod_set_model_locked_(LODCONTEXT *context, librdf_model *model)
+{
+	lod_state_(context)->error = 0;
+	lod_set_bulk_load(context, 0);
+	lod_index_reset_(context);
+	lod_generation_bump_(context, NULL);
 	if(context->model && context->model_alloc)
 	{
 		librdf_free_model(context->model);
@@ -207,59 +440,209 @@ lod_set_model(LODCONTEXT *context, librdf_model *model)
 	return 0;
 }
 
-/* Obtain a cURL handle for a context */
+/* Obtain a cURL handle for a context; unless one has been supplied via
+ * lod_set_curl(), each thread has its own
+ */
 CURL *
 lod_curl(LODCONTEXT *context)
 {
+	LODSTATE *state;
+	CURL *ch;
 	const char *ua, *accept;
+	int r;
 
-	context->error = 0;
-	if(context->ch)
+	state = lod_state_(context);
+	state->error = 0;
+	lod_lock_(context);
+	ch = context->ch;
+	lod_unlock_(context);
+	if(ch)
 	{
-		return context->ch;
+		return ch;
 	}
-	ua = lod_useragent(context);
-	if(!ua)
+	if(state->ch)
 	{
-		lod_set_error_(context, "failed to obtain User-Agent for context");
-		return NULL;
+		return state->ch;
 	}
-	accept = lod_accept(context);
-	if(!accept)
+	/* The request headers are shared by every thread's handle */
+	r = 0;
+	lod_lock_(context);
+	if(!context->headers)
+	{
+		ua = lod_useragent(context);
+		accept = ua ? lod_accept(context) : NULL;
+		if(!ua)
+		{
+			lod_set_error_(context, "failed to obtain User-Agent for context");
+			r = -1;
+		}
+		else if(!accept)
+		{
+			lod_set_error_(context, "failed to obtain Accept header for context");
+			r = -1;
+		}
+		else
+		{
+			context->headers = curl_slist_append(NULL, accept);
+			context->headers = curl_slist_append(context->headers, ua);
+		}
+	}
+	lod_unlock_(context);
+	if(r)
 	{
-		lod_set_error_(context, "failed to obtain Accept header for context");
 		return NULL;
-	}	
-	context->ch_alloc = 1;
-	context->ch = curl_easy_init();
-	if(!context->ch)
+	}
+	state->ch = curl_easy_init();
+	if(!state->ch)
 	{
 		lod_set_error_(context, "failed to create new cURL handle");
 		return NULL;
 	}
-	context->headers = curl_slist_append(NULL, accept);
-	context->headers = curl_slist_append(context->headers, ua);
-	curl_easy_setopt(context->ch, CURLOPT_HTTPHEADER, context->headers);
-	curl_easy_setopt(context->ch, CURLOPT_VERBOSE, (int) context->verbose);
-	return context->ch;
+	curl_easy_setopt(state->ch, CURLOPT_HTTPHEADER, context->headers);
+	curl_easy_setopt(state->ch, CURLOPT_VERBOSE, (int) context->verbose);
+	return state->ch;
 }
 
 /* Set the cURL handle which will be used for future fetches by the context */
 int
 lod_set_curl(LODCONTEXT *context, CURL *ch)
 {
-	context->error = 0;
-	if(context->headers)
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_curl_locked_(context, ch);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_curl(), with the context lock held */
+static int
+lod_set_curl_locked_(LODCONTEXT *context, CURL *ch)
+{
+	lod_state_(context)->error = 0;
+	context->ch = ch;
+	return 0;
+}
+
+/* Return the generation of the context's model */
+unsigned long
+lod_generation(LODCONTEXT *context)
+{
+	unsigned long r;
+
+	lod_lock_(context);
+	r = lod_generation_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_generation(), with the context lock held */
+static unsigned long
+lod_generation_locked_(LODCONTEXT *context)
+{
+	librdf_model *model;
+
+	lod_state_(context)->error = 0;
+	model = lod_model(context);
+	if(!model)
 	{
-		curl_slist_free_all(context->headers);
+		return 0;
 	}
-	context->headers = NULL;
-	if(context->ch && context->ch_alloc)
+	return lod_generation_(context, model);
+}
+
+/* Return the generation of the context's model, first checking whether it
+ * has been modified other than through liblod
+ */
+unsigned long
+lod_generation_(LODCONTEXT *context, librdf_model *model)
+{
+	int size;
+
+	size = librdf_model_size(model);
+	if(size < 0 || size != context->generation_size)
 	{
-		curl_easy_cleanup(context->ch);
+		/* If the storage can't report its size, nothing derived from the
+		 * model can be assumed to remain valid
+		 */
+		context->generation++;
+		context->generation_size = size;
 	}
-	context->ch_alloc = 0;
-	context->ch = ch;
+	return context->generation;
+}
+
+/* Record that the model has been modified (or replaced, if model is NULL) */
+void
+lod_generation_bump_(LODCONTEXT *context, librdf_model *model)
+{
+	context->generation++;
+	context->generation_size = model ? librdf_model_size(model) : -1;
+}
+
+/* Obtain the payload size beyond which responses fetched by the context
+ * will be written to a temporary file
+ */
+size_t
+lod_spill_threshold(LODCONTEXT *context)
+{
+	size_t r;
+
+	lod_lock_(context);
+	r = lod_spill_threshold_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_spill_threshold(), with the context lock held */
+static size_t
+lod_spill_threshold_locked_(LODCONTEXT *context)
+{
+	lod_state_(context)->error = 0;
+	return context->spill_threshold;
+}
+
+/* Set the payload size beyond which responses fetched by the context will
+ * be written to a temporary file
+ */
+int
+lod_set_spill_threshold(LODCONTEXT *context, size_t threshold)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_spill_threshold_locked_(context, threshold);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_spill_threshold(), with the context lock held */
+static int
+lod_set_spill_threshold_locked_(LODCONTEXT *context, size_t threshold)
+{
+	lod_state_(context)->error = 0;
+	context->spill_threshold = threshold;
+	return 0;
+}
+
+/* Obtain the time limits applied to the context's fetches */
+int
+lod_timeouts(LODCONTEXT *context, LODTIMEOUTS *timeouts)
+{
+	lod_lock_(context);
+	lod_state_(context)->error = 0;
+	*timeouts = context->timeouts;
+	lod_unlock_(context);
+	return 0;
+}
+
+/* Set the time limits applied to the context's fetches */
+int
+lod_set_timeouts(LODCONTEXT *context, const LODTIMEOUTS *timeouts)
+{
+	lod_lock_(context);
+	lod_state_(context)->error = 0;
+	context->timeouts = *timeouts;
+	lod_unlock_(context);
 	return 0;
 }
 
@@ -269,8 +652,8 @@ lod_set_curl(LODCONTEXT *context, CURL *ch)
 const char *
 lod_subject(LODCONTEXT *context)
 {
-	context->error = 0;
-	return context->subject;
+	lod_state_(context)->error = 0;
+	return lod_state_(context)->subject;
 }
 
 /* Return the document URL (after following any relevant redirects) that was
@@ -279,8 +662,69 @@ lod_subject(LODCONTEXT *context)
 const char *
 lod_document(LODCONTEXT *context)
 {
-	context->error = 0;
-	return context->document;
+	lod_state_(context)->error = 0;
+	return lod_state_(context)->document;
+}
+
+/* Return an instance representing the foaf:primaryTopic of the document
+ * most recently fetched from
+ */
+LODINSTANCE *
+lod_document_primarytopic(LODCONTEXT *context)
+{
+	LODINSTANCE *r;
+
+	lod_lock_(context);
+	r = lod_document_primarytopic_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_document_primarytopic(), with the context lock held */
+static LODINSTANCE *
+lod_document_primarytopic_locked_(LODCONTEXT *context)
+{
+	LODSTATE *state;
+	LODINSTANCE *doc, *inst;
+	librdf_world *world;
+	librdf_node *node;
+	librdf_statement *query;
+	int e;
+
+	state = lod_state_(context);
+	state->error = 0;
+	if(!state->document)
+	{
+		return NULL;
+	}
+	world = lod_world(context);
+	if(!world)
+	{
+		return NULL;
+	}
+	node = lod_intern_probe_(context, state->document);
+	if(!node)
+	{
+		return NULL;
+	}
+	query = librdf_new_statement_from_nodes(world, node, NULL, NULL);
+	/* Note: node becomes owned by the statement, and freed upon error */
+	if(!query)
+	{
+		lod_set_error_(context, "failed to create librdf query statement");
+		return NULL;
+	}
+	doc = lod_instance_create_(context, query, node);
+	if(!doc)
+	{
+		librdf_free_statement(query);
+		return NULL;
+	}
+	inst = lod_instance_primarytopic(doc);
+	e = state->error;
+	lod_instance_destroy(doc);
+	state->error = e;
+	return inst;
 }
 
 /* Return the HTTP status code from the most recent resolution request; a
@@ -289,8 +733,8 @@ lod_document(LODCONTEXT *context)
 long
 lod_status(LODCONTEXT *context)
 {
-	context->error = 0;
-	return context->status;
+	lod_state_(context)->error = 0;
+	return lod_state_(context)->status;
 }
 
 /* Return the context error state from the most recent resolution request;
@@ -299,22 +743,34 @@ lod_status(LODCONTEXT *context)
 int
 lod_error(LODCONTEXT *context)
 {
-	return context->error;
+	return lod_state_(context)->error;
 }
 
 /* Return the error message from the most recent resolution request */
 const char *
 lod_errmsg(LODCONTEXT *context)
 {
-	if(!context->error)
+	LODSTATE *state;
+
+	state = lod_state_(context);
+	if(!state->error)
 	{
 		return NULL;
 	}
-	if(!context->errmsg)
+	if(!state->errmsg)
 	{
 		return "Unknown error";
 	}
-	return context->errmsg;
+	return state->errmsg;
+}
+
+/* Return the phase in which the most recent resolution request ran out of
+ * time
+ */
+LODTIMEOUTPHASE
+lod_timeout_phase(LODCONTEXT *context)
+{
+	return lod_state_(context)->timeout;
 }
 
 /* Logging function which is set on librdf_world objects via
@@ -342,13 +798,25 @@ lod_useragent(LODCONTEXT *context)
 {
 	(void) context;
 
-	context->error = 0;
+	lod_state_(context)->error = 0;
 	return "User-Agent: liblod/1 (+https://github.com/bbcarchdev/liblod)";
 }
 
 /* Return the default Accept header */
 const char *
 lod_accept(LODCONTEXT *context)
+{
+	const char *r;
+
+	lod_lock_(context);
+	r = lod_accept_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_accept(), with the context lock held */
+static const char *
+lod_accept_locked_(LODCONTEXT *context)
 {
 	librdf_world *world;
 	size_t nbytes;
@@ -356,7 +824,7 @@ lod_accept(LODCONTEXT *context)
 	const raptor_syntax_description *desc;
 	char *p;
 
-	context->error = 0;
+	lod_state_(context)->error = 0;
 	if(context->accept)
 	{
 		return context->accept;
@@ -400,76 +868,231 @@ lod_accept(LODCONTEXT *context)
 	return context->accept;
 }
 
-/* Set the error state and an error message on a context */
+/* Set the error state and an error message on the calling thread's
+ * state
+ */
 int 
 lod_set_error_(LODCONTEXT *context, const char *msg)
 {
-	context->error = 1;
+	LODSTATE *state;
+
+	state = lod_state_(context);
+	state->error = 1;
 	/* Only the first error between calls to lod_reset_() will be stored */
-	if(!context->errmsg)
+	if(!state->errmsg)
 	{
-		context->errmsg = strdup(msg);
+		state->errmsg = strdup(msg);
 	}
 	return 0;
 }
 
-/* Reset the internal state of a context */
+/* Reset the calling thread's resolution state */
 int
 lod_reset_(LODCONTEXT *context)
+{
+	return lod_reset_state_(lod_state_(context));
+}
+
+/* Reset a thread's resolution state */
+int
+lod_reset_state_(LODSTATE *state)
 {
 	int i;
 
-	if(context->subjects)
+	if(state->subjects)
 	{
-		for(i = 0; i < context->nsubjects; i++)
+		for(i = 0; i < state->nsubjects; i++)
 		{
-			if(context->subjects[i] == context->subject)
+			if(state->subjects[i] == state->subject)
 			{
-				context->subject = NULL;
+				state->subject = NULL;
 			}
-			if(context->subjects[i] == context->document)
+			if(state->subjects[i] == state->document)
 			{
-				context->document = NULL;
+				state->document = NULL;
 			}
-			free(context->subjects[i]);
+			free(state->subjects[i]);
 		}
-		free(context->subjects);
-	}
-	context->subjects = NULL;
-	context->nsubjects = 0;
-	context->status = 0;
-	context->error = 0;
-	free(context->errmsg);
-	context->errmsg = NULL;
-	free(context->document);
-	context->document = NULL;
-	free(context->subject);
-	context->subject = NULL;
+		free(state->subjects);
+	}
+	state->subjects = NULL;
+	state->nsubjects = 0;
+	state->status = 0;
+	state->error = 0;
+	state->timeout = LODT_NONE;
+	free(state->errmsg);
+	state->errmsg = NULL;
+	free(state->document);
+	state->document = NULL;
+	free(state->subject);
+	state->subject = NULL;
 	return 0;
 }
 
-/* Add a subject URI to the context; the string becomes owned by the
- * the context.
+/* Add a subject URI to the calling thread's state; the string becomes owned
+ * by the the context.
  */
 int
 lod_push_subject_(LODCONTEXT *context, char *uri)
 {
-	if(!context->subjects)
+	LODSTATE *state;
+
+	state = lod_state_(context);
+	if(!state->subjects)
 	{
-		context->subjects = (char **) calloc(context->max_redirects + 1, sizeof(char *));
-		if(!context->subjects)
+		state->subjects = (char **) calloc(context->max_redirects + 1, sizeof(char *));
+		if(!state->subjects)
 		{
 			lod_set_error_(context, strerror(errno));
 			return -1;
 		}
-		context->nsubjects = 0;
+		state->nsubjects = 0;
 	}
-	if(context->nsubjects >= context->max_redirects)
+	if(state->nsubjects >= context->max_redirects)
 	{
 		lod_set_error_(context, strerror(ENOMEM));
 		return -1;
 	}
-	context->subjects[context->nsubjects] = uri;
-	context->nsubjects++;
+	state->subjects[state->nsubjects] = uri;
+	state->nsubjects++;
 	return 0;
 }
+
+/* Obtain the calling thread's state, creating it if needed */
+LODSTATE *
+lod_state_(LODCONTEXT *context)
+{
+	LODTHREAD *thread;
+	LODSTATE *state;
+
+	thread = (LODTHREAD *) pthread_getspecific(lod_state_key_);
+	if(thread)
+	{
+		pthread_mutex_lock(&(thread->lock));
+		for(state = thread->states; state && state->context != context; state = state->thread_next)
+		{
+		}
+		pthread_mutex_unlock(&(thread->lock));
+		if(state)
+		{
+			return state;
+		}
+	}
+	else
+	{
+		thread = (LODTHREAD *) calloc(1, sizeof(LODTHREAD));
+		if(!thread)
+		{
+			/* Better a shared state than none at all */
+			return &(context->fallback);
+		}
+		if(pthread_mutex_init(&(thread->lock), NULL))
+		{
+			free(thread);
+			return &(context->fallback);
+		}
+		if(pthread_setspecific(lod_state_key_, (void *) thread))
+		{
+			pthread_mutex_destroy(&(thread->lock));
+			free(thread);
+			return &(context->fallback);
+		}
+	}
+	state = (LODSTATE *) calloc(1, sizeof(LODSTATE));
+	if(!state)
+	{
+		return &(context->fallback);
+	}
+	state->context = context;
+	state->thread = thread;
+	pthread_mutex_lock(&lod_states_lock_);
+	pthread_mutex_lock(&(thread->lock));
+	state->thread_next = thread->states;
+	thread->states = state;
+	pthread_mutex_unlock(&(thread->lock));
+	state->next = context->states;
+	if(state->next)
+	{
+		state->next->prev = state;
+	}
+	context->states = state;
+	pthread_mutex_unlock(&lod_states_lock_);
+	return state;
+}
+
+/* Acquire the context lock */
+void
+lod_lock_(LODCONTEXT *context)
+{
+	pthread_mutex_lock(&(context->lock));
+	lod_state_(context)->depth++;
+}
+
+/* Release the context lock */
+void
+lod_unlock_(LODCONTEXT *context)
+{
+	lod_state_(context)->depth--;
+	pthread_mutex_unlock(&(context->lock));
+}
+
+/* Create the thread-specific key shared by every context */
+static void
+lod_state_key_init_(void)
+{
+	lod_state_key_ok_ = !pthread_key_create(&lod_state_key_, lod_thread_destroy_);
+}
+
+/* Invoked when a thread which has used any context exits */
+static void
+lod_thread_destroy_(void *ptr)
+{
+	LODTHREAD *thread;
+	LODSTATE *state, *states;
+	LODCONTEXT *context;
+
+	thread = (LODTHREAD *) ptr;
+	pthread_mutex_lock(&lod_states_lock_);
+	states = thread->states;
+	thread->states = NULL;
+	for(state = states; state; state = state->thread_next)
+	{
+		context = state->context;
+		if(state->prev)
+		{
+			state->prev->next = state->next;
+		}
+		else
+		{
+			context->states = state->next;
+		}
+		if(state->next)
+		{
+			state->next->prev = state->prev;
+		}
+	}
+	pthread_mutex_unlock(&lod_states_lock_);
+	while((state = states))
+	{
+		states = state->thread_next;
+		lod_state_free_(state);
+	}
+	pthread_mutex_destroy(&(thread->lock));
+	free(thread);
+}
+
+/* Free a thread's state */
+static void
+lod_state_free_(LODSTATE *state)
+{
+	lod_reset_state_(state);
+	if(state->ch)
+	{
+		curl_easy_cleanup(state->ch);
+	}
+	if(state->world)
+	{
+		librdf_free_world(state->world);
+	}
+	free(state);
+}
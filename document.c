@@ -0,0 +1,263 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* Metadata about each document fetched by a context is recorded when it
+ * has been successfully processed, so that it can be consulted later (and
+ * carried across restarts in snapshots)
+ */
+
+#define DOCUMENTS_MINSLOTS              64
+
+static LODDOCUMENT *lod_document_find_(LODDOCUMENTS *documents, const char *uri, size_t *slot);
+static int lod_documents_grow_(LODDOCUMENTS *documents);
+static int lod_document_info_locked_(LODCONTEXT *context, const char *uri, LODDOCINFO *info);
+static int lod_document_info_dup_locked_(LODCONTEXT *context, const char *uri, LODDOCINFO *info);
+
+/* Obtain the metadata recorded when a document was fetched */
+int
+lod_document_info(LODCONTEXT *context, const char *uri, LODDOCINFO *info)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_document_info_locked_(context, uri, info);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_document_info(), with the context lock held */
+static int
+lod_document_info_locked_(LODCONTEXT *context, const char *uri, LODDOCINFO *info)
+{
+	LODDOCUMENT *doc;
+	size_t slot;
+
+	lod_state_(context)->error = 0;
+	memset(info, 0, sizeof(LODDOCINFO));
+	doc = lod_document_find_(&(context->documents), uri, &slot);
+	if(!doc)
+	{
+		/* An overlay's base may have fetched it */
+		return context->overlay ? lod_snapshot_document(context->overlay, uri, info) : 0;
+	}
+	info->uri = doc->uri;
+	info->fetched = doc->fetched;
+	info->etag = doc->etag;
+	info->redirects = doc->redirects;
+	return 1;
+}
+
+/* Obtain a copy of the metadata recorded when a document was fetched */
+int
+lod_document_info_dup(LODCONTEXT *context, const char *uri, LODDOCINFO *info)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_document_info_dup_locked_(context, uri, info);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_document_info_dup(), with the context lock held */
+static int
+lod_document_info_dup_locked_(LODCONTEXT *context, const char *uri, LODDOCINFO *info)
+{
+	LODDOCINFO shared;
+	char *u, *e, *r;
+
+	if(lod_document_info_locked_(context, uri, &shared) != 1)
+	{
+		memset(info, 0, sizeof(LODDOCINFO));
+		return lod_state_(context)->error ? -1 : 0;
+	}
+	u = strdup(shared.uri);
+	e = shared.etag ? strdup(shared.etag) : NULL;
+	r = shared.redirects ? strdup(shared.redirects) : NULL;
+	if(!u || (shared.etag && !e) || (shared.redirects && !r))
+	{
+		lod_set_error_(context, strerror(errno));
+		free(u);
+		free(e);
+		free(r);
+		memset(info, 0, sizeof(LODDOCINFO));
+		return -1;
+	}
+	info->uri = u;
+	info->fetched = shared.fetched;
+	info->etag = e;
+	info->redirects = r;
+	return 1;
+}
+
+/* Free the strings of metadata obtained via lod_document_info_dup() */
+void
+lod_document_info_free(LODDOCINFO *info)
+{
+	free((char *) info->uri);
+	free((char *) info->etag);
+	free((char *) info->redirects);
+	memset(info, 0, sizeof(LODDOCINFO));
+}
+
+/* Record (or replace) the metadata about a document */
+int
+lod_document_record_(LODCONTEXT *context, const char *uri, time_t fetched, const char *etag, const char *redirects)
+{
+	LODDOCUMENTS *documents;
+	LODDOCUMENT *doc;
+	char *u, *e, *r;
+	size_t slot;
+
+	documents = &(context->documents);
+	if(documents->ndocs == documents->size || (documents->ndocs + 1) * 2 > documents->nslots)
+	{
+		if(lod_documents_grow_(documents))
+		{
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+	}
+	u = NULL;
+	doc = lod_document_find_(documents, uri, &slot);
+	if(!doc)
+	{
+		u = strdup(uri);
+	}
+	e = etag ? strdup(etag) : NULL;
+	r = redirects ? strdup(redirects) : NULL;
+	if((!doc && !u) || (etag && !e) || (redirects && !r))
+	{
+		lod_set_error_(context, strerror(errno));
+		free(u);
+		free(e);
+		free(r);
+		return -1;
+	}
+	if(!doc)
+	{
+		doc = &(documents->docs[documents->ndocs]);
+		doc->uri = u;
+		documents->slots[slot] = (uint32_t) documents->ndocs;
+		documents->ndocs++;
+	}
+	else
+	{
+		free(doc->etag);
+		free(doc->redirects);
+	}
+	doc->fetched = fetched;
+	doc->etag = e;
+	doc->redirects = r;
+	return 0;
+}
+
+/* Discard the metadata about all documents */
+void
+lod_documents_free_(LODCONTEXT *context)
+{
+	LODDOCUMENTS *documents;
+	size_t c;
+
+	documents = &(context->documents);
+	for(c = 0; c < documents->ndocs; c++)
+	{
+		free(documents->docs[c].uri);
+		free(documents->docs[c].etag);
+		free(documents->docs[c].redirects);
+	}
+	free(documents->docs);
+	free(documents->slots);
+	memset(documents, 0, sizeof(LODDOCUMENTS));
+}
+
+/* Locate a document; if it isn't present, *slot is set to the hash slot
+ * at which it should be added
+ */
+static LODDOCUMENT *
+lod_document_find_(LODDOCUMENTS *documents, const char *uri, size_t *slot)
+{
+	uint32_t id;
+
+	if(!documents->nslots)
+	{
+		return NULL;
+	}
+	*slot = (size_t) (lod_hash_(uri, strlen(uri)) & (documents->nslots - 1));
+	while((id = documents->slots[*slot]) != LOD_NOTERM)
+	{
+		if(!strcmp(documents->docs[id].uri, uri))
+		{
+			return &(documents->docs[id]);
+		}
+		*slot = (*slot + 1) & (documents->nslots - 1);
+	}
+	return NULL;
+}
+
+/* Enlarge the document array and its hash */
+static int
+lod_documents_grow_(LODDOCUMENTS *documents)
+{
+	LODDOCUMENT *docs;
+	uint32_t *slots;
+	size_t size, nslots, c, slot;
+
+	if(documents->ndocs == documents->size)
+	{
+		size = documents->size ? documents->size * 2 : DOCUMENTS_MINSLOTS / 2;
+		docs = (LODDOCUMENT *) realloc(documents->docs, size * sizeof(LODDOCUMENT));
+		if(!docs)
+		{
+			return -1;
+		}
+		documents->docs = docs;
+		documents->size = size;
+	}
+	if((documents->ndocs + 1) * 2 > documents->nslots)
+	{
+		nslots = documents->nslots ? documents->nslots * 2 : DOCUMENTS_MINSLOTS;
+		slots = (uint32_t *) malloc(nslots * sizeof(uint32_t));
+		if(!slots)
+		{
+			return -1;
+		}
+		for(c = 0; c < nslots; c++)
+		{
+			slots[c] = LOD_NOTERM;
+		}
+		for(c = 0; c < documents->ndocs; c++)
+		{
+			slot = (size_t) (lod_hash_(documents->docs[c].uri, strlen(documents->docs[c].uri)) & (nslots - 1));
+			while(slots[slot] != LOD_NOTERM)
+			{
+				slot = (slot + 1) & (nslots - 1);
+			}
+			slots[slot] = (uint32_t) c;
+		}
+		free(documents->slots);
+		documents->slots = slots;
+		documents->nslots = nslots;
+	}
+	return 0;
+}
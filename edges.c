@@ -0,0 +1,181 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* A set of labelled edges between interned terms, indexed by source term:
+ * each source term's edges form a linked list threaded through a single
+ * contiguous array, with the list heads held in an open-addressed hash.
+ */
+
+#define EDGES_MINSLOTS                  64
+#define EDGES_MINEDGES                  64
+
+static int lod_edges_grow_(LODEDGES *edges);
+static size_t lod_edges_slot_(LODEDGES *edges, LODTERMID from);
+
+/* Add an edge */
+int
+lod_edges_add_(LODEDGES *edges, LODTERMID from, LODTERMID label, LODTERMID to)
+{
+	LODEDGE *edge;
+	size_t slot;
+
+	if(edges->nedges == edges->esize || (edges->nkeys + 1) * 2 > edges->nslots)
+	{
+		if(lod_edges_grow_(edges))
+		{
+			return -1;
+		}
+	}
+	slot = lod_edges_slot_(edges, from);
+	edge = &(edges->edges[edges->nedges]);
+	edge->from = from;
+	edge->label = label;
+	edge->to = to;
+	if(edges->keys[slot] == LOD_NOTERM)
+	{
+		edges->keys[slot] = from;
+		edges->nkeys++;
+		edge->next = LOD_NOEDGE;
+	}
+	else
+	{
+		edge->next = edges->heads[slot];
+	}
+	edges->heads[slot] = (uint32_t) edges->nedges;
+	edges->nedges++;
+	return 0;
+}
+
+/* Obtain the index of the first edge from a term, or LOD_NOEDGE */
+uint32_t
+lod_edges_first_(LODEDGES *edges, LODTERMID from)
+{
+	size_t slot;
+
+	if(!edges->nslots)
+	{
+		return LOD_NOEDGE;
+	}
+	slot = lod_edges_slot_(edges, from);
+	if(edges->keys[slot] == LOD_NOTERM)
+	{
+		return LOD_NOEDGE;
+	}
+	return edges->heads[slot];
+}
+
+/* Test whether a particular edge exists */
+int
+lod_edges_exists_(LODEDGES *edges, LODTERMID from, LODTERMID label, LODTERMID to)
+{
+	uint32_t e;
+
+	for(e = lod_edges_first_(edges, from); e != LOD_NOEDGE; e = edges->edges[e].next)
+	{
+		if(edges->edges[e].label == label && edges->edges[e].to == to)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Discard all of the edges */
+void
+lod_edges_reset_(LODEDGES *edges)
+{
+	free(edges->edges);
+	free(edges->keys);
+	free(edges->heads);
+	memset(edges, 0, sizeof(LODEDGES));
+}
+
+/* Grow the edge array and (if needed) the hash */
+static int
+lod_edges_grow_(LODEDGES *edges)
+{
+	LODEDGE *p;
+	LODTERMID *keys, *oldkeys;
+	uint32_t *heads, *oldheads;
+	size_t size, c, oldslots, slot;
+
+	if(edges->nedges == edges->esize)
+	{
+		size = edges->esize ? edges->esize * 2 : EDGES_MINEDGES;
+		p = (LODEDGE *) realloc(edges->edges, size * sizeof(LODEDGE));
+		if(!p)
+		{
+			return -1;
+		}
+		edges->edges = p;
+		edges->esize = size;
+	}
+	if((edges->nkeys + 1) * 2 <= edges->nslots)
+	{
+		return 0;
+	}
+	size = edges->nslots ? edges->nslots * 2 : EDGES_MINSLOTS;
+	keys = (LODTERMID *) malloc(size * sizeof(LODTERMID));
+	heads = (uint32_t *) malloc(size * sizeof(uint32_t));
+	if(!keys || !heads)
+	{
+		free(keys);
+		free(heads);
+		return -1;
+	}
+	memset(keys, 0xff, size * sizeof(LODTERMID));
+	oldkeys = edges->keys;
+	oldheads = edges->heads;
+	oldslots = edges->nslots;
+	edges->keys = keys;
+	edges->heads = heads;
+	edges->nslots = size;
+	for(c = 0; c < oldslots; c++)
+	{
+		if(oldkeys[c] != LOD_NOTERM)
+		{
+			slot = lod_edges_slot_(edges, oldkeys[c]);
+			keys[slot] = oldkeys[c];
+			heads[slot] = oldheads[c];
+		}
+	}
+	free(oldkeys);
+	free(oldheads);
+	return 0;
+}
+
+/* Locate the slot occupied by a source term, or the empty slot it would
+ * occupy
+ */
+static size_t
+lod_edges_slot_(LODEDGES *edges, LODTERMID from)
+{
+	size_t slot;
+
+	slot = (size_t) ((from * UINT32_C(2654435761)) & (edges->nslots - 1));
+	while(edges->keys[slot] != LOD_NOTERM && edges->keys[slot] != from)
+	{
+		slot = (slot + 1) & (edges->nslots - 1);
+	}
+	return slot;
+}
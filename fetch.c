@@ -21,36 +21,115 @@
 
 #include "p_liblod.h"
 
-static int lod_fetch_curl_(LODCONTEXT *context, const char *uri, LODRESPONSE *response);
+static int lod_fetch_document_(LODCONTEXT *context, LODFLIGHT *flight, const char *fragment, double deadline);
+static int lod_fetch_curl_(LODCONTEXT *context, const char *uri, LODTRANSFER *xfer);
+static LODTIMEOUTPHASE lod_fetch_timeout_(CURL *ch, LODTRANSFER *xfer);
+static const char *lod_fetch_timeout_msg_(LODTIMEOUTPHASE phase);
+static LODFLIGHT *lod_flight_join_(LODCONTEXT *context, const char *uri, LODPRIORITY priority, int *leader);
+static int lod_flight_follow_(LODFLIGHT *flight, const char *target, int replace);
+static void lod_flight_finish_(LODCONTEXT *context, LODFLIGHT *flight, int result);
+static int lod_flight_adopt_(LODCONTEXT *context, LODFLIGHT *flight, const char *fragment, double deadline);
+static void lod_flight_release_(LODFLIGHT *flight);
+static char *lod_fetch_fragment_(const char *uri, const char *fragment);
 static size_t lod_fetch_write_(char *ptr, size_t size, size_t nmemb, void *userdata);
+static size_t lod_fetch_header_(char *ptr, size_t size, size_t nmemb, void *userdata);
+static int lod_fetch_progress_(void *userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
 
-/* Unconditionally fetch some LOD and parse it into the existing model */
+/* Unconditionally fetch some LOD and parse it into the existing model. If
+ * another thread is already fetching the same document, this waits for it
+ * to finish and adopts its outcome, rather than fetching it again.
+ */
 int
 lod_fetch_(LODCONTEXT *context)
 {
-	LODRESPONSE *response;
-	LODRESULT rr;
-	int r, count, followed_link;
-	const char *uri, *fragment;
-	char *t, *tempuri;
-	size_t fraglen;
+	LODSTATE *state;
+	LODFLIGHT *flight;
+	struct timespec ts;
+	const char *fragment;
+	double deadline;
+	int r, leader;
 
-	tempuri = NULL;
-	if(lod_push_subject_(context, context->subject))
+	state = lod_state_(context);
+	if(lod_push_subject_(context, state->subject))
 	{
 		return -1;
 	}
+	/* The deadline spans the whole resolution, including waiting for
+	 * another thread's fetch of the same document
+	 */
+	deadline = 0;
+	if(context->timeouts.deadline > 0)
+	{
+		deadline = lod_sched_now_() + (double) context->timeouts.deadline / 1000.0;
+	}
 	/* Save the fragment in case we need to apply it to a
 	 * a redirect URI
 	 */
-	if((fragment = strchr(context->subject, '#')))
+	fragment = strchr(state->subject, '#');
+	flight = NULL;
+	leader = 1;
+	/* A thread which holds the lock more than once (for example, within
+	 * a callback) can't release it to wait for another
+	 */
+	if(state->depth == 1 && state != &(context->fallback))
 	{
-		fraglen = strlen(fragment);
+		flight = lod_flight_join_(context, state->subject, state->priority, &leader);
 	}
-	else
+	if(!leader)
 	{
-		fraglen = 0;
+		while(!flight->done)
+		{
+			if(deadline <= 0)
+			{
+				pthread_cond_wait(&(context->flight_cond), &(context->lock));
+				continue;
+			}
+			ts.tv_sec = (time_t) deadline;
+			ts.tv_nsec = (long) ((deadline - (double) ts.tv_sec) * 1000000000.0);
+			if(pthread_cond_timedwait(&(context->flight_cond), &(context->lock), &ts) == ETIMEDOUT && !flight->done)
+			{
+				lod_flight_release_(flight);
+				state->timeout = LODT_DEADLINE;
+				lod_set_error_(context, lod_fetch_timeout_msg_(LODT_DEADLINE));
+				state->error = 1;
+				return -1;
+			}
+		}
+		r = lod_flight_adopt_(context, flight, fragment, deadline);
+		lod_flight_release_(flight);
+		return r;
+	}
+	r = lod_fetch_document_(context, flight, fragment, deadline);
+	if(flight)
+	{
+		lod_flight_finish_(context, flight, r);
 	}
+	return r;
+}
+
+/* Fetch a document and parse it into the model, following redirects,
+ * and recording the subjects which are followed in the flight (if any),
+ * unless the deadline (if non-zero) passes first
+ */
+static int
+lod_fetch_document_(LODCONTEXT *context, LODFLIGHT *flight, const char *fragment, double deadline)
+{
+	LODSTATE *state;
+	LODRESPONSE *response;
+	LODTIMEOUTS timeouts;
+	LODTRANSFER xfer;
+	LODRESULT rr;
+	int r, count, followed_link;
+	const char *uri;
+	char *t, *tempuri, *chain;
+	size_t chainlen;
+	LODSCHEDWAITER slot;
+	LODPRIORITY priority;
+
+	state = lod_state_(context);
+	tempuri = NULL;
+	chain = NULL;
+	chainlen = 0;
 	r = 0;
 	followed_link = 0;
 	response = lod_response_create();
@@ -59,11 +138,82 @@ lod_fetch_(LODCONTEXT *context)
 		lod_set_error_(context, "failed to create response object");
 		return -1;
 	}
-	uri = context->subjects[0];
+	lod_response_set_spill_threshold(response, context->spill_threshold);
+	timeouts = context->timeouts;
+	uri = state->subjects[0];
 	for(count = 0; count < context->max_redirects; count++)
 	{
+		if(deadline > 0 && lod_sched_now_() >= deadline)
+		{
+			state->timeout = LODT_DEADLINE;
+			lod_set_error_(context, lod_fetch_timeout_msg_(LODT_DEADLINE));
+			r = 1;
+			break;
+		}
 		lod_response_reset(response);
-		r = lod_fetch_curl_(context, uri, response);
+		/* Record the URIs requested, for the document's metadata */
+		t = (char *) realloc(chain, chainlen + strlen(uri) + 2);
+		if(!t)
+		{
+			lod_set_error_(context, strerror(errno));
+			r = 1;
+			break;
+		}
+		chain = t;
+		if(chainlen)
+		{
+			chain[chainlen++] = ' ';
+		}
+		strcpy(chain + chainlen, uri);
+		chainlen += strlen(uri);
+		state->chain = chain;
+		/* A background fetch is promoted if an interactive thread is
+		 * waiting for it
+		 */
+		priority = state->priority;
+		if(flight && flight->priority < priority)
+		{
+			priority = flight->priority;
+		}
+		/* Other threads may use the context during the transfer, and
+		 * while the payload is being parsed
+		 */
+		lod_unlock_(context);
+		/* Wait for the scheduler to allow the request to start; the
+		 * slot is released as soon as the transfer is complete
+		 */
+		memset(&slot, 0, sizeof(LODSCHEDWAITER));
+		memset(&xfer, 0, sizeof(LODTRANSFER));
+		xfer.response = response;
+		xfer.slot = &slot;
+		xfer.timeouts = &timeouts;
+		xfer.deadline = deadline;
+		for(;;)
+		{
+			if(lod_sched_acquire_(context, uri, &slot, priority, deadline))
+			{
+				xfer.timeout = LODT_QUEUE;
+				lod_response_set_error(response, lod_fetch_timeout_msg_(LODT_QUEUE));
+				r = -1;
+				break;
+			}
+			r = lod_fetch_curl_(context, uri, &xfer);
+			if(!lod_sched_release_(context, &slot))
+			{
+				break;
+			}
+			/* The transfer was interrupted to make way for an
+			 * interactive request, and is retried from the start
+			 */
+			lod_response_reset(response);
+		}
+		rr = LODR_FAIL;
+		if(!r && response->status > 0 && !response->errmsg)
+		{
+			rr = lod_response_process(context, response);
+		}
+		lod_lock_(context);
+		state->timeout = xfer.timeout;
 		if(r || response->status <= 0 || response->errmsg)
 		{
 			if(response->errmsg)
@@ -77,7 +227,6 @@ lod_fetch_(LODCONTEXT *context)
 			r = 1;
 			break;
 		}
-		rr = lod_response_process(context, response);
 		switch(rr)
 		{
 		case LODR_FAIL:
@@ -89,30 +238,21 @@ lod_fetch_(LODCONTEXT *context)
 		case LODR_FOLLOW:
 		case LODR_FOLLOW_REPLACE:
 			free(tempuri);
-			tempuri = (char *) malloc(strlen(response->target) + fraglen + 1);
+			tempuri = lod_fetch_fragment_(response->target, rr == LODR_FOLLOW_REPLACE ? fragment : NULL);
 			if(!tempuri)
 			{
 				lod_set_error_(context, strerror(errno));
 				r = 1;
 				break;
 			}
-			strcpy(tempuri, response->target);
 			uri = tempuri;
 			if(rr != LODR_FOLLOW_REPLACE)
 			{
 				continue;
 			}
-			if(fragment)
+			if(flight)
 			{
-				t = strchr(tempuri, '#');
-				if(t)
-				{
-					strcpy(t, fragment);
-				}
-				else
-				{
-					strcat(tempuri, fragment);
-				}
+				lod_flight_follow_(flight, response->target, 1);
 			}
 			lod_push_subject_(context, tempuri);
 			/* tempuri is now owned by context */
@@ -126,6 +266,10 @@ lod_fetch_(LODCONTEXT *context)
 				r = 1;
 				break;
 			}
+			if(flight)
+			{
+				lod_flight_follow_(flight, response->target, 0);
+			}
 			lod_push_subject_(context, response->target);
 			/* response->target is now owned by the context */
 			uri = response->target;
@@ -144,24 +288,230 @@ lod_fetch_(LODCONTEXT *context)
 		r = 1;
 	}
 	free(tempuri);
+	state->chain = NULL;
+	free(chain);
 	lod_response_destroy(response);
 	if(r)
 	{
-		context->error = 1;
+		state->error = 1;
+		return -1;
+	}
+	return 0;
+}
+
+/* Duplicate a URI, replacing its fragment (if any) with the supplied one,
+ * if that isn't NULL
+ */
+static char *
+lod_fetch_fragment_(const char *uri, const char *fragment)
+{
+	char *p, *t;
+
+	p = (char *) malloc(strlen(uri) + (fragment ? strlen(fragment) : 0) + 1);
+	if(!p)
+	{
+		return NULL;
+	}
+	strcpy(p, uri);
+	if(fragment)
+	{
+		t = strchr(p, '#');
+		if(t)
+		{
+			strcpy(t, fragment);
+		}
+		else
+		{
+			strcat(p, fragment);
+		}
+	}
+	return p;
+}
+
+/* Join the fetch of a document which is already in progress, or begin a
+ * new one; *leader is set if the caller must perform the fetch itself.
+ * Documents are identified by URI, without any fragment.
+ */
+static LODFLIGHT *
+lod_flight_join_(LODCONTEXT *context, const char *uri, LODPRIORITY priority, int *leader)
+{
+	LODFLIGHT *flight;
+	size_t len;
+
+	*leader = 1;
+	len = strcspn(uri, "#");
+	for(flight = context->flights; flight; flight = flight->next)
+	{
+		if(!strncmp(flight->uri, uri, len) && !flight->uri[len])
+		{
+			flight->refs++;
+			if(priority < flight->priority)
+			{
+				flight->priority = priority;
+			}
+			*leader = 0;
+			return flight;
+		}
+	}
+	/* If this fails, the document is simply fetched without coalescing */
+	flight = (LODFLIGHT *) calloc(1, sizeof(LODFLIGHT));
+	if(!flight)
+	{
+		return NULL;
+	}
+	flight->uri = strndup(uri, len);
+	if(!flight->uri)
+	{
+		free(flight);
+		return NULL;
+	}
+	flight->refs = 1;
+	flight->priority = priority;
+	flight->next = context->flights;
+	context->flights = flight;
+	return flight;
+}
+
+/* Record a subject followed by the fetch of a document, which will be
+ * pushed by each waiter; if replace is set, the waiter's own fragment is
+ * applied to it first
+ */
+static int
+lod_flight_follow_(LODFLIGHT *flight, const char *target, int replace)
+{
+	LODFLIGHTFOLLOW *p;
+
+	p = (LODFLIGHTFOLLOW *) realloc(flight->follows, (flight->nfollows + 1) * sizeof(LODFLIGHTFOLLOW));
+	if(p)
+	{
+		flight->follows = p;
+		p[flight->nfollows].uri = strdup(target);
+		p[flight->nfollows].replace = replace;
+	}
+	if(!p || !p[flight->nfollows].uri)
+	{
+		/* Waiters will have to fetch the document themselves */
+		flight->incomplete = 1;
+		return -1;
+	}
+	flight->nfollows++;
+	return 0;
+}
+
+/* Record the outcome of a fetch, and wake any threads waiting for it */
+static void
+lod_flight_finish_(LODCONTEXT *context, LODFLIGHT *flight, int result)
+{
+	LODSTATE *state;
+	LODFLIGHT **p;
+
+	state = lod_state_(context);
+	flight->result = result;
+	flight->status = state->status;
+	if(state->document)
+	{
+		flight->document = strdup(state->document);
+		flight->incomplete |= !flight->document;
+	}
+	if(result && state->errmsg)
+	{
+		flight->errmsg = strdup(state->errmsg);
+	}
+	flight->timeout = state->timeout;
+	flight->done = 1;
+	/* Later fetches of the same document begin anew */
+	for(p = &(context->flights); *p; p = &((*p)->next))
+	{
+		if(*p == flight)
+		{
+			*p = flight->next;
+			break;
+		}
+	}
+	pthread_cond_broadcast(&(context->flight_cond));
+	lod_flight_release_(flight);
+}
+
+/* Adopt the outcome of a fetch performed by another thread, as though the
+ * calling thread had performed it
+ */
+static int
+lod_flight_adopt_(LODCONTEXT *context, LODFLIGHT *flight, const char *fragment, double deadline)
+{
+	LODSTATE *state;
+	char *uri;
+	size_t c;
+
+	state = lod_state_(context);
+	if(flight->incomplete)
+	{
+		return lod_fetch_document_(context, NULL, fragment, deadline);
+	}
+	for(c = 0; c < flight->nfollows; c++)
+	{
+		uri = lod_fetch_fragment_(flight->follows[c].uri, flight->follows[c].replace ? fragment : NULL);
+		if(!uri)
+		{
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+		if(lod_push_subject_(context, uri))
+		{
+			free(uri);
+			return -1;
+		}
+	}
+	state->status = flight->status;
+	state->timeout = flight->timeout;
+	if(flight->document)
+	{
+		free(state->document);
+		state->document = strdup(flight->document);
+	}
+	if(flight->result)
+	{
+		lod_set_error_(context, flight->errmsg ? flight->errmsg : "failed to fetch document");
+		state->error = 1;
 		return -1;
 	}
 	return 0;
 }
 
+/* Release a reference to a flight, freeing it once there are none */
+static void
+lod_flight_release_(LODFLIGHT *flight)
+{
+	size_t c;
+
+	flight->refs--;
+	if(flight->refs)
+	{
+		return;
+	}
+	for(c = 0; c < flight->nfollows; c++)
+	{
+		free(flight->follows[c].uri);
+	}
+	free(flight->follows);
+	free(flight->document);
+	free(flight->errmsg);
+	free(flight->uri);
+	free(flight);
+}
+
 /* The default implementation of a LODFETCHURI callback using cURL */
 static int
-lod_fetch_curl_(LODCONTEXT *context, const char *uri, LODRESPONSE *response)
+lod_fetch_curl_(LODCONTEXT *context, const char *uri, LODTRANSFER *xfer)
 {
 	CURL *ch;
 	CURLcode e;
-	long code;
+	LODRESPONSE *response;
+	const LODTIMEOUTS *timeouts;
+	long code, remaining;
 	char *str;
 
+	response = xfer->response;
+	timeouts = xfer->timeouts;
 	ch = lod_curl(context);
 	if(!ch)
 	{
@@ -169,15 +519,58 @@ lod_fetch_curl_(LODCONTEXT *context, const char *uri, LODRESPONSE *response)
 	}
 	curl_easy_setopt(ch, CURLOPT_WRITEDATA, (void *) response);
 	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, lod_fetch_write_);
+	curl_easy_setopt(ch, CURLOPT_HEADERDATA, (void *) xfer);
+	curl_easy_setopt(ch, CURLOPT_HEADERFUNCTION, lod_fetch_header_);
 	curl_easy_setopt(ch, CURLOPT_FOLLOWLOCATION, 0);
 	curl_easy_setopt(ch, CURLOPT_URL, uri);
+	/* No request may outlast the resolution's deadline */
+	remaining = 0;
+	if(xfer->deadline > 0)
+	{
+		remaining = (long) ((xfer->deadline - lod_sched_now_()) * 1000.0);
+		if(remaining < 1)
+		{
+			remaining = 1;
+		}
+	}
+	curl_easy_setopt(ch, CURLOPT_TIMEOUT_MS, remaining);
+	curl_easy_setopt(ch, CURLOPT_CONNECTTIMEOUT_MS, timeouts->connect);
+	curl_easy_setopt(ch, CURLOPT_LOW_SPEED_LIMIT, timeouts->low_speed);
+	curl_easy_setopt(ch, CURLOPT_LOW_SPEED_TIME, timeouts->low_speed_time);
+	xfer->started = lod_sched_now_();
+	xfer->received = 0;
+	xfer->timeout = LODT_NONE;
+	if(xfer->slot->priority == LODP_BACKGROUND || timeouts->first_byte > 0)
+	{
+		/* The first-byte limit is enforced, and background transfers
+		 * interrupted by the scheduler, from the progress callback
+		 */
+		curl_easy_setopt(ch, CURLOPT_XFERINFOFUNCTION, lod_fetch_progress_);
+		curl_easy_setopt(ch, CURLOPT_XFERINFODATA, (void *) xfer);
+		curl_easy_setopt(ch, CURLOPT_NOPROGRESS, 0L);
+	}
+	else
+	{
+		curl_easy_setopt(ch, CURLOPT_NOPROGRESS, 1L);
+	}
 	e = curl_easy_perform(ch);
 	if(e)
 	{
-		lod_response_set_error(response, curl_easy_strerror(e));
+		if(e == CURLE_OPERATION_TIMEDOUT)
+		{
+			xfer->timeout = lod_fetch_timeout_(ch, xfer);
+		}
+		if(xfer->timeout)
+		{
+			lod_response_set_error(response, lod_fetch_timeout_msg_(xfer->timeout));
+		}
+		else
+		{
+			lod_response_set_error(response, curl_easy_strerror(e));
+		}
 		return -1;
 	}
-	if((e = curl_easy_getinfo(context->ch, CURLINFO_RESPONSE_CODE, &code)))
+	if((e = curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &code)))
 	{
 		lod_response_set_error(response, curl_easy_strerror(e));
 		return -1;
@@ -233,3 +626,98 @@ lod_fetch_write_(char *ptr, size_t size, size_t nmemb, void *userdata)
 	}
 	return size;
 }
+
+/* Invoked by libcurl for each response header line */
+static size_t
+lod_fetch_header_(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	LODTRANSFER *xfer;
+	LODRESPONSE *response;
+
+	xfer = (LODTRANSFER *) userdata;
+	xfer->received = 1;
+	response = xfer->response;
+	size *= nmemb;
+	/* Skip the status line and the blank line which ends the headers */
+	if(size < 2 || !memchr(ptr, ':', size))
+	{
+		return size;
+	}
+	if(lod_response_add_header(response, ptr, size))
+	{
+		return 0;
+	}
+	return size;
+}
+
+/* Invoked by libcurl periodically during a transfer which has a first-byte
+ * limit, or is in the background; a non-zero return value interrupts it
+ */
+static int
+lod_fetch_progress_(void *userdata, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+	LODTRANSFER *xfer;
+
+	(void) dltotal;
+	(void) ultotal;
+	(void) ulnow;
+
+	xfer = (LODTRANSFER *) userdata;
+	if(dlnow > 0)
+	{
+		xfer->received = 1;
+	}
+	if(!xfer->received && xfer->timeouts->first_byte > 0 &&
+	   lod_sched_now_() - xfer->started >= (double) xfer->timeouts->first_byte / 1000.0)
+	{
+		xfer->timeout = LODT_FIRST_BYTE;
+		return 1;
+	}
+	if(xfer->slot->priority == LODP_BACKGROUND)
+	{
+		return lod_sched_preempted_(xfer->slot);
+	}
+	return 0;
+}
+
+/* Determine which time limit caused a transfer to time out */
+static LODTIMEOUTPHASE
+lod_fetch_timeout_(CURL *ch, LODTRANSFER *xfer)
+{
+	double connect;
+
+	if(xfer->deadline > 0 && lod_sched_now_() >= xfer->deadline)
+	{
+		return LODT_DEADLINE;
+	}
+	if(xfer->received)
+	{
+		return LODT_LOW_SPEED;
+	}
+	/* The connection time is zero if a connection wasn't established */
+	connect = 0;
+	curl_easy_getinfo(ch, CURLINFO_CONNECT_TIME, &connect);
+	return connect > 0 ? LODT_FIRST_BYTE : LODT_CONNECT;
+}
+
+/* Return the error message describing a timeout */
+static const char *
+lod_fetch_timeout_msg_(LODTIMEOUTPHASE phase)
+{
+	switch(phase)
+	{
+	case LODT_NONE:
+		break;
+	case LODT_QUEUE:
+		return "the resolution deadline passed while waiting for the request to be scheduled";
+	case LODT_CONNECT:
+		return "timed out while connecting";
+	case LODT_FIRST_BYTE:
+		return "timed out waiting for the response to begin";
+	case LODT_LOW_SPEED:
+		return "the response was received too slowly";
+	case LODT_DEADLINE:
+		return "the resolution deadline passed";
+	}
+	return "timed out";
+}
@@ -27,6 +27,7 @@ static void lod_html_xml_structured_error_(void *userData, xmlErrorPtr error);
 int
 lod_html_discover_(LODCONTEXT *context, LODRESPONSE *response, const char *url, char **newurl)
 {
+	LODSTATE *state;
 	librdf_world *world;
 	htmlParserCtxtPtr ctx;
 	xmlDoc *doc;
@@ -35,7 +36,9 @@ lod_html_discover_(LODCONTEXT *context, LODRESPONSE *response, const char *url,
 	xmlChar *rel, *type, *href;
 	int i;
 	URI *base, *dest;
+	FILE *f;
 
+	state = lod_state_(context);
 	*newurl = NULL;
 	world = lod_world(context);
 	if(!world)
@@ -57,7 +60,16 @@ lod_html_discover_(LODCONTEXT *context, LODRESPONSE *response, const char *url,
 	}
 	xmlSetGenericErrorFunc(ctx, lod_html_xml_generic_error_);
 	xmlSetStructuredErrorFunc(ctx, lod_html_xml_structured_error_);
-	doc = htmlCtxtReadMemory(ctx, response->buf, response->buflen, url, NULL, 0);
+	if(response->spill)
+	{
+		/* The payload has been written to a temporary file */
+		f = lod_response_rewind_(response);
+		doc = f ? htmlCtxtReadFd(ctx, fileno(f), url, NULL, 0) : NULL;
+	}
+	else
+	{
+		doc = htmlCtxtReadMemory(ctx, response->buf, response->buflen, url, NULL, 0);
+	}
 	if(!doc)
 	{
 		lod_set_error_(context, "failed to parse HTML document");
@@ -97,9 +109,9 @@ lod_html_discover_(LODCONTEXT *context, LODRESPONSE *response, const char *url,
 		/* Ensure that any condition triggered by librdf_parser_guess_name2()
 		 * isn't misleadingly returned to the application.
 		 */
-		context->error = 0;
-		free(context->errmsg);
-		context->errmsg = NULL;
+		state->error = 0;
+		free(state->errmsg);
+		state->errmsg = NULL;
 		xmlFree(rel);
 		xmlFree(type);
 		xmlFree(href);
@@ -0,0 +1,574 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* The context's indexes are updated as statements are added to the model
+ * by liblod itself. Because applications are free to modify the model
+ * directly, the model's size is recorded whenever the indexes are known to
+ * be complete; if it has changed by the time an index is consulted, the
+ * indexes are rebuilt from the model before being used.
+ */
+
+static int lod_index_rebuild_(LODCONTEXT *context, librdf_model *model);
+static int lod_set_indexes_locked_(LODCONTEXT *context, unsigned int flags);
+static int lod_add_pointer_locked_(LODCONTEXT *context, const char *predicate);
+static int lod_filter_stats_locked_(LODCONTEXT *context, LODFILTERSTATS *stats);
+
+/* Obtain the set of indexes maintained by the context */
+unsigned int
+lod_indexes(LODCONTEXT *context)
+{
+	lod_state_(context)->error = 0;
+	return context->index.flags;
+}
+
+/* Set the indexes which will be maintained by the context */
+int
+lod_set_indexes(LODCONTEXT *context, unsigned int flags)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_indexes_locked_(context, flags);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_indexes(), with the context lock held */
+static int
+lod_set_indexes_locked_(LODCONTEXT *context, unsigned int flags)
+{
+	lod_state_(context)->error = 0;
+	lod_index_reset_(context);
+	context->index.flags = flags;
+	return 0;
+}
+
+/* Register a pointer predicate */
+int
+lod_add_pointer(LODCONTEXT *context, const char *predicate)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_add_pointer_locked_(context, predicate);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_add_pointer(), with the context lock held */
+static int
+lod_add_pointer_locked_(LODCONTEXT *context, const char *predicate)
+{
+	LODINDEXES *index;
+	char **p, *str;
+	LODTERMID *ids;
+
+	lod_state_(context)->error = 0;
+	index = &(context->index);
+	str = strdup(predicate);
+	p = (char **) realloc(index->pointers, (index->npointers + 1) * sizeof(char *));
+	if(p)
+	{
+		index->pointers = p;
+	}
+	ids = (LODTERMID *) realloc(index->pointer_ids, (index->npointers + 1) * sizeof(LODTERMID));
+	if(ids)
+	{
+		index->pointer_ids = ids;
+	}
+	if(!str || !p || !ids)
+	{
+		lod_set_error_(context, strerror(errno));
+		free(str);
+		return -1;
+	}
+	index->pointers[index->npointers] = str;
+	index->pointer_ids[index->npointers] = LOD_NOTERM;
+	index->npointers++;
+	/* Existing statements must be re-examined */
+	index->rebuild = 1;
+	return 0;
+}
+
+/* Obtain statistics about the subject membership filter */
+int
+lod_filter_stats(LODCONTEXT *context, LODFILTERSTATS *stats)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_filter_stats_locked_(context, stats);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_filter_stats(), with the context lock held */
+static int
+lod_filter_stats_locked_(LODCONTEXT *context, LODFILTERSTATS *stats)
+{
+	LODBLOOM *bloom;
+
+	lod_state_(context)->error = 0;
+	bloom = &(context->index.subjects);
+	memset(stats, 0, sizeof(LODFILTERSTATS));
+	stats->queries = bloom->queries;
+	stats->negatives = bloom->negatives;
+	stats->positives = bloom->positives;
+	stats->false_positives = bloom->false_positives;
+	stats->subjects = bloom->count;
+	stats->bits = bloom->nbits;
+	return 0;
+}
+
+/* Add the statements from a stream to the context's model, updating the
+ * indexes as it goes
+ */
+int
+lod_model_add_stream_(LODCONTEXT *context, librdf_model *model, librdf_stream *stream)
+{
+	librdf_statement *st;
+	int indexed, r;
+	size_t added;
+
+	if(context->store.bulk && !context->journal.path)
+	{
+		/* Nothing is indexed or journalled during a bulk load, so hand the
+		 * whole stream to the storage, which may be able to add it more
+		 * quickly than one statement at a time
+		 */
+		if(librdf_model_add_statements(model, stream))
+		{
+			lod_set_error_(context, "failed to add statements to model");
+			return -1;
+		}
+		lod_generation_bump_(context, model);
+		return 0;
+	}
+	indexed = !lod_index_sync_(context, model);
+	r = 0;
+	added = 0;
+	for(; !librdf_stream_end(stream); librdf_stream_next(stream))
+	{
+		st = librdf_stream_get_object(stream);
+		if(!st)
+		{
+			continue;
+		}
+		/* Every statement is journalled, present or not, so that each
+		 * journal record describes a whole document
+		 */
+		if(context->journal.path && !context->journal.replaying &&
+		   lod_journal_statement_(context, st))
+		{
+			r = -1;
+			break;
+		}
+		if(indexed && librdf_model_contains_statement(model, st))
+		{
+			/* Already present, and so already indexed */
+			continue;
+		}
+		if(librdf_model_add_statement(model, st))
+		{
+			lod_set_error_(context, "failed to add statement to model");
+			r = -1;
+			break;
+		}
+		added++;
+		if(indexed)
+		{
+			lod_index_add_(context, st);
+		}
+	}
+	if(added)
+	{
+		lod_generation_bump_(context, model);
+	}
+	if(indexed)
+	{
+		if(context->index.rebuild)
+		{
+			lod_index_rebuild_(context, model);
+		}
+		else
+		{
+			context->index.size = librdf_model_size(model);
+			lod_storage_changes_(context, model, &(context->index.changes));
+		}
+	}
+	return r;
+}
+
+/* Update the indexes to reflect a statement which has been added to the
+ * model
+ */
+int
+lod_index_add_(LODCONTEXT *context, librdf_statement *statement)
+{
+	LODINDEXES *index;
+	librdf_node *subject;
+	LODTERMID id, sid, pid, oid;
+	size_t c;
+
+	index = &(context->index);
+	subject = librdf_statement_get_subject(statement);
+	if((index->flags & LODI_SUBJECTS) && librdf_node_is_resource(subject))
+	{
+		id = lod_intern_node_id_(context, subject, 1);
+		if(id == LOD_NOTERM)
+		{
+			return -1;
+		}
+		context->intern.terms[id].flags |= LODTERM_SUBJECT;
+		lod_bloom_add_(&(index->subjects), context->intern.terms[id].hash);
+		if(index->subjects.count > index->subjects.capacity)
+		{
+			/* The filter is over capacity, and must be rebuilt at a larger
+			 * size to keep the false-positive rate down
+			 */
+			index->rebuild = 1;
+		}
+	}
+	if(!(index->flags & (LODI_POINTERS|LODI_SAMEAS|LODI_LABELS|LODI_TYPES|LODI_INCOMING)) || !librdf_node_is_resource(subject))
+	{
+		return 0;
+	}
+	pid = lod_intern_node_id_(context, librdf_statement_get_predicate(statement), 1);
+	if(pid == LOD_NOTERM)
+	{
+		return 0;
+	}
+	if((index->flags & LODI_LABELS) && librdf_node_is_literal(librdf_statement_get_object(statement)))
+	{
+		sid = lod_intern_node_id_(context, subject, 1);
+		if(sid != LOD_NOTERM &&
+		   lod_label_add_(context, sid, pid, librdf_statement_get_object(statement)))
+		{
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+		/* A literal can't be co-referent or a pointer target */
+		return 0;
+	}
+	if((index->flags & LODI_TYPES) && (pid == LOD_RDF_TYPE || pid == LOD_RDFS_SUBCLASSOF))
+	{
+		sid = lod_intern_node_id_(context, subject, 1);
+		oid = lod_intern_node_id_(context, librdf_statement_get_object(statement), 1);
+		if(sid != LOD_NOTERM && oid != LOD_NOTERM &&
+		   lod_types_add_(context, sid, pid, oid))
+		{
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+	}
+	if(pid == LOD_OWL_SAMEAS && (index->flags & LODI_SAMEAS))
+	{
+		sid = lod_intern_node_id_(context, subject, 1);
+		oid = lod_intern_node_id_(context, librdf_statement_get_object(statement), 1);
+		if(sid != LOD_NOTERM && oid != LOD_NOTERM &&
+		   lod_sameas_union_(&(index->sameas), sid, oid))
+		{
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+	}
+	if(index->flags & LODI_INCOMING)
+	{
+		sid = lod_intern_node_id_(context, subject, 1);
+		oid = lod_intern_node_id_(context, librdf_statement_get_object(statement), 1);
+		if(sid != LOD_NOTERM && oid != LOD_NOTERM &&
+		   lod_edges_add_(&(index->incoming), oid, pid, sid))
+		{
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+	}
+	if(!(index->flags & LODI_POINTERS))
+	{
+		return 0;
+	}
+	if(pid != LOD_FOAF_PRIMARYTOPIC)
+	{
+		for(c = 0; c < index->npointers; c++)
+		{
+			if(index->pointer_ids[c] == pid)
+			{
+				break;
+			}
+		}
+		if(c == index->npointers)
+		{
+			return 0;
+		}
+	}
+	sid = lod_intern_node_id_(context, subject, 1);
+	oid = lod_intern_node_id_(context, librdf_statement_get_object(statement), 1);
+	if(sid == LOD_NOTERM || oid == LOD_NOTERM)
+	{
+		return 0;
+	}
+	if(lod_edges_add_(&(index->pointer_edges), sid, pid, oid))
+	{
+		lod_set_error_(context, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Determine whether the supplied set of indexes is being maintained and
+ * is in sync with the model
+ */
+int
+lod_index_ready_(LODCONTEXT *context, librdf_model *model, unsigned int flags)
+{
+	if((context->index.flags & flags) != flags)
+	{
+		return 0;
+	}
+	/* The indexes are only used in place of the model when they are
+	 * known to be exact
+	 */
+	return !lod_index_sync_(context, model) && context->index.exact;
+}
+
+/* Determine whether the pointer index can be used to answer a query about
+ * the supplied predicate
+ */
+int
+lod_index_pointer_(LODCONTEXT *context, librdf_model *model, LODTERMID predicate)
+{
+	LODINDEXES *index;
+	size_t c;
+
+	index = &(context->index);
+	if((index->flags & (LODI_SUBJECTS|LODI_POINTERS)) != (LODI_SUBJECTS|LODI_POINTERS) ||
+	   predicate == LOD_NOTERM || lod_index_sync_(context, model) ||
+	   !index->exact)
+	{
+		return 0;
+	}
+	if(predicate == LOD_FOAF_PRIMARYTOPIC)
+	{
+		return 1;
+	}
+	for(c = 0; c < index->npointers; c++)
+	{
+		if(index->pointer_ids[c] == predicate)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Ensure that the indexes reflect the contents of the model, rebuilding
+ * them if needed; returns -1 if the indexes cannot be used
+ */
+int
+lod_index_sync_(LODCONTEXT *context, librdf_model *model)
+{
+	unsigned long changes;
+	int size;
+
+	/* The indexes aren't maintained during a bulk load */
+	if(!context->index.flags || context->store.bulk)
+	{
+		return -1;
+	}
+	if(!lod_storage_changes_(context, model, &changes))
+	{
+		/* Every change to the storage is counted, so the indexes are
+		 * exact
+		 */
+		context->index.exact = 1;
+		if(changes != context->index.changes || context->index.size < 0 || context->index.rebuild)
+		{
+			return lod_index_rebuild_(context, model);
+		}
+		return 0;
+	}
+	/* Otherwise, only a change in size can be detected: a statement
+	 * removed and another added directly through librdf goes unnoticed
+	 */
+	context->index.exact = 0;
+	size = librdf_model_size(model);
+	if(size < 0)
+	{
+		/* The storage can't tell us whether it has been modified */
+		return -1;
+	}
+	if(size != context->index.size || context->index.rebuild)
+	{
+		return lod_index_rebuild_(context, model);
+	}
+	return 0;
+}
+
+/* Test whether a URI is the subject of a statement in the model: returns
+ * 0 if it isn't, 1 if it is, and -1 if the subject index isn't available
+ * (and so the model must be queried instead). The Bloom filter is tested
+ * first; only if it passes is the interning table consulted.
+ */
+int
+lod_index_probe_(LODCONTEXT *context, librdf_model *model, const char *uri)
+{
+	LODBLOOM *bloom;
+	LODTERMID id;
+	size_t len;
+	uint64_t hash;
+
+	if(!(context->index.flags & LODI_SUBJECTS) || lod_index_sync_(context, model))
+	{
+		return -1;
+	}
+	bloom = &(context->index.subjects);
+	bloom->queries++;
+	len = strlen(uri);
+	hash = lod_hash_(uri, len);
+	if(!lod_bloom_test_(bloom, hash))
+	{
+		bloom->negatives++;
+		return 0;
+	}
+	id = lod_intern_find_(context, uri, len);
+	if(id == LOD_NOTERM || !(context->intern.terms[id].flags & LODTERM_SUBJECT))
+	{
+		bloom->false_positives++;
+		return 0;
+	}
+	bloom->positives++;
+	/* If the indexes might be stale, a positive result must be checked
+	 * against the model
+	 */
+	return context->index.exact ? 1 : -1;
+}
+
+/* Discard the contents of the indexes, which will be rebuilt when next
+ * used
+ */
+void
+lod_index_reset_(LODCONTEXT *context)
+{
+	size_t c;
+
+	for(c = 0; c < context->intern.nterms; c++)
+	{
+		context->intern.terms[c].flags = 0;
+	}
+	lod_bloom_reset_(&(context->index.subjects));
+	lod_edges_reset_(&(context->index.pointer_edges));
+	lod_sameas_reset_(&(context->index.sameas));
+	lod_label_reset_(&(context->index));
+	lod_types_reset_(&(context->index));
+	lod_edges_reset_(&(context->index.incoming));
+	for(c = 0; c < context->index.npointers; c++)
+	{
+		context->index.pointer_ids[c] = LOD_NOTERM;
+	}
+	for(c = 0; c < context->index.nlabels; c++)
+	{
+		context->index.label_ids[c] = LOD_NOTERM;
+	}
+	context->index.size = -1;
+	context->index.rebuild = 0;
+}
+
+/* Discard the indexes and their configuration when the context is
+ * destroyed
+ */
+void
+lod_index_free_(LODCONTEXT *context)
+{
+	size_t c;
+
+	lod_index_reset_(context);
+	for(c = 0; c < context->index.npointers; c++)
+	{
+		free(context->index.pointers[c]);
+	}
+	free(context->index.pointers);
+	free(context->index.pointer_ids);
+	context->index.pointers = NULL;
+	context->index.pointer_ids = NULL;
+	context->index.npointers = 0;
+	for(c = 0; c < context->index.nlabels; c++)
+	{
+		free(context->index.labels[c]);
+	}
+	free(context->index.labels);
+	free(context->index.label_ids);
+	context->index.labels = NULL;
+	context->index.label_ids = NULL;
+	context->index.nlabels = 0;
+}
+
+/* Rebuild the indexes from the contents of the model */
+static int
+lod_index_rebuild_(LODCONTEXT *context, librdf_model *model)
+{
+	librdf_stream *stream;
+	size_t capacity, c;
+	int size;
+
+	lod_index_reset_(context);
+	size = librdf_model_size(model);
+	if(size < 0)
+	{
+		return -1;
+	}
+	for(c = 0; c < context->index.npointers; c++)
+	{
+		context->index.pointer_ids[c] = lod_intern_(context, context->index.pointers[c], strlen(context->index.pointers[c]));
+	}
+	for(c = 0; c < context->index.nlabels; c++)
+	{
+		context->index.label_ids[c] = lod_intern_(context, context->index.labels[c], strlen(context->index.labels[c]));
+	}
+	if(context->index.flags & LODI_SUBJECTS)
+	{
+		/* There can't be more subjects than statements; allow for the
+		 * model to double in size before the filter must be rebuilt again
+		 */
+		capacity = (size_t) size * 2;
+		if(lod_bloom_init_(&(context->index.subjects), capacity))
+		{
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+	}
+	stream = librdf_model_as_stream(model);
+	if(!stream)
+	{
+		lod_index_reset_(context);
+		return -1;
+	}
+	for(; !librdf_stream_end(stream); librdf_stream_next(stream))
+	{
+		lod_index_add_(context, librdf_stream_get_object(stream));
+	}
+	librdf_free_stream(stream);
+	context->index.rebuild = 0;
+	context->index.size = size;
+	lod_storage_changes_(context, model, &(context->index.changes));
+	return 0;
+}
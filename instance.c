@@ -21,12 +21,29 @@
 
 #include "p_liblod.h"
 
+static LODINSTANCE *lod_instance_follow_(LODINSTANCE *instance, const char *predicate);
+static int lod_instance_props_(LODINSTANCE *instance);
+static void lod_instance_free_props_(LODINSTANCE *instance);
+static int lod_prop_compare_(const void *a, const void *b);
+static librdf_node **lod_instance_range_(LODINSTANCE *instance, const char *predicate, size_t *count);
+static int lod_instance_destroy_locked_(LODINSTANCE *instance);
+static librdf_stream *lod_instance_stream_locked_(LODINSTANCE *instance);
+static int lod_instance_exists_locked_(LODINSTANCE *instance);
+static LODINSTANCE *lod_instance_primarytopic_locked_(LODINSTANCE *instance);
+static LODINSTANCE *lod_instance_follow_locked_(LODINSTANCE *instance, const char *predicate);
+static long lod_instance_incoming_locked_(LODINSTANCE *instance, const char *predicate, const char **uris, size_t max);
+static librdf_node *lod_instance_get_locked_(LODINSTANCE *instance, const char *predicate);
+static librdf_node *const *lod_instance_get_all_locked_(LODINSTANCE *instance, const char *predicate, size_t *count);
+static long lod_instance_count_locked_(LODINSTANCE *instance, const char *predicate);
+static int lod_instance_foreach_locked_(LODINSTANCE *instance, LODTRIPLECB fn, void *userdata);
+static int lod_instance_foreach_predicate_locked_(LODINSTANCE *instance, const char *predicate, LODTRIPLECB fn, void *userdata);
+
 LODINSTANCE *
 lod_instance_create_(LODCONTEXT *context, librdf_statement *query, librdf_node *subject)
 {
 	LODINSTANCE *p;
 
-	context->error = 0;
+	lod_state_(context)->error = 0;
 	p = (LODINSTANCE *) calloc(1, sizeof(LODINSTANCE));
 	if(!p)
 	{
@@ -42,7 +59,22 @@ lod_instance_create_(LODCONTEXT *context, librdf_statement *query, librdf_node *
 int
 lod_instance_destroy(LODINSTANCE *instance)
 {
-	instance->context->error = 0;
+	LODCONTEXT *context;
+	int r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_destroy_locked_(instance);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_destroy(), with the context lock held */
+static int
+lod_instance_destroy_locked_(LODINSTANCE *instance)
+{
+	lod_state_(instance->context)->error = 0;
+	lod_instance_free_props_(instance);
 	librdf_free_statement(instance->query);
 	free(instance);
 	return 0;
@@ -52,17 +84,31 @@ lod_instance_destroy(LODINSTANCE *instance)
 librdf_uri *
 lod_instance_uri(LODINSTANCE *instance)
 {
-	instance->context->error = 0;
+	lod_state_(instance->context)->error = 0;
 	return librdf_node_get_uri(instance->subject);
 }
 
 librdf_stream *
 lod_instance_stream(LODINSTANCE *instance)
+{
+	LODCONTEXT *context;
+	librdf_stream *r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_stream_locked_(instance);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_stream(), with the context lock held */
+static librdf_stream *
+lod_instance_stream_locked_(LODINSTANCE *instance)
 {
 	librdf_stream *stream;
 	librdf_model *model;
 
-	instance->context->error = 0;
+	lod_state_(instance->context)->error = 0;
 	model = lod_model(instance->context);
 	if(!model)
 	{
@@ -71,33 +117,70 @@ lod_instance_stream(LODINSTANCE *instance)
 	stream = librdf_model_find_statements(model, instance->query);
 	if(!stream)
 	{
-		instance->context->error = 1;
+		lod_state_(instance->context)->error = 1;
 		return NULL;
 	}
 	return stream;
 }
 
+/* Determine whether the instance's subject exists within the model; the
+ * result is cached until the model's generation changes
+ */
 int
 lod_instance_exists(LODINSTANCE *instance)
 {
+	LODCONTEXT *context;
+	int r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_exists_locked_(instance);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_exists(), with the context lock held */
+static int
+lod_instance_exists_locked_(LODINSTANCE *instance)
+{
+	LODCONTEXT *context;
 	librdf_stream *stream;
 	librdf_model *model;
+	unsigned long generation;
+	LODTERMID id;
 	int e;
 
-	instance->context->error = 0;
-	model = lod_model(instance->context);
+	context = instance->context;
+	lod_state_(context)->error = 0;
+	model = lod_model(context);
 	if(!model)
 	{
 		return -1;
 	}
+	generation = lod_generation_(context, model);
+	if(generation == instance->exists_generation)
+	{
+		return instance->exists;
+	}
+	if(librdf_node_is_resource(instance->subject) &&
+	   lod_index_ready_(context, model, LODI_SUBJECTS))
+	{
+		id = lod_intern_node_id_(context, instance->subject, 0);
+		e = (id != LOD_NOTERM && (context->intern.terms[id].flags & LODTERM_SUBJECT));
+		instance->exists = e;
+		instance->exists_generation = generation;
+		return e;
+	}
 	stream = librdf_model_find_statements(model, instance->query);
 	if(!stream)
 	{
-		instance->context->error = 1;
+		lod_state_(instance->context)->error = 1;
 		return -1;
 	}
 	e = !librdf_stream_end(stream);
 	librdf_free_stream(stream);
+	instance->exists = e;
+	instance->exists_generation = generation;
 	return e;
 }
 
@@ -106,39 +189,390 @@ lod_instance_exists(LODINSTANCE *instance)
  */
 LODINSTANCE *
 lod_instance_primarytopic(LODINSTANCE *instance)
+{
+	LODCONTEXT *context;
+	LODINSTANCE *r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_primarytopic_locked_(instance);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_primarytopic(), with the context lock held */
+static LODINSTANCE *
+lod_instance_primarytopic_locked_(LODINSTANCE *instance)
+{
+	lod_state_(instance->context)->error = 0;
+	return lod_instance_follow_(instance, lod_wellknown_uri_(LOD_FOAF_PRIMARYTOPIC));
+}
+
+/* Return an instance representing the first object of the supplied
+ * predicate which is itself a subject within the model
+ */
+LODINSTANCE *
+lod_instance_follow(LODINSTANCE *instance, const char *predicate)
+{
+	LODCONTEXT *context;
+	LODINSTANCE *r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_follow_locked_(instance, predicate);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_follow(), with the context lock held */
+static LODINSTANCE *
+lod_instance_follow_locked_(LODINSTANCE *instance, const char *predicate)
+{
+	lod_state_(instance->context)->error = 0;
+	return lod_instance_follow_(instance, predicate);
+}
+
+/* Obtain the subjects which refer to the instance */
+long
+lod_instance_incoming(LODINSTANCE *instance, const char *predicate, const char **uris, size_t max)
+{
+	LODCONTEXT *context;
+	long r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_incoming_locked_(instance, predicate, uris, max);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_incoming(), with the context lock held */
+static long
+lod_instance_incoming_locked_(LODINSTANCE *instance, const char *predicate, const char **uris, size_t max)
+{
+	LODSTATE *state;
+	LODCONTEXT *context;
+	LODEDGES *edges;
+	LODTERMID oid, pid, *ids;
+	uint32_t e;
+	size_t count, size;
+	librdf_model *model;
+	librdf_world *world;
+	librdf_node *object, *pnode;
+	librdf_statement *query;
+	librdf_stream *stream;
+
+	context = instance->context;
+	state = lod_state_(context);
+	state->error = 0;
+	world = lod_world(context);
+	if(!world)
+	{
+		return -1;
+	}
+	model = lod_model(context);
+	if(!model)
+	{
+		return -1;
+	}
+	pid = LOD_NOTERM;
+	if(predicate)
+	{
+		pid = lod_intern_find_(context, predicate, strlen(predicate));
+	}
+	ids = NULL;
+	count = size = 0;
+	if(librdf_node_is_resource(instance->subject) &&
+	   lod_index_ready_(context, model, LODI_INCOMING))
+	{
+		/* Every subject and predicate of an indexed edge is interned */
+		oid = lod_intern_node_id_(context, instance->subject, 0);
+		if(oid == LOD_NOTERM || (predicate && pid == LOD_NOTERM))
+		{
+			return 0;
+		}
+		edges = &(context->index.incoming);
+		for(e = lod_edges_first_(edges, oid); e != LOD_NOEDGE; e = edges->edges[e].next)
+		{
+			if(pid != LOD_NOTERM && edges->edges[e].label != pid)
+			{
+				continue;
+			}
+			if(lod_termids_append_(&ids, &count, &size, edges->edges[e].from))
+			{
+				lod_set_error_(context, strerror(errno));
+				free(ids);
+				return -1;
+			}
+		}
+		return lod_termids_uris_(context, ids, count, uris, max);
+	}
+	/* Query the model for statements with the instance as their object */
+	object = librdf_new_node_from_node(instance->subject);
+	if(!object)
+	{
+		state->error = 1;
+		return -1;
+	}
+	pnode = NULL;
+	if(predicate)
+	{
+		pnode = lod_intern_probe_(context, predicate);
+		if(!pnode)
+		{
+			librdf_free_node(object);
+			return -1;
+		}
+	}
+	query = librdf_new_statement_from_nodes(world, NULL, pnode, object);
+	if(!query)
+	{
+		lod_set_error_(context, "failed to create librdf query statement");
+		return -1;
+	}
+	stream = librdf_model_find_statements(model, query);
+	if(!stream)
+	{
+		librdf_free_statement(query);
+		state->error = 1;
+		return -1;
+	}
+	for(; !librdf_stream_end(stream); librdf_stream_next(stream))
+	{
+		oid = lod_intern_node_id_(context, librdf_statement_get_subject(librdf_stream_get_object(stream)), 1);
+		if(oid == LOD_NOTERM)
+		{
+			continue;
+		}
+		if(lod_termids_append_(&ids, &count, &size, oid))
+		{
+			lod_set_error_(context, strerror(errno));
+			break;
+		}
+	}
+	librdf_free_stream(stream);
+	librdf_free_statement(query);
+	if(state->error)
+	{
+		free(ids);
+		return -1;
+	}
+	return lod_termids_uris_(context, ids, count, uris, max);
+}
+
+/* Create an instance representing an interned URI */
+LODINSTANCE *
+lod_instance_from_term_(LODCONTEXT *context, LODTERMID id)
 {
 	LODINSTANCE *inst;
+	librdf_world *world;
+	librdf_node *node;
+	librdf_statement *query;
+
+	world = lod_world(context);
+	if(!world)
+	{
+		return NULL;
+	}
+	node = lod_intern_node_(context, id);
+	if(!node)
+	{
+		return NULL;
+	}
+	node = librdf_new_node_from_node(node);
+	if(!node)
+	{
+		lod_set_error_(context, "failed to create librdf URI node");
+		return NULL;
+	}
+	query = librdf_new_statement_from_nodes(world, node, NULL, NULL);
+	/* Note: node becomes owned by the statement, and freed upon error */
+	if(!query)
+	{
+		lod_set_error_(context, "failed to create librdf query statement");
+		return NULL;
+	}
+	inst = lod_instance_create_(context, query, node);
+	if(!inst)
+	{
+		librdf_free_statement(query);
+		return NULL;
+	}
+	return inst;
+}
+
+/* Append to a list of term identifiers the URIs which the model relates
+ * to a node via a well-known predicate: its objects, or if inbound is set,
+ * the subjects which refer to it. The list may contain duplicates. This is
+ * the fallback used when the corresponding index is not available.
+ */
+int
+lod_model_related_(LODCONTEXT *context, librdf_model *model, librdf_node *node, LODTERMID predicate, int inbound, LODTERMID **ids, size_t *count, size_t *size)
+{
+	LODSTATE *state;
+	librdf_world *world;
+	librdf_node *subject, *pnode, *object;
+	librdf_statement *query, *triple;
+	librdf_stream *stream;
+	LODTERMID id;
+
+	state = lod_state_(context);
+	world = lod_world(context);
+	if(!world)
+	{
+		return -1;
+	}
+	pnode = lod_intern_node_(context, predicate);
+	if(!pnode)
+	{
+		return -1;
+	}
+	pnode = librdf_new_node_from_node(pnode);
+	node = librdf_new_node_from_node(node);
+	if(!pnode || !node)
+	{
+		if(pnode)
+		{
+			librdf_free_node(pnode);
+		}
+		if(node)
+		{
+			librdf_free_node(node);
+		}
+		lod_set_error_(context, "failed to create librdf node");
+		return -1;
+	}
+	subject = inbound ? NULL : node;
+	object = inbound ? node : NULL;
+	query = librdf_new_statement_from_nodes(world, subject, pnode, object);
+	if(!query)
+	{
+		lod_set_error_(context, "failed to create librdf query statement");
+		return -1;
+	}
+	stream = librdf_model_find_statements(model, query);
+	if(!stream)
+	{
+		librdf_free_statement(query);
+		state->error = 1;
+		return -1;
+	}
+	for(; !librdf_stream_end(stream); librdf_stream_next(stream))
+	{
+		triple = librdf_stream_get_object(stream);
+		/* Terms found in the model are interned, as the indexes would */
+		id = lod_intern_node_id_(context, inbound ? librdf_statement_get_subject(triple) : librdf_statement_get_object(triple), 1);
+		if(id == LOD_NOTERM)
+		{
+			continue;
+		}
+		if(lod_termids_append_(ids, count, size, id))
+		{
+			lod_set_error_(context, strerror(errno));
+			break;
+		}
+	}
+	librdf_free_stream(stream);
+	librdf_free_statement(query);
+	return state->error ? -1 : 0;
+}
+
+/* Follow a predicate from an instance to the first of its objects which is
+ * a subject within the model, using the pointer index if possible
+ */
+static LODINSTANCE *
+lod_instance_follow_(LODINSTANCE *instance, const char *predicate)
+{
+	LODINSTANCE *inst;
+	LODCONTEXT *context;
+	LODEDGES *edges;
+	LODTERMID sid;
+	uint32_t e;
 	librdf_model *model;
 	librdf_world *world;
-	librdf_node *subject, *predicate, *object, *onode;
-	librdf_statement *query, *oquery, *triple;
+	librdf_node *subject, *pnode, *object, *onode;
+	LODTERMID pid;
+	librdf_statement *query, *oquery, *triple, *bestquery;
 	librdf_stream *result, *oresult;
+	librdf_node *bestnode;
+	LODTERMID to, best;
+	const char *str, *beststr;
 
-	instance->context->error = 0;	
+	context = instance->context;
 	inst = NULL;
-	world = lod_world(instance->context);
+	world = lod_world(context);
 	if(!world)
 	{
 		return NULL;
 	}
-	model = lod_model(instance->context);
+	model = lod_model(context);
 	if(!model)
 	{
 		return NULL;
 	}
+	/* The pointer predicates are interned when they're configured */
+	pid = lod_intern_find_(context, predicate, strlen(predicate));
+	if(pid != LOD_NOTERM && lod_index_pointer_(context, model, pid))
+	{
+		sid = lod_intern_node_id_(context, instance->subject, 0);
+		if(sid == LOD_NOTERM)
+		{
+			return NULL;
+		}
+		edges = &(context->index.pointer_edges);
+		best = LOD_NOTERM;
+		for(e = lod_edges_first_(edges, sid); e != LOD_NOEDGE; e = edges->edges[e].next)
+		{
+			to = edges->edges[e].to;
+			if(edges->edges[e].label == pid &&
+			   (context->intern.terms[to].flags & LODTERM_SUBJECT) &&
+			   (best == LOD_NOTERM || strcmp(context->intern.terms[to].str, context->intern.terms[best].str) < 0))
+			{
+				best = to;
+			}
+		}
+		if(best == LOD_NOTERM)
+		{
+			return NULL;
+		}
+		return lod_instance_from_term_(context, best);
+	}
 	subject = librdf_new_node_from_node(instance->subject);
 	if(!subject)
 	{
-		instance->context->error = 1;
+		lod_state_(context)->error = 1;
 		return NULL;
 	}
-	predicate = librdf_new_node_from_uri_string(world, (const unsigned char *) "http://xmlns.com/foaf/0.1/primaryTopic");
-	query = librdf_new_statement_from_nodes(world, subject, predicate, NULL);
+	pnode = lod_intern_probe_(context, predicate);
+	if(!pnode)
+	{
+		librdf_free_node(subject);
+		return NULL;
+	}
+	query = librdf_new_statement_from_nodes(world, subject, pnode, NULL);
 	result = librdf_model_find_statements(model, query);
+	bestquery = NULL;
+	bestnode = NULL;
+	beststr = NULL;
 	while(!librdf_stream_end(result))
 	{
 		triple = librdf_stream_get_object(result);
 		object = librdf_statement_get_object(triple);
+		/* Only named targets are followed, and of those, the one whose
+		 * URI sorts first, so that the answer is the same as that given
+		 * by the index, whatever order the storage returns triples in
+		 */
+		if(!librdf_node_is_resource(object))
+		{
+			librdf_stream_next(result);
+			continue;
+		}
+		str = (const char *) librdf_uri_as_string(librdf_node_get_uri(object));
+		if(beststr && strcmp(str, beststr) >= 0)
+		{
+			librdf_stream_next(result);
+			continue;
+		}
 		/* Now there's an object, query the model again to see if there are
 		 * any matching triples with it as a subject
 		 */
@@ -147,18 +581,372 @@ lod_instance_primarytopic(LODINSTANCE *instance)
 		oresult = librdf_model_find_statements(model, oquery);
 		if(!librdf_stream_end(oresult))
 		{
-			/* A match was found: create a new LODINSTANCE representing
-			 * the query and return it.
-			 */
-			librdf_free_stream(oresult);
-			inst = lod_instance_create_(instance->context, oquery, onode);
-			break;
+			/* A match was found: keep it until a better one turns up */
+			if(bestquery)
+			{
+				librdf_free_statement(bestquery);
+			}
+			bestquery = oquery;
+			bestnode = onode;
+			beststr = (const char *) librdf_uri_as_string(librdf_node_get_uri(onode));
+		}
+		else
+		{
+			librdf_free_statement(oquery);
 		}
 		librdf_free_stream(oresult);
-		librdf_free_statement(oquery);
 		librdf_stream_next(result);
 	}
+	if(bestquery)
+	{
+		/* Create a new LODINSTANCE representing the query */
+		inst = lod_instance_create_(context, bestquery, bestnode);
+		if(!inst)
+		{
+			librdf_free_statement(bestquery);
+		}
+	}
 	librdf_free_stream(result);
 	librdf_free_statement(query);
 	return inst;
 }
+
+/* Return the first object of a property of the instance */
+librdf_node *
+lod_instance_get(LODINSTANCE *instance, const char *predicate)
+{
+	LODCONTEXT *context;
+	librdf_node *r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_get_locked_(instance, predicate);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_get(), with the context lock held */
+static librdf_node *
+lod_instance_get_locked_(LODINSTANCE *instance, const char *predicate)
+{
+	librdf_node **objects;
+	size_t count;
+
+	objects = lod_instance_range_(instance, predicate, &count);
+	if(!count)
+	{
+		return NULL;
+	}
+	return objects[0];
+}
+
+/* Obtain all of the objects of a property of the instance */
+librdf_node *const *
+lod_instance_get_all(LODINSTANCE *instance, const char *predicate, size_t *count)
+{
+	LODCONTEXT *context;
+	librdf_node *const *r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_get_all_locked_(instance, predicate, count);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_get_all(), with the context lock held */
+static librdf_node *const *
+lod_instance_get_all_locked_(LODINSTANCE *instance, const char *predicate, size_t *count)
+{
+	return lod_instance_range_(instance, predicate, count);
+}
+
+/* Return the number of objects of a property of the instance */
+long
+lod_instance_count(LODINSTANCE *instance, const char *predicate)
+{
+	LODCONTEXT *context;
+	long r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_count_locked_(instance, predicate);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_count(), with the context lock held */
+static long
+lod_instance_count_locked_(LODINSTANCE *instance, const char *predicate)
+{
+	size_t count;
+
+	lod_instance_range_(instance, predicate, &count);
+	if(lod_state_(instance->context)->error)
+	{
+		return -1;
+	}
+	return (long) count;
+}
+
+/* Invoke a callback for each triple whose subject is the instance */
+int
+lod_instance_foreach(LODINSTANCE *instance, LODTRIPLECB fn, void *userdata)
+{
+	LODCONTEXT *context;
+	int r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_foreach_locked_(instance, fn, userdata);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_foreach(), with the context lock held */
+static int
+lod_instance_foreach_locked_(LODINSTANCE *instance, LODTRIPLECB fn, void *userdata)
+{
+	return lod_instance_foreach_predicate(instance, NULL, fn, userdata);
+}
+
+/* Invoke a callback for each triple with the supplied predicate whose
+ * subject is the instance (or all triples, if predicate is NULL). This
+ * walks the materialised property arrays, and so the only per-triple work
+ * is the callback itself.
+ */
+int
+lod_instance_foreach_predicate(LODINSTANCE *instance, const char *predicate, LODTRIPLECB fn, void *userdata)
+{
+	LODCONTEXT *context;
+	int r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_foreach_predicate_locked_(instance, predicate, fn, userdata);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_foreach_predicate(), with the context lock held */
+static int
+lod_instance_foreach_predicate_locked_(LODINSTANCE *instance, const char *predicate, LODTRIPLECB fn, void *userdata)
+{
+	librdf_node **objects, *pnode;
+	LODTERMID *preds, pred;
+	size_t count, c;
+	int r;
+
+	objects = lod_instance_range_(instance, predicate, &count);
+	if(lod_state_(instance->context)->error)
+	{
+		return -1;
+	}
+	if(!count)
+	{
+		return 0;
+	}
+	preds = &(instance->predicates[objects - instance->objects]);
+	pnode = NULL;
+	pred = LOD_NOTERM;
+	for(c = 0; c < count; c++)
+	{
+		if(preds[c] != pred)
+		{
+			pred = preds[c];
+			pnode = lod_intern_node_(instance->context, pred);
+			if(!pnode)
+			{
+				return -1;
+			}
+		}
+		if((r = fn(instance, pnode, objects[c], userdata)))
+		{
+			return r;
+		}
+	}
+	return 0;
+}
+
+/* Locate the range of the materialised property arrays holding the
+ * objects of the supplied predicate (or the whole array, if predicate is
+ * NULL)
+ */
+static librdf_node **
+lod_instance_range_(LODINSTANCE *instance, const char *predicate, size_t *count)
+{
+	LODTERMID id;
+	size_t lo, hi, mid, start;
+
+	lod_state_(instance->context)->error = 0;
+	*count = 0;
+	if(lod_instance_props_(instance))
+	{
+		return NULL;
+	}
+	if(!predicate)
+	{
+		*count = instance->nprops;
+		return instance->objects;
+	}
+	/* A predicate which has never been interned can't be present */
+	id = lod_intern_find_(instance->context, predicate, strlen(predicate));
+	if(id == LOD_NOTERM)
+	{
+		return NULL;
+	}
+	lo = 0;
+	hi = instance->nprops;
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if(instance->predicates[mid] < id)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	start = lo;
+	while(lo < instance->nprops && instance->predicates[lo] == id)
+	{
+		lo++;
+	}
+	*count = lo - start;
+	return &(instance->objects[start]);
+}
+
+/* Materialise the properties of the instance, if they haven't been
+ * already or the model has changed since they were
+ */
+static int
+lod_instance_props_(LODINSTANCE *instance)
+{
+	librdf_model *model;
+	librdf_stream *stream;
+	librdf_statement *st;
+	librdf_node *node;
+	LODTERMID id;
+	LODPROP *props, *p;
+	size_t nprops, size, c;
+	unsigned long generation;
+
+	model = lod_model(instance->context);
+	if(!model)
+	{
+		return -1;
+	}
+	generation = lod_generation_(instance->context, model);
+	if(generation == instance->props_generation)
+	{
+		return 0;
+	}
+	lod_instance_free_props_(instance);
+	stream = librdf_model_find_statements(model, instance->query);
+	if(!stream)
+	{
+		lod_state_(instance->context)->error = 1;
+		return -1;
+	}
+	props = NULL;
+	nprops = size = 0;
+	for(; !librdf_stream_end(stream); librdf_stream_next(stream))
+	{
+		st = librdf_stream_get_object(stream);
+		id = lod_intern_node_id_(instance->context, librdf_statement_get_predicate(st), 1);
+		if(id == LOD_NOTERM)
+		{
+			continue;
+		}
+		if(nprops == size)
+		{
+			size = size ? size * 2 : 16;
+			p = (LODPROP *) realloc(props, size * sizeof(LODPROP));
+			if(!p)
+			{
+				lod_set_error_(instance->context, strerror(errno));
+				break;
+			}
+			props = p;
+		}
+		node = librdf_new_node_from_node(librdf_statement_get_object(st));
+		if(!node)
+		{
+			continue;
+		}
+		props[nprops].predicate = id;
+		props[nprops].seq = nprops;
+		props[nprops].object = node;
+		nprops++;
+	}
+	librdf_free_stream(stream);
+	if(!lod_state_(instance->context)->error && nprops)
+	{
+		/* Order by predicate identifier, keeping the objects of each
+		 * predicate in the order the model returned them
+		 */
+		qsort(props, nprops, sizeof(LODPROP), lod_prop_compare_);
+		instance->predicates = (LODTERMID *) malloc(nprops * sizeof(LODTERMID));
+		instance->objects = (librdf_node **) malloc(nprops * sizeof(librdf_node *));
+		if(!instance->predicates || !instance->objects)
+		{
+			lod_set_error_(instance->context, strerror(errno));
+		}
+	}
+	if(lod_state_(instance->context)->error)
+	{
+		for(c = 0; c < nprops; c++)
+		{
+			librdf_free_node(props[c].object);
+		}
+		free(props);
+		lod_instance_free_props_(instance);
+		return -1;
+	}
+	for(c = 0; c < nprops; c++)
+	{
+		instance->predicates[c] = props[c].predicate;
+		instance->objects[c] = props[c].object;
+	}
+	instance->nprops = nprops;
+	free(props);
+	instance->props_generation = generation;
+	instance->exists = (instance->nprops > 0);
+	instance->exists_generation = generation;
+	return 0;
+}
+
+/* qsort() comparator for properties being materialised */
+static int
+lod_prop_compare_(const void *a, const void *b)
+{
+	const LODPROP *pa, *pb;
+
+	pa = (const LODPROP *) a;
+	pb = (const LODPROP *) b;
+	if(pa->predicate != pb->predicate)
+	{
+		return (pa->predicate > pb->predicate) - (pa->predicate < pb->predicate);
+	}
+	return (pa->seq > pb->seq) - (pa->seq < pb->seq);
+}
+
+/* Discard the materialised properties of an instance */
+static void
+lod_instance_free_props_(LODINSTANCE *instance)
+{
+	size_t c;
+
+	for(c = 0; c < instance->nprops; c++)
+	{
+		librdf_free_node(instance->objects[c]);
+	}
+	free(instance->predicates);
+	free(instance->objects);
+	instance->predicates = NULL;
+	instance->objects = NULL;
+	instance->nprops = 0;
+	instance->props_generation = 0;
+}
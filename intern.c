@@ -0,0 +1,465 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* The interning table maps URI strings to small integer term identifiers,
+ * each of which can have an associated librdf node which is created on
+ * first use and then shared for the lifetime of the context's world. Term
+ * identifiers are stable, and are used as keys by the context's indexes.
+ */
+
+#define INTERN_MINSLOTS                 256
+#define INTERN_MINTERMS                 64
+
+static const char *const lod_wellknown_[LOD_NWELLKNOWN] = {
+	"http://xmlns.com/foaf/0.1/primaryTopic",
+	"http://www.w3.org/2002/07/owl#sameAs",
+	"http://www.w3.org/2004/02/skos/core#prefLabel",
+	"http://www.w3.org/2000/01/rdf-schema#label",
+	"http://schema.org/name",
+	"http://xmlns.com/foaf/0.1/name",
+	"http://purl.org/dc/terms/title",
+	"http://purl.org/dc/elements/1.1/title",
+	"http://www.w3.org/1999/02/22-rdf-syntax-ns#type",
+	"http://www.w3.org/2000/01/rdf-schema#subClassOf",
+};
+
+static int lod_intern_init_(LODCONTEXT *context);
+static int lod_intern_grow_(LODCONTEXT *context);
+static LODTERMID lod_intern_lookup_(LODINTERN *intern, const char *uri, size_t len, uint64_t hash, size_t *slot);
+static int lod_termid_compare_(const void *a, const void *b);
+static librdf_node *lod_node_locked_(LODCONTEXT *context, const char *uri);
+
+/* Obtain the interned librdf node for a URI */
+librdf_node *
+lod_node(LODCONTEXT *context, const char *uri)
+{
+	librdf_node *r;
+
+	lod_lock_(context);
+	r = lod_node_locked_(context, uri);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_node(), with the context lock held */
+static librdf_node *
+lod_node_locked_(LODCONTEXT *context, const char *uri)
+{
+	LODTERMID id;
+
+	lod_state_(context)->error = 0;
+	id = lod_intern_(context, uri, strlen(uri));
+	if(id == LOD_NOTERM)
+	{
+		return NULL;
+	}
+	return lod_intern_node_(context, id);
+}
+
+/* 64-bit FNV-1a */
+uint64_t
+lod_hash_(const char *str, size_t len)
+{
+	uint64_t h;
+	size_t c;
+
+	h = UINT64_C(14695981039346656037);
+	for(c = 0; c < len; c++)
+	{
+		h ^= (unsigned char) str[c];
+		h *= UINT64_C(1099511628211);
+	}
+	return h;
+}
+
+/* Intern a URI, returning its term identifier */
+LODTERMID
+lod_intern_(LODCONTEXT *context, const char *uri, size_t len)
+{
+	LODINTERN *intern;
+	LODTERM *term;
+	LODTERMID id;
+	uint64_t hash;
+	size_t slot;
+
+	intern = &(context->intern);
+	if(!intern->slots && lod_intern_init_(context))
+	{
+		return LOD_NOTERM;
+	}
+	hash = lod_hash_(uri, len);
+	id = lod_intern_lookup_(intern, uri, len, hash, &slot);
+	if(id != LOD_NOTERM)
+	{
+		return id;
+	}
+	if((intern->nterms + 1) * 2 > intern->nslots || intern->nterms == intern->tsize)
+	{
+		if(lod_intern_grow_(context))
+		{
+			return LOD_NOTERM;
+		}
+		lod_intern_lookup_(intern, uri, len, hash, &slot);
+	}
+	term = &(intern->terms[intern->nterms]);
+	term->str = (char *) malloc(len + 1);
+	if(!term->str)
+	{
+		lod_set_error_(context, strerror(errno));
+		return LOD_NOTERM;
+	}
+	memcpy(term->str, uri, len);
+	term->str[len] = 0;
+	term->len = len;
+	term->hash = hash;
+	term->node = NULL;
+	term->flags = 0;
+	id = (LODTERMID) intern->nterms;
+	intern->slots[slot] = id;
+	intern->nterms++;
+	return id;
+}
+
+/* Look up a URI in the interning table without adding it */
+LODTERMID
+lod_intern_find_(LODCONTEXT *context, const char *uri, size_t len)
+{
+	size_t slot;
+
+	if(!context->intern.slots)
+	{
+		return LOD_NOTERM;
+	}
+	return lod_intern_lookup_(&(context->intern), uri, len, lod_hash_(uri, len), &slot);
+}
+
+/* Obtain the term identifier for a URI node, optionally interning it;
+ * blank nodes and literals are never interned
+ */
+LODTERMID
+lod_intern_node_id_(LODCONTEXT *context, librdf_node *node, int create)
+{
+	librdf_uri *uri;
+	const char *str;
+	size_t len;
+
+	if(!node || !librdf_node_is_resource(node))
+	{
+		return LOD_NOTERM;
+	}
+	uri = librdf_node_get_uri(node);
+	str = (const char *) librdf_uri_as_counted_string(uri, &len);
+	if(create)
+	{
+		return lod_intern_(context, str, len);
+	}
+	return lod_intern_find_(context, str, len);
+}
+
+/* Obtain the (borrowed) librdf node for an interned term, creating it if
+ * needed
+ */
+librdf_node *
+lod_intern_node_(LODCONTEXT *context, LODTERMID id)
+{
+	LODTERM *term;
+	librdf_world *world;
+
+	/* The well-known terms may be requested before anything else has
+	 * been interned
+	 */
+	if(!context->intern.slots && lod_intern_init_(context))
+	{
+		return NULL;
+	}
+	term = &(context->intern.terms[id]);
+	if(term->node)
+	{
+		return term->node;
+	}
+	world = lod_world(context);
+	if(!world)
+	{
+		return NULL;
+	}
+	term->node = librdf_new_node_from_uri_string(world, (const unsigned char *) term->str);
+	if(!term->node)
+	{
+		lod_set_error_(context, "failed to create librdf URI node");
+		return NULL;
+	}
+	return term->node;
+}
+
+/* Obtain a new reference to the interned node for a URI, which must be
+ * freed by the caller (or passed to something which takes ownership of it)
+ */
+librdf_node *
+lod_intern_copy_(LODCONTEXT *context, const char *uri)
+{
+	LODTERMID id;
+	librdf_node *node;
+
+	id = lod_intern_(context, uri, strlen(uri));
+	if(id == LOD_NOTERM)
+	{
+		return NULL;
+	}
+	node = lod_intern_node_(context, id);
+	if(!node)
+	{
+		return NULL;
+	}
+	return librdf_new_node_from_node(node);
+}
+
+/* Return the URI of a well-known term */
+const char *
+lod_wellknown_uri_(LODTERMID id)
+{
+	return lod_wellknown_[id];
+}
+
+/* Obtain a new reference to a node for a URI, which must be freed by the
+ * caller, without interning it: the interned node is used if there is one,
+ * otherwise a temporary node is created. Lookups use this, so that the
+ * table doesn't grow with every URI which is merely queried.
+ */
+librdf_node *
+lod_intern_probe_(LODCONTEXT *context, const char *uri)
+{
+	LODTERMID id;
+	librdf_node *node;
+	librdf_world *world;
+
+	id = lod_intern_find_(context, uri, strlen(uri));
+	if(id != LOD_NOTERM)
+	{
+		node = lod_intern_node_(context, id);
+		if(!node)
+		{
+			return NULL;
+		}
+		return librdf_new_node_from_node(node);
+	}
+	world = lod_world(context);
+	if(!world)
+	{
+		return NULL;
+	}
+	node = librdf_new_node_from_uri_string(world, (const unsigned char *) uri);
+	if(!node)
+	{
+		lod_set_error_(context, "failed to create librdf URI node");
+	}
+	return node;
+}
+
+/* Discard the interning table; this must happen before the librdf world
+ * the nodes belong to is freed
+ */
+void
+lod_intern_reset_(LODCONTEXT *context)
+{
+	LODINTERN *intern;
+	size_t c;
+
+	intern = &(context->intern);
+	for(c = 0; c < intern->nterms; c++)
+	{
+		free(intern->terms[c].str);
+		if(intern->terms[c].node)
+		{
+			librdf_free_node(intern->terms[c].node);
+		}
+	}
+	free(intern->terms);
+	free(intern->slots);
+	memset(intern, 0, sizeof(LODINTERN));
+}
+
+/* Append a term identifier to a dynamically-allocated array */
+int
+lod_termids_append_(LODTERMID **ids, size_t *count, size_t *size, LODTERMID id)
+{
+	LODTERMID *p;
+
+	if(*count == *size)
+	{
+		p = (LODTERMID *) realloc(*ids, (*size ? *size * 2 : 16) * sizeof(LODTERMID));
+		if(!p)
+		{
+			return -1;
+		}
+		*ids = p;
+		*size = *size ? *size * 2 : 16;
+	}
+	(*ids)[*count] = id;
+	(*count)++;
+	return 0;
+}
+
+/* Store the URIs of a set of terms, eliminating duplicates, and free the
+ * set; returns the number of distinct terms
+ */
+long
+lod_termids_uris_(LODCONTEXT *context, LODTERMID *ids, size_t count, const char **uris, size_t max)
+{
+	size_t c, n;
+
+	if(count > 1)
+	{
+		qsort(ids, count, sizeof(LODTERMID), lod_termid_compare_);
+	}
+	for(c = n = 0; c < count; c++)
+	{
+		if(c && ids[c] == ids[c - 1])
+		{
+			continue;
+		}
+		if(n < max)
+		{
+			uris[n] = context->intern.terms[ids[c]].str;
+		}
+		n++;
+	}
+	free(ids);
+	return (long) n;
+}
+
+/* Allocate an empty table and populate it with the well-known URIs, so
+ * that their identifiers are the LODWELLKNOWN values
+ */
+static int
+lod_intern_init_(LODCONTEXT *context)
+{
+	LODINTERN *intern;
+	size_t c;
+
+	intern = &(context->intern);
+	intern->slots = (LODTERMID *) malloc(INTERN_MINSLOTS * sizeof(LODTERMID));
+	intern->terms = (LODTERM *) calloc(INTERN_MINTERMS, sizeof(LODTERM));
+	if(!intern->slots || !intern->terms)
+	{
+		lod_set_error_(context, strerror(errno));
+		free(intern->slots);
+		free(intern->terms);
+		memset(intern, 0, sizeof(LODINTERN));
+		return -1;
+	}
+	memset(intern->slots, 0xff, INTERN_MINSLOTS * sizeof(LODTERMID));
+	intern->nslots = INTERN_MINSLOTS;
+	intern->tsize = INTERN_MINTERMS;
+	for(c = 0; c < LOD_NWELLKNOWN; c++)
+	{
+		if(lod_intern_(context, lod_wellknown_[c], strlen(lod_wellknown_[c])) != (LODTERMID) c)
+		{
+			lod_intern_reset_(context);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Double the size of the term array and (if needed) the hash */
+static int
+lod_intern_grow_(LODCONTEXT *context)
+{
+	LODINTERN *intern;
+	LODTERMID *slots;
+	LODTERM *terms;
+	size_t c, nslots, slot;
+
+	intern = &(context->intern);
+	if(intern->nterms == intern->tsize)
+	{
+		terms = (LODTERM *) realloc(intern->terms, intern->tsize * 2 * sizeof(LODTERM));
+		if(!terms)
+		{
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+		intern->terms = terms;
+		intern->tsize *= 2;
+	}
+	if((intern->nterms + 1) * 2 <= intern->nslots)
+	{
+		return 0;
+	}
+	nslots = intern->nslots * 2;
+	slots = (LODTERMID *) malloc(nslots * sizeof(LODTERMID));
+	if(!slots)
+	{
+		lod_set_error_(context, strerror(errno));
+		return -1;
+	}
+	memset(slots, 0xff, nslots * sizeof(LODTERMID));
+	for(c = 0; c < intern->nterms; c++)
+	{
+		slot = (size_t) (intern->terms[c].hash & (nslots - 1));
+		while(slots[slot] != LOD_NOTERM)
+		{
+			slot = (slot + 1) & (nslots - 1);
+		}
+		slots[slot] = (LODTERMID) c;
+	}
+	free(intern->slots);
+	intern->slots = slots;
+	intern->nslots = nslots;
+	return 0;
+}
+
+/* Locate a URI in the hash, returning its identifier if present; *slot
+ * is set to the slot it occupies, or the empty slot it would occupy
+ */
+static LODTERMID
+lod_intern_lookup_(LODINTERN *intern, const char *uri, size_t len, uint64_t hash, size_t *slot)
+{
+	LODTERM *term;
+	size_t s;
+
+	s = (size_t) (hash & (intern->nslots - 1));
+	while(intern->slots[s] != LOD_NOTERM)
+	{
+		term = &(intern->terms[intern->slots[s]]);
+		if(term->hash == hash && term->len == len && !memcmp(term->str, uri, len))
+		{
+			*slot = s;
+			return intern->slots[s];
+		}
+		s = (s + 1) & (intern->nslots - 1);
+	}
+	*slot = s;
+	return LOD_NOTERM;
+}
+
+/* qsort() comparator for term identifiers */
+static int
+lod_termid_compare_(const void *a, const void *b)
+{
+	LODTERMID ia, ib;
+
+	ia = *(const LODTERMID *) a;
+	ib = *(const LODTERMID *) b;
+	return (ia > ib) - (ia < ib);
+}
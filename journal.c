@@ -0,0 +1,915 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* The journal is a sequence of self-describing records, each holding the
+ * statements parsed from one document (as N-Quads) along with the
+ * document's metadata. Records are appended with a single write() and
+ * carry a checksum, so that an incomplete record left by a crash is
+ * detected (and discarded) when the journal is next opened or replayed.
+ *
+ * Compaction copies the most recent record for each document into a new
+ * file; records appended while this is happening are copied across at the
+ * end, with the journal's lock held, before the new file replaces the old.
+ */
+
+#define JOURNAL_MINBUF                  16384
+#define JOURNAL_MINDOCS                 64
+/* Journals smaller than this are never compacted automatically */
+#define JOURNAL_COMPACTMIN              (1024 * 1024)
+
+static int lod_journal_term_(LODJOURNAL *journal, librdf_node *node);
+static int lod_journal_escape_(LODJOURNAL *journal, const char *str, size_t len, int uri);
+static int lod_journal_append_(LODJOURNAL *journal, const char *str, size_t len);
+static int lod_journal_read_(int fd, off_t offset, off_t size, LODJOURNALHEADER *header, char **body, size_t *bodylen);
+static int lod_journal_write_(int fd, const char *buf, size_t len);
+static int lod_journal_copy_(int from, int to, off_t offset, off_t length);
+static int lod_journal_spawn_(LODJOURNAL *journal);
+static void *lod_journal_thread_(void *arg);
+static int lod_journal_compact_(LODJOURNAL *journal);
+static LODJOURNALDOC *lod_journal_doc_(LODJOURNALDOC **docs, size_t *ndocs, size_t *nslots, const char *uri, size_t len);
+static int lod_set_journal_locked_(LODCONTEXT *context, const char *path, unsigned int flags);
+static int lod_journal_replay_locked_(LODCONTEXT *context, const char *path);
+static int lod_journal_compact_locked_(LODCONTEXT *context);
+
+/* Begin journalling each document processed by the context */
+int
+lod_set_journal(LODCONTEXT *context, const char *path, unsigned int flags)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_journal_locked_(context, path, flags);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_journal(), with the context lock held */
+static int
+lod_set_journal_locked_(LODCONTEXT *context, const char *path, unsigned int flags)
+{
+	LODJOURNAL *journal;
+	LODJOURNALHEADER header;
+	struct stat sbuf;
+	size_t bodylen;
+	off_t end;
+	int fd, r;
+
+	lod_state_(context)->error = 0;
+	journal = &(context->journal);
+	lod_journal_close_(context);
+	if(!path)
+	{
+		return 0;
+	}
+	fd = open(path, O_RDWR|O_CREAT|O_APPEND, 0666);
+	if(fd == -1 || fstat(fd, &sbuf))
+	{
+		lod_set_error_(context, strerror(errno));
+		if(fd != -1)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	/* Find the end of the last complete record, and discard anything
+	 * beyond it so that new records aren't appended after a damaged one;
+	 * if the journal can't be read, though, nothing is discarded
+	 */
+	journal->seq = 0;
+	for(end = 0; (r = lod_journal_read_(fd, end, sbuf.st_size, &header, NULL, &bodylen)) == 1;)
+	{
+		end += sizeof(LODJOURNALHEADER) + bodylen;
+		if(header.seq > journal->seq)
+		{
+			journal->seq = header.seq;
+		}
+	}
+	if(r < 0)
+	{
+		lod_set_error_(context, "failed to read journal");
+		close(fd);
+		return -1;
+	}
+	if(end != sbuf.st_size && ftruncate(fd, end))
+	{
+		lod_set_error_(context, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	journal->path = strdup(path);
+	if(!journal->path || pthread_mutex_init(&(journal->lock), NULL))
+	{
+		lod_set_error_(context, "failed to initialise journal");
+		free(journal->path);
+		journal->path = NULL;
+		close(fd);
+		return -1;
+	}
+	journal->lock_init = 1;
+	journal->fd = fd;
+	journal->flags = flags;
+	journal->compacted = end;
+	return 0;
+}
+
+/* Add the contents of a journal to the context's model */
+int
+lod_journal_replay(LODCONTEXT *context, const char *path)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_journal_replay_locked_(context, path);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_journal_replay(), with the context lock held */
+static int
+lod_journal_replay_locked_(LODCONTEXT *context, const char *path)
+{
+	LODJOURNALHEADER header;
+	struct stat sbuf;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *base;
+	librdf_stream *stream;
+	char *body, *raw, *uri, *etag, *redirects, *data;
+	size_t bodylen;
+	off_t offset;
+	int fd, r, rr;
+#ifdef HAVE_ZLIB_H
+	uLongf rawlen;
+#endif
+
+	lod_state_(context)->error = 0;
+	world = lod_world(context);
+	if(!world)
+	{
+		return -1;
+	}
+	model = lod_model(context);
+	if(!model)
+	{
+		return -1;
+	}
+	fd = open(path, O_RDONLY);
+	if(fd == -1 || fstat(fd, &sbuf))
+	{
+		lod_set_error_(context, strerror(errno));
+		if(fd != -1)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	parser = librdf_new_parser(world, "nquads", NULL, NULL);
+	if(!parser)
+	{
+		lod_set_error_(context, "failed to create RDF parser");
+		close(fd);
+		return -1;
+	}
+	r = 0;
+	for(offset = 0; !r && (rr = lod_journal_read_(fd, offset, sbuf.st_size, &header, &body, &bodylen)) == 1; offset += sizeof(LODJOURNALHEADER) + bodylen)
+	{
+		uri = strndup(body, header.urilen);
+		etag = header.etaglen ? strndup(body + header.urilen, header.etaglen) : NULL;
+		redirects = header.redirectslen ? strndup(body + header.urilen + header.etaglen, header.redirectslen) : NULL;
+		data = body + header.urilen + header.etaglen + header.redirectslen;
+		raw = NULL;
+		if(!uri || (header.etaglen && !etag) || (header.redirectslen && !redirects))
+		{
+			lod_set_error_(context, strerror(errno));
+			r = -1;
+		}
+		else if(header.flags & LODJREC_DEFLATE)
+		{
+#ifdef HAVE_ZLIB_H
+			rawlen = header.rawlen;
+			raw = (char *) malloc(rawlen + 1);
+			if(!raw || uncompress((Bytef *) raw, &rawlen, (const Bytef *) data, header.datalen) != Z_OK || rawlen != header.rawlen)
+			{
+				lod_set_error_(context, "failed to decompress journal record");
+				r = -1;
+			}
+			data = raw;
+#else
+			lod_set_error_(context, "journal record is compressed, but liblod was built without zlib");
+			r = -1;
+#endif
+		}
+		if(!r && header.rawlen)
+		{
+			base = librdf_new_uri(world, (const unsigned char *) uri);
+			stream = base ? librdf_parser_parse_counted_string_as_stream(parser, (const unsigned char *) data, header.rawlen, base) : NULL;
+			if(stream)
+			{
+				/* The statements are already in the journal */
+				context->journal.replaying = 1;
+				r = lod_model_add_stream_(context, model, stream);
+				context->journal.replaying = 0;
+				librdf_free_stream(stream);
+			}
+			else
+			{
+				lod_set_error_(context, "failed to parse journal record");
+				r = -1;
+			}
+			if(base)
+			{
+				librdf_free_uri(base);
+			}
+		}
+		if(!r)
+		{
+			r = lod_document_record_(context, uri, (time_t) header.fetched, etag, redirects);
+		}
+		free(raw);
+		free(uri);
+		free(etag);
+		free(redirects);
+		free(body);
+	}
+	if(!r && rr < 0)
+	{
+		lod_set_error_(context, "failed to read journal");
+		r = -1;
+	}
+	librdf_free_parser(parser);
+	close(fd);
+	return r;
+}
+
+/* Compact the context's journal */
+int
+lod_journal_compact(LODCONTEXT *context)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_journal_compact_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_journal_compact(), with the context lock held */
+static int
+lod_journal_compact_locked_(LODCONTEXT *context)
+{
+	LODJOURNAL *journal;
+
+	lod_state_(context)->error = 0;
+	journal = &(context->journal);
+	if(!journal->path)
+	{
+		lod_set_error_(context, "no journal has been opened");
+		return -1;
+	}
+	/* Wait for any background compaction to finish first */
+	if(journal->thread_started)
+	{
+		pthread_join(journal->thread, NULL);
+		journal->thread_started = 0;
+	}
+	if(lod_journal_compact_(journal))
+	{
+		lod_set_error_(context, "failed to compact journal");
+		return -1;
+	}
+	return 0;
+}
+
+/* Begin collecting the statements of a document */
+void
+lod_journal_begin_(LODCONTEXT *context)
+{
+	context->journal.len = 0;
+	context->journal.seq++;
+}
+
+/* Add a statement to the document being collected, in N-Quads form */
+int
+lod_journal_statement_(LODCONTEXT *context, librdf_statement *statement)
+{
+	LODJOURNAL *journal;
+
+	journal = &(context->journal);
+	if(lod_journal_term_(journal, librdf_statement_get_subject(statement)) ||
+	   lod_journal_append_(journal, " ", 1) ||
+	   lod_journal_term_(journal, librdf_statement_get_predicate(statement)) ||
+	   lod_journal_append_(journal, " ", 1) ||
+	   lod_journal_term_(journal, librdf_statement_get_object(statement)) ||
+	   lod_journal_append_(journal, " .\n", 3))
+	{
+		lod_set_error_(context, "failed to add statement to journal");
+		return -1;
+	}
+	return 0;
+}
+
+/* Append the collected document to the journal */
+int
+lod_journal_commit_(LODCONTEXT *context, const char *uri, time_t fetched, const char *etag, const char *redirects)
+{
+	LODJOURNAL *journal;
+	LODJOURNALHEADER header;
+	const char *data;
+	char *record, *p, *zbuf;
+	size_t bodylen;
+	off_t size, compacted;
+	int r;
+#ifdef HAVE_ZLIB_H
+	uLongf zlen;
+#endif
+
+	journal = &(context->journal);
+	if(!journal->path || journal->replaying)
+	{
+		return 0;
+	}
+	memset(&header, 0, sizeof(LODJOURNALHEADER));
+	memcpy(header.magic, LODJ_MAGIC, 4);
+	header.fetched = (uint64_t) fetched;
+	header.urilen = (uint32_t) strlen(uri);
+	header.etaglen = etag ? (uint32_t) strlen(etag) : 0;
+	header.redirectslen = redirects ? (uint32_t) strlen(redirects) : 0;
+	header.rawlen = (uint32_t) journal->len;
+	header.datalen = (uint32_t) journal->len;
+	header.seq = journal->seq;
+	if(journal->len > UINT32_MAX)
+	{
+		lod_set_error_(context, "document is too large to be journalled");
+		return -1;
+	}
+	data = journal->buf;
+	zbuf = NULL;
+#ifdef HAVE_ZLIB_H
+	if((journal->flags & LODJ_COMPRESS) && journal->len)
+	{
+		zlen = compressBound(journal->len);
+		zbuf = (char *) malloc(zlen);
+		if(zbuf && compress2((Bytef *) zbuf, &zlen, (const Bytef *) journal->buf, journal->len, Z_DEFAULT_COMPRESSION) == Z_OK &&
+		   zlen < journal->len)
+		{
+			data = zbuf;
+			header.datalen = (uint32_t) zlen;
+			header.flags |= LODJREC_DEFLATE;
+		}
+	}
+#endif
+	bodylen = (size_t) header.urilen + header.etaglen + header.redirectslen + header.datalen;
+	record = (char *) malloc(sizeof(LODJOURNALHEADER) + bodylen);
+	if(!record)
+	{
+		lod_set_error_(context, strerror(errno));
+		free(zbuf);
+		return -1;
+	}
+	p = record + sizeof(LODJOURNALHEADER);
+	memcpy(p, uri, header.urilen);
+	p += header.urilen;
+	if(header.etaglen)
+	{
+		memcpy(p, etag, header.etaglen);
+		p += header.etaglen;
+	}
+	if(header.redirectslen)
+	{
+		memcpy(p, redirects, header.redirectslen);
+		p += header.redirectslen;
+	}
+	if(header.datalen)
+	{
+		memcpy(p, data, header.datalen);
+	}
+	header.check = lod_hash_(record + sizeof(LODJOURNALHEADER), bodylen);
+	memcpy(record, &header, sizeof(LODJOURNALHEADER));
+	pthread_mutex_lock(&(journal->lock));
+	r = lod_journal_write_(journal->fd, record, sizeof(LODJOURNALHEADER) + bodylen);
+	if(!r && (journal->flags & LODJ_SYNC))
+	{
+		r = fsync(journal->fd);
+	}
+	size = lseek(journal->fd, 0, SEEK_END);
+	/* The background thread updates this once compaction completes */
+	compacted = journal->compacted;
+	pthread_mutex_unlock(&(journal->lock));
+	free(record);
+	free(zbuf);
+	if(r)
+	{
+		lod_set_error_(context, "failed to write to journal");
+		return -1;
+	}
+	if((journal->flags & LODJ_AUTOCOMPACT) && size >= JOURNAL_COMPACTMIN && size > compacted * 2)
+	{
+		/* Failing to start compaction isn't fatal: it will be attempted
+		 * again when the next record is written
+		 */
+		lod_journal_spawn_(journal);
+	}
+	return 0;
+}
+
+/* Close the context's journal, waiting for any compaction to finish */
+void
+lod_journal_close_(LODCONTEXT *context)
+{
+	LODJOURNAL *journal;
+
+	journal = &(context->journal);
+	if(journal->thread_started)
+	{
+		pthread_join(journal->thread, NULL);
+		journal->thread_started = 0;
+	}
+	if(journal->fd != -1)
+	{
+		close(journal->fd);
+		journal->fd = -1;
+	}
+	if(journal->lock_init)
+	{
+		pthread_mutex_destroy(&(journal->lock));
+		journal->lock_init = 0;
+	}
+	free(journal->path);
+	free(journal->buf);
+	journal->path = NULL;
+	journal->buf = NULL;
+	journal->len = 0;
+	journal->size = 0;
+	journal->flags = 0;
+}
+
+/* Append a term in N-Triples form */
+static int
+lod_journal_term_(LODJOURNAL *journal, librdf_node *node)
+{
+	const char *str;
+	librdf_uri *uri;
+	size_t len;
+	char prefix[24];
+
+	if(librdf_node_is_resource(node))
+	{
+		str = (const char *) librdf_uri_as_counted_string(librdf_node_get_uri(node), &len);
+		return lod_journal_append_(journal, "<", 1) ||
+			lod_journal_escape_(journal, str, len, 1) ||
+			lod_journal_append_(journal, ">", 1);
+	}
+	if(librdf_node_is_blank(node))
+	{
+		/* Blank node identifiers are only meaningful within the
+		 * document they came from, and are generated afresh by each
+		 * process, so they're qualified by the record's sequence number
+		 * in order that replaying one record can't merge its blank
+		 * nodes with those of another
+		 */
+		str = (const char *) librdf_node_get_blank_identifier(node);
+		sprintf(prefix, "_:j%lub", (unsigned long) journal->seq);
+		return lod_journal_append_(journal, prefix, strlen(prefix)) ||
+			lod_journal_append_(journal, str, strlen(str));
+	}
+	str = (const char *) librdf_node_get_literal_value_as_counted_string(node, &len);
+	if(lod_journal_append_(journal, "\"", 1) ||
+	   lod_journal_escape_(journal, str, len, 0) ||
+	   lod_journal_append_(journal, "\"", 1))
+	{
+		return -1;
+	}
+	str = librdf_node_get_literal_value_language(node);
+	if(str && *str)
+	{
+		return lod_journal_append_(journal, "@", 1) ||
+			lod_journal_append_(journal, str, strlen(str));
+	}
+	uri = librdf_node_get_literal_value_datatype_uri(node);
+	if(uri)
+	{
+		str = (const char *) librdf_uri_as_counted_string(uri, &len);
+		return lod_journal_append_(journal, "^^<", 3) ||
+			lod_journal_escape_(journal, str, len, 1) ||
+			lod_journal_append_(journal, ">", 1);
+	}
+	return 0;
+}
+
+/* Append a string, escaped for use within an N-Triples IRI or literal */
+static int
+lod_journal_escape_(LODJOURNAL *journal, const char *str, size_t len, int uri)
+{
+	char esc[8];
+	size_t c, start;
+	unsigned char ch;
+
+	for(c = start = 0; c < len; c++)
+	{
+		ch = (unsigned char) str[c];
+		esc[0] = 0;
+		if(uri)
+		{
+			if(ch <= 0x20 || strchr("<>\"{}|^`\\", ch))
+			{
+				sprintf(esc, "\\u%04X", ch);
+			}
+		}
+		else if(ch == '\\' || ch == '"')
+		{
+			esc[0] = '\\';
+			esc[1] = ch;
+			esc[2] = 0;
+		}
+		else if(ch == '\n')
+		{
+			strcpy(esc, "\\n");
+		}
+		else if(ch == '\r')
+		{
+			strcpy(esc, "\\r");
+		}
+		else if(ch < 0x20)
+		{
+			sprintf(esc, "\\u%04X", ch);
+		}
+		if(!esc[0])
+		{
+			continue;
+		}
+		if(lod_journal_append_(journal, str + start, c - start) ||
+		   lod_journal_append_(journal, esc, strlen(esc)))
+		{
+			return -1;
+		}
+		start = c + 1;
+	}
+	return lod_journal_append_(journal, str + start, len - start);
+}
+
+/* Append bytes to the document being collected */
+static int
+lod_journal_append_(LODJOURNAL *journal, const char *str, size_t len)
+{
+	char *p;
+	size_t size;
+
+	if(journal->len + len > journal->size)
+	{
+		for(size = journal->size ? journal->size : JOURNAL_MINBUF; size < journal->len + len; size *= 2)
+		{
+		}
+		p = (char *) realloc(journal->buf, size);
+		if(!p)
+		{
+			return -1;
+		}
+		journal->buf = p;
+		journal->size = size;
+	}
+	memcpy(journal->buf + journal->len, str, len);
+	journal->len += len;
+	return 0;
+}
+
+/* Read and verify the record at offset; returns 1 if a complete record was
+ * read, 0 if there isn't one (because the end of the journal, or a damaged
+ * or incomplete record, has been reached), or -1 if it couldn't be read.
+ * If body is NULL, the record is verified but not returned.
+ */
+static int
+lod_journal_read_(int fd, off_t offset, off_t size, LODJOURNALHEADER *header, char **body, size_t *bodylen)
+{
+	char *buf;
+	uint64_t len;
+
+	if(body)
+	{
+		*body = NULL;
+	}
+	if(size - offset < (off_t) sizeof(LODJOURNALHEADER))
+	{
+		return 0;
+	}
+	/* The file is known to be long enough, and so a short read is an
+	 * error rather than the end of the journal
+	 */
+	if(pread(fd, header, sizeof(LODJOURNALHEADER), offset) != (ssize_t) sizeof(LODJOURNALHEADER))
+	{
+		return -1;
+	}
+	if(memcmp(header->magic, LODJ_MAGIC, 4))
+	{
+		return 0;
+	}
+	len = (uint64_t) header->urilen + header->etaglen + header->redirectslen + header->datalen;
+	if(len > (uint64_t) (size - offset - sizeof(LODJOURNALHEADER)))
+	{
+		return 0;
+	}
+	buf = (char *) malloc(len + 1);
+	if(!buf)
+	{
+		return -1;
+	}
+	if(pread(fd, buf, len, offset + sizeof(LODJOURNALHEADER)) != (ssize_t) len)
+	{
+		free(buf);
+		return -1;
+	}
+	if(lod_hash_(buf, len) != header->check)
+	{
+		free(buf);
+		return 0;
+	}
+	*bodylen = (size_t) len;
+	if(body)
+	{
+		*body = buf;
+	}
+	else
+	{
+		free(buf);
+	}
+	return 1;
+}
+
+/* Write a buffer in its entirety */
+static int
+lod_journal_write_(int fd, const char *buf, size_t len)
+{
+	ssize_t w;
+
+	while(len)
+	{
+		w = write(fd, buf, len);
+		if(w < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		buf += w;
+		len -= w;
+	}
+	return 0;
+}
+
+/* Copy a range of one file to the end of another */
+static int
+lod_journal_copy_(int from, int to, off_t offset, off_t length)
+{
+	char buf[65536];
+	ssize_t r;
+
+	while(length > 0)
+	{
+		r = pread(from, buf, length < (off_t) sizeof(buf) ? (size_t) length : sizeof(buf), offset);
+		if(r <= 0 || lod_journal_write_(to, buf, r))
+		{
+			return -1;
+		}
+		offset += r;
+		length -= r;
+	}
+	return 0;
+}
+
+/* Start compacting the journal in the background, unless that's already
+ * happening
+ */
+static int
+lod_journal_spawn_(LODJOURNAL *journal)
+{
+	int done;
+
+	if(journal->thread_started)
+	{
+		pthread_mutex_lock(&(journal->lock));
+		done = journal->thread_done;
+		pthread_mutex_unlock(&(journal->lock));
+		if(!done)
+		{
+			return 0;
+		}
+		pthread_join(journal->thread, NULL);
+		journal->thread_started = 0;
+	}
+	journal->thread_done = 0;
+	if(pthread_create(&(journal->thread), NULL, lod_journal_thread_, (void *) journal))
+	{
+		return -1;
+	}
+	journal->thread_started = 1;
+	return 0;
+}
+
+/* The body of the background compaction thread */
+static void *
+lod_journal_thread_(void *arg)
+{
+	LODJOURNAL *journal;
+
+	journal = (LODJOURNAL *) arg;
+	lod_journal_compact_(journal);
+	pthread_mutex_lock(&(journal->lock));
+	journal->thread_done = 1;
+	pthread_mutex_unlock(&(journal->lock));
+	return NULL;
+}
+
+/* Write a new journal containing the most recent record for each
+ * document, and replace the current journal with it
+ */
+static int
+lod_journal_compact_(LODJOURNAL *journal)
+{
+	LODJOURNALHEADER header;
+	LODJOURNALDOC *docs, *doc;
+	size_t ndocs, nslots, bodylen, c;
+	off_t end, offset, size;
+	struct stat sbuf;
+	char *tmp, *body;
+	int rfd, wfd, r, rr;
+
+	tmp = (char *) malloc(strlen(journal->path) + 8);
+	if(!tmp)
+	{
+		return -1;
+	}
+	strcpy(tmp, journal->path);
+	strcat(tmp, ".XXXXXX");
+	/* Everything up to the current end of the journal is compacted; any
+	 * records appended in the meantime are copied as-is afterwards
+	 */
+	pthread_mutex_lock(&(journal->lock));
+	end = lseek(journal->fd, 0, SEEK_END);
+	rfd = open(journal->path, O_RDONLY);
+	pthread_mutex_unlock(&(journal->lock));
+	if(rfd == -1 || end < 0)
+	{
+		if(rfd != -1)
+		{
+			close(rfd);
+		}
+		free(tmp);
+		return -1;
+	}
+	docs = NULL;
+	ndocs = nslots = 0;
+	r = 0;
+	for(offset = 0; (rr = lod_journal_read_(rfd, offset, end, &header, &body, &bodylen)) == 1; offset += sizeof(LODJOURNALHEADER) + bodylen)
+	{
+		doc = lod_journal_doc_(&docs, &ndocs, &nslots, body, header.urilen);
+		free(body);
+		if(!doc)
+		{
+			r = -1;
+			break;
+		}
+		doc->last = offset;
+	}
+	/* Unless every record up to the end was read, the compacted journal
+	 * would be missing some, and so mustn't replace this one
+	 */
+	if(rr < 0 || offset != end)
+	{
+		r = -1;
+	}
+	wfd = -1;
+	if(!r)
+	{
+		wfd = mkstemp(tmp);
+		r = (wfd == -1) ? -1 : 0;
+	}
+	for(offset = 0; !r && (rr = lod_journal_read_(rfd, offset, end, &header, &body, &bodylen)) == 1; offset += sizeof(LODJOURNALHEADER) + bodylen)
+	{
+		doc = lod_journal_doc_(&docs, &ndocs, &nslots, body, header.urilen);
+		if(!doc || (doc->last == offset &&
+		   (lod_journal_write_(wfd, (const char *) &header, sizeof(LODJOURNALHEADER)) ||
+			lod_journal_write_(wfd, body, bodylen))))
+		{
+			r = -1;
+		}
+		free(body);
+	}
+	if(!r && (rr < 0 || offset != end))
+	{
+		r = -1;
+	}
+	if(!r)
+	{
+		pthread_mutex_lock(&(journal->lock));
+		size = lseek(journal->fd, 0, SEEK_END);
+		/* The replacement keeps the journal's permissions, rather than
+		 * the owner-only mode which mkstemp() created it with
+		 */
+		if(size < end || lod_journal_copy_(rfd, wfd, end, size - end) ||
+		   fstat(journal->fd, &sbuf) || fchmod(wfd, sbuf.st_mode & 07777) || fsync(wfd) ||
+		   fcntl(wfd, F_SETFL, O_APPEND) || rename(tmp, journal->path))
+		{
+			r = -1;
+		}
+		else
+		{
+			close(journal->fd);
+			journal->fd = wfd;
+			journal->compacted = lseek(wfd, 0, SEEK_END);
+			wfd = -1;
+		}
+		pthread_mutex_unlock(&(journal->lock));
+	}
+	if(wfd != -1)
+	{
+		close(wfd);
+		unlink(tmp);
+	}
+	close(rfd);
+	for(c = 0; c < nslots; c++)
+	{
+		free(docs[c].uri);
+	}
+	free(docs);
+	free(tmp);
+	return r;
+}
+
+/* Locate (adding if needed) a document in the open-addressed table used
+ * during compaction
+ */
+static LODJOURNALDOC *
+lod_journal_doc_(LODJOURNALDOC **docs, size_t *ndocs, size_t *nslots, const char *uri, size_t len)
+{
+	LODJOURNALDOC *p;
+	uint64_t hash;
+	size_t slot, size, c;
+
+	if((*ndocs + 1) * 2 > *nslots)
+	{
+		size = *nslots ? *nslots * 2 : JOURNAL_MINDOCS;
+		p = (LODJOURNALDOC *) calloc(size, sizeof(LODJOURNALDOC));
+		if(!p)
+		{
+			return NULL;
+		}
+		for(c = 0; c < *nslots; c++)
+		{
+			if(!(*docs)[c].uri)
+			{
+				continue;
+			}
+			for(slot = (size_t) ((*docs)[c].hash & (size - 1)); p[slot].uri; slot = (slot + 1) & (size - 1))
+			{
+			}
+			p[slot] = (*docs)[c];
+		}
+		free(*docs);
+		*docs = p;
+		*nslots = size;
+	}
+	hash = lod_hash_(uri, len);
+	for(slot = (size_t) (hash & (*nslots - 1)); (*docs)[slot].uri; slot = (slot + 1) & (*nslots - 1))
+	{
+		p = &((*docs)[slot]);
+		if(p->hash == hash && p->len == len && !memcmp(p->uri, uri, len))
+		{
+			return p;
+		}
+	}
+	p = &((*docs)[slot]);
+	p->uri = (char *) malloc(len + 1);
+	if(!p->uri)
+	{
+		return NULL;
+	}
+	memcpy(p->uri, uri, len);
+	p->uri[len] = 0;
+	p->hash = hash;
+	p->len = len;
+	p->last = -1;
+	(*ndocs)++;
+	return p;
+}
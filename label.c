@@ -0,0 +1,541 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* Label selection: the literal objects of the label predicates are
+ * recorded against their subjects as statements are added to the model,
+ * so that choosing the best label for an instance requires a single probe
+ * of the label index followed by a walk of that subject's candidates.
+ */
+
+static const LODTERMID lod_label_defaults_[] = {
+	LOD_SKOS_PREFLABEL,
+	LOD_RDFS_LABEL,
+	LOD_SCHEMA_NAME,
+	LOD_FOAF_NAME,
+	LOD_DCT_TITLE,
+	LOD_DC_TITLE
+};
+
+#define LABEL_NDEFAULTS                 (sizeof(lod_label_defaults_) / sizeof(LODTERMID))
+
+static long lod_label_score_(LODCONTEXT *context, librdf_node *literal);
+static int lod_label_better_(long score, long rank, long bscore, long brank);
+static int lod_set_label_predicates_locked_(LODCONTEXT *context, const char *const *predicates, size_t count);
+static int lod_set_languages_locked_(LODCONTEXT *context, const char *languages);
+static const char *lod_instance_label_locked_(LODINSTANCE *instance, const char **lang);
+static char *lod_instance_label_dup_locked_(LODINSTANCE *instance, char **lang);
+
+/* Set the predicates used as labels, in order of decreasing priority */
+int
+lod_set_label_predicates(LODCONTEXT *context, const char *const *predicates, size_t count)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_label_predicates_locked_(context, predicates, count);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_label_predicates(), with the context lock held */
+static int
+lod_set_label_predicates_locked_(LODCONTEXT *context, const char *const *predicates, size_t count)
+{
+	LODINDEXES *index;
+	char **labels;
+	LODTERMID *ids;
+	size_t c;
+
+	lod_state_(context)->error = 0;
+	index = &(context->index);
+	labels = NULL;
+	ids = NULL;
+	if(predicates && count)
+	{
+		labels = (char **) calloc(count, sizeof(char *));
+		ids = (LODTERMID *) calloc(count, sizeof(LODTERMID));
+		if(!labels || !ids)
+		{
+			lod_set_error_(context, strerror(errno));
+			free(labels);
+			free(ids);
+			return -1;
+		}
+		for(c = 0; c < count; c++)
+		{
+			ids[c] = LOD_NOTERM;
+			labels[c] = strdup(predicates[c]);
+			if(!labels[c])
+			{
+				lod_set_error_(context, strerror(errno));
+				while(c > 0)
+				{
+					c--;
+					free(labels[c]);
+				}
+				free(labels);
+				free(ids);
+				return -1;
+			}
+		}
+	}
+	else
+	{
+		count = 0;
+	}
+	for(c = 0; c < index->nlabels; c++)
+	{
+		free(index->labels[c]);
+	}
+	free(index->labels);
+	free(index->label_ids);
+	index->labels = labels;
+	index->label_ids = ids;
+	index->nlabels = count;
+	/* Existing statements must be re-examined */
+	index->rebuild = 1;
+	return 0;
+}
+
+/* Set the language preferences used for label selection */
+int
+lod_set_languages(LODCONTEXT *context, const char *languages)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_languages_locked_(context, languages);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_languages(), with the context lock held */
+static int
+lod_set_languages_locked_(LODCONTEXT *context, const char *languages)
+{
+	LODLANGRANGE *list;
+	const char *p, *start, *end;
+	size_t n, len;
+	double q;
+
+	lod_state_(context)->error = 0;
+	lod_languages_free_(context);
+	if(!languages)
+	{
+		return 0;
+	}
+	for(n = 1, p = languages; *p; p++)
+	{
+		if(*p == ',')
+		{
+			n++;
+		}
+	}
+	list = (LODLANGRANGE *) calloc(n, sizeof(LODLANGRANGE));
+	if(!list)
+	{
+		lod_set_error_(context, strerror(errno));
+		return -1;
+	}
+	n = 0;
+	for(p = languages; *p;)
+	{
+		while(*p == ',' || isspace((unsigned char) *p))
+		{
+			p++;
+		}
+		if(!*p)
+		{
+			break;
+		}
+		start = p;
+		while(*p && *p != ',' && *p != ';' && !isspace((unsigned char) *p))
+		{
+			p++;
+		}
+		len = p - start;
+		q = 1.0;
+		/* Parameters: only q is meaningful */
+		end = strchr(p, ',');
+		if(!end)
+		{
+			end = p + strlen(p);
+		}
+		for(; p < end; p++)
+		{
+			if(*p == ';')
+			{
+				for(p++; isspace((unsigned char) *p); p++)
+				{
+				}
+				if((*p == 'q' || *p == 'Q') && p[1] == '=')
+				{
+					q = strtod(p + 2, NULL);
+				}
+			}
+		}
+		list[n].range = (char *) calloc(1, len + 1);
+		if(!list[n].range)
+		{
+			lod_set_error_(context, strerror(errno));
+			context->languages = list;
+			context->nlanguages = n;
+			lod_languages_free_(context);
+			return -1;
+		}
+		memcpy(list[n].range, start, len);
+		list[n].q = (int) (q < 0 ? 0 : (q > 1 ? 1000 : q * 1000 + 0.5));
+		n++;
+	}
+	context->languages = list;
+	context->nlanguages = n;
+	return 0;
+}
+
+/* Return the best label for the instance */
+const char *
+lod_instance_label(LODINSTANCE *instance, const char **lang)
+{
+	LODCONTEXT *context;
+	const char *r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_label_locked_(instance, lang);
+	lod_unlock_(context);
+	return r;
+}
+
+/* Return a copy of the best label for the instance */
+char *
+lod_instance_label_dup(LODINSTANCE *instance, char **lang)
+{
+	LODCONTEXT *context;
+	char *r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_label_dup_locked_(instance, lang);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_label_dup(), with the context lock held */
+static char *
+lod_instance_label_dup_locked_(LODINSTANCE *instance, char **lang)
+{
+	const char *label, *language;
+	char *l, *t;
+
+	if(lang)
+	{
+		*lang = NULL;
+	}
+	label = lod_instance_label_locked_(instance, &language);
+	if(!label)
+	{
+		return NULL;
+	}
+	l = strdup(label);
+	t = (lang && language) ? strdup(language) : NULL;
+	if(!l || (lang && language && !t))
+	{
+		lod_set_error_(instance->context, strerror(errno));
+		free(l);
+		free(t);
+		return NULL;
+	}
+	if(lang)
+	{
+		*lang = t;
+	}
+	return l;
+}
+
+/* lod_instance_label(), with the context lock held */
+static const char *
+lod_instance_label_locked_(LODINSTANCE *instance, const char **lang)
+{
+	LODCONTEXT *context;
+	LODINDEXES *index;
+	librdf_model *model;
+	librdf_node *best, *const *objects;
+	LODTERMID sid, pid;
+	LODEDGE *edge;
+	uint32_t e;
+	long score, rank, bscore, brank;
+	size_t c, count, n;
+
+	context = instance->context;
+	lod_state_(context)->error = 0;
+	if(lang)
+	{
+		*lang = NULL;
+	}
+	model = lod_model(context);
+	if(!model)
+	{
+		return NULL;
+	}
+	index = &(context->index);
+	best = NULL;
+	bscore = brank = 0;
+	if(librdf_node_is_resource(instance->subject) &&
+	   lod_index_ready_(context, model, LODI_LABELS))
+	{
+		sid = lod_intern_node_id_(context, instance->subject, 0);
+		if(sid == LOD_NOTERM)
+		{
+			return NULL;
+		}
+		for(e = lod_edges_first_(&(index->label_edges), sid); e != LOD_NOEDGE; e = edge->next)
+		{
+			edge = &(index->label_edges.edges[e]);
+			score = lod_label_score_(context, index->literals[edge->to]);
+			if(!best || lod_label_better_(score, edge->label, bscore, brank))
+			{
+				best = index->literals[edge->to];
+				bscore = score;
+				brank = edge->label;
+			}
+		}
+	}
+	else
+	{
+		/* Consult the instance's own properties for each label predicate */
+		n = index->labels ? index->nlabels : LABEL_NDEFAULTS;
+		for(c = 0; c < n; c++)
+		{
+			if(index->labels)
+			{
+				objects = lod_instance_get_all(instance, index->labels[c], &count);
+			}
+			else
+			{
+				pid = lod_label_defaults_[c];
+				if(!lod_intern_node_(context, pid))
+				{
+					return NULL;
+				}
+				objects = lod_instance_get_all(instance, context->intern.terms[pid].str, &count);
+			}
+			if(lod_state_(context)->error)
+			{
+				return NULL;
+			}
+			for(; count; count--, objects++)
+			{
+				if(!librdf_node_is_literal(*objects))
+				{
+					continue;
+				}
+				score = lod_label_score_(context, *objects);
+				rank = (long) c;
+				if(!best || lod_label_better_(score, rank, bscore, brank))
+				{
+					best = *objects;
+					bscore = score;
+					brank = rank;
+				}
+			}
+		}
+	}
+	if(!best)
+	{
+		return NULL;
+	}
+	if(lang)
+	{
+		*lang = librdf_node_get_literal_value_language(best);
+	}
+	return (const char *) librdf_node_get_literal_value(best);
+}
+
+/* Return the priority of a label predicate (lower is better), or -1 if
+ * it isn't one
+ */
+long
+lod_label_rank_(LODINDEXES *index, LODTERMID predicate)
+{
+	size_t c;
+
+	if(!index->labels)
+	{
+		for(c = 0; c < LABEL_NDEFAULTS; c++)
+		{
+			if(lod_label_defaults_[c] == predicate)
+			{
+				return (long) c;
+			}
+		}
+		return -1;
+	}
+	for(c = 0; c < index->nlabels; c++)
+	{
+		if(index->label_ids[c] == predicate)
+		{
+			return (long) c;
+		}
+	}
+	return -1;
+}
+
+/* Record a literal as a candidate label for a subject, if the predicate
+ * is a label predicate
+ */
+int
+lod_label_add_(LODCONTEXT *context, LODTERMID subject, LODTERMID predicate, librdf_node *object)
+{
+	LODINDEXES *index;
+	librdf_node **p, *node;
+	size_t size;
+	long rank;
+
+	index = &(context->index);
+	rank = lod_label_rank_(index, predicate);
+	if(rank < 0)
+	{
+		return 0;
+	}
+	if(index->nliterals == index->literalsize)
+	{
+		size = index->literalsize ? index->literalsize * 2 : 64;
+		p = (librdf_node **) realloc(index->literals, size * sizeof(librdf_node *));
+		if(!p)
+		{
+			return -1;
+		}
+		index->literals = p;
+		index->literalsize = size;
+	}
+	node = librdf_new_node_from_node(object);
+	if(!node)
+	{
+		return -1;
+	}
+	if(lod_edges_add_(&(index->label_edges), subject, (LODTERMID) rank, (LODTERMID) index->nliterals))
+	{
+		librdf_free_node(node);
+		return -1;
+	}
+	index->literals[index->nliterals] = node;
+	index->nliterals++;
+	return 0;
+}
+
+/* Discard the contents of the label index */
+void
+lod_label_reset_(LODINDEXES *index)
+{
+	size_t c;
+
+	lod_edges_reset_(&(index->label_edges));
+	for(c = 0; c < index->nliterals; c++)
+	{
+		librdf_free_node(index->literals[c]);
+	}
+	free(index->literals);
+	index->literals = NULL;
+	index->nliterals = 0;
+	index->literalsize = 0;
+}
+
+/* Discard the context's language preferences */
+void
+lod_languages_free_(LODCONTEXT *context)
+{
+	size_t c;
+
+	for(c = 0; c < context->nlanguages; c++)
+	{
+		free(context->languages[c].range);
+	}
+	free(context->languages);
+	context->languages = NULL;
+	context->nlanguages = 0;
+}
+
+/* Score a literal according to the language preferences (higher is
+ * better): the quality of the most specific range matching its language;
+ * untagged literals rank below any explicitly-preferred language, but
+ * above languages only matched by a wildcard, or not at all
+ */
+static long
+lod_label_score_(LODCONTEXT *context, librdf_node *literal)
+{
+	const char *lang;
+	size_t c, len, blen;
+	long wild, q;
+
+	if(!context->nlanguages)
+	{
+		return 0;
+	}
+	lang = librdf_node_get_literal_value_language(literal);
+	wild = -1;
+	q = -1;
+	blen = 0;
+	for(c = 0; c < context->nlanguages; c++)
+	{
+		if(!strcmp(context->languages[c].range, "*"))
+		{
+			wild = context->languages[c].q;
+			continue;
+		}
+		if(!lang || !*lang)
+		{
+			continue;
+		}
+		len = strlen(context->languages[c].range);
+		if(len > blen && !strncasecmp(context->languages[c].range, lang, len) &&
+		   (!lang[len] || lang[len] == '-'))
+		{
+			q = context->languages[c].q;
+			blen = len;
+		}
+	}
+	if(q > 0)
+	{
+		return 2 * q + 3;
+	}
+	if(!lang || !*lang)
+	{
+		return 2;
+	}
+	if(q < 0 && wild > 0)
+	{
+		return 1;
+	}
+	return 0;
+}
+
+/* Determine whether a candidate label is better than the best so far */
+static int
+lod_label_better_(long score, long rank, long bscore, long brank)
+{
+	if(score != bscore)
+	{
+		return score > bscore;
+	}
+	return rank < brank;
+}
@@ -18,12 +18,32 @@
 #ifndef LIBLOD_H_
 # define LIBLOD_H_                      1
 
+# include <stdint.h>
+# include <time.h>
 # include <librdf.h>
 # include <curl/curl.h>
 
 typedef struct lod_context_struct LODCONTEXT;
 typedef struct lod_instance_struct LODINSTANCE;
 typedef struct lod_response_struct LODRESPONSE;
+typedef struct lod_snapshot_struct LODSNAPSHOT;
+
+/* The identifier of a term within a snapshot */
+typedef uint32_t LODSNAPID;
+
+/* Matches any term in a snapshot query; also returned when a term isn't
+ * present
+ */
+# define LODSNAP_ANY                    ((LODSNAPID) -1)
+
+/* The kinds of term in a snapshot */
+typedef enum
+{
+	LODSNAP_URI,
+	LODSNAP_BLANK,
+	LODSNAP_LITERAL,
+	LODSNAP_NKINDS
+} LODSNAPKIND;
 
 typedef enum
 {
@@ -39,18 +59,305 @@ typedef enum
 	LODR_FOLLOW_LINK
 } LODRESULT;
 
+/* Indexes which can be maintained by a context over the statements which
+ * liblod adds to its model
+ */
+typedef enum
+{
+	/* The set of subject URIs, fronted by a membership filter, allowing
+	 * existence checks to be answered without querying the model
+	 */
+	LODI_SUBJECTS = (1<<0),
+	/* The objects of foaf:primaryTopic and other "pointer" predicates
+	 * registered with lod_add_pointer(); requires LODI_SUBJECTS
+	 */
+	LODI_POINTERS = (1<<1),
+	/* Sets of URIs which are co-referent via owl:sameAs */
+	LODI_SAMEAS = (1<<2),
+	/* Candidate labels (literal objects of the label predicates) */
+	LODI_LABELS = (1<<3),
+	/* Subjects by rdf:type, and types by subject */
+	LODI_TYPES = (1<<4),
+	/* Take account of the rdfs:subClassOf hierarchy (whose transitive
+	 * closure is precomputed) when answering type queries; requires
+	 * LODI_TYPES
+	 */
+	LODI_SUBCLASSES = (1<<5),
+	/* Inbound links: subjects by the URIs they refer to (not maintained
+	 * by default, as it holds an entry for every statement whose object
+	 * is a URI)
+	 */
+	LODI_INCOMING = (1<<6),
+	/* The indexes maintained by a newly-created context */
+	LODI_DEFAULT = LODI_SUBJECTS|LODI_POINTERS|LODI_SAMEAS|LODI_LABELS|LODI_TYPES
+} LODINDEX;
+
+/* Statistics about the subject membership filter */
+typedef struct
+{
+	/* The number of lookups answered using the filter */
+	unsigned long queries;
+	/* Lookups which the filter determined were definite misses */
+	unsigned long negatives;
+	/* Lookups which passed the filter and where the subject was present */
+	unsigned long positives;
+	/* Lookups which passed the filter but where the subject wasn't present */
+	unsigned long false_positives;
+	/* The approximate number of distinct subjects in the filter */
+	unsigned long subjects;
+	/* The size of the filter, in bits */
+	unsigned long bits;
+} LODFILTERSTATS;
+
 /* A callback which can be supplied to perform a low-level URI fetch in
  * place of the default implementation (for example, to modify the cURL
  * request on a per-resource basis, or to use something else entirely).
  */
 typedef int (*LODFETCHURI)(LODCONTEXT *context, const char *uri, LODRESPONSE *response);
 
-/* Create a new LOD context */
+/* A callback which is invoked when an externally-owned payload buffer
+ * assigned via lod_response_set_payload_external() is no longer required
+ * by liblod.
+ */
+typedef void (*LODPAYLOADRELEASE)(void *userdata, const char *payload, size_t length);
+
+/* A callback invoked when a response submitted via lod_response_submit()
+ * has been processed, on the thread which processed it (so that lod_error()
+ * describes any failure)
+ */
+typedef void (*LODRESPONSECB)(LODCONTEXT *context, LODRESPONSE *response, LODRESULT result, void *userdata);
+
+/* A callback invoked by lod_instance_foreach() for each triple whose
+ * subject is the instance. The nodes are borrowed, and must not be freed
+ * or retained beyond the call without taking a new reference; the callback
+ * must not modify the context's model. Return nonzero to end the iteration
+ * early.
+ */
+typedef int (*LODTRIPLECB)(LODINSTANCE *instance, librdf_node *predicate, librdf_node *object, void *userdata);
+
+/* Options for a context's journal */
+typedef enum
+{
+	/* Compress each record (if liblod was built with zlib) */
+	LODJ_COMPRESS = (1<<0),
+	/* Flush each record to stable storage before continuing */
+	LODJ_SYNC = (1<<1),
+	/* Compact the journal in the background as it grows */
+	LODJ_AUTOCOMPACT = (1<<2)
+} LODJOURNALFLAGS;
+
+/* The storage backends which may be selected by lod_set_storage_config() */
+typedef enum
+{
+	/* liblod's own storage, held in memory, which keeps each subject's
+	 * triples together (the default)
+	 */
+	LODSTORE_CLUSTERED = 0,
+	/* librdf hashes, held in memory */
+	LODSTORE_MEMORY,
+	/* librdf hashes, held in Berkeley DB files within a directory */
+	LODSTORE_BDB,
+	/* librdf's SQLite storage, held in a single database file */
+	LODSTORE_SQLITE
+} LODSTORETYPE;
+
+/* When changes to persistent storage are flushed to disk */
+typedef enum
+{
+	/* After each document has been processed (the default) */
+	LODSYNC_DOCUMENT = 0,
+	/* Only when lod_sync() is called, or the storage is closed */
+	LODSYNC_NONE,
+	/* After each document, and (where the backend supports it) waiting
+	 * for each write to reach stable storage
+	 */
+	LODSYNC_FULL
+} LODSYNCPOLICY;
+
+/* The storage configuration passed to lod_set_storage_config() */
+typedef struct
+{
+	LODSTORETYPE type;
+	/* The directory holding the database files (LODSTORE_BDB), or the
+	 * database file (LODSTORE_SQLITE)
+	 */
+	const char *path;
+	/* The prefix of the database file names (LODSTORE_BDB; default "lod") */
+	const char *name;
+	/* Non-zero to discard any existing contents */
+	int create;
+	LODSYNCPOLICY sync;
+	/* Further librdf storage options, in librdf's "name='value',..." form */
+	const char *options;
+} LODSTORAGECONFIG;
+
+/* Metadata about a document which has been fetched */
+typedef struct
+{
+	const char *uri;
+	/* When the document was most recently fetched */
+	time_t fetched;
+	/* The document's ETag, if the server supplied one */
+	const char *etag;
+	/* The URIs which were requested in order to reach the document,
+	 * beginning with the URI being resolved, separated by spaces
+	 */
+	const char *redirects;
+} LODDOCINFO;
+
+/* The time limits applied to fetches, passed to lod_set_timeouts(); a
+ * zero value imposes no limit (except that libcurl's default connection
+ * timeout applies)
+ */
+typedef struct
+{
+	/* The time allowed for a whole resolution, including waiting for the
+	 * scheduler and following every redirect, 303 and alternate link, in
+	 * milliseconds
+	 */
+	long deadline;
+	/* The time allowed for each request to connect, and to begin
+	 * receiving a response, in milliseconds
+	 */
+	long connect;
+	long first_byte;
+	/* A response received at fewer than low_speed bytes per second for
+	 * low_speed_time seconds is abandoned
+	 */
+	long low_speed;
+	long low_speed_time;
+} LODTIMEOUTS;
+
+/* The phase of a resolution in which a time limit was reached */
+typedef enum
+{
+	/* No limit has been reached */
+	LODT_NONE = 0,
+	/* The deadline passed while waiting for the scheduler */
+	LODT_QUEUE,
+	/* Connecting to a host */
+	LODT_CONNECT,
+	/* Waiting for a response to begin */
+	LODT_FIRST_BYTE,
+	/* A response was being received too slowly */
+	LODT_LOW_SPEED,
+	/* The deadline passed during a request, or between requests */
+	LODT_DEADLINE
+} LODTIMEOUTPHASE;
+
+/* The priority classes of fetches (see lod_set_priority()) */
+typedef enum
+{
+	/* Fetches which someone is waiting for */
+	LODP_INTERACTIVE = 0,
+	/* Crawling and refreshing, which may be delayed and interrupted */
+	LODP_BACKGROUND
+} LODPRIORITY;
+
+/* The limits applied to fetches from a host, passed to
+ * lod_set_host_policy()
+ */
+typedef struct
+{
+	/* The maximum number of requests in progress at once; zero for no
+	 * limit
+	 */
+	unsigned int connections;
+	/* The sustained rate at which requests may be started, per second,
+	 * and the number which may be started in a burst; a zero rate
+	 * imposes no limit
+	 */
+	double rate;
+	unsigned int burst;
+	/* The minimum interval, in seconds, between starting requests */
+	double delay;
+} LODHOSTPOLICY;
+
+/* Statistics about scheduled fetches, returned by lod_fetch_stats() */
+typedef struct
+{
+	/* The number of requests in progress, and waiting to start */
+	unsigned long active;
+	unsigned long queued;
+	/* The greatest number of requests which have been waiting at once */
+	unsigned long max_queued;
+	/* The number of requests which have been started */
+	unsigned long started;
+	/* The total time, in seconds, which requests have spent waiting */
+	double wait_time;
+	/* The number of background requests interrupted by interactive ones */
+	unsigned long preempted;
+} LODFETCHSTATS;
+
+/* Callback invoked for each matching triple by lod_snapshot_foreach(); a
+ * non-zero return value stops the iteration and is returned to the caller
+ */
+typedef int (*LODSNAPSHOTCB)(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object, void *userdata);
+
+/* Create a new LOD context.
+ *
+ * A context may be shared by several threads. Each thread sees its own
+ * resolution state (lod_subject(), lod_document(), lod_status() and
+ * lod_error() describe the calling thread's most recent request) and has
+ * its own cURL handle; the model, and everything derived from it, is
+ * protected by a lock which is released while documents are being
+ * transferred. If several threads resolve subjects described by the same
+ * document (for example, URIs which differ only in their fragments), only
+ * one of them fetches it while it's in progress, and the others wait for
+ * and share its outcome, including any redirects and errors. Threaded
+ * applications must call curl_global_init() before sharing a context.
+ */
 LODCONTEXT *lod_create(void);
 
-/* Free a LOD context created by lod_create() */
+/* Free a LOD context created by lod_create(); no other thread may be
+ * using it
+ */
 int lod_destroy(LODCONTEXT *context);
 
+/* Publish a snapshot of the context's model (see lod_freeze()) for the
+ * overlays subsequently created over it, along with the configuration they
+ * inherit. This takes time proportional to the size of the model if it
+ * has changed since the last was published, and otherwise none; overlays
+ * which already exist are unaffected.
+ */
+int lod_publish(LODCONTEXT *context);
+
+/* Obtain a reference to the snapshot most recently published by the
+ * context with lod_publish() (for example, to save it), or NULL if none
+ * has been; release it with lod_snapshot_release()
+ */
+LODSNAPSHOT *lod_published(LODCONTEXT *context);
+
+/* Create an overlay context over the snapshot most recently published by
+ * another context with lod_publish(). Queries against the overlay see the
+ * base model's triples as of then, as well as any added to the overlay
+ * (for example, by resolving with it), but additions are held in a private
+ * in-memory layer which is discarded when the overlay is destroyed, and
+ * the base is never modified.
+ *
+ * Creating an overlay only takes a reference to the published snapshot,
+ * and so is inexpensive however large the base is; neither creating one
+ * nor querying it waits for the base context's lock. Overlays don't build
+ * indexes (see lod_set_indexes()), nor inherit the base's label or
+ * language configuration, and triples in the base can't be removed
+ * through an overlay. Replacing an overlay's storage or model detaches it
+ * from its base.
+ *
+ * Returns NULL on failure, including if the base has never published a
+ * snapshot, in which case lod_error() on the base context may describe the
+ * problem.
+ */
+LODCONTEXT *lod_create_overlay(LODCONTEXT *base);
+
+/* Create a context over a snapshot (for example, one obtained from
+ * lod_load_snapshot()), so that lod_locate(), lod_instance_stream() and
+ * the other accessors answer from it, and lod_document_info() from the
+ * metadata it records. The context behaves as an overlay whose base is
+ * the snapshot, and holds its own reference to it. Returns NULL on
+ * failure.
+ */
+LODCONTEXT *lod_create_from_snapshot(LODSNAPSHOT *snapshot);
+
 /* Obtain the librdf world used by the context */
 librdf_world *lod_world(LODCONTEXT *context);
 
@@ -77,6 +384,26 @@ librdf_storage *lod_storage(LODCONTEXT *context);
  */
 int lod_set_storage(LODCONTEXT *context, librdf_storage *storage);
 
+/* Select the storage which the context will create for itself, replacing
+ * any existing storage and model as lod_set_storage() does. The storage
+ * is opened immediately, so that any error is reported here. If config
+ * is NULL, the default (LODSTORE_CLUSTERED) storage is selected.
+ */
+int lod_set_storage_config(LODCONTEXT *context, const LODSTORAGECONFIG *config);
+
+/* Begin (if enable is non-zero) or end a bulk load. While a bulk load is
+ * in progress, the context's indexes aren't maintained (they are rebuilt
+ * when next used), statements aren't checked for before being added
+ * (the storage is relied upon to discard duplicates), storage isn't
+ * flushed after each document, and if the storage supports transactions,
+ * the whole load takes place within one. Ending a bulk load commits and
+ * flushes the storage.
+ */
+int lod_set_bulk_load(LODCONTEXT *context, int enable);
+
+/* Flush any changes to the context's storage to disk */
+int lod_sync(LODCONTEXT *context);
+
 /* Obtain the librdf model used by the context */
 librdf_model *lod_model(LODCONTEXT *context);
 
@@ -88,7 +415,16 @@ librdf_model *lod_model(LODCONTEXT *context);
  */
 int lod_set_model(LODCONTEXT *context, librdf_model *model);
 
-/* Obtain a cURL handle for a context */
+/* Obtain the interned librdf node for a URI. The node is owned by the
+ * context and remains valid until the context's librdf world is changed
+ * or the context is destroyed; it must not be freed by the caller (use
+ * librdf_new_node_from_node() to obtain a reference which may be).
+ */
+librdf_node *lod_node(LODCONTEXT *context, const char *uri);
+
+/* Obtain a cURL handle for a context; unless one has been set with
+ * lod_set_curl(), each thread has its own
+ */
 CURL *lod_curl(LODCONTEXT *context);
 
 /* Set the cURL handle which will be used for future fetches by the context.
@@ -97,11 +433,86 @@ CURL *lod_curl(LODCONTEXT *context);
  * any HTTP request headers (including Accept), and the caller must do it
  * instead.
  *
+ * The handle is used by every thread, and so a context with an explicit
+ * cURL handle must not be used to fetch from more than one thread at once.
+ *
  * It's the caller's responsibility to free the handle once the context has
  * been destroyed.
  */
 int lod_set_curl(LODCONTEXT *context, CURL *ch);
 
+/* Obtain the payload size beyond which responses fetched by the context
+ * will be written to a temporary file rather than held in memory; zero
+ * means payloads are never written to disk.
+ */
+size_t lod_spill_threshold(LODCONTEXT *context);
+
+/* Set the payload size beyond which responses fetched by the context will
+ * be written to a temporary file (in $TMPDIR, or /tmp) and parsed from
+ * there; zero (the default) disables this.
+ */
+int lod_set_spill_threshold(LODCONTEXT *context, size_t threshold);
+
+/* Obtain the time limits applied to the context's fetches */
+int lod_timeouts(LODCONTEXT *context, LODTIMEOUTS *timeouts);
+
+/* Set the time limits applied to the context's fetches; by default, none
+ * are imposed. The limits replace any set on a handle supplied via
+ * lod_set_curl(). A resolution which runs out of time fails, and
+ * lod_timeout_phase() reports where.
+ */
+int lod_set_timeouts(LODCONTEXT *context, const LODTIMEOUTS *timeouts);
+
+/* Return the generation of the context's model: a counter which changes
+ * whenever statements are added to or removed from the model, or the
+ * model is replaced. Changes made directly through librdf are detected
+ * only if the storage can report its size. Returns 0 on error.
+ */
+unsigned long lod_generation(LODCONTEXT *context);
+
+/* Obtain the set of indexes (LODINDEX flags) maintained by the context */
+unsigned int lod_indexes(LODCONTEXT *context);
+
+/* Set the indexes (LODINDEX flags) which will be maintained by the context;
+ * the indexes are (re-)built from the model when they are next needed.
+ * With the default storage, every change to the model is noticed, even
+ * those made directly through librdf. With any other storage, only a
+ * change in size can be, and so the indexes are used only to rule out
+ * subjects which are absent; everything else is answered from the model.
+ */
+int lod_set_indexes(LODCONTEXT *context, unsigned int flags);
+
+/* Register a "pointer" predicate (such as schema:about or owl:sameAs)
+ * whose objects will be indexed alongside those of foaf:primaryTopic,
+ * allowing lod_instance_follow() to answer without querying the model
+ */
+int lod_add_pointer(LODCONTEXT *context, const char *predicate);
+
+/* Set the predicates used as labels by lod_instance_label(), in order of
+ * decreasing priority. If predicates is NULL or count is zero, the
+ * defaults are restored: skos:prefLabel, rdfs:label, schema:name,
+ * foaf:name, dct:title and dc:title.
+ */
+int lod_set_label_predicates(LODCONTEXT *context, const char *const *predicates, size_t count);
+
+/* Set the language preferences used by lod_instance_label(), in the form
+ * of an HTTP Accept-Language header (e.g., "en-GB, en;q=0.8, *;q=0.1").
+ * If languages is NULL or empty, language is disregarded.
+ */
+int lod_set_languages(LODCONTEXT *context, const char *languages);
+
+/* Obtain the URIs of the subjects which are instances of a class (or, if
+ * LODI_SUBCLASSES is enabled, of any of its subclasses), storing up to max
+ * of them in uris; returns the total number, or -1 on error. The strings
+ * belong to the context and remain valid until its librdf world is
+ * changed or it is destroyed. The type index is used if LODI_TYPES is
+ * enabled, and the model is queried otherwise.
+ */
+long lod_subjects_of_type(LODCONTEXT *context, const char *type, const char **uris, size_t max);
+
+/* Obtain statistics about the subject membership filter */
+int lod_filter_stats(LODCONTEXT *context, LODFILTERSTATS *stats);
+
 /* Return the subject URI (after following any relevant redirects) that was
  * most recently resolved, if any.
  *
@@ -116,6 +527,50 @@ const char *lod_subject(LODCONTEXT *context);
  */
 const char *lod_document(LODCONTEXT *context);
 
+/* Append each document processed by the context to a write-ahead journal
+ * at path (created if needed), as a block of N-Quads along with its fetch
+ * metadata. Blank nodes are relabelled with each record's sequence number,
+ * so that those of different documents, or written by different processes,
+ * remain distinct when the journal is replayed. Any incomplete record at
+ * the end of an existing journal is discarded; if the existing journal
+ * can't be read, it is left untouched and -1 is returned. If path is NULL,
+ * the journal is closed.
+ */
+int lod_set_journal(LODCONTEXT *context, const char *path, unsigned int flags);
+
+/* Add the contents of a journal to the context's model, restoring the
+ * metadata of the documents it describes; replay stops at the first
+ * incomplete or damaged record, but fails if the journal can't be read
+ */
+int lod_journal_replay(LODCONTEXT *context, const char *path);
+
+/* Compact the context's journal, retaining only the most recent record for
+ * each document; this happens in the background with LODJ_AUTOCOMPACT. The
+ * journal is replaced only if every record in it could be read.
+ */
+int lod_journal_compact(LODCONTEXT *context);
+
+/* Obtain the metadata recorded when a document was fetched by the context,
+ * returning 1 if it was found and 0 if not. The strings remain valid until
+ * the document is next fetched or the context is destroyed; a context
+ * which is shared between threads should use lod_document_info_dup().
+ */
+int lod_document_info(LODCONTEXT *context, const char *uri, LODDOCINFO *info);
+
+/* As lod_document_info(), but the strings are copies belonging to the
+ * caller, which must release them with lod_document_info_free(); returns
+ * -1 on error
+ */
+int lod_document_info_dup(LODCONTEXT *context, const char *uri, LODDOCINFO *info);
+
+/* Free the strings of metadata obtained via lod_document_info_dup() */
+void lod_document_info_free(LODDOCINFO *info);
+
+/* Return an instance representing the foaf:primaryTopic of the document
+ * most recently fetched from, if there is one and it exists in the model
+ */
+LODINSTANCE *lod_document_primarytopic(LODCONTEXT *context);
+
 /* Return the HTTP status code from the most recent resolution request; a
  * return value of zero means no fetch was performed.
  */
@@ -129,6 +584,11 @@ int lod_error(LODCONTEXT *context);
 /* Return the error message from the most recent resolution request */
 const char *lod_errmsg(LODCONTEXT *context);
 
+/* Return the phase in which the most recent resolution request ran out of
+ * time, or LODT_NONE
+ */
+LODTIMEOUTPHASE lod_timeout_phase(LODCONTEXT *context);
+
 /* Logging function which is set on librdf_world objects via
  * librdf_world_set_logger(); note that the context must be
  * specified as the "user_data" parameter.
@@ -149,6 +609,21 @@ LODINSTANCE *lod_resolve(LODCONTEXT *context, const char *uri);
  */
 LODINSTANCE *lod_locate(LODCONTEXT *context, const char *uri);
 
+/* Determine which of an array of URIs are subjects within the context's
+ * model, without fetching anything. Bit (n % 8) of bitmap[n / 8] is set if
+ * uris[n] is present, and cleared otherwise; bitmap must be at least
+ * (count + 7) / 8 bytes long. Returns the number of URIs which are
+ * present, or -1 on error.
+ */
+long lod_exists_many(LODCONTEXT *context, const char *const *uris, size_t count, unsigned char *bitmap);
+
+/* As lod_exists_many(), but additionally (if instances is not NULL) set
+ * instances[n] to a new LODINSTANCE for each URI which is present, or NULL
+ * for each which isn't. Each instance must be freed with
+ * lod_instance_destroy(). Either bitmap or instances may be NULL.
+ */
+long lod_locate_many(LODCONTEXT *context, const char *const *uris, size_t count, unsigned char *bitmap, LODINSTANCE **instances);
+
 /* Fetch data about a subject, fetching the data about it (irrespective of
  * whether it already exists in the model.
  */
@@ -164,17 +639,129 @@ int lod_instance_destroy(LODINSTANCE *instance);
 /* Return the URI of the instance */
 librdf_uri *lod_instance_uri(LODINSTANCE *instance);
 
-/* Return a stream filtering the triples in the context by subject */
+/* Return a stream filtering the triples in the context by subject. The
+ * stream reads from the model as it is consumed, and so it mustn't be used
+ * while other threads are using the context (lod_instance_foreach() is
+ * safe).
+ */
 librdf_stream *lod_instance_stream(LODINSTANCE *instance);
 
 /* Return 1 if the subject exists in the related context */
 int lod_instance_exists(LODINSTANCE *instance);
 
 /* Return an instance representing the foaf:primaryTopic of the supplied
- * instance, if one exists.
+ * instance, if one exists; if there are several, the choice is made as
+ * described for lod_instance_follow().
  */
 LODINSTANCE *lod_instance_primarytopic(LODINSTANCE *instance);
 
+/* Return an instance representing an object of the supplied predicate
+ * which is named by a URI and is itself a subject within the model, if
+ * there is one. If there are several, the one whose URI sorts first
+ * (byte-wise, as by strcmp()) is chosen, regardless of the order in which
+ * the triples were added or the storage returns them. This is answered
+ * from the index if the predicate has been registered with
+ * lod_add_pointer() (foaf:primaryTopic always is), and by querying the
+ * model otherwise.
+ */
+LODINSTANCE *lod_instance_follow(LODINSTANCE *instance, const char *predicate);
+
+/* Obtain the URIs of the subjects which refer to the instance via the
+ * supplied predicate (or any predicate, if predicate is NULL), storing up
+ * to max of them in uris; returns the total number, or -1 on error. The
+ * strings belong to the context and remain valid until its librdf world
+ * is changed or it is destroyed. This is answered from the inbound link
+ * index if LODI_INCOMING is enabled, and by querying the model otherwise.
+ */
+long lod_instance_incoming(LODINSTANCE *instance, const char *predicate, const char **uris, size_t max);
+
+/* Return an instance representing the canonical member of the set of URIs
+ * which are co-referent with the instance via owl:sameAs (in either
+ * direction, and transitively). Which member is canonical is unspecified,
+ * but doesn't change until further owl:sameAs statements are added. If
+ * the instance has no co-referents, the result represents the same URI.
+ * The set is obtained from the index if LODI_SAMEAS is enabled, and by
+ * querying the model otherwise.
+ */
+LODINSTANCE *lod_instance_canonical(LODINSTANCE *instance);
+
+/* Obtain the URIs which are co-referent with the instance (including the
+ * instance's own, which is always first), storing up to max of them in
+ * uris; returns the total number, or -1 on error. The strings belong to
+ * the context and remain valid until its librdf world is changed or it is
+ * destroyed, except that if the instance has no co-referents its own URI
+ * belongs to the instance.
+ */
+long lod_instance_sameas(LODINSTANCE *instance, const char **uris, size_t max);
+
+/* As lod_instance_foreach(), but visiting the triples of every subject
+ * which is co-referent with the instance (the "smushed" view); the
+ * instance passed to the callback is the one whose triple is being
+ * visited.
+ */
+int lod_instance_foreach_smushed(LODINSTANCE *instance, LODTRIPLECB fn, void *userdata);
+
+/* Obtain the URIs of the classes of which the instance is a member (via
+ * rdf:type, and if LODI_SUBCLASSES is enabled, via rdfs:subClassOf),
+ * storing up to max of them in types; returns the total number, or -1 on
+ * error. The strings belong to the context as for lod_subjects_of_type().
+ */
+long lod_instance_types(LODINSTANCE *instance, const char **types, size_t max);
+
+/* Determine whether the instance is a member of a class, returning 1 if
+ * so, 0 if not, or -1 on error
+ */
+int lod_instance_is_a(LODINSTANCE *instance, const char *type);
+
+/* Return the best label for the instance, according to the context's
+ * language preferences and label predicates, or NULL if it has none.
+ * Literals in a preferred language are chosen over untagged literals,
+ * which are chosen over those in any other language; amongst equally
+ * preferred literals, the higher-priority predicate wins. If lang is
+ * non-NULL, it receives the label's language tag (or NULL). The strings
+ * remain valid until the context's model is next modified; a context which
+ * is shared between threads should use lod_instance_label_dup().
+ */
+const char *lod_instance_label(LODINSTANCE *instance, const char **lang);
+
+/* As lod_instance_label(), but the label and language tag are copies
+ * which the caller must free()
+ */
+char *lod_instance_label_dup(LODINSTANCE *instance, char **lang);
+
+/* Return the first object of a property of the instance, or NULL if it has
+ * no such property. The node belongs to the instance: it remains valid
+ * until the instance is destroyed or the context's model is next modified,
+ * and must not be freed by the caller.
+ *
+ * The first call to any of the property accessors materialises all of the
+ * instance's properties, which are then re-used until the model changes.
+ */
+librdf_node *lod_instance_get(LODINSTANCE *instance, const char *predicate);
+
+/* Obtain all of the objects of a property of the instance (or of all of
+ * its properties, if predicate is NULL) as a contiguous array, storing the
+ * number of elements in *count. The array and its nodes belong to the
+ * instance, and are subject to the same lifetime as lod_instance_get().
+ */
+librdf_node *const *lod_instance_get_all(LODINSTANCE *instance, const char *predicate, size_t *count);
+
+/* Return the number of objects of a property of the instance (or the
+ * number of triples about it, if predicate is NULL), or -1 on error
+ */
+long lod_instance_count(LODINSTANCE *instance, const char *predicate);
+
+/* Invoke a callback for each triple whose subject is the instance, in
+ * order of predicate. Returns 0 once every triple has been visited, the
+ * callback's return value if it ended the iteration early, or -1 on error.
+ */
+int lod_instance_foreach(LODINSTANCE *instance, LODTRIPLECB fn, void *userdata);
+
+/* As lod_instance_foreach(), but visiting only the triples with the
+ * supplied predicate
+ */
+int lod_instance_foreach_predicate(LODINSTANCE *instance, const char *predicate, LODTRIPLECB fn, void *userdata);
+
 /* Create a new response object for population */
 LODRESPONSE *lod_response_create(void);
 
@@ -202,6 +789,16 @@ int lod_response_set_target(LODRESPONSE *resp, const char *uri);
 /* Set the MIME type of a payload in a response */
 int lod_response_set_type(LODRESPONSE *resp, const char *type);
 
+/* Add a response header, in RFC822/HTTP format ("Name: value"); any
+ * trailing line ending is removed
+ */
+int lod_response_add_header(LODRESPONSE *resp, const char *header, size_t length);
+
+/* Obtain the value of the last response header with the supplied name
+ * (compared case-insensitively), or NULL if there is none
+ */
+const char *lod_response_header(LODRESPONSE *resp, const char *name);
+
 /* Assign the payload of a response
  * NOTE: The payload must be allocated with malloc(), realloc() or calloc()
  * The heap block will be owned by the response and can be freed at any
@@ -212,14 +809,182 @@ int lod_response_set_payload(LODRESPONSE *resp, char *payload, size_t length);
 /* Assign the payload of a response by duplicating a buffer */
 int lod_response_set_payload_copy(LODRESPONSE *resp, const char *payload, size_t length);
 
+/* Assign an externally-owned buffer as the payload of a response without
+ * copying it. The buffer must remain valid and unmodified until the release
+ * callback (if not NULL) is invoked, which will happen when the payload is
+ * reset or replaced, or the response is destroyed.
+ */
+int lod_response_set_payload_external(LODRESPONSE *resp, const char *payload, size_t length, LODPAYLOADRELEASE release, void *userdata);
+
+/* Map the contents of an open file read-only and use them as the payload of
+ * a response. The descriptor may be closed once this call returns; the
+ * mapping is released along with the payload.
+ */
+int lod_response_set_payload_fd(LODRESPONSE *resp, int fd);
+
+/* Map the contents of the named file read-only and use them as the payload
+ * of a response.
+ */
+int lod_response_set_payload_file(LODRESPONSE *resp, const char *path);
+
+/* Set the payload size beyond which the payload of a response will be
+ * written to a temporary file rather than held in memory; zero (the
+ * default) disables this. The setting persists across lod_response_reset().
+ */
+int lod_response_set_spill_threshold(LODRESPONSE *resp, size_t threshold);
+
 /* Append a byte sequence to the payload of a response */
 int lod_response_append_payload(LODRESPONSE *resp, const char *bytes, size_t length);
 
 /* Reset the payload of a response */
 int lod_response_reset_payload(LODRESPONSE *resp);
 
-/* Process a response as part of a fetch loop */
+/* Process a response as part of a fetch loop.
+ *
+ * The payload is parsed into a private batch of statements without the
+ * context lock held, and the batch is then added to the model at once, so
+ * that several threads can process responses concurrently; if the calling
+ * thread already holds the lock (for example, within a callback), the
+ * parse is serialised with everything else. Applications which parse
+ * from several threads must initialise libxml2 (via xmlInitParser()) before
+ * doing so.
+ */
 LODRESULT lod_response_process(LODCONTEXT *context, LODRESPONSE *response);
 
+/* Start a pool of threads which process responses submitted via
+ * lod_response_submit(), replacing any existing pool once the responses
+ * already submitted to it have been processed. If nthreads is zero, no
+ * pool is used and responses are processed as they are submitted.
+ */
+int lod_set_parse_threads(LODCONTEXT *context, unsigned int nthreads);
+
+/* Submit a response to be processed (as if by lod_response_process()) by
+ * the context's parse pool, invoking the callback, if any, once it has
+ * been. The response must not be used by the caller until then.
+ */
+int lod_response_submit(LODCONTEXT *context, LODRESPONSE *response, LODRESPONSECB callback, void *userdata);
+
+/* Wait until every response submitted to the parse pool has been
+ * processed; this must not be called from a LODRESPONSECB callback
+ */
+int lod_parse_wait(LODCONTEXT *context);
+
+/* Set the maximum number of fetches which may be in progress at once,
+ * across all hosts and threads; zero (the default) imposes no limit.
+ * Fetches which can't start wait in a queue for their host, and hosts
+ * with waiting fetches take turns.
+ */
+int lod_set_fetch_limit(LODCONTEXT *context, unsigned int max);
+
+/* Set the limits applied to fetches from a host (the authority part of a
+ * URI, such as "example.com:8080", compared case-insensitively), or if
+ * host is NULL, to hosts which have no limits of their own. If policy is
+ * NULL, the host's own limits are removed, or the default becomes to
+ * impose no limits.
+ */
+int lod_set_host_policy(LODCONTEXT *context, const char *host, const LODHOSTPOLICY *policy);
+
+/* Set the priority of the fetches made by the calling thread, which is
+ * initially LODP_INTERACTIVE. Interactive fetches are queued ahead of, and
+ * started before, background fetches. If an interactive fetch is held back
+ * only by a limit on the number of fetches in progress, a background
+ * transfer is interrupted to make way for it, and is retried once it can
+ * start again. A background fetch of a document which an interactive
+ * thread is waiting for is promoted for the remainder of its redirects.
+ */
+int lod_set_priority(LODCONTEXT *context, LODPRIORITY priority);
+
+/* Obtain statistics about the fetches scheduled for a host, or for all
+ * hosts if host is NULL; a host which is unknown has none
+ */
+int lod_fetch_stats(LODCONTEXT *context, const char *host, LODFETCHSTATS *stats);
+
+/* Convert the contents of the context's model into an immutable snapshot:
+ * a sorted term dictionary and sorted arrays of term identifiers in SPO,
+ * POS and OSP order, which can be queried by binary search. The snapshot
+ * is independent of the context and of librdf, and because it is never
+ * modified, it can be read by any number of threads without locking. The
+ * caller holds a single reference to the new snapshot.
+ */
+LODSNAPSHOT *lod_freeze(LODCONTEXT *context);
+
+/* Write a snapshot to a file, which is replaced atomically */
+int lod_save_snapshot(LODSNAPSHOT *snapshot, const char *path);
+
+/* Load a snapshot previously written by lod_save_snapshot(). The file is
+ * mapped into memory and used in place, with no parsing (although its
+ * structure is validated); returns NULL with errno set on failure, which
+ * will be EINVAL if the file isn't a snapshot which can be loaded by this
+ * version of liblod on this host.
+ */
+LODSNAPSHOT *lod_load_snapshot(const char *path);
+
+/* Add the triples in a snapshot to the context's model, and restore the
+ * metadata of the documents it describes. A snapshot can be used without
+ * populating a model, either through lod_create_from_snapshot() or by
+ * querying it with the lod_snapshot_*() functions below, which need no
+ * context or librdf world at all; this instead allows a context to be
+ * restored to its previous, writeable, state.
+ */
+int lod_thaw(LODCONTEXT *context, LODSNAPSHOT *snapshot);
+
+/* Obtain the metadata of a document recorded in a snapshot, returning 1
+ * if it was found and 0 if not
+ */
+int lod_snapshot_document(LODSNAPSHOT *snapshot, const char *uri, LODDOCINFO *info);
+
+/* Obtain an additional reference to a snapshot (thread-safe) */
+LODSNAPSHOT *lod_snapshot_retain(LODSNAPSHOT *snapshot);
+
+/* Release a reference to a snapshot, freeing it when the last reference
+ * is released (thread-safe)
+ */
+void lod_snapshot_release(LODSNAPSHOT *snapshot);
+
+/* Return the number of triples in a snapshot */
+size_t lod_snapshot_triples(LODSNAPSHOT *snapshot);
+
+/* Return the number of terms in a snapshot */
+size_t lod_snapshot_terms(LODSNAPSHOT *snapshot);
+
+/* Look up a URI in a snapshot's dictionary, returning LODSNAP_ANY if it
+ * isn't present
+ */
+LODSNAPID lod_snapshot_lookup(LODSNAPSHOT *snapshot, const char *uri);
+
+/* Determine whether a URI is the subject of any triples in a snapshot */
+int lod_snapshot_exists(LODSNAPSHOT *snapshot, const char *uri);
+
+/* Return the number of triples matching a pattern, in which any of the
+ * terms may be LODSNAP_ANY
+ */
+size_t lod_snapshot_count(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object);
+
+/* Return the first object of a property of a subject, or LODSNAP_ANY */
+LODSNAPID lod_snapshot_get(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate);
+
+/* Invoke a callback for each triple matching a pattern, in which any of
+ * the terms may be LODSNAP_ANY. Triples are visited in the order of
+ * whichever of the snapshot's indexes is used to answer the query.
+ */
+int lod_snapshot_foreach(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object, LODSNAPSHOTCB fn, void *userdata);
+
+/* Obtain the kind of a term in a snapshot */
+LODSNAPKIND lod_snapshot_kind(LODSNAPSHOT *snapshot, LODSNAPID id);
+
+/* Obtain the value of a term in a snapshot (a URI, blank node identifier
+ * or literal value); if len is non-NULL, it receives the value's length
+ */
+const char *lod_snapshot_value(LODSNAPSHOT *snapshot, LODSNAPID id, size_t *len);
+
+/* Obtain the language of a literal term in a snapshot, or NULL */
+const char *lod_snapshot_language(LODSNAPSHOT *snapshot, LODSNAPID id);
+
+/* Obtain the datatype URI of a literal term in a snapshot, or NULL */
+const char *lod_snapshot_datatype(LODSNAPSHOT *snapshot, LODSNAPID id);
+
+/* Create a new librdf node from a term in a snapshot */
+librdf_node *lod_snapshot_node(LODSNAPSHOT *snapshot, librdf_world *world, LODSNAPID id);
+
 #endif /*!LIBLOD_H_*/
 
@@ -202,13 +202,9 @@ resolve_uri(const char *uri, int mode)
 static int
 process_command(const char *command)
 {
-	librdf_world *world;
+	LODINSTANCE *instance;
 	librdf_serializer *serializer;
 	librdf_model *model;
-	librdf_node *node, *subj, *predicate;
-	librdf_stream *stream;
-	librdf_statement *query, *st;
-	librdf_uri *uri;
 
 	const char *doc;
 	char *s;
@@ -268,25 +264,28 @@ process_command(const char *command)
 			fprintf(stderr, "cannot print primary topic triples because no document has been fetched yet\n");
 			return 0;
 		}
-		world = lod_world(context);
-		model = lod_model(context);
-		subj = librdf_new_node_from_uri_string(world, (const unsigned char *) doc);
-		predicate = librdf_new_node_from_uri_string(world, (const unsigned char *) "http://xmlns.com/foaf/0.1/primaryTopic");
-		query = librdf_new_statement_from_nodes(world, subj, predicate, NULL);
-		stream = librdf_model_find_statements(model, query);
-		if(librdf_stream_end(stream))
+		instance = lod_document_primarytopic(context);
+		if(!instance)
+		{
+			if(lod_error(context))
+			{
+				fprintf(stderr, "failed to locate primary topic of <%s>: %s\n", doc, lod_errmsg(context));
+			}
+			else
+			{
+				fprintf(stderr, "failed to locate a foaf:primaryTopic predicate associated with document URI <%s>\n", doc);
+			}
+			return 0;
+		}
+		s = strdup((const char *) librdf_uri_as_string(lod_instance_uri(instance)));
+		lod_instance_destroy(instance);
+		if(!s)
 		{
-			fprintf(stderr, "failed to locate a foaf:primaryTopic predicate associated with document URI <%s>\n", doc);
-			librdf_free_statement(query);
-			librdf_free_stream(stream);
+			fprintf(stderr, "failed to duplicate primary topic URI: %s\n", strerror(errno));
 			return 0;
 		}
-		st = librdf_stream_get_object(stream);
-		node = librdf_statement_get_object(st);
-		uri = librdf_node_get_uri(node);
-		resolve_uri((const char *) librdf_uri_as_string(uri), LOD_FETCH_NEVER);
-		librdf_free_statement(query);
-		librdf_free_stream(stream);
+		resolve_uri(s, LOD_FETCH_NEVER);
+		free(s);
 		return 0;
 	}
 	if(!strcmp(command, "help"))
@@ -0,0 +1,173 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* An overlay is a context layered over an immutable snapshot of another
+ * context's model. The base publishes a snapshot when asked to (see
+ * lod_publish()), which is shared by every overlay created until the next
+ * is published, and each overlay's storage holds only the triples which
+ * have been added to it; queries against the overlay return both, without
+ * reference to the base context itself.
+ */
+
+static int lod_publish_locked_(LODCONTEXT *context);
+static LODCONTEXT *lod_overlay_create_(LODSNAPSHOT *snapshot);
+
+/* Publish a snapshot of the context's model for overlays */
+int
+lod_publish(LODCONTEXT *context)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_publish_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_publish(), with the context lock held */
+static int
+lod_publish_locked_(LODCONTEXT *context)
+{
+	LODSNAPSHOT *snapshot, *old;
+	unsigned long generation;
+
+	lod_state_(context)->error = 0;
+	generation = lod_generation(context);
+	if(!generation)
+	{
+		return -1;
+	}
+	pthread_mutex_lock(&(context->publish_lock));
+	snapshot = (context->published && context->published_generation == generation) ? lod_snapshot_retain(context->published) : NULL;
+	pthread_mutex_unlock(&(context->publish_lock));
+	/* Freezing takes time proportional to the size of the model, and so
+	 * it happens only if the model has changed since the last snapshot was
+	 * published, and without the publish lock held
+	 */
+	if(!snapshot)
+	{
+		snapshot = lod_freeze(context);
+		if(!snapshot)
+		{
+			return -1;
+		}
+	}
+	pthread_mutex_lock(&(context->publish_lock));
+	old = context->published;
+	context->published = snapshot;
+	context->published_generation = generation;
+	context->published_max_redirects = context->max_redirects;
+	context->published_spill_threshold = context->spill_threshold;
+	context->published_timeouts = context->timeouts;
+	context->published_fetch_uri = context->fetch_uri;
+	context->published_verbose = context->verbose;
+	pthread_mutex_unlock(&(context->publish_lock));
+	if(old)
+	{
+		lod_snapshot_release(old);
+	}
+	return 0;
+}
+
+/* Obtain a reference to the snapshot most recently published by a context */
+LODSNAPSHOT *
+lod_published(LODCONTEXT *context)
+{
+	LODSNAPSHOT *snapshot;
+
+	lod_state_(context)->error = 0;
+	pthread_mutex_lock(&(context->publish_lock));
+	snapshot = context->published ? lod_snapshot_retain(context->published) : NULL;
+	pthread_mutex_unlock(&(context->publish_lock));
+	return snapshot;
+}
+
+/* Create a context layered over the snapshot most recently published by
+ * another
+ */
+LODCONTEXT *
+lod_create_overlay(LODCONTEXT *base)
+{
+	LODCONTEXT *context;
+	LODSNAPSHOT *snapshot;
+
+	pthread_mutex_lock(&(base->publish_lock));
+	snapshot = base->published ? lod_snapshot_retain(base->published) : NULL;
+	pthread_mutex_unlock(&(base->publish_lock));
+	if(!snapshot)
+	{
+		lod_set_error_(base, "no snapshot has been published for overlays");
+		return NULL;
+	}
+	context = lod_overlay_create_(snapshot);
+	if(!context)
+	{
+		lod_snapshot_release(snapshot);
+		return NULL;
+	}
+	/* The base's configuration is inherited as of when it published */
+	pthread_mutex_lock(&(base->publish_lock));
+	context->max_redirects = base->published_max_redirects;
+	context->spill_threshold = base->published_spill_threshold;
+	context->timeouts = base->published_timeouts;
+	context->fetch_uri = base->published_fetch_uri;
+	context->verbose = base->published_verbose;
+	pthread_mutex_unlock(&(base->publish_lock));
+	return context;
+}
+
+/* Create a context layered over a snapshot */
+LODCONTEXT *
+lod_create_from_snapshot(LODSNAPSHOT *snapshot)
+{
+	LODCONTEXT *context;
+
+	snapshot = lod_snapshot_retain(snapshot);
+	context = lod_overlay_create_(snapshot);
+	if(!context)
+	{
+		lod_snapshot_release(snapshot);
+	}
+	return context;
+}
+
+/* Create a context which takes ownership of a reference to the snapshot
+ * it is layered over
+ */
+static LODCONTEXT *
+lod_overlay_create_(LODSNAPSHOT *snapshot)
+{
+	LODCONTEXT *context;
+
+	context = lod_create();
+	if(!context)
+	{
+		return NULL;
+	}
+	context->overlay = snapshot;
+	/* Building indexes would mean scanning the whole of the snapshot, and
+	 * so queries are answered by the storage instead
+	 */
+	context->index.flags = 0;
+	return context;
+}
@@ -23,6 +23,16 @@
 # include <string.h>
 # include <errno.h>
 # include <ctype.h>
+# include <stdint.h>
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/types.h>
+# include <sys/stat.h>
+# include <sys/mman.h>
+# include <pthread.h>
+# ifdef HAVE_ZLIB_H
+#  include <zlib.h>
+# endif
 
 # include <librdf.h>
 # include <curl/curl.h>
@@ -33,37 +43,783 @@
 
 # include "liblod.h"
 
-struct lod_context_struct
+/* Identifies a term within a context's interning table */
+typedef uint32_t LODTERMID;
+
+# define LOD_NOTERM                     ((LODTERMID) -1)
+
+/* Well-known URIs which are always interned, and whose term identifiers
+ * are therefore constant
+ */
+typedef enum
+{
+	LOD_FOAF_PRIMARYTOPIC,
+	LOD_OWL_SAMEAS,
+	/* The default label predicates, in priority order */
+	LOD_SKOS_PREFLABEL,
+	LOD_RDFS_LABEL,
+	LOD_SCHEMA_NAME,
+	LOD_FOAF_NAME,
+	LOD_DCT_TITLE,
+	LOD_DC_TITLE,
+	LOD_RDF_TYPE,
+	LOD_RDFS_SUBCLASSOF,
+	LOD_NWELLKNOWN
+} LODWELLKNOWN;
+
+/* Flags recorded against interned terms by the indexes */
+# define LODTERM_SUBJECT                (1<<0)
+
+/* An interned URI and (once it has been requested) its librdf node */
+typedef struct
+{
+	char *str;
+	size_t len;
+	uint64_t hash;
+	librdf_node *node;
+	unsigned int flags;
+} LODTERM;
+
+/* The table of interned URIs, which is tied to the context's librdf world */
+typedef struct
+{
+	LODTERM *terms;
+	size_t nterms;
+	size_t tsize;
+	/* Open-addressed hash of term identifiers */
+	LODTERMID *slots;
+	size_t nslots;
+} LODINTERN;
+
+/* A labelled edge between two interned terms */
+typedef struct
+{
+	LODTERMID from;
+	LODTERMID label;
+	LODTERMID to;
+	uint32_t next;
+} LODEDGE;
+
+# define LOD_NOEDGE                     ((uint32_t) -1)
+
+/* A set of edges, indexed by source term */
+typedef struct
+{
+	LODEDGE *edges;
+	size_t nedges;
+	size_t esize;
+	/* Open-addressed hash from source term to its most recent edge */
+	LODTERMID *keys;
+	uint32_t *heads;
+	size_t nkeys;
+	size_t nslots;
+} LODEDGES;
+
+/* A Bloom filter, and statistics about the queries made of it */
+typedef struct
+{
+	uint64_t *bits;
+	size_t nbits;
+	size_t capacity;
+	size_t count;
+	unsigned long queries;
+	unsigned long negatives;
+	unsigned long positives;
+	unsigned long false_positives;
+} LODBLOOM;
+
+/* owl:sameAs equivalence classes: union-find parents and ranks, and a
+ * circular list threading together the members of each class. Terms
+ * beyond the end of the arrays are implicitly in classes of their own.
+ */
+typedef struct
+{
+	LODTERMID *parent;
+	LODTERMID *next;
+	unsigned char *rank;
+	size_t size;
+} LODSAMEAS;
+
+/* The indexes maintained over the statements in a context's model */
+typedef struct
+{
+	/* The LODINDEX flags for the indexes to be maintained */
+	unsigned int flags;
+	/* The size of the model when the indexes were last complete, or -1 */
+	int size;
+	/* The storage's count of changes when the indexes were last complete,
+	 * and whether it is available: if it is, the indexes are exact,
+	 * otherwise only the size can be checked
+	 */
+	unsigned long changes;
+	int exact;
+	/* Set if the indexes must be rebuilt before they're next used */
+	int rebuild;
+	/* Subject URIs */
+	LODBLOOM subjects;
+	/* Pointer predicates registered in addition to foaf:primaryTopic, and
+	 * their term identifiers as of the last rebuild
+	 */
+	char **pointers;
+	LODTERMID *pointer_ids;
+	size_t npointers;
+	/* subject -> (pointer predicate, object) */
+	LODEDGES pointer_edges;
+	/* Co-referent URIs */
+	LODSAMEAS sameas;
+	/* Label predicates in priority order (if NULL, the defaults are
+	 * used), and their interned identifiers
+	 */
+	char **labels;
+	LODTERMID *label_ids;
+	size_t nlabels;
+	/* subject -> (label predicate rank, index into literals) */
+	LODEDGES label_edges;
+	librdf_node **literals;
+	size_t nliterals;
+	size_t literalsize;
+	/* subject -> (rdf:type, class), and class -> (rdf:type, subject) */
+	LODEDGES types;
+	LODEDGES members;
+	/* class -> (rdfs:subClassOf, superclass) */
+	LODEDGES superclasses;
+	/* The transitive closure of the above, in both directions, computed
+	 * when first needed after the hierarchy changes
+	 */
+	LODEDGES ancestors;
+	LODEDGES descendants;
+	int closure_valid;
+	/* object -> (predicate, subject) */
+	LODEDGES incoming;
+} LODINDEXES;
+
+/* A language range from an Accept-Language-style preference list */
+typedef struct
+{
+	char *range;
+	/* Quality value, in thousandths */
+	int q;
+} LODLANGRANGE;
+
+/* Metadata about a document which has been fetched */
+typedef struct
+{
+	char *uri;
+	time_t fetched;
+	char *etag;
+	/* The URIs which were requested in order to reach the document,
+	 * separated by spaces
+	 */
+	char *redirects;
+} LODDOCUMENT;
+
+/* The documents fetched by a context, with an open-addressed hash on URI */
+typedef struct
+{
+	LODDOCUMENT *docs;
+	size_t ndocs;
+	size_t size;
+	uint32_t *slots;
+	size_t nslots;
+} LODDOCUMENTS;
+
+/* No string, in a snapshot's string pool */
+# define LODSNAP_NOSTR                  ((uint32_t) -1)
+
+/* A term in a snapshot's dictionary: the strings are NUL-terminated, and
+ * held as offsets into the snapshot's string pool
+ */
+typedef struct
+{
+	uint32_t kind;
+	uint32_t value;
+	uint32_t length;
+	uint32_t language;
+	uint32_t datatype;
+} LODSNAPTERM;
+
+/* A triple in one of a snapshot's indexes, with its terms in the order of
+ * that index (e.g., predicate, object, subject for POS)
+ */
+typedef struct
+{
+	LODSNAPID k[3];
+} LODSNAPROW;
+
+/* Metadata about a document in a snapshot; the strings are offsets into
+ * the snapshot's string pool
+ */
+typedef struct
+{
+	uint64_t fetched;
+	uint32_t uri;
+	uint32_t etag;
+	uint32_t redirects;
+	uint32_t reserved;
+} LODSNAPDOC;
+
+struct lod_snapshot_struct
+{
+	int refcount;
+	/* The dictionary, sorted by kind and then value; kinds[k] is the
+	 * identifier of the first term of kind k
+	 */
+	LODSNAPTERM *terms;
+	uint32_t nterms;
+	uint32_t kinds[LODSNAP_NKINDS + 1];
+	char *strings;
+	size_t stringlen;
+	/* The triples, in each of the three orders */
+	LODSNAPROW *spo;
+	LODSNAPROW *pos;
+	LODSNAPROW *osp;
+	size_t ntriples;
+	/* Document metadata, sorted by URI */
+	LODSNAPDOC *docs;
+	size_t ndocs;
+	/* If the snapshot was loaded from a file, the read-only mapping which
+	 * holds all of the above
+	 */
+	void *map;
+	size_t maplen;
+};
+
+/* Snapshot files begin with this header, and each section which follows
+ * is aligned to 8 bytes; all values are in the byte order of the host
+ * which wrote the file, which must match that of the host reading it
+ */
+# define LODSNAP_MAGIC                  "LODSNAP"
+# define LODSNAP_VERSION                1
+# define LODSNAP_BYTEORDER              0x01020304
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteorder;
+	uint32_t nterms;
+	uint32_t kinds[LODSNAP_NKINDS + 1];
+	uint64_t stringlen;
+	uint64_t ntriples;
+	uint64_t ndocs;
+	/* The offsets of each section from the start of the file */
+	uint64_t terms;
+	uint64_t strings;
+	uint64_t spo;
+	uint64_t pos;
+	uint64_t osp;
+	uint64_t docs;
+} LODSNAPHEADER;
+
+/* State used while building a snapshot from a model */
+typedef struct
+{
+	LODSNAPTERM *terms;
+	size_t nterms;
+	size_t tsize;
+	uint64_t *hashes;
+	/* Open-addressed hash of term hashes to term indices */
+	uint32_t *slots;
+	size_t nslots;
+	char *strings;
+	size_t stringlen;
+	size_t stringsize;
+	LODSNAPROW *triples;
+	size_t ntriples;
+	size_t trsize;
+	LODSNAPDOC *docs;
+	size_t ndocs;
+} LODSNAPBUILDER;
+
+/* Each record in a journal begins with this header, which is followed by
+ * the document URI, ETag and redirect chain (none of which are
+ * terminated), and then the N-Quads data, which may be compressed
+ */
+# define LODJ_MAGIC                     "LODJ"
+# define LODJREC_DEFLATE                (1<<0)
+
+typedef struct
+{
+	char magic[4];
+	uint32_t flags;
+	uint64_t fetched;
+	/* FNV-1a hash of everything following the header */
+	uint64_t check;
+	uint32_t urilen;
+	uint32_t etaglen;
+	uint32_t redirectslen;
+	/* The stored and uncompressed lengths of the data */
+	uint32_t datalen;
+	uint32_t rawlen;
+	/* The record's sequence number, which is used to label its blank
+	 * nodes (zero in journals written before records were numbered)
+	 */
+	uint32_t seq;
+} LODJOURNALHEADER;
+
+/* A document's most recent record, used while compacting a journal */
+typedef struct
+{
+	uint64_t hash;
+	char *uri;
+	size_t len;
+	off_t last;
+} LODJOURNALDOC;
+
+/* A context's write-ahead journal */
+typedef struct
+{
+	char *path;
+	int fd;
+	unsigned int flags;
+	/* N-Quads for the document currently being processed */
+	char *buf;
+	size_t len;
+	size_t size;
+	int replaying;
+	/* The sequence number of the record being collected, which is one
+	 * greater than that of any record already in the journal
+	 */
+	uint32_t seq;
+	/* Held while appending, and while a compacted journal replaces this
+	 * one
+	 */
+	pthread_mutex_t lock;
+	int lock_init;
+	/* The journal size following the last compaction */
+	off_t compacted;
+	/* The background compaction thread, if one has been started */
+	pthread_t thread;
+	int thread_started;
+	int thread_done;
+} LODJOURNAL;
+
+/* The name under which the subject-clustered storage module is registered */
+# define LOD_CLUSTERED_STORAGE          "lod-clustered"
+
+/* A term held by the subject-clustered storage */
+typedef struct
+{
+	librdf_node *node;
+	uint64_t hash;
+	/* The term's cluster, if it is a subject, or LOD_NOTERM */
+	LODTERMID cluster;
+	/* The number of triples whose graph is this term */
+	size_t graph_count;
+} LODCLTERM;
+
+/* A triple within a cluster; the graph is LOD_NOTERM if there is none */
+typedef struct
+{
+	LODTERMID predicate;
+	LODTERMID object;
+	LODTERMID graph;
+} LODCLTRIPLE;
+
+/* The triples of a single subject, held contiguously and ordered by
+ * (predicate, object, graph)
+ */
+typedef struct
+{
+	LODTERMID subject;
+	LODCLTRIPLE *triples;
+	size_t count;
+	size_t size;
+	/* Set when triples have been appended out of order */
+	int unsorted;
+} LODCLUSTER;
+
+/* An instance of the subject-clustered storage */
+typedef struct
 {
 	librdf_world *world;
+	LODCLTERM *terms;
+	size_t nterms;
+	size_t termsize;
+	/* Open-addressed table of term identifiers + 1, keyed by term hash */
+	LODTERMID *slots;
+	size_t nslots;
+	LODCLUSTER *clusters;
+	size_t nclusters;
+	size_t clustersize;
+	/* Clusters which must be sorted before they are next read */
+	LODTERMID *dirty;
+	size_t ndirty;
+	size_t dirtysize;
+	/* The total number of triples */
+	size_t count;
+	/* Bumped whenever a triple is added or removed */
+	unsigned long changes;
+	/* For an overlay, the immutable snapshot which lies beneath the
+	 * triples held here; those already in it are never added
+	 */
+	LODSNAPSHOT *base;
+} LODCLSTORE;
+
+/* A stream (or, for graphs, an iterator) over the clustered storage */
+typedef struct
+{
 	librdf_storage *storage;
-	librdf_model *model;
-	CURL *ch;
-	struct curl_slist *headers;
+	LODCLSTORE *store;
+	librdf_statement *statement;
+	/* The range of clusters being scanned, and the position within it */
+	size_t cluster;
+	size_t last;
+	size_t pos;
+	/* The terms to match, or LOD_NOTERM for any */
+	LODTERMID predicate;
+	LODTERMID object;
+	LODTERMID graph;
+	int match_graph;
+	/* Once the store's own triples have been visited, the range of rows
+	 * of the base snapshot which match, in the given order (see
+	 * lod_snapshot_match_())
+	 */
+	LODSNAPROW *rows;
+	size_t row;
+	size_t end;
+	int order;
+	int in_base;
+	int done;
+} LODCLSTREAM;
+
+/* A context's storage configuration (see LODSTORAGECONFIG) */
+typedef struct
+{
+	LODSTORETYPE type;
+	char *path;
+	char *name;
+	char *options;
+	LODSYNCPOLICY sync;
+	/* Discard existing contents when the storage is next opened */
+	int create;
+	/* Whether a bulk load is in progress, and whether it began a
+	 * storage transaction
+	 */
+	int bulk;
+	int transaction;
+	/* Set if the storage most recently opened is the clustered module */
+	int clustered;
+} LODSTORE;
+
+typedef struct lod_state_struct LODSTATE;
+typedef struct lod_thread_struct LODTHREAD;
+
+/* The resolution state of a thread using a context: each thread sees its
+ * own subject chain, status and error
+ */
+struct lod_state_struct
+{
+	LODCONTEXT *context;
 	char *subject;
 	char *document;
 	long status;
 	int error;
 	char *errmsg;
-	int max_redirects;
 	char **subjects;	
 	int nsubjects;
+	/* The URIs requested by the fetch in progress, separated by spaces */
+	const char *chain;
+	/* The thread's own cURL handle, used unless one has been supplied via
+	 * lod_set_curl()
+	 */
+	CURL *ch;
+	/* The thread's own librdf world, used to parse payloads without the
+	 * context lock held
+	 */
+	librdf_world *world;
+	/* The number of times the thread holds the context lock */
+	int depth;
+	/* The priority of the thread's fetches */
+	LODPRIORITY priority;
+	/* Where the most recent resolution ran out of time, if it did */
+	LODTIMEOUTPHASE timeout;
+	/* The context's list of the states of every thread using it */
+	LODSTATE *prev;
+	LODSTATE *next;
+	/* The thread's list of its states for every context it has used */
+	LODTHREAD *thread;
+	LODSTATE *thread_next;
+};
+
+/* A thread's states, which is the value of the single process-wide
+ * thread-specific key; the lock is held while the thread searches the
+ * list, and while another thread removes a state from it
+ */
+struct lod_thread_struct
+{
+	pthread_mutex_t lock;
+	LODSTATE *states;
+};
+
+/* A subject followed while fetching a document (see LODFLIGHT) */
+typedef struct
+{
+	char *uri;
+	/* Whether the fragment of the subject being resolved is applied */
+	int replace;
+} LODFLIGHTFOLLOW;
+
+/* A fetch in progress, which other threads resolving subjects within the
+ * same document wait for, and whose outcome they adopt, rather than
+ * fetching it themselves; protected by the context lock
+ */
+typedef struct lod_flight_struct LODFLIGHT;
+
+struct lod_flight_struct
+{
+	/* The document URI, without any fragment */
+	char *uri;
+	/* The fetching thread, and each waiting thread, holds a reference */
+	int refs;
+	int done;
+	/* The outcome of the fetch */
+	int result;
+	long status;
+	char *document;
+	char *errmsg;
+	LODFLIGHTFOLLOW *follows;
+	size_t nfollows;
+	/* Set if the outcome couldn't be recorded in full */
+	int incomplete;
+	/* The most urgent priority of the threads waiting for the fetch */
+	LODPRIORITY priority;
+	LODTIMEOUTPHASE timeout;
+	LODFLIGHT *next;
+};
+
+/* A response queued for processing by a context's parse pool */
+typedef struct lod_parse_task_struct LODPARSETASK;
+
+struct lod_parse_task_struct
+{
+	LODRESPONSE *response;
+	LODRESPONSECB callback;
+	void *userdata;
+	LODPARSETASK *next;
+};
+
+/* The threads which process responses submitted to a context */
+typedef struct
+{
+	pthread_mutex_t lock;
+	/* Signalled when a task is queued, or the pool is stopping */
+	pthread_cond_t work;
+	/* Signalled when the last outstanding task has completed */
+	pthread_cond_t idle;
+	pthread_t *threads;
+	unsigned int nthreads;
+	LODPARSETASK *head;
+	LODPARSETASK *tail;
+	/* The number of tasks which are queued or in progress */
+	size_t pending;
+	int stopping;
+} LODPARSEPOOL;
+
+/* A stream over the triples of a parsed batch (see lod_parse_()), whose
+ * terms have been converted to nodes in the context's world
+ */
+typedef struct
+{
+	LODSNAPBUILDER *batch;
+	librdf_node **nodes;
+	librdf_statement *statement;
+	size_t pos;
+} LODBATCHSTREAM;
+
+/* A request waiting for the scheduler to allow it to start, or in
+ * progress
+ */
+typedef struct lod_sched_waiter_struct LODSCHEDWAITER;
+
+struct lod_sched_waiter_struct
+{
+	LODCONTEXT *context;
+	LODPRIORITY priority;
+	/* The index of the request's host, or (size_t) -1 if it couldn't be
+	 * scheduled
+	 */
+	size_t host;
+	int granted;
+	/* Set if an interactive request has claimed the slot of this
+	 * (background) request, and once its transfer has been interrupted
+	 */
+	int preempted;
+	int aborted;
+	/* The neighbouring requests in the host's queue, or in the list of
+	 * requests in progress
+	 */
+	LODSCHEDWAITER *prev;
+	LODSCHEDWAITER *next;
+};
+
+/* A host known to the scheduler */
+typedef struct
+{
+	/* The lowercased authority of the host's URIs */
+	char *name;
+	LODHOSTPOLICY policy;
+	int has_policy;
+	/* The token bucket, or -1 if it has not been filled; refilled is the
+	 * time the level was last updated
+	 */
+	double tokens;
+	double refilled;
+	/* The time the most recent request was started */
+	double last;
+	/* The requests waiting to be started, and the last interactive one */
+	LODSCHEDWAITER *head;
+	LODSCHEDWAITER *tail;
+	LODSCHEDWAITER *urgent;
+	/* The number of requests pre-empted because of the host's own limit */
+	unsigned int preempting;
+	/* The neighbouring hosts in the ring of hosts with waiting requests */
+	size_t prev;
+	size_t next;
+	LODFETCHSTATS stats;
+} LODSCHEDHOST;
+
+/* The scheduler which admits fetches (see sched.c) */
+typedef struct
+{
+	pthread_mutex_t lock;
+	/* Signalled when requests are granted; waiters also wake when a
+	 * host which is being held back becomes ready
+	 */
+	pthread_cond_t cond;
+	/* The maximum number of fetches in progress, or zero for no limit */
+	unsigned int max_fetches;
+	/* The policy for hosts which don't have their own */
+	LODHOSTPOLICY policy;
+	LODSCHEDHOST *hosts;
+	size_t nhosts;
+	size_t size;
+	/* Open-addressed hash of host names to their indices */
+	uint32_t *slots;
+	size_t nslots;
+	/* The next host in the ring to be visited, and the ring's length */
+	size_t ring;
+	size_t nactive;
+	/* The requests in progress */
+	LODSCHEDWAITER *active;
+	/* The number of requests pre-empted because of max_fetches */
+	unsigned int preempting;
+	LODFETCHSTATS stats;
+} LODSCHED;
+
+/* A transfer made by lod_fetch_curl_() */
+typedef struct
+{
+	LODRESPONSE *response;
+	LODSCHEDWAITER *slot;
+	const LODTIMEOUTS *timeouts;
+	/* When the resolution must be complete (or zero), and when the
+	 * transfer began, on the monotonic clock
+	 */
+	double deadline;
+	double started;
+	/* Set once any of the response has been received */
+	int received;
+	/* Set if the transfer was abandoned because of a time limit */
+	LODTIMEOUTPHASE timeout;
+} LODTRANSFER;
+
+struct lod_context_struct
+{
+	librdf_world *world;
+	librdf_storage *storage;
+	librdf_model *model;
+	CURL *ch;
+	struct curl_slist *headers;
+	int max_redirects;
 	char *accept;
+	size_t spill_threshold;
+	LODTIMEOUTS timeouts;
+	/* Bumped whenever the model is modified, or replaced */
+	unsigned long generation;
+	/* The model size when the generation was last checked */
+	int generation_size;
+	LODINTERN intern;
+	LODINDEXES index;
+	LODDOCUMENTS documents;
+	LODJOURNAL journal;
+	LODSTORE store;
+	LODPARSEPOOL parse;
+	LODSCHED sched;
+	/* Language preferences for label selection */
+	LODLANGRANGE *languages;
+	size_t nlanguages;
 	LODFETCHURI fetch_uri;
+	/* Held (recursively) while the model and everything derived from it
+	 * is in use; released while fetching
+	 */
+	pthread_mutex_t lock;
+	/* The state of every thread which has used the context */
+	LODSTATE *states;
+	/* Used if a thread's state can't be allocated */
+	LODSTATE fallback;
+	/* Fetches in progress, and the condition signalled when one ends */
+	LODFLIGHT *flights;
+	pthread_cond_t flight_cond;
+	/* If this is an overlay, the snapshot of the base model beneath it */
+	LODSNAPSHOT *overlay;
+	/* What was most recently published for overlays by lod_publish(): a
+	 * snapshot of the model, the generation it reflects, and the
+	 * configuration overlays inherit. This has its own lock, so that
+	 * overlays can be created without waiting for the context lock.
+	 */
+	pthread_mutex_t publish_lock;
+	LODSNAPSHOT *published;
+	unsigned long published_generation;
+	int published_max_redirects;
+	size_t published_spill_threshold;
+	LODTIMEOUTS published_timeouts;
+	LODFETCHURI published_fetch_uri;
+	int published_verbose;
 	int verbose:1;
 	int world_alloc:1;
 	int storage_alloc:1;
 	int model_alloc:1;
-	int ch_alloc:1;
 };
 
+/* A property of an instance while it is being materialised; seq records
+ * the order in which the model returned it
+ */
+typedef struct
+{
+	LODTERMID predicate;
+	size_t seq;
+	librdf_node *object;
+} LODPROP;
+
 struct lod_instance_struct
 {
 	LODCONTEXT *context;
 	librdf_statement *query;
 	librdf_node *subject;
+	/* The properties of the subject, materialised on first use as parallel
+	 * arrays ordered by predicate term identifier
+	 */
+	LODTERMID *predicates;
+	librdf_node **objects;
+	size_t nprops;
+	/* The model generation when the properties were materialised, or 0 */
+	unsigned long props_generation;
+	/* Whether the subject exists, as of exists_generation (or 0) */
+	int exists;
+	unsigned long exists_generation;
 };
 
+typedef enum
+{
+	/* The payload is a heap block owned by the response */
+	LODPAYLOAD_BUFFER,
+	/* The payload is owned by the caller, and released via a callback */
+	LODPAYLOAD_EXTERNAL,
+	/* The payload is a read-only mapping of a file */
+	LODPAYLOAD_MAPPED
+} LODPAYLOADKIND;
+
 struct lod_response_struct
 {
 	/* HTTP status, or zero for a low-level error */
@@ -74,6 +830,17 @@ struct lod_response_struct
 	char *buf;
 	size_t bufsize;
 	size_t buflen;
+	/* How the payload buffer is owned */
+	LODPAYLOADKIND bufkind;
+	LODPAYLOADRELEASE release;
+	void *release_data;
+	/* Payloads larger than spill_threshold are written in their entirety
+	 * to a temporary file, with only the leading bytes (for sniffing)
+	 * retained in buf
+	 */
+	size_t spill_threshold;
+	FILE *spill;
+	size_t spilllen;
 	/* The 'effective URI' */
 	char *uri;
 	/* The redirect target URI */
@@ -86,12 +853,102 @@ struct lod_response_struct
 };
 
 int lod_reset_(LODCONTEXT *context);
+int lod_reset_state_(LODSTATE *state);
+LODSTATE *lod_state_(LODCONTEXT *context);
+void lod_lock_(LODCONTEXT *context);
+void lod_unlock_(LODCONTEXT *context);
 int lod_set_error_(LODCONTEXT *context, const char *msg);
 int lod_fetch_(LODCONTEXT *context);
 int lod_html_discover_(LODCONTEXT *context, LODRESPONSE *response, const char *url, char **newurl);
 int lod_push_subject_(LODCONTEXT *context, char *uri);
 int lod_sniff_(LODCONTEXT *context, LODRESPONSE *response);
+FILE *lod_response_rewind_(LODRESPONSE *response);
+
+uint64_t lod_hash_(const char *str, size_t len);
+LODTERMID lod_intern_(LODCONTEXT *context, const char *uri, size_t len);
+LODTERMID lod_intern_find_(LODCONTEXT *context, const char *uri, size_t len);
+LODTERMID lod_intern_node_id_(LODCONTEXT *context, librdf_node *node, int create);
+librdf_node *lod_intern_node_(LODCONTEXT *context, LODTERMID id);
+librdf_node *lod_intern_copy_(LODCONTEXT *context, const char *uri);
+librdf_node *lod_intern_probe_(LODCONTEXT *context, const char *uri);
+const char *lod_wellknown_uri_(LODTERMID id);
+void lod_intern_reset_(LODCONTEXT *context);
+int lod_termids_append_(LODTERMID **ids, size_t *count, size_t *size, LODTERMID id);
+long lod_termids_uris_(LODCONTEXT *context, LODTERMID *ids, size_t count, const char **uris, size_t max);
+
+int lod_bloom_init_(LODBLOOM *bloom, size_t capacity);
+void lod_bloom_reset_(LODBLOOM *bloom);
+void lod_bloom_add_(LODBLOOM *bloom, uint64_t hash);
+int lod_bloom_test_(LODBLOOM *bloom, uint64_t hash);
+
+int lod_edges_add_(LODEDGES *edges, LODTERMID from, LODTERMID label, LODTERMID to);
+uint32_t lod_edges_first_(LODEDGES *edges, LODTERMID from);
+int lod_edges_exists_(LODEDGES *edges, LODTERMID from, LODTERMID label, LODTERMID to);
+void lod_edges_reset_(LODEDGES *edges);
+
+int lod_sameas_union_(LODSAMEAS *sameas, LODTERMID a, LODTERMID b);
+LODTERMID lod_sameas_find_(LODSAMEAS *sameas, LODTERMID id);
+LODTERMID lod_sameas_next_(LODSAMEAS *sameas, LODTERMID id);
+void lod_sameas_reset_(LODSAMEAS *sameas);
+
+long lod_label_rank_(LODINDEXES *index, LODTERMID predicate);
+int lod_label_add_(LODCONTEXT *context, LODTERMID subject, LODTERMID predicate, librdf_node *object);
+void lod_label_reset_(LODINDEXES *index);
+void lod_languages_free_(LODCONTEXT *context);
+
+void lod_snapshot_free_(LODSNAPSHOT *snapshot);
+int lod_snapbuild_add_(LODSNAPBUILDER *b, librdf_statement *statement);
+void lod_snapbuild_free_(LODSNAPBUILDER *b);
+librdf_node *lod_snapterm_node_(const char *strings, const LODSNAPTERM *term, librdf_world *world);
+LODSNAPID lod_snapshot_find_(LODSNAPSHOT *snapshot, librdf_node *node);
+LODSNAPROW *lod_snapshot_match_(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object, size_t *start, size_t *end, int *order);
+
+int lod_document_record_(LODCONTEXT *context, const char *uri, time_t fetched, const char *etag, const char *redirects);
+void lod_documents_free_(LODCONTEXT *context);
+
+void lod_journal_begin_(LODCONTEXT *context);
+int lod_journal_statement_(LODCONTEXT *context, librdf_statement *statement);
+int lod_journal_commit_(LODCONTEXT *context, const char *uri, time_t fetched, const char *etag, const char *redirects);
+void lod_journal_close_(LODCONTEXT *context);
+
+int lod_sched_init_(LODCONTEXT *context);
+void lod_sched_free_(LODCONTEXT *context);
+int lod_sched_acquire_(LODCONTEXT *context, const char *uri, LODSCHEDWAITER *waiter, LODPRIORITY priority, double deadline);
+int lod_sched_release_(LODCONTEXT *context, LODSCHEDWAITER *waiter);
+int lod_sched_preempted_(LODSCHEDWAITER *waiter);
+double lod_sched_now_(void);
+
+int lod_clustered_register_(librdf_world *world);
+int lod_clustered_attach_(librdf_storage *storage, LODSNAPSHOT *base);
+unsigned long lod_clustered_changes_(librdf_storage *storage);
+
+int lod_parse_init_(LODCONTEXT *context);
+int lod_parse_(LODCONTEXT *context, LODRESPONSE *response, LODSNAPBUILDER *batch);
+int lod_parse_merge_(LODCONTEXT *context, librdf_world *world, librdf_model *model, LODSNAPBUILDER *batch);
+void lod_parse_free_(LODCONTEXT *context);
+
+librdf_storage *lod_storage_open_(LODCONTEXT *context, librdf_world *world);
+int lod_storage_document_(LODCONTEXT *context);
+int lod_storage_changes_(LODCONTEXT *context, librdf_model *model, unsigned long *changes);
+void lod_storage_free_(LODCONTEXT *context);
+
+int lod_types_add_(LODCONTEXT *context, LODTERMID subject, LODTERMID predicate, LODTERMID object);
+void lod_types_reset_(LODINDEXES *index);
+
+unsigned long lod_generation_(LODCONTEXT *context, librdf_model *model);
+void lod_generation_bump_(LODCONTEXT *context, librdf_model *model);
+
+int lod_model_add_stream_(LODCONTEXT *context, librdf_model *model, librdf_stream *stream);
+int lod_index_add_(LODCONTEXT *context, librdf_statement *statement);
+int lod_index_sync_(LODCONTEXT *context, librdf_model *model);
+int lod_index_probe_(LODCONTEXT *context, librdf_model *model, const char *uri);
+int lod_index_pointer_(LODCONTEXT *context, librdf_model *model, LODTERMID predicate);
+int lod_index_ready_(LODCONTEXT *context, librdf_model *model, unsigned int flags);
+void lod_index_reset_(LODCONTEXT *context);
+void lod_index_free_(LODCONTEXT *context);
 
 LODINSTANCE *lod_instance_create_(LODCONTEXT *context, librdf_statement *query, librdf_node *subject);
+LODINSTANCE *lod_instance_from_term_(LODCONTEXT *context, LODTERMID id);
+int lod_model_related_(LODCONTEXT *context, librdf_model *model, librdf_node *node, LODTERMID predicate, int inbound, LODTERMID **ids, size_t *count, size_t *size);
 
 #endif /*!P_LIBLOD_H_*/
@@ -0,0 +1,495 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* Payloads are parsed by each thread in its own librdf world (which, unlike
+ * the context's, is never used by any other thread), into a batch of
+ * statements held as a term dictionary and an array of triples. Only
+ * adding the batch to the model requires the context lock. Responses may
+ * also be submitted to a pool of threads which process them in this way.
+ */
+
+static librdf_world *lod_parse_world_(LODCONTEXT *context, LODSTATE *state);
+static int lod_parse_stream_(LODCONTEXT *context, librdf_world *world, LODRESPONSE *response, LODSNAPBUILDER *batch);
+static int lod_parse_stop_(LODCONTEXT *context);
+static void *lod_parse_worker_(void *arg);
+static int lod_batch_end_(void *context);
+static int lod_batch_next_(void *context);
+static void *lod_batch_get_(void *context, int flags);
+static void lod_batch_done_(void *context);
+
+/* Start a pool of threads which process submitted responses */
+int
+lod_set_parse_threads(LODCONTEXT *context, unsigned int nthreads)
+{
+	LODPARSEPOOL *pool;
+	pthread_t *threads;
+	unsigned int c;
+
+	lod_state_(context)->error = 0;
+	pool = &(context->parse);
+	lod_parse_stop_(context);
+	if(!nthreads)
+	{
+		return 0;
+	}
+	threads = (pthread_t *) calloc(nthreads, sizeof(pthread_t));
+	if(!threads)
+	{
+		lod_set_error_(context, strerror(errno));
+		return -1;
+	}
+	for(c = 0; c < nthreads; c++)
+	{
+		if(pthread_create(&(threads[c]), NULL, lod_parse_worker_, (void *) context))
+		{
+			break;
+		}
+	}
+	/* Responses are only queued once there are threads to process them */
+	pthread_mutex_lock(&(pool->lock));
+	pool->threads = threads;
+	pool->nthreads = c;
+	pthread_mutex_unlock(&(pool->lock));
+	if(c < nthreads)
+	{
+		lod_set_error_(context, "failed to start parse thread");
+		lod_parse_stop_(context);
+		return -1;
+	}
+	return 0;
+}
+
+/* Submit a response to be processed by the parse pool */
+int
+lod_response_submit(LODCONTEXT *context, LODRESPONSE *response, LODRESPONSECB callback, void *userdata)
+{
+	LODPARSEPOOL *pool;
+	LODPARSETASK *task;
+	LODRESULT r;
+
+	lod_state_(context)->error = 0;
+	pool = &(context->parse);
+	pthread_mutex_lock(&(pool->lock));
+	if(!pool->nthreads)
+	{
+		pthread_mutex_unlock(&(pool->lock));
+		r = lod_response_process(context, response);
+		if(callback)
+		{
+			callback(context, response, r, userdata);
+		}
+		return 0;
+	}
+	task = (LODPARSETASK *) calloc(1, sizeof(LODPARSETASK));
+	if(!task)
+	{
+		pthread_mutex_unlock(&(pool->lock));
+		lod_set_error_(context, strerror(errno));
+		return -1;
+	}
+	task->response = response;
+	task->callback = callback;
+	task->userdata = userdata;
+	if(pool->tail)
+	{
+		pool->tail->next = task;
+	}
+	else
+	{
+		pool->head = task;
+	}
+	pool->tail = task;
+	pool->pending++;
+	pthread_cond_signal(&(pool->work));
+	pthread_mutex_unlock(&(pool->lock));
+	return 0;
+}
+
+/* Wait until every submitted response has been processed */
+int
+lod_parse_wait(LODCONTEXT *context)
+{
+	LODPARSEPOOL *pool;
+
+	pool = &(context->parse);
+	pthread_mutex_lock(&(pool->lock));
+	while(pool->pending)
+	{
+		pthread_cond_wait(&(pool->idle), &(pool->lock));
+	}
+	pthread_mutex_unlock(&(pool->lock));
+	return 0;
+}
+
+/* Parse the payload of a response into a batch, using the calling thread's
+ * own librdf world
+ */
+int
+lod_parse_(LODCONTEXT *context, LODRESPONSE *response, LODSNAPBUILDER *batch)
+{
+	LODSTATE *state;
+	librdf_world *world;
+	int r;
+
+	state = lod_state_(context);
+	if(state == &(context->fallback))
+	{
+		/* The fallback state (and its world) may be shared by several
+		 * threads, and so can only be used with the lock held
+		 */
+		lod_lock_(context);
+		world = lod_parse_world_(context, state);
+		r = world ? lod_parse_stream_(context, world, response, batch) : -1;
+		lod_unlock_(context);
+		return r;
+	}
+	world = lod_parse_world_(context, state);
+	if(!world)
+	{
+		return -1;
+	}
+	return lod_parse_stream_(context, world, response, batch);
+}
+
+/* Add the statements in a parsed batch to the model, via liblod so that the
+ * indexes and journal are updated; blank nodes are given new identifiers,
+ * so that they can't collide with those already in the model
+ */
+int
+lod_parse_merge_(LODCONTEXT *context, librdf_world *world, librdf_model *model, LODSNAPBUILDER *batch)
+{
+	LODBATCHSTREAM *bs;
+	librdf_stream *stream;
+	size_t c;
+	int r;
+
+	bs = (LODBATCHSTREAM *) calloc(1, sizeof(LODBATCHSTREAM));
+	if(!bs)
+	{
+		lod_set_error_(context, strerror(errno));
+		return -1;
+	}
+	bs->batch = batch;
+	bs->nodes = (librdf_node **) calloc(batch->nterms ? batch->nterms : 1, sizeof(librdf_node *));
+	bs->statement = librdf_new_statement(world);
+	if(!bs->nodes || !bs->statement)
+	{
+		lod_set_error_(context, "failed to allocate statement batch");
+		lod_batch_done_(bs);
+		return -1;
+	}
+	for(c = 0; c < batch->nterms; c++)
+	{
+		if(batch->terms[c].kind == LODSNAP_BLANK)
+		{
+			bs->nodes[c] = librdf_new_node_from_blank_identifier(world, NULL);
+		}
+		else
+		{
+			bs->nodes[c] = lod_snapterm_node_(batch->strings, &(batch->terms[c]), world);
+		}
+		if(!bs->nodes[c])
+		{
+			lod_set_error_(context, "failed to create librdf node");
+			lod_batch_done_(bs);
+			return -1;
+		}
+	}
+	stream = librdf_new_stream(world, (void *) bs, lod_batch_end_, lod_batch_next_, lod_batch_get_, lod_batch_done_);
+	if(!stream)
+	{
+		lod_set_error_(context, "failed to create librdf stream");
+		lod_batch_done_(bs);
+		return -1;
+	}
+	r = lod_model_add_stream_(context, model, stream);
+	librdf_free_stream(stream);
+	return r;
+}
+
+/* Stop the parse pool, once every submitted response has been processed */
+void
+lod_parse_free_(LODCONTEXT *context)
+{
+	lod_parse_stop_(context);
+	pthread_cond_destroy(&(context->parse.idle));
+	pthread_cond_destroy(&(context->parse.work));
+	pthread_mutex_destroy(&(context->parse.lock));
+}
+
+/* Initialise a new context's parse pool (which has no threads) */
+int
+lod_parse_init_(LODCONTEXT *context)
+{
+	LODPARSEPOOL *pool;
+
+	pool = &(context->parse);
+	if(pthread_mutex_init(&(pool->lock), NULL))
+	{
+		return -1;
+	}
+	if(pthread_cond_init(&(pool->work), NULL))
+	{
+		pthread_mutex_destroy(&(pool->lock));
+		return -1;
+	}
+	if(pthread_cond_init(&(pool->idle), NULL))
+	{
+		pthread_cond_destroy(&(pool->work));
+		pthread_mutex_destroy(&(pool->lock));
+		return -1;
+	}
+	return 0;
+}
+
+/* Obtain a thread's parsing world, creating it if needed */
+static librdf_world *
+lod_parse_world_(LODCONTEXT *context, LODSTATE *state)
+{
+	if(state->world)
+	{
+		return state->world;
+	}
+	state->world = librdf_new_world();
+	if(!state->world)
+	{
+		lod_set_error_(context, "failed to construct new librdf_world");
+		return NULL;
+	}
+	librdf_world_open(state->world);
+	/* Diagnostics are reported via lod_error() on the parsing thread, as
+	 * they are for the context's own world
+	 */
+	librdf_world_set_logger(state->world, (void *) context, lod_librdf_logger);
+	return state->world;
+}
+
+/* Parse a payload into a batch in the supplied world */
+static int
+lod_parse_stream_(LODCONTEXT *context, librdf_world *world, LODRESPONSE *response, LODSNAPBUILDER *batch)
+{
+	librdf_parser *parser;
+	librdf_uri *baseuri;
+	librdf_stream *stream;
+	FILE *f;
+	int r;
+
+	parser = librdf_new_parser(world, NULL, response->type, NULL);
+	if(!parser)
+	{
+		lod_set_error_(context, "failed to create RDF parser");
+		return -1;
+	}
+	baseuri = librdf_new_uri(world, (const unsigned char *) lod_state_(context)->document);
+	if(!baseuri)
+	{
+		lod_set_error_(context, "failed to create RDF URI");
+		librdf_free_parser(parser);
+		return -1;
+	}
+	stream = NULL;
+	if(response->spill)
+	{
+		/* Stream the payload from the temporary file */
+		if((f = lod_response_rewind_(response)))
+		{
+			stream = librdf_parser_parse_file_handle_as_stream(parser, f, 0, baseuri);
+			if(!stream)
+			{
+				lod_set_error_(context, "failed to parse payload");
+			}
+		}
+		else
+		{
+			lod_set_error_(context, "failed to rewind spilled payload");
+		}
+	}
+	else
+	{
+		stream = librdf_parser_parse_counted_string_as_stream(parser, (unsigned char *) response->buf, response->buflen, baseuri);
+		if(!stream)
+		{
+			lod_set_error_(context, "failed to parse payload");
+		}
+	}
+	r = stream ? 0 : -1;
+	if(stream)
+	{
+		for(; !librdf_stream_end(stream); librdf_stream_next(stream))
+		{
+			if(lod_snapbuild_add_(batch, librdf_stream_get_object(stream)))
+			{
+				lod_set_error_(context, "failed to add statement to batch");
+				r = -1;
+				break;
+			}
+		}
+		librdf_free_stream(stream);
+	}
+	librdf_free_uri(baseuri);
+	librdf_free_parser(parser);
+	return r;
+}
+
+/* Stop and join the pool's threads, which first process anything which
+ * remains queued
+ */
+static int
+lod_parse_stop_(LODCONTEXT *context)
+{
+	LODPARSEPOOL *pool;
+	pthread_t *threads;
+	unsigned int c, nthreads;
+
+	pool = &(context->parse);
+	/* Responses submitted from now on are processed immediately */
+	pthread_mutex_lock(&(pool->lock));
+	threads = pool->threads;
+	nthreads = pool->nthreads;
+	pool->threads = NULL;
+	pool->nthreads = 0;
+	pool->stopping = 1;
+	pthread_cond_broadcast(&(pool->work));
+	pthread_mutex_unlock(&(pool->lock));
+	for(c = 0; c < nthreads; c++)
+	{
+		pthread_join(threads[c], NULL);
+	}
+	free(threads);
+	pthread_mutex_lock(&(pool->lock));
+	pool->stopping = 0;
+	pthread_mutex_unlock(&(pool->lock));
+	return 0;
+}
+
+/* The body of each of the pool's threads */
+static void *
+lod_parse_worker_(void *arg)
+{
+	LODCONTEXT *context;
+	LODPARSEPOOL *pool;
+	LODPARSETASK *task;
+	LODRESULT r;
+
+	context = (LODCONTEXT *) arg;
+	pool = &(context->parse);
+	pthread_mutex_lock(&(pool->lock));
+	for(;;)
+	{
+		while(!pool->head && !pool->stopping)
+		{
+			pthread_cond_wait(&(pool->work), &(pool->lock));
+		}
+		task = pool->head;
+		if(!task)
+		{
+			break;
+		}
+		pool->head = task->next;
+		if(!pool->head)
+		{
+			pool->tail = NULL;
+		}
+		pthread_mutex_unlock(&(pool->lock));
+		r = lod_response_process(context, task->response);
+		if(task->callback)
+		{
+			task->callback(context, task->response, r, task->userdata);
+		}
+		free(task);
+		pthread_mutex_lock(&(pool->lock));
+		pool->pending--;
+		if(!pool->pending)
+		{
+			pthread_cond_broadcast(&(pool->idle));
+		}
+	}
+	pthread_mutex_unlock(&(pool->lock));
+	return NULL;
+}
+
+static int
+lod_batch_end_(void *context)
+{
+	LODBATCHSTREAM *bs;
+
+	bs = (LODBATCHSTREAM *) context;
+	return bs->pos >= bs->batch->ntriples;
+}
+
+static int
+lod_batch_next_(void *context)
+{
+	LODBATCHSTREAM *bs;
+
+	bs = (LODBATCHSTREAM *) context;
+	if(bs->pos < bs->batch->ntriples)
+	{
+		bs->pos++;
+	}
+	return bs->pos >= bs->batch->ntriples;
+}
+
+static void *
+lod_batch_get_(void *context, int flags)
+{
+	LODBATCHSTREAM *bs;
+	LODSNAPROW *row;
+
+	bs = (LODBATCHSTREAM *) context;
+	if(bs->pos >= bs->batch->ntriples || flags != LIBRDF_STREAM_GET_METHOD_GET_OBJECT)
+	{
+		return NULL;
+	}
+	row = &(bs->batch->triples[bs->pos]);
+	librdf_statement_clear(bs->statement);
+	librdf_statement_set_subject(bs->statement, librdf_new_node_from_node(bs->nodes[row->k[0]]));
+	librdf_statement_set_predicate(bs->statement, librdf_new_node_from_node(bs->nodes[row->k[1]]));
+	librdf_statement_set_object(bs->statement, librdf_new_node_from_node(bs->nodes[row->k[2]]));
+	return (void *) bs->statement;
+}
+
+static void
+lod_batch_done_(void *context)
+{
+	LODBATCHSTREAM *bs;
+	size_t c;
+
+	bs = (LODBATCHSTREAM *) context;
+	if(bs->nodes)
+	{
+		for(c = 0; c < bs->batch->nterms; c++)
+		{
+			if(bs->nodes[c])
+			{
+				librdf_free_node(bs->nodes[c]);
+			}
+		}
+		free(bs->nodes);
+	}
+	if(bs->statement)
+	{
+		librdf_free_statement(bs->statement);
+	}
+	free(bs);
+}
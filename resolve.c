@@ -21,7 +21,11 @@
 
 #include "p_liblod.h"
 
-static LODINSTANCE *lod_locate_subject_(LODCONTEXT *context, librdf_world *world);
+static LODINSTANCE *lod_locate_subject_(LODCONTEXT *context, librdf_world *world, librdf_model *model);
+static LODINSTANCE *lod_locate_locked_(LODCONTEXT *context, const char *uri);
+static LODINSTANCE *lod_fetch_locked_(LODCONTEXT *context, const char *uri);
+static LODINSTANCE *lod_resolve_locked_(LODCONTEXT *context, const char *uri);
+static long lod_locate_many_locked_(LODCONTEXT *context, const char *const *uris, size_t count, unsigned char *bitmap, LODINSTANCE **instances);
 
 /* Attempt to locate a subject within the context's model, but don't
  * try to fetch it all.
@@ -29,13 +33,28 @@ static LODINSTANCE *lod_locate_subject_(LODCONTEXT *context, librdf_world *world
 LODINSTANCE *
 lod_locate(LODCONTEXT *context, const char *uri)
 {
+	LODINSTANCE *r;
+
+	lod_lock_(context);
+	r = lod_locate_locked_(context, uri);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_locate(), with the context lock held */
+static LODINSTANCE *
+lod_locate_locked_(LODCONTEXT *context, const char *uri)
+{
+	LODSTATE *state;
 	LODINSTANCE *inst;
 	librdf_node *node;
 	librdf_statement *query;
 	librdf_world *world;
 	librdf_model *model;
 	char *p;
+	int probe;
 
+	state = lod_state_(context);
 	/* Duplicate the URI first, in case it's actually a string belonging
 	 * to the context itself which would get deallocated by lod_reset_()
 	 */
@@ -46,7 +65,7 @@ lod_locate(LODCONTEXT *context, const char *uri)
 		return NULL;
 	}		
 	lod_reset_(context);
-	context->subject = p;
+	state->subject = p;
 	world = lod_world(context);
 	if(!world)
 	{
@@ -59,8 +78,15 @@ lod_locate(LODCONTEXT *context, const char *uri)
 		lod_set_error_(context, "failed to obtain librdf model from context");
 		return NULL;
 	}
+	/* If the subject index is available, it can answer the question alone */
+	probe = lod_index_probe_(context, model, p);
+	if(!probe)
+	{
+		state->error = 0;
+		return NULL;
+	}
 	/* Attempt to locate triples about the subject */
-	node = librdf_new_node_from_uri_string(world, (const unsigned char *) uri);
+	node = lod_intern_probe_(context, p);
 	if(!node)
 	{
 		lod_set_error_(context, "failed to create new URI node");
@@ -79,23 +105,63 @@ lod_locate(LODCONTEXT *context, const char *uri)
 		librdf_free_statement(query);
 		return NULL;
 	}	
-	if(!lod_instance_exists(inst))
+	if(probe < 0 && !lod_instance_exists(inst))
 	{
 		/* No error has occurred, but the subject isn't present in the
 		 * model.
 		 */
 		lod_instance_destroy(inst);
-		context->error = 0;
+		state->error = 0;
 		return NULL;
 	}
 	return inst;
 }
 
+/* Determine which of an array of URIs are subjects within the context's
+ * model, without fetching anything.
+ */
+long
+lod_exists_many(LODCONTEXT *context, const char *const *uris, size_t count, unsigned char *bitmap)
+{
+	long r;
+
+	lod_lock_(context);
+	r = lod_locate_many_locked_(context, uris, count, bitmap, NULL);
+	lod_unlock_(context);
+	return r;
+}
+
+/* As lod_exists_many(), but optionally also create instances for each of
+ * the URIs which are present.
+ */
+long
+lod_locate_many(LODCONTEXT *context, const char *const *uris, size_t count, unsigned char *bitmap, LODINSTANCE **instances)
+{
+	long r;
+
+	lod_lock_(context);
+	r = lod_locate_many_locked_(context, uris, count, bitmap, instances);
+	lod_unlock_(context);
+	return r;
+}
+
 /* Fetch data about a subject, fetching the data about it (irrespective of
  * whether it already exists in the model.
  */
 LODINSTANCE *
 lod_fetch(LODCONTEXT *context, const char *uri)
+{
+	LODINSTANCE *r;
+
+	lod_lock_(context);
+	r = lod_fetch_locked_(context, uri);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_fetch(), with the context lock held */
+static LODINSTANCE *
+lod_fetch_locked_(LODCONTEXT *context, const char *uri)
 {
 	librdf_world *world;
 	librdf_model *model;
@@ -111,7 +177,7 @@ lod_fetch(LODCONTEXT *context, const char *uri)
 		return NULL;
 	}		
 	lod_reset_(context);
-	context->subject = p;
+	lod_state_(context)->subject = p;
 	world = lod_world(context);
 	if(!world)
 	{
@@ -130,7 +196,7 @@ lod_fetch(LODCONTEXT *context, const char *uri)
 		/* An error ocurred while actually performing the fetch operation */
 		return NULL;
 	}
-	return lod_locate_subject_(context, world);
+	return lod_locate_subject_(context, world, model);
 }
 
 /* Resolve a LOD URI, fetching data if the URI is not a subject in the
@@ -139,6 +205,19 @@ lod_fetch(LODCONTEXT *context, const char *uri)
 LODINSTANCE *
 lod_resolve(LODCONTEXT *context, const char *uri)
 {
+	LODINSTANCE *r;
+
+	lod_lock_(context);
+	r = lod_resolve_locked_(context, uri);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_resolve(), with the context lock held */
+static LODINSTANCE *
+lod_resolve_locked_(LODCONTEXT *context, const char *uri)
+{
+	LODSTATE *state;
 	LODINSTANCE *inst;
 	librdf_stream *stream;
 	librdf_world *world;
@@ -146,8 +225,10 @@ lod_resolve(LODCONTEXT *context, const char *uri)
 	librdf_node *node;
 	librdf_statement *query;
 	char *p;
+	int probe;
 
-	context->error = 0;
+	state = lod_state_(context);
+	state->error = 0;
 	/* Duplicate the URI first, in case it's actually a string belonging
 	 * to the context itself which would get deallocated by lod_reset_()
 	 */
@@ -158,21 +239,33 @@ lod_resolve(LODCONTEXT *context, const char *uri)
 		return NULL;
 	}		
 	lod_reset_(context);
-	context->subject = p;
+	state->subject = p;
 	world = lod_world(context);
 	if(!world)
 	{
-		context->error = 1;
+		state->error = 1;
 		return NULL;
 	}
 	model = lod_model(context);
 	if(!model)
 	{
-		context->error = 1;
+		state->error = 1;
 		return NULL;
 	}
+	/* If the subject index says the subject is absent, there's no need to
+	 * query the model before fetching
+	 */
+	probe = lod_index_probe_(context, model, p);
+	if(!probe)
+	{
+		if(lod_fetch_(context))
+		{
+			return NULL;
+		}
+		return lod_locate_subject_(context, world, model);
+	}
 	/* Attempt to locate triples about the subject */
-	node = librdf_new_node_from_uri_string(world, (const unsigned char *) uri);
+	node = lod_intern_probe_(context, p);
 	if(!node)
 	{
 		lod_set_error_(context, "failed to create librdf URI node");
@@ -185,6 +278,17 @@ lod_resolve(LODCONTEXT *context, const char *uri)
 		lod_set_error_(context, "failed to create librdf query statement");
 		return NULL;
 	}
+	if(probe > 0)
+	{
+		/* The subject index says the subject exists in the model */
+		inst = lod_instance_create_(context, query, node);
+		if(!inst)
+		{
+			librdf_free_statement(query);
+			return NULL;
+		}
+		return inst;
+	}
 	stream = librdf_model_find_statements(model, query);
 	if(!stream)
 	{
@@ -213,32 +317,43 @@ lod_resolve(LODCONTEXT *context, const char *uri)
 		/* An error occurred during the fetch itself */
 		return NULL;
 	}
-	return lod_locate_subject_(context, world);
+	return lod_locate_subject_(context, world, model);
 }
 
 /* Following a fetch operation, loop through the subject list and return
  * a LODINSTANCE for the first one which is found
  */
 static LODINSTANCE *
-lod_locate_subject_(LODCONTEXT *context, librdf_world *world)
+lod_locate_subject_(LODCONTEXT *context, librdf_world *world, librdf_model *model)
 {
+	LODSTATE *state;
 	LODINSTANCE *inst;
-	int i;
+	int i, probe;
 	librdf_node *node;
 	librdf_statement *query;
 
+	state = lod_state_(context);
 	inst = NULL;
 	/* Now that we've successfully fetched the URI, Attempt to locate
 	 * triples about the subject
 	 */	
-	for(i = 0; i < context->nsubjects; i++)
+	for(i = 0; i < state->nsubjects; i++)
 	{
 		if(inst)
 		{
 			lod_instance_destroy(inst);
 		}		
-		context->error = 0;
-		node = librdf_new_node_from_uri_string(world, (const unsigned char *) context->subjects[i]);
+		state->error = 0;
+		probe = lod_index_probe_(context, model, state->subjects[i]);
+		if(!probe && i + 1 < state->nsubjects)
+		{
+			/* Definitely not present; an instance is only needed if this
+			 * is the last subject in the list
+			 */
+			inst = NULL;
+			continue;
+		}
+		node = lod_intern_probe_(context, state->subjects[i]);
 		if(!node)
 		{
 			lod_set_error_(context, "failed to create librdf URI node");
@@ -257,7 +372,11 @@ lod_locate_subject_(LODCONTEXT *context, librdf_world *world)
 			librdf_free_statement(query);
 			return NULL;
 		}
-		if(lod_instance_exists(inst))
+		if(!probe)
+		{
+			break;
+		}
+		if(probe > 0 || lod_instance_exists(inst))
 		{
 			return inst;
 		}
@@ -265,6 +384,136 @@ lod_locate_subject_(LODCONTEXT *context, librdf_world *world)
 	/* No error occurred, but the fetched data didn't describe the subject
 	 * we were looking for.
 	 */
-	context->error = 0;
+	state->error = 0;
 	return inst;	
 }
+
+/* lod_locate_many() and lod_exists_many(), with the context lock held:
+ * perform a batch membership test against the model. Unlike lod_locate(),
+ * this doesn't reset the context's resolution state: no subject is being
+ * resolved. When the subject index is available, each URI costs a filter
+ * test and (only if that passes) a hash lookup; otherwise, a single query
+ * statement is re-used for each URI.
+ */
+static long
+lod_locate_many_locked_(LODCONTEXT *context, const char *const *uris, size_t count, unsigned char *bitmap, LODINSTANCE **instances)
+{
+	librdf_world *world;
+	librdf_model *model;
+	librdf_statement *query, *iquery;
+	librdf_stream *stream;
+	librdf_node *node;
+	size_t c;
+	long found;
+	int present, indexed;
+
+	lod_state_(context)->error = 0;
+	if(bitmap)
+	{
+		memset(bitmap, 0, (count + 7) / 8);
+	}
+	if(instances)
+	{
+		memset(instances, 0, count * sizeof(LODINSTANCE *));
+	}
+	world = lod_world(context);
+	if(!world)
+	{
+		return -1;
+	}
+	model = lod_model(context);
+	if(!model)
+	{
+		return -1;
+	}
+	indexed = !lod_index_sync_(context, model) && context->index.exact &&
+		(context->index.flags & LODI_SUBJECTS);
+	query = NULL;
+	if(!indexed)
+	{
+		query = librdf_new_statement(world);
+		if(!query)
+		{
+			lod_set_error_(context, "failed to create librdf query statement");
+			return -1;
+		}
+	}
+	found = 0;
+	for(c = 0; c < count; c++)
+	{
+		if(indexed)
+		{
+			present = lod_index_probe_(context, model, uris[c]) > 0;
+		}
+		else
+		{
+			node = lod_intern_probe_(context, uris[c]);
+			if(!node)
+			{
+				break;
+			}
+			/* The statement takes ownership of the node */
+			librdf_statement_set_subject(query, node);
+			stream = librdf_model_find_statements(model, query);
+			if(!stream)
+			{
+				lod_set_error_(context, "failed to create librdf stream for query");
+				break;
+			}
+			present = !librdf_stream_end(stream);
+			librdf_free_stream(stream);
+			librdf_statement_clear(query);
+		}
+		if(!present)
+		{
+			continue;
+		}
+		found++;
+		if(bitmap)
+		{
+			bitmap[c / 8] |= (1 << (c % 8));
+		}
+		if(instances)
+		{
+			node = lod_intern_probe_(context, uris[c]);
+			if(!node)
+			{
+				break;
+			}
+			iquery = librdf_new_statement_from_nodes(world, node, NULL, NULL);
+			if(!iquery)
+			{
+				lod_set_error_(context, "failed to create librdf query statement");
+				break;
+			}
+			instances[c] = lod_instance_create_(context, iquery, node);
+			if(!instances[c])
+			{
+				librdf_free_statement(iquery);
+				break;
+			}
+		}
+	}
+	if(query)
+	{
+		librdf_free_statement(query);
+	}
+	if(c < count)
+	{
+		/* An error occurred part-way through */
+		if(instances)
+		{
+			for(c = 0; c < count; c++)
+			{
+				if(instances[c])
+				{
+					lod_instance_destroy(instances[c]);
+					instances[c] = NULL;
+				}
+			}
+		}
+		lod_state_(context)->error = 1;
+		return -1;
+	}
+	return found;
+}
@@ -23,6 +23,13 @@
 
 #define BUFSIZE                         512
 #define BUFMAX                          (256 * 1024 * 1024)
+/* The number of leading bytes of a spilled payload kept in memory */
+#define SPILLHEAD                       4096
+
+static void lod_response_release_payload_(LODRESPONSE *resp, int keep);
+static int lod_response_spill_(LODRESPONSE *resp);
+static LODRESULT lod_response_check_locked_(LODCONTEXT *context, LODRESPONSE *response);
+static LODRESULT lod_response_merge_locked_(LODCONTEXT *context, LODRESPONSE *response, LODSNAPBUILDER *batch);
 
 /* Create a response object for population by a fetch-uri callback */
 LODRESPONSE *
@@ -50,7 +57,7 @@ lod_response_reset(LODRESPONSE *resp)
 	resp->status = 0;
 	free(resp->errmsg);
 	resp->errmsg = NULL;
-	resp->buflen = 0;
+	lod_response_release_payload_(resp, 1);
 	free(resp->uri);
 	resp->uri = NULL;
 	free(resp->target);
@@ -63,6 +70,7 @@ lod_response_reset(LODRESPONSE *resp)
 	}
 	free(resp->headers);
 	resp->headers = NULL;
+	resp->nheaders = 0;
 	return 0;
 }
 
@@ -75,7 +83,7 @@ lod_response_destroy(LODRESPONSE *resp)
 	size_t c;
 
 	free(resp->errmsg);
-	free(resp->buf);
+	lod_response_release_payload_(resp, 0);
 	free(resp->uri);
 	free(resp->target);
 	free(resp->type);
@@ -168,23 +176,232 @@ lod_response_set_type(LODRESPONSE *resp, const char *type)
 	return 0;
 }
 
+/* Add a response header, in RFC822/HTTP format ("Name: value"); any
+ * trailing line ending is removed
+ */
+int
+lod_response_add_header(LODRESPONSE *resp, const char *header, size_t length)
+{
+	char **p, *h;
+
+	while(length && (header[length - 1] == '\r' || header[length - 1] == '\n'))
+	{
+		length--;
+	}
+	p = (char **) realloc(resp->headers, (resp->nheaders + 1) * sizeof(char *));
+	if(!p)
+	{
+		lod_response_set_error(resp, "failed to allocate memory for response header");
+		return -1;
+	}
+	resp->headers = p;
+	h = (char *) malloc(length + 1);
+	if(!h)
+	{
+		lod_response_set_error(resp, "failed to allocate memory for response header");
+		return -1;
+	}
+	memcpy(h, header, length);
+	h[length] = 0;
+	resp->headers[resp->nheaders] = h;
+	resp->nheaders++;
+	return 0;
+}
+
+/* Obtain the value of the last response header with the supplied name, or
+ * NULL if there is none
+ */
+const char *
+lod_response_header(LODRESPONSE *resp, const char *name)
+{
+	size_t c, len;
+	const char *p;
+
+	len = strlen(name);
+	for(c = resp->nheaders; c > 0; c--)
+	{
+		p = resp->headers[c - 1];
+		if(!strncasecmp(p, name, len) && p[len] == ':')
+		{
+			for(p += len + 1; *p == ' ' || *p == '\t'; p++)
+			{
+			}
+			return p;
+		}
+	}
+	return NULL;
+}
+
 /* Assign the payload of a response
  * NOTE: The payload must be allocated with malloc(), realloc() or calloc()
  * The heap block will be owned by the response and can be freed at any
  * time by liblod once set.
  */
-int lod_response_set_payload(LODRESPONSE *resp, char *payload, size_t length);
+int
+lod_response_set_payload(LODRESPONSE *resp, char *payload, size_t length)
+{
+	lod_response_release_payload_(resp, 0);
+	resp->buf = payload;
+	resp->bufsize = length;
+	resp->buflen = length;
+	return 0;
+}
 
 /* Assign the payload of a response by duplicating a buffer */
-int lod_response_set_payload_copy(LODRESPONSE *resp, const char *payload, size_t length);
+int
+lod_response_set_payload_copy(LODRESPONSE *resp, const char *payload, size_t length)
+{
+	lod_response_reset_payload(resp);
+	return lod_response_append_payload(resp, payload, length);
+}
+
+/* Assign an externally-owned buffer as the payload of a response without
+ * copying it
+ */
+int
+lod_response_set_payload_external(LODRESPONSE *resp, const char *payload, size_t length, LODPAYLOADRELEASE release, void *userdata)
+{
+	lod_response_release_payload_(resp, 0);
+	/* The buffer is never written to while it's borrowed: anything which
+	 * needs to modify it must take a private copy first.
+	 */
+	resp->buf = (char *) payload;
+	resp->buflen = length;
+	resp->bufkind = LODPAYLOAD_EXTERNAL;
+	resp->release = release;
+	resp->release_data = userdata;
+	return 0;
+}
+
+/* Map the contents of an open file read-only and use them as the payload of
+ * a response
+ */
+int
+lod_response_set_payload_fd(LODRESPONSE *resp, int fd)
+{
+	struct stat sbuf;
+	void *p;
+
+	if(fstat(fd, &sbuf))
+	{
+		lod_response_set_error(resp, strerror(errno));
+		return -1;
+	}
+	lod_response_release_payload_(resp, 0);
+	if(!sbuf.st_size)
+	{
+		/* mmap() can't map an empty file; leave the payload empty */
+		return 0;
+	}
+	p = mmap(NULL, (size_t) sbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(p == MAP_FAILED)
+	{
+		lod_response_set_error(resp, strerror(errno));
+		return -1;
+	}
+	/* The parsers read the payload from start to finish exactly once */
+	posix_madvise(p, (size_t) sbuf.st_size, POSIX_MADV_SEQUENTIAL);
+	resp->buf = (char *) p;
+	resp->bufsize = (size_t) sbuf.st_size;
+	resp->buflen = (size_t) sbuf.st_size;
+	resp->bufkind = LODPAYLOAD_MAPPED;
+	return 0;
+}
+
+/* Map the contents of the named file read-only and use them as the payload
+ * of a response
+ */
+int
+lod_response_set_payload_file(LODRESPONSE *resp, const char *path)
+{
+	int fd, r;
+
+	fd = open(path, O_RDONLY);
+	if(fd == -1)
+	{
+		lod_response_set_error(resp, strerror(errno));
+		return -1;
+	}
+	r = lod_response_set_payload_fd(resp, fd);
+	close(fd);
+	return r;
+}
+
+/* Set the payload size beyond which the payload of a response will be
+ * written to a temporary file rather than held in memory
+ */
+int
+lod_response_set_spill_threshold(LODRESPONSE *resp, size_t threshold)
+{
+	resp->spill_threshold = threshold;
+	return 0;
+}
 
 /* Append a byte sequence to the payload of a response */
 int
 lod_response_append_payload(LODRESPONSE *resp, const char *bytes, size_t size)
 {
-	size_t toalloc;
+	size_t toalloc, len;
 	char *p;
 
+	if(!resp->spill && resp->spill_threshold &&
+	   (resp->buflen + size > resp->spill_threshold || resp->buflen + size >= BUFMAX))
+	{
+		if(lod_response_spill_(resp))
+		{
+			return -1;
+		}
+	}
+	if(resp->spill)
+	{
+		if(fwrite(bytes, 1, size, resp->spill) != size)
+		{
+			lod_response_set_error(resp, strerror(errno));
+			return -1;
+		}
+		resp->spilllen += size;
+		/* Top up the leading bytes retained for sniffing, if the payload
+		 * was spilled before there were enough of them
+		 */
+		if(resp->buflen < SPILLHEAD)
+		{
+			len = SPILLHEAD - resp->buflen;
+			if(len > size)
+			{
+				len = size;
+			}
+			memcpy(&(resp->buf[resp->buflen]), bytes, len);
+			resp->buflen += len;
+		}
+		return 0;
+	}
+	if(resp->bufkind != LODPAYLOAD_BUFFER)
+	{
+		/* The payload isn't ours to extend, so replace it with a private
+		 * copy which can be.
+		 */
+		len = resp->buflen;
+		toalloc = ((len + size) / BUFSIZE + 1) * BUFSIZE;
+		if(toalloc > BUFMAX)
+		{
+			lod_response_set_error(resp, strerror(ENOMEM));
+			return -1;
+		}
+		p = (char *) malloc(toalloc);
+		if(!p)
+		{
+			lod_response_set_error(resp, strerror(errno));
+			return -1;
+		}
+		if(len)
+		{
+			memcpy(p, resp->buf, len);
+		}
+		lod_response_release_payload_(resp, 0);
+		resp->buf = p;
+		resp->bufsize = toalloc;
+		resp->buflen = len;
+	}
 	if(resp->buflen + size >= resp->bufsize)
 	{
 		toalloc = ((resp->bufsize + size) / BUFSIZE + 1) * BUFSIZE;
@@ -211,7 +428,7 @@ lod_response_append_payload(LODRESPONSE *resp, const char *bytes, size_t size)
 int
 lod_response_reset_payload(LODRESPONSE *resp)
 {
-	resp->buflen = 0;
+	lod_response_release_payload_(resp, 1);
 	return 0;
 }
 
@@ -219,22 +436,46 @@ lod_response_reset_payload(LODRESPONSE *resp)
 LODRESULT
 lod_response_process(LODCONTEXT *context, LODRESPONSE *response)
 {
-	int r;
-	char *newuri, *t;
-	char errbuf[64];
-	librdf_world *world;
-	librdf_model *model;
-	librdf_uri *baseuri;
-	librdf_parser *parser;
-	
-	context->status = response->status;
-	world = lod_world(context);
-	if(!world)
+	LODSNAPBUILDER batch;
+	LODRESULT r;
+
+	lod_lock_(context);
+	r = lod_response_check_locked_(context, response);
+	lod_unlock_(context);
+	if(r != LODR_COMPLETE)
+	{
+		return r;
+	}
+	/* The payload is parsed without the context lock, so that other
+	 * threads can parse (or use the model) meanwhile
+	 */
+	memset(&batch, 0, sizeof(LODSNAPBUILDER));
+	if(lod_parse_(context, response, &batch))
 	{
+		lod_snapbuild_free_(&batch);
 		return LODR_FAIL;
 	}
-	model = lod_model(context);
-	if(!model)
+	lod_lock_(context);
+	r = lod_response_merge_locked_(context, response, &batch);
+	lod_unlock_(context);
+	lod_snapbuild_free_(&batch);
+	return r;
+}
+
+/* Determine what should be done with a response, with the context lock
+ * held; returns LODR_COMPLETE if its payload should be parsed
+ */
+static LODRESULT
+lod_response_check_locked_(LODCONTEXT *context, LODRESPONSE *response)
+{
+	LODSTATE *state;
+	int r;
+	char *newuri, *t;
+	char errbuf[64];
+
+	state = lod_state_(context);
+	state->status = response->status;
+	if(!lod_world(context) || !lod_model(context))
 	{
 		return LODR_FAIL;
 	}
@@ -313,41 +554,185 @@ lod_response_process(LODCONTEXT *context, LODRESPONSE *response)
 		lod_set_error_(context, "no document URI has been set; cannot parse payload\n");
 		return LODR_FAIL;
 	}
-	parser = librdf_new_parser(world, NULL, response->type, NULL);
-	if(!parser)
+	free(state->document);
+	state->document = response->uri;
+	response->uri = NULL;
+	return LODR_COMPLETE;
+}
+
+/* Add the batch parsed from a response to the model, and record the
+ * document, with the context lock held
+ */
+static LODRESULT
+lod_response_merge_locked_(LODCONTEXT *context, LODRESPONSE *response, LODSNAPBUILDER *batch)
+{
+	LODSTATE *state;
+	librdf_world *world;
+	librdf_model *model;
+	time_t fetched;
+	const char *etag;
+
+	state = lod_state_(context);
+	world = lod_world(context);
+	model = lod_model(context);
+	if(!world || !model)
 	{
-		lod_set_error_(context, "failed to create RDF parser");
 		return LODR_FAIL;
 	}
-	free(context->document);
-	context->document = response->uri;
-	response->uri = NULL;
-	r = 0;
-	baseuri = librdf_new_uri(world, (const unsigned char *) context->document);
-	if(!baseuri)
-	{	
-		lod_set_error_(context, "failed to create RDF URI");
-		r = 1;
+	/* Add the statements via liblod so that the indexes are updated (and
+	 * the journal written) as we go
+	 */
+	lod_journal_begin_(context);
+	if(lod_parse_merge_(context, world, model, batch) || state->error)
+	{
+		return LODR_FAIL;
 	}
-	if(!r)
+	fetched = time(NULL);
+	etag = lod_response_header(response, "ETag");
+	if(lod_document_record_(context, state->document, fetched, etag, state->chain) ||
+	   lod_journal_commit_(context, state->document, fetched, etag, state->chain) ||
+	   lod_storage_document_(context))
 	{
-		r = librdf_parser_parse_counted_string_into_model(parser, (unsigned char *) response->buf, response->buflen, baseuri, model);
-		if(context->error)
-		{
-			r = 1;
-		}
+		return LODR_FAIL;
 	}
-	if(baseuri)
+	return LODR_COMPLETE;
+}
+
+/* Obtain the temporary file holding a spilled payload, positioned at the
+ * start of the payload, or NULL if the payload is held in memory
+ */
+FILE *
+lod_response_rewind_(LODRESPONSE *resp)
+{
+	if(!resp->spill)
+	{
+		return NULL;
+	}
+	if(fflush(resp->spill) || fseek(resp->spill, 0, SEEK_SET) ||
+	   lseek(fileno(resp->spill), 0, SEEK_SET) == -1)
+	{
+		lod_response_set_error(resp, strerror(errno));
+		return NULL;
+	}
+	return resp->spill;
+}
+
+/* Move the payload of a response to a temporary file, retaining only
+ * the leading bytes in memory
+ */
+static int
+lod_response_spill_(LODRESPONSE *resp)
+{
+	const char *dir;
+	char *path;
+	size_t len;
+	int fd;
+	char *p;
+	FILE *spill;
+
+	dir = getenv("TMPDIR");
+	if(!dir || !*dir)
+	{
+		dir = "/tmp";
+	}
+	path = (char *) malloc(strlen(dir) + 16);
+	if(!path)
 	{
-		librdf_free_uri(baseuri);
+		lod_response_set_error(resp, strerror(errno));
+		return -1;
 	}
-	if(parser)
+	sprintf(path, "%s/liblod.XXXXXX", dir);
+	fd = mkstemp(path);
+	if(fd == -1)
 	{
-		librdf_free_parser(parser);
+		lod_response_set_error(resp, strerror(errno));
+		free(path);
+		return -1;
 	}
-	if(r)
+	/* The file only needs to exist for as long as it's open */
+	unlink(path);
+	free(path);
+	resp->spill = fdopen(fd, "w+b");
+	if(!resp->spill)
 	{
-		return LODR_FAIL;
+		lod_response_set_error(resp, strerror(errno));
+		close(fd);
+		return -1;
 	}
-	return LODR_COMPLETE;
+	if(resp->buflen && fwrite(resp->buf, 1, resp->buflen, resp->spill) != resp->buflen)
+	{
+		lod_response_set_error(resp, strerror(errno));
+		fclose(resp->spill);
+		resp->spill = NULL;
+		return -1;
+	}
+	resp->spilllen = resp->buflen;
+	/* Retain a private copy of the leading bytes for content sniffing;
+	 * the buffer has room for SPILLHEAD bytes, so that it can be topped up
+	 * as the rest of the payload arrives
+	 */
+	len = resp->buflen < SPILLHEAD ? resp->buflen : SPILLHEAD;
+	p = (char *) malloc(SPILLHEAD + 1);
+	if(!p)
+	{
+		lod_response_set_error(resp, strerror(errno));
+		fclose(resp->spill);
+		resp->spill = NULL;
+		return -1;
+	}
+	if(len)
+	{
+		memcpy(p, resp->buf, len);
+	}
+	/* Only the in-memory payload is released: the temporary file now
+	 * holds it
+	 */
+	spill = resp->spill;
+	resp->spill = NULL;
+	lod_response_release_payload_(resp, 0);
+	resp->spill = spill;
+	resp->buf = p;
+	resp->bufsize = SPILLHEAD + 1;
+	resp->buflen = len;
+	return 0;
+}
+
+/* Release a response's payload; if keep is nonzero, a heap buffer owned by
+ * the response is retained (but emptied) so that it can be re-used
+ */
+static void
+lod_response_release_payload_(LODRESPONSE *resp, int keep)
+{
+	if(resp->spill)
+	{
+		fclose(resp->spill);
+		resp->spill = NULL;
+		resp->spilllen = 0;
+	}
+	switch(resp->bufkind)
+	{
+	case LODPAYLOAD_BUFFER:
+		if(keep)
+		{
+			resp->buflen = 0;
+			return;
+		}
+		free(resp->buf);
+		break;
+	case LODPAYLOAD_EXTERNAL:
+		if(resp->release)
+		{
+			resp->release(resp->release_data, resp->buf, resp->buflen);
+		}
+		break;
+	case LODPAYLOAD_MAPPED:
+		munmap(resp->buf, resp->bufsize);
+		break;
+	}
+	resp->buf = NULL;
+	resp->bufsize = 0;
+	resp->buflen = 0;
+	resp->bufkind = LODPAYLOAD_BUFFER;
+	resp->release = NULL;
+	resp->release_data = NULL;
 }
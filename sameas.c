@@ -0,0 +1,453 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* owl:sameAs identity sets are maintained incrementally as a union-find
+ * structure over interned terms (union by rank, with path halving), so
+ * that both merging two sets and finding a term's canonical member are
+ * effectively constant-time. The members of each set are additionally
+ * threaded together in a circular list so that they can be enumerated
+ * without scanning.
+ */
+
+static int lod_sameas_ensure_(LODSAMEAS *sameas, LODTERMID id);
+static long lod_instance_identity_(LODINSTANCE *instance, LODTERMID **ids, LODSAMEAS **sameas);
+static LODINSTANCE *lod_instance_canonical_locked_(LODINSTANCE *instance);
+static long lod_instance_sameas_locked_(LODINSTANCE *instance, const char **uris, size_t max);
+static int lod_instance_foreach_smushed_locked_(LODINSTANCE *instance, LODTRIPLECB fn, void *userdata);
+
+/* Return an instance representing the canonical member of the set of URIs
+ * which are co-referent with the instance
+ */
+LODINSTANCE *
+lod_instance_canonical(LODINSTANCE *instance)
+{
+	LODCONTEXT *context;
+	LODINSTANCE *r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_canonical_locked_(instance);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_canonical(), with the context lock held */
+static LODINSTANCE *
+lod_instance_canonical_locked_(LODINSTANCE *instance)
+{
+	LODCONTEXT *context;
+	LODSAMEAS *sameas;
+	LODTERMID *ids, best;
+	LODINSTANCE *inst;
+	librdf_world *world;
+	librdf_node *node;
+	librdf_statement *query;
+	long count, c;
+
+	context = instance->context;
+	count = lod_instance_identity_(instance, &ids, &sameas);
+	if(count < 0)
+	{
+		return NULL;
+	}
+	if(count)
+	{
+		if(sameas)
+		{
+			best = lod_sameas_find_(sameas, ids[0]);
+		}
+		else
+		{
+			/* Without the index, the lowest URI is chosen so that every
+			 * member of the set agrees upon it
+			 */
+			best = ids[0];
+			for(c = 1; c < count; c++)
+			{
+				if(strcmp(context->intern.terms[ids[c]].str, context->intern.terms[best].str) < 0)
+				{
+					best = ids[c];
+				}
+			}
+		}
+		free(ids);
+		return lod_instance_from_term_(context, best);
+	}
+	/* The instance is co-referent only with itself */
+	world = lod_world(context);
+	if(!world)
+	{
+		return NULL;
+	}
+	node = librdf_new_node_from_node(instance->subject);
+	if(!node)
+	{
+		lod_set_error_(context, "failed to create librdf node");
+		return NULL;
+	}
+	query = librdf_new_statement_from_nodes(world, node, NULL, NULL);
+	if(!query)
+	{
+		lod_set_error_(context, "failed to create librdf query statement");
+		return NULL;
+	}
+	inst = lod_instance_create_(context, query, node);
+	if(!inst)
+	{
+		librdf_free_statement(query);
+		return NULL;
+	}
+	return inst;
+}
+
+/* Obtain the URIs which are co-referent with the instance */
+long
+lod_instance_sameas(LODINSTANCE *instance, const char **uris, size_t max)
+{
+	LODCONTEXT *context;
+	long r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_sameas_locked_(instance, uris, max);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_sameas(), with the context lock held */
+static long
+lod_instance_sameas_locked_(LODINSTANCE *instance, const char **uris, size_t max)
+{
+	LODSAMEAS *sameas;
+	LODTERMID *ids;
+	long count, c;
+
+	count = lod_instance_identity_(instance, &ids, &sameas);
+	if(count < 0)
+	{
+		return -1;
+	}
+	if(!count)
+	{
+		if(!librdf_node_is_resource(instance->subject))
+		{
+			return 0;
+		}
+		if(max)
+		{
+			uris[0] = (const char *) librdf_uri_as_string(librdf_node_get_uri(instance->subject));
+		}
+		return 1;
+	}
+	for(c = 0; c < count && (size_t) c < max; c++)
+	{
+		uris[c] = instance->context->intern.terms[ids[c]].str;
+	}
+	free(ids);
+	return count;
+}
+
+/* Visit the triples of every subject which is co-referent with the
+ * instance
+ */
+int
+lod_instance_foreach_smushed(LODINSTANCE *instance, LODTRIPLECB fn, void *userdata)
+{
+	LODCONTEXT *context;
+	int r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_foreach_smushed_locked_(instance, fn, userdata);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_foreach_smushed(), with the context lock held */
+static int
+lod_instance_foreach_smushed_locked_(LODINSTANCE *instance, LODTRIPLECB fn, void *userdata)
+{
+	LODCONTEXT *context;
+	LODINSTANCE *member;
+	LODSAMEAS *sameas;
+	LODTERMID *ids;
+	long count, c;
+	int r;
+
+	context = instance->context;
+	count = lod_instance_identity_(instance, &ids, &sameas);
+	if(count < 0)
+	{
+		return -1;
+	}
+	r = lod_instance_foreach(instance, fn, userdata);
+	for(c = 1; !r && c < count; c++)
+	{
+		/* The index records which terms are subjects; without it, members
+		 * with no triples of their own are simply visited to no effect
+		 */
+		if(sameas && !(context->intern.terms[ids[c]].flags & LODTERM_SUBJECT))
+		{
+			continue;
+		}
+		member = lod_instance_from_term_(context, ids[c]);
+		if(!member)
+		{
+			r = -1;
+			break;
+		}
+		r = lod_instance_foreach(member, fn, userdata);
+		lod_instance_destroy(member);
+	}
+	free(ids);
+	return r;
+}
+
+/* Merge the sets containing two terms */
+int
+lod_sameas_union_(LODSAMEAS *sameas, LODTERMID a, LODTERMID b)
+{
+	LODTERMID ra, rb, t;
+
+	if(lod_sameas_ensure_(sameas, a > b ? a : b))
+	{
+		return -1;
+	}
+	ra = lod_sameas_find_(sameas, a);
+	rb = lod_sameas_find_(sameas, b);
+	if(ra == rb)
+	{
+		return 0;
+	}
+	if(sameas->rank[ra] < sameas->rank[rb])
+	{
+		t = ra;
+		ra = rb;
+		rb = t;
+	}
+	sameas->parent[rb] = ra;
+	if(sameas->rank[ra] == sameas->rank[rb])
+	{
+		sameas->rank[ra]++;
+	}
+	/* Splicing two circular lists together is a matter of exchanging the
+	 * successors of one member of each
+	 */
+	t = sameas->next[ra];
+	sameas->next[ra] = sameas->next[rb];
+	sameas->next[rb] = t;
+	return 0;
+}
+
+/* Find the canonical member of the set containing a term */
+LODTERMID
+lod_sameas_find_(LODSAMEAS *sameas, LODTERMID id)
+{
+	while(id < sameas->size && sameas->parent[id] != id)
+	{
+		sameas->parent[id] = sameas->parent[sameas->parent[id]];
+		id = sameas->parent[id];
+	}
+	return id;
+}
+
+/* Obtain the next member of the set containing a term */
+LODTERMID
+lod_sameas_next_(LODSAMEAS *sameas, LODTERMID id)
+{
+	if(id >= sameas->size)
+	{
+		return id;
+	}
+	return sameas->next[id];
+}
+
+/* Discard all of the sets */
+void
+lod_sameas_reset_(LODSAMEAS *sameas)
+{
+	free(sameas->parent);
+	free(sameas->next);
+	free(sameas->rank);
+	memset(sameas, 0, sizeof(LODSAMEAS));
+}
+
+/* Ensure that the arrays extend to cover the supplied term */
+static int
+lod_sameas_ensure_(LODSAMEAS *sameas, LODTERMID id)
+{
+	LODTERMID *parent, *next;
+	unsigned char *rank;
+	size_t size, c;
+
+	if(id < sameas->size)
+	{
+		return 0;
+	}
+	for(size = sameas->size ? sameas->size : 256; size <= id; size *= 2)
+	{
+	}
+	parent = (LODTERMID *) realloc(sameas->parent, size * sizeof(LODTERMID));
+	if(parent)
+	{
+		sameas->parent = parent;
+	}
+	next = (LODTERMID *) realloc(sameas->next, size * sizeof(LODTERMID));
+	if(next)
+	{
+		sameas->next = next;
+	}
+	rank = (unsigned char *) realloc(sameas->rank, size);
+	if(rank)
+	{
+		sameas->rank = rank;
+	}
+	if(!parent || !next || !rank)
+	{
+		return -1;
+	}
+	for(c = sameas->size; c < size; c++)
+	{
+		sameas->parent[c] = (LODTERMID) c;
+		sameas->next[c] = (LODTERMID) c;
+		sameas->rank[c] = 0;
+	}
+	sameas->size = size;
+	return 0;
+}
+
+/* Obtain the members of the set of URIs which are co-referent with an
+ * instance's subject, beginning with the subject itself. The owl:sameAs
+ * index is used if it is available, in which case *sameas is set to it;
+ * otherwise the owl:sameAs statements in the model are followed in both
+ * directions. Returns the number of members, which is zero if the subject
+ * is co-referent only with itself, or -1 on error.
+ */
+static long
+lod_instance_identity_(LODINSTANCE *instance, LODTERMID **ids, LODSAMEAS **sameas)
+{
+	LODCONTEXT *context;
+	librdf_model *model;
+	librdf_node *node;
+	LODTERMID id, m, *found;
+	size_t count, size, nfound, fsize, c, f, k;
+
+	context = instance->context;
+	lod_state_(context)->error = 0;
+	*ids = NULL;
+	*sameas = NULL;
+	count = size = 0;
+	model = lod_model(context);
+	if(!model)
+	{
+		return -1;
+	}
+	if(!librdf_node_is_resource(instance->subject))
+	{
+		return 0;
+	}
+	if(lod_index_ready_(context, model, LODI_SAMEAS))
+	{
+		/* A subject which was never interned cannot be in any set */
+		id = lod_intern_node_id_(context, instance->subject, 0);
+		if(id == LOD_NOTERM)
+		{
+			return 0;
+		}
+		*sameas = &(context->index.sameas);
+		m = id;
+		do
+		{
+			if(lod_termids_append_(ids, &count, &size, m))
+			{
+				lod_set_error_(context, strerror(errno));
+				free(*ids);
+				return -1;
+			}
+			m = lod_sameas_next_(*sameas, m);
+		}
+		while(m != id);
+		return (long) count;
+	}
+	if(lod_state_(context)->error)
+	{
+		return -1;
+	}
+	found = NULL;
+	nfound = fsize = 0;
+	if(lod_model_related_(context, model, instance->subject, LOD_OWL_SAMEAS, 0, &found, &nfound, &fsize) ||
+	   lod_model_related_(context, model, instance->subject, LOD_OWL_SAMEAS, 1, &found, &nfound, &fsize))
+	{
+		free(found);
+		return -1;
+	}
+	if(!nfound)
+	{
+		return 0;
+	}
+	/* The subject participates in an owl:sameAs statement, and so is a
+	 * term of the model
+	 */
+	id = lod_intern_node_id_(context, instance->subject, 1);
+	if(id == LOD_NOTERM || lod_termids_append_(ids, &count, &size, id))
+	{
+		lod_set_error_(context, "failed to intern the instance's subject");
+		free(found);
+		return -1;
+	}
+	/* Breadth-first traversal: each member is appended once, and its own
+	 * neighbours are collected when the traversal reaches it
+	 */
+	for(c = 0; ; )
+	{
+		for(f = 0; f < nfound; f++)
+		{
+			for(k = 0; k < count && (*ids)[k] != found[f]; k++)
+			{
+			}
+			if(k == count && lod_termids_append_(ids, &count, &size, found[f]))
+			{
+				lod_set_error_(context, strerror(errno));
+				free(found);
+				free(*ids);
+				return -1;
+			}
+		}
+		nfound = 0;
+		if(++c >= count)
+		{
+			break;
+		}
+		node = lod_intern_node_(context, (*ids)[c]);
+		if(!node ||
+		   lod_model_related_(context, model, node, LOD_OWL_SAMEAS, 0, &found, &nfound, &fsize) ||
+		   lod_model_related_(context, model, node, LOD_OWL_SAMEAS, 1, &found, &nfound, &fsize))
+		{
+			free(found);
+			free(*ids);
+			return -1;
+		}
+	}
+	free(found);
+	return (long) count;
+}
@@ -0,0 +1,844 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* The fetch scheduler: before each request is transferred, the fetching
+ * thread must be granted a slot. Requests wait in a queue for their host
+ * until the host's policy (a limit on concurrent requests, a token bucket
+ * limiting the request rate, and a crawl delay) and the context-wide limit
+ * on requests in progress allow them to start. Hosts with waiting requests
+ * form a ring, which is visited round-robin, so that a host with a long
+ * queue can't starve the others.
+ *
+ * Requests are either interactive or background (see lod_set_priority()).
+ * Interactive requests are queued ahead of background ones, and are
+ * started first. If one is held back only by a limit on the number of
+ * requests in progress, it claims the slot of a background request whose
+ * transfer is in progress: the transfer is interrupted, and the background
+ * request is queued again.
+ */
+
+#define SCHED_MINSLOTS                  64
+#define SCHED_NOHOST                    ((size_t) -1)
+
+/* Why a background request has been pre-empted */
+#define SCHED_PREEMPT_HOST              1
+#define SCHED_PREEMPT_GLOBAL            2
+
+static LODHOSTPOLICY *lod_sched_policy_(LODSCHED *sched, LODSCHEDHOST *host);
+static size_t lod_sched_host_(LODSCHED *sched, const char *name, size_t len, int create);
+static int lod_sched_grow_(LODSCHED *sched);
+static int lod_sched_ready_(LODSCHED *sched, LODSCHEDHOST *host, double now, double *when);
+static double lod_sched_dispatch_(LODSCHED *sched);
+static void lod_sched_enqueue_(LODSCHED *sched, size_t h, LODSCHEDWAITER *waiter, int requeue);
+static void lod_sched_dequeue_(LODSCHED *sched, LODSCHEDWAITER *waiter);
+static void lod_sched_preempt_(LODSCHED *sched, double now);
+static int lod_sched_victim_(LODSCHED *sched, size_t h, int reason);
+static void lod_sched_activate_(LODSCHED *sched, size_t h);
+static void lod_sched_deactivate_(LODSCHED *sched, size_t h);
+
+/* Set the priority of fetches made by the calling thread */
+int
+lod_set_priority(LODCONTEXT *context, LODPRIORITY priority)
+{
+	LODSTATE *state;
+
+	state = lod_state_(context);
+	state->error = 0;
+	state->priority = priority;
+	return 0;
+}
+
+/* Set the maximum number of fetches which may be in progress at once */
+int
+lod_set_fetch_limit(LODCONTEXT *context, unsigned int max)
+{
+	LODSCHED *sched;
+
+	sched = &(context->sched);
+	pthread_mutex_lock(&(sched->lock));
+	sched->max_fetches = max;
+	lod_sched_dispatch_(sched);
+	pthread_mutex_unlock(&(sched->lock));
+	return 0;
+}
+
+/* Set the limits applied to fetches from a host, or to hosts which have
+ * no limits of their own
+ */
+int
+lod_set_host_policy(LODCONTEXT *context, const char *host, const LODHOSTPOLICY *policy)
+{
+	LODSCHED *sched;
+	LODHOSTPOLICY *p;
+	size_t h;
+
+	lod_state_(context)->error = 0;
+	sched = &(context->sched);
+	pthread_mutex_lock(&(sched->lock));
+	if(host)
+	{
+		h = lod_sched_host_(sched, host, strlen(host), 1);
+		if(h == SCHED_NOHOST)
+		{
+			pthread_mutex_unlock(&(sched->lock));
+			lod_set_error_(context, strerror(errno));
+			return -1;
+		}
+		sched->hosts[h].has_policy = (policy != NULL);
+		p = &(sched->hosts[h].policy);
+	}
+	else
+	{
+		p = &(sched->policy);
+	}
+	if(policy)
+	{
+		*p = *policy;
+	}
+	else
+	{
+		memset(p, 0, sizeof(LODHOSTPOLICY));
+	}
+	if(p->burst < 1)
+	{
+		p->burst = 1;
+	}
+	lod_sched_dispatch_(sched);
+	pthread_mutex_unlock(&(sched->lock));
+	return 0;
+}
+
+/* Obtain statistics about the fetches scheduled for a host, or for all
+ * hosts
+ */
+int
+lod_fetch_stats(LODCONTEXT *context, const char *host, LODFETCHSTATS *stats)
+{
+	LODSCHED *sched;
+	size_t h;
+
+	sched = &(context->sched);
+	memset(stats, 0, sizeof(LODFETCHSTATS));
+	pthread_mutex_lock(&(sched->lock));
+	if(!host)
+	{
+		*stats = sched->stats;
+	}
+	else if((h = lod_sched_host_(sched, host, strlen(host), 0)) != SCHED_NOHOST)
+	{
+		*stats = sched->hosts[h].stats;
+	}
+	pthread_mutex_unlock(&(sched->lock));
+	return 0;
+}
+
+/* Wait until a request for a URI may be started, or until the deadline
+ * (if non-zero) passes, in which case -1 is returned. Otherwise, the waiter
+ * must be passed to lod_sched_release_() once the request has completed;
+ * if it was interrupted, it is queued again ahead of other background
+ * requests when it is next passed to this function.
+ */
+int
+lod_sched_acquire_(LODCONTEXT *context, const char *uri, LODSCHEDWAITER *waiter, LODPRIORITY priority, double deadline)
+{
+	LODSCHED *sched;
+	LODSCHEDHOST *host;
+	struct timespec ts;
+	const char *name, *t;
+	double queued, when;
+	size_t h, len;
+	int requeue;
+
+	sched = &(context->sched);
+	requeue = waiter->aborted;
+	memset(waiter, 0, sizeof(LODSCHEDWAITER));
+	waiter->context = context;
+	waiter->priority = priority;
+	waiter->host = SCHED_NOHOST;
+	/* Hosts are identified by the authority of the URI, without any
+	 * user information
+	 */
+	name = strstr(uri, "://");
+	name = name ? name + 3 : uri;
+	len = strcspn(name, "/?#");
+	for(t = name; t < name + len; t++)
+	{
+		if(*t == '@')
+		{
+			len -= (t + 1 - name);
+			name = t + 1;
+			t = name - 1;
+		}
+	}
+	pthread_mutex_lock(&(sched->lock));
+	h = lod_sched_host_(sched, name, len, 1);
+	if(h == SCHED_NOHOST)
+	{
+		/* The request can't be scheduled, but can still be made */
+		pthread_mutex_unlock(&(sched->lock));
+		return 0;
+	}
+	waiter->host = h;
+	lod_sched_enqueue_(sched, h, waiter, requeue);
+	host = &(sched->hosts[h]);
+	host->stats.queued++;
+	sched->stats.queued++;
+	if(host->stats.queued > host->stats.max_queued)
+	{
+		host->stats.max_queued = host->stats.queued;
+	}
+	if(sched->stats.queued > sched->stats.max_queued)
+	{
+		sched->stats.max_queued = sched->stats.queued;
+	}
+	queued = lod_sched_now_();
+	when = lod_sched_dispatch_(sched);
+	while(!waiter->granted)
+	{
+		if(deadline > 0 && (!when || deadline < when))
+		{
+			when = deadline;
+		}
+		if(when > 0)
+		{
+			/* A host is waiting for its bucket to refill, or for its
+			 * crawl delay to elapse
+			 */
+			ts.tv_sec = (time_t) when;
+			ts.tv_nsec = (long) ((when - (double) ts.tv_sec) * 1000000000.0);
+			pthread_cond_timedwait(&(sched->cond), &(sched->lock), &ts);
+		}
+		else
+		{
+			pthread_cond_wait(&(sched->cond), &(sched->lock));
+		}
+		if(waiter->granted)
+		{
+			break;
+		}
+		if(deadline > 0 && lod_sched_now_() >= deadline)
+		{
+			lod_sched_dequeue_(sched, waiter);
+			pthread_mutex_unlock(&(sched->lock));
+			return -1;
+		}
+		when = lod_sched_dispatch_(sched);
+	}
+	/* The hosts array may have been reallocated meanwhile */
+	host = &(sched->hosts[h]);
+	when = lod_sched_now_() - queued;
+	host->stats.wait_time += when;
+	sched->stats.wait_time += when;
+	pthread_mutex_unlock(&(sched->lock));
+	return 0;
+}
+
+/* Release the slot granted to a request, returning non-zero if its
+ * transfer was interrupted so that an interactive request could start
+ */
+int
+lod_sched_release_(LODCONTEXT *context, LODSCHEDWAITER *waiter)
+{
+	LODSCHED *sched;
+	LODSCHEDHOST *host;
+
+	if(waiter->host == SCHED_NOHOST)
+	{
+		return 0;
+	}
+	sched = &(context->sched);
+	pthread_mutex_lock(&(sched->lock));
+	host = &(sched->hosts[waiter->host]);
+	if(waiter->prev)
+	{
+		waiter->prev->next = waiter->next;
+	}
+	else
+	{
+		sched->active = waiter->next;
+	}
+	if(waiter->next)
+	{
+		waiter->next->prev = waiter->prev;
+	}
+	if(waiter->preempted == SCHED_PREEMPT_HOST)
+	{
+		host->preempting--;
+	}
+	else if(waiter->preempted == SCHED_PREEMPT_GLOBAL)
+	{
+		sched->preempting--;
+	}
+	host->stats.active--;
+	sched->stats.active--;
+	lod_sched_dispatch_(sched);
+	pthread_mutex_unlock(&(sched->lock));
+	return waiter->aborted;
+}
+
+/* Determine whether a request's transfer should be interrupted, because an
+ * interactive request has claimed its slot
+ */
+int
+lod_sched_preempted_(LODSCHEDWAITER *waiter)
+{
+	LODSCHED *sched;
+	int r;
+
+	sched = &(waiter->context->sched);
+	pthread_mutex_lock(&(sched->lock));
+	if(waiter->preempted && !waiter->aborted)
+	{
+		waiter->aborted = 1;
+		sched->hosts[waiter->host].stats.preempted++;
+		sched->stats.preempted++;
+	}
+	r = waiter->aborted;
+	pthread_mutex_unlock(&(sched->lock));
+	return r;
+}
+
+/* Initialise a new context's scheduler, which imposes no limits */
+int
+lod_sched_init_(LODCONTEXT *context)
+{
+	LODSCHED *sched;
+	pthread_condattr_t attr;
+
+	sched = &(context->sched);
+	sched->ring = SCHED_NOHOST;
+	sched->policy.burst = 1;
+	if(pthread_mutex_init(&(sched->lock), NULL))
+	{
+		return -1;
+	}
+	/* Deadlines are measured on the monotonic clock */
+	if(pthread_condattr_init(&attr))
+	{
+		pthread_mutex_destroy(&(sched->lock));
+		return -1;
+	}
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if(pthread_cond_init(&(sched->cond), &attr))
+	{
+		pthread_condattr_destroy(&attr);
+		pthread_mutex_destroy(&(sched->lock));
+		return -1;
+	}
+	pthread_condattr_destroy(&attr);
+	return 0;
+}
+
+/* Free a context's scheduler; no requests may be in progress */
+void
+lod_sched_free_(LODCONTEXT *context)
+{
+	LODSCHED *sched;
+	size_t c;
+
+	sched = &(context->sched);
+	for(c = 0; c < sched->nhosts; c++)
+	{
+		free(sched->hosts[c].name);
+	}
+	free(sched->hosts);
+	free(sched->slots);
+	pthread_cond_destroy(&(sched->cond));
+	pthread_mutex_destroy(&(sched->lock));
+}
+
+/* Return the time on the monotonic clock, in seconds */
+double
+lod_sched_now_(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000.0;
+}
+
+/* Obtain the policy which applies to a host */
+static LODHOSTPOLICY *
+lod_sched_policy_(LODSCHED *sched, LODSCHEDHOST *host)
+{
+	return host->has_policy ? &(host->policy) : &(sched->policy);
+}
+
+/* Locate a host by name (compared case-insensitively), optionally adding
+ * it, returning its index or SCHED_NOHOST
+ */
+static size_t
+lod_sched_host_(LODSCHED *sched, const char *name, size_t len, int create)
+{
+	LODSCHEDHOST *host;
+	char *p;
+	size_t slot, c;
+	uint32_t id;
+
+	p = (char *) malloc(len + 1);
+	if(!p)
+	{
+		return SCHED_NOHOST;
+	}
+	for(c = 0; c < len; c++)
+	{
+		p[c] = (char) tolower((unsigned char) name[c]);
+	}
+	p[len] = 0;
+	if(create && (sched->nhosts == sched->size || (sched->nhosts + 1) * 2 > sched->nslots))
+	{
+		if(lod_sched_grow_(sched))
+		{
+			free(p);
+			return SCHED_NOHOST;
+		}
+	}
+	if(!sched->nslots)
+	{
+		free(p);
+		return SCHED_NOHOST;
+	}
+	slot = (size_t) (lod_hash_(p, len) & (sched->nslots - 1));
+	while((id = sched->slots[slot]) != LOD_NOTERM)
+	{
+		if(!strcmp(sched->hosts[id].name, p))
+		{
+			free(p);
+			return id;
+		}
+		slot = (slot + 1) & (sched->nslots - 1);
+	}
+	if(!create)
+	{
+		free(p);
+		return SCHED_NOHOST;
+	}
+	host = &(sched->hosts[sched->nhosts]);
+	memset(host, 0, sizeof(LODSCHEDHOST));
+	host->name = p;
+	host->prev = host->next = SCHED_NOHOST;
+	host->tokens = -1;
+	sched->slots[slot] = (uint32_t) sched->nhosts;
+	sched->nhosts++;
+	return sched->nhosts - 1;
+}
+
+/* Enlarge the hosts array and its hash */
+static int
+lod_sched_grow_(LODSCHED *sched)
+{
+	LODSCHEDHOST *hosts;
+	uint32_t *slots;
+	size_t size, nslots, c, slot;
+
+	if(sched->nhosts == sched->size)
+	{
+		size = sched->size ? sched->size * 2 : SCHED_MINSLOTS / 2;
+		hosts = (LODSCHEDHOST *) realloc(sched->hosts, size * sizeof(LODSCHEDHOST));
+		if(!hosts)
+		{
+			return -1;
+		}
+		sched->hosts = hosts;
+		sched->size = size;
+	}
+	if((sched->nhosts + 1) * 2 > sched->nslots)
+	{
+		nslots = sched->nslots ? sched->nslots * 2 : SCHED_MINSLOTS;
+		slots = (uint32_t *) malloc(nslots * sizeof(uint32_t));
+		if(!slots)
+		{
+			return -1;
+		}
+		for(c = 0; c < nslots; c++)
+		{
+			slots[c] = LOD_NOTERM;
+		}
+		for(c = 0; c < sched->nhosts; c++)
+		{
+			slot = (size_t) (lod_hash_(sched->hosts[c].name, strlen(sched->hosts[c].name)) & (nslots - 1));
+			while(slots[slot] != LOD_NOTERM)
+			{
+				slot = (slot + 1) & (nslots - 1);
+			}
+			slots[slot] = (uint32_t) c;
+		}
+		free(sched->slots);
+		sched->slots = slots;
+		sched->nslots = nslots;
+	}
+	return 0;
+}
+
+/* Determine whether a host's policy allows another request to start now;
+ * if not, and the host will become ready at a known time, *when is set to
+ * it (if it's earlier than the current value)
+ */
+static int
+lod_sched_ready_(LODSCHED *sched, LODSCHEDHOST *host, double now, double *when)
+{
+	LODHOSTPOLICY *policy;
+	double t;
+
+	policy = lod_sched_policy_(sched, host);
+	if(policy->connections && host->stats.active >= policy->connections)
+	{
+		/* The host will be reconsidered when a request completes */
+		return 0;
+	}
+	if(policy->delay > 0 && host->stats.started && now < host->last + policy->delay)
+	{
+		t = host->last + policy->delay;
+		if(!*when || t < *when)
+		{
+			*when = t;
+		}
+		return 0;
+	}
+	if(policy->rate > 0)
+	{
+		/* A host starts with a full bucket */
+		if(host->tokens < 0)
+		{
+			host->tokens = (double) policy->burst;
+		}
+		else
+		{
+			host->tokens += (now - host->refilled) * policy->rate;
+			if(host->tokens > (double) policy->burst)
+			{
+				host->tokens = (double) policy->burst;
+			}
+		}
+		host->refilled = now;
+		if(host->tokens < 1)
+		{
+			t = now + (1 - host->tokens) / policy->rate;
+			if(!*when || t < *when)
+			{
+				*when = t;
+			}
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Grant slots to as many waiting requests as the limits allow, visiting
+ * the hosts with waiting requests round-robin, first for interactive
+ * requests and then for any; returns the earliest time at which a host
+ * which is being held back will become ready, or zero
+ */
+static double
+lod_sched_dispatch_(LODSCHED *sched)
+{
+	LODSCHEDHOST *host;
+	LODSCHEDWAITER *waiter;
+	double now, when;
+	size_t h, idle;
+	int granted, pass;
+
+	now = lod_sched_now_();
+	when = 0;
+	granted = 0;
+	for(pass = LODP_INTERACTIVE; pass <= LODP_BACKGROUND; pass++)
+	{
+		/* idle counts the hosts visited since a request was last
+		 * granted; a full circuit of the ring without one means nothing
+		 * more can start in this pass
+		 */
+		for(idle = 0; sched->ring != SCHED_NOHOST && idle < sched->nactive; )
+		{
+			if(sched->max_fetches && sched->stats.active >= sched->max_fetches)
+			{
+				break;
+			}
+			h = sched->ring;
+			host = &(sched->hosts[h]);
+			sched->ring = host->next;
+			if((int) host->head->priority > pass || !lod_sched_ready_(sched, host, now, &when))
+			{
+				idle++;
+				continue;
+			}
+			idle = 0;
+			waiter = host->head;
+			host->head = waiter->next;
+			if(host->urgent == waiter)
+			{
+				host->urgent = NULL;
+			}
+			if(!host->head)
+			{
+				host->tail = NULL;
+				lod_sched_deactivate_(sched, h);
+			}
+			/* The waiter joins the list of requests in progress, most
+			 * recently started first
+			 */
+			waiter->granted = 1;
+			waiter->prev = NULL;
+			waiter->next = sched->active;
+			if(sched->active)
+			{
+				sched->active->prev = waiter;
+			}
+			sched->active = waiter;
+			granted = 1;
+			if(lod_sched_policy_(sched, host)->rate > 0)
+			{
+				host->tokens -= 1;
+			}
+			host->last = now;
+			host->stats.queued--;
+			host->stats.active++;
+			host->stats.started++;
+			sched->stats.queued--;
+			sched->stats.active++;
+			sched->stats.started++;
+		}
+	}
+	if(granted)
+	{
+		pthread_cond_broadcast(&(sched->cond));
+	}
+	if(sched->active && sched->ring != SCHED_NOHOST)
+	{
+		lod_sched_preempt_(sched, now);
+	}
+	return when;
+}
+
+/* Add a request to a host's queue: interactive requests, and background
+ * requests whose transfers were interrupted, are queued behind any other
+ * interactive requests but ahead of other background ones
+ */
+static void
+lod_sched_enqueue_(LODSCHED *sched, size_t h, LODSCHEDWAITER *waiter, int requeue)
+{
+	LODSCHEDHOST *host;
+	LODSCHEDWAITER *after;
+
+	host = &(sched->hosts[h]);
+	if(!host->head)
+	{
+		lod_sched_activate_(sched, h);
+	}
+	if(waiter->priority == LODP_INTERACTIVE || requeue)
+	{
+		after = host->urgent;
+	}
+	else
+	{
+		after = host->tail;
+	}
+	if(after)
+	{
+		waiter->next = after->next;
+		after->next = waiter;
+	}
+	else
+	{
+		waiter->next = host->head;
+		host->head = waiter;
+	}
+	if(!waiter->next)
+	{
+		host->tail = waiter;
+	}
+	if(waiter->priority == LODP_INTERACTIVE)
+	{
+		host->urgent = waiter;
+	}
+}
+
+/* Remove a request which has given up waiting from its host's queue */
+static void
+lod_sched_dequeue_(LODSCHED *sched, LODSCHEDWAITER *waiter)
+{
+	LODSCHEDHOST *host;
+	LODSCHEDWAITER *prev, *p;
+
+	host = &(sched->hosts[waiter->host]);
+	prev = NULL;
+	for(p = host->head; p != waiter; p = p->next)
+	{
+		prev = p;
+	}
+	if(prev)
+	{
+		prev->next = waiter->next;
+	}
+	else
+	{
+		host->head = waiter->next;
+	}
+	if(host->tail == waiter)
+	{
+		host->tail = prev;
+	}
+	/* Interactive requests are at the front of the queue, so the one
+	 * before the last is also interactive
+	 */
+	if(host->urgent == waiter)
+	{
+		host->urgent = prev;
+	}
+	if(!host->head)
+	{
+		lod_sched_deactivate_(sched, waiter->host);
+	}
+	host->stats.queued--;
+	sched->stats.queued--;
+	waiter->host = SCHED_NOHOST;
+}
+
+/* Claim the slots of background requests for the interactive requests at
+ * the heads of the hosts' queues which could otherwise start, once per
+ * host held back by its own limit, and as many as are held back by the
+ * limit on fetches in progress
+ */
+static void
+lod_sched_preempt_(LODSCHED *sched, double now)
+{
+	LODSCHEDHOST *host;
+	LODHOSTPOLICY *policy;
+	double when;
+	size_t c, h;
+	unsigned int needed;
+
+	needed = 0;
+	when = 0;
+	h = sched->ring;
+	for(c = 0; c < sched->nactive; c++, h = host->next)
+	{
+		host = &(sched->hosts[h]);
+		if(host->head->priority != LODP_INTERACTIVE)
+		{
+			continue;
+		}
+		policy = lod_sched_policy_(sched, host);
+		if(policy->connections && host->stats.active >= policy->connections)
+		{
+			if(!host->preempting)
+			{
+				lod_sched_victim_(sched, h, SCHED_PREEMPT_HOST);
+			}
+		}
+		else if(lod_sched_ready_(sched, host, now, &when))
+		{
+			/* Having just been dispatched, only the limit on fetches in
+			 * progress can be holding the host back
+			 */
+			needed++;
+		}
+	}
+	while(sched->preempting < needed)
+	{
+		if(!lod_sched_victim_(sched, SCHED_NOHOST, SCHED_PREEMPT_GLOBAL))
+		{
+			break;
+		}
+	}
+}
+
+/* Mark a background request in progress (for a particular host, or any) to
+ * be interrupted; the most recently started is chosen, having made the
+ * least progress. Returns zero if there is none.
+ */
+static int
+lod_sched_victim_(LODSCHED *sched, size_t h, int reason)
+{
+	LODSCHEDWAITER *waiter;
+
+	for(waiter = sched->active; waiter; waiter = waiter->next)
+	{
+		if(waiter->priority != LODP_BACKGROUND || waiter->preempted)
+		{
+			continue;
+		}
+		if(h != SCHED_NOHOST && waiter->host != h)
+		{
+			continue;
+		}
+		waiter->preempted = reason;
+		if(reason == SCHED_PREEMPT_HOST)
+		{
+			sched->hosts[h].preempting++;
+		}
+		else
+		{
+			sched->preempting++;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Add a host to the ring of hosts with waiting requests, behind the host
+ * which will be visited next
+ */
+static void
+lod_sched_activate_(LODSCHED *sched, size_t h)
+{
+	LODSCHEDHOST *host;
+
+	host = &(sched->hosts[h]);
+	if(sched->ring == SCHED_NOHOST)
+	{
+		host->prev = host->next = h;
+		sched->ring = h;
+	}
+	else
+	{
+		host->next = sched->ring;
+		host->prev = sched->hosts[sched->ring].prev;
+		sched->hosts[host->prev].next = h;
+		sched->hosts[sched->ring].prev = h;
+	}
+	sched->nactive++;
+}
+
+/* Remove a host whose queue is empty from the ring */
+static void
+lod_sched_deactivate_(LODSCHED *sched, size_t h)
+{
+	LODSCHEDHOST *host;
+
+	host = &(sched->hosts[h]);
+	if(host->next == h)
+	{
+		sched->ring = SCHED_NOHOST;
+	}
+	else
+	{
+		sched->hosts[host->prev].next = host->next;
+		sched->hosts[host->next].prev = host->prev;
+		if(sched->ring == h)
+		{
+			sched->ring = host->next;
+		}
+	}
+	host->prev = host->next = SCHED_NOHOST;
+	sched->nactive--;
+}
@@ -0,0 +1,1492 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* Frozen snapshots: the contents of a model are copied into a dictionary
+ * of terms, sorted by kind and value so that term identifiers can be
+ * found by binary search, and three sorted arrays of identifier triples
+ * (in SPO, POS and OSP order), so that any pattern of bound and unbound
+ * terms can be answered as a contiguous range of one of them. Nothing is
+ * modified once the snapshot has been built, and so no locking is needed
+ * to read it; only the reference count is updated atomically.
+ */
+
+#define SNAPSHOT_MINSLOTS               1024
+#define SNAPSHOT_MINTERMS               256
+#define SNAPSHOT_MINSTRINGS             16384
+#define SNAPSHOT_MINTRIPLES             1024
+
+static LODSNAPID lod_snapbuild_term_(LODSNAPBUILDER *b, librdf_node *node);
+static uint32_t lod_snapbuild_string_(LODSNAPBUILDER *b, const char *str, size_t len);
+static int lod_snapbuild_grow_(LODSNAPBUILDER *b);
+static LODSNAPSHOT *lod_snapshot_build_(LODSNAPBUILDER *b);
+static int lod_snapbuild_docs_(LODSNAPBUILDER *b, LODDOCUMENTS *documents);
+static void lod_snapshot_sort_(uint32_t *ids, uint32_t *tmp, size_t n, int (*compare)(void *data, uint32_t a, uint32_t b), void *data);
+static int lod_snapbuild_termcmp_(void *data, uint32_t a, uint32_t b);
+static int lod_snapbuild_doccmp_(void *data, uint32_t a, uint32_t b);
+static int lod_snapterm_compare_(const char *strings, const LODSNAPTERM *a, const LODSNAPTERM *b);
+static int lod_snapstr_compare_(const char *strings, uint32_t a, uint32_t b);
+static int lod_snapstr_match_(const char *strings, uint32_t a, const char *b);
+static int lod_snaprow_compare_(const void *a, const void *b);
+static LODSNAPROW *lod_snapshot_plan_(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object, LODSNAPID *key, int *nkey, int *order);
+static void lod_snapshot_range_(LODSNAPROW *rows, size_t nrows, const LODSNAPID *key, int nkey, size_t *start, size_t *end);
+static int lod_snapshot_write_(FILE *f, const void *buf, size_t len, uint64_t *offset);
+static int lod_snapshot_validate_(LODSNAPSHOT *snapshot);
+static int lod_snapshot_section_(size_t maplen, uint64_t offset, uint64_t count, size_t size);
+static LODSNAPSHOT *lod_freeze_locked_(LODCONTEXT *context);
+static int lod_thaw_locked_(LODCONTEXT *context, LODSNAPSHOT *snapshot);
+
+/* Convert the contents of the context's model into an immutable snapshot */
+LODSNAPSHOT *
+lod_freeze(LODCONTEXT *context)
+{
+	LODSNAPSHOT *r;
+
+	lod_lock_(context);
+	r = lod_freeze_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_freeze(), with the context lock held */
+static LODSNAPSHOT *
+lod_freeze_locked_(LODCONTEXT *context)
+{
+	LODSNAPBUILDER b;
+	LODSNAPSHOT *snapshot;
+	librdf_model *model;
+	librdf_stream *stream;
+	int r;
+
+	lod_state_(context)->error = 0;
+	model = lod_model(context);
+	if(!model)
+	{
+		return NULL;
+	}
+	stream = librdf_model_as_stream(model);
+	if(!stream)
+	{
+		lod_set_error_(context, "failed to obtain a stream from the model");
+		return NULL;
+	}
+	memset(&b, 0, sizeof(LODSNAPBUILDER));
+	r = 0;
+	for(; !librdf_stream_end(stream); librdf_stream_next(stream))
+	{
+		if(lod_snapbuild_add_(&b, librdf_stream_get_object(stream)))
+		{
+			r = -1;
+			break;
+		}
+	}
+	librdf_free_stream(stream);
+	if(!r && lod_snapbuild_docs_(&b, &(context->documents)))
+	{
+		r = -1;
+	}
+	if(r)
+	{
+		lod_set_error_(context, "failed to add statement to snapshot");
+		lod_snapbuild_free_(&b);
+		return NULL;
+	}
+	snapshot = lod_snapshot_build_(&b);
+	if(!snapshot)
+	{
+		lod_set_error_(context, strerror(errno));
+		return NULL;
+	}
+	return snapshot;
+}
+
+/* Obtain an additional reference to a snapshot */
+LODSNAPSHOT *
+lod_snapshot_retain(LODSNAPSHOT *snapshot)
+{
+	__sync_add_and_fetch(&(snapshot->refcount), 1);
+	return snapshot;
+}
+
+/* Release a reference to a snapshot */
+void
+lod_snapshot_release(LODSNAPSHOT *snapshot)
+{
+	if(__sync_sub_and_fetch(&(snapshot->refcount), 1))
+	{
+		return;
+	}
+	lod_snapshot_free_(snapshot);
+}
+
+/* Return the number of triples in a snapshot */
+size_t
+lod_snapshot_triples(LODSNAPSHOT *snapshot)
+{
+	return snapshot->ntriples;
+}
+
+/* Return the number of terms in a snapshot */
+size_t
+lod_snapshot_terms(LODSNAPSHOT *snapshot)
+{
+	return snapshot->nterms;
+}
+
+/* Look up a URI in a snapshot's dictionary */
+LODSNAPID
+lod_snapshot_lookup(LODSNAPSHOT *snapshot, const char *uri)
+{
+	LODSNAPTERM *term;
+	uint32_t lo, hi, mid;
+	size_t len;
+	int r;
+
+	len = strlen(uri);
+	/* URI terms have neither language nor datatype, so are ordered by
+	 * value alone
+	 */
+	lo = snapshot->kinds[LODSNAP_URI];
+	hi = snapshot->kinds[LODSNAP_URI + 1];
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		term = &(snapshot->terms[mid]);
+		r = memcmp(snapshot->strings + term->value, uri, term->length < len ? term->length : len);
+		if(!r && term->length != len)
+		{
+			r = term->length < len ? -1 : 1;
+		}
+		if(!r)
+		{
+			return mid;
+		}
+		if(r < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return LODSNAP_ANY;
+}
+
+/* Determine whether a URI is the subject of any triples in a snapshot */
+int
+lod_snapshot_exists(LODSNAPSHOT *snapshot, const char *uri)
+{
+	LODSNAPID id;
+
+	id = lod_snapshot_lookup(snapshot, uri);
+	if(id == LODSNAP_ANY)
+	{
+		return 0;
+	}
+	return lod_snapshot_count(snapshot, id, LODSNAP_ANY, LODSNAP_ANY) > 0;
+}
+
+/* Return the number of triples matching a pattern */
+size_t
+lod_snapshot_count(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object)
+{
+	LODSNAPROW *rows;
+	LODSNAPID key[3];
+	size_t start, end;
+	int nkey, order;
+
+	rows = lod_snapshot_plan_(snapshot, subject, predicate, object, key, &nkey, &order);
+	lod_snapshot_range_(rows, snapshot->ntriples, key, nkey, &start, &end);
+	return end - start;
+}
+
+/* Return the first object of a property of a subject */
+LODSNAPID
+lod_snapshot_get(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate)
+{
+	LODSNAPID key[2];
+	size_t start, end;
+
+	key[0] = subject;
+	key[1] = predicate;
+	lod_snapshot_range_(snapshot->spo, snapshot->ntriples, key, 2, &start, &end);
+	if(start == end)
+	{
+		return LODSNAP_ANY;
+	}
+	return snapshot->spo[start].k[2];
+}
+
+/* Invoke a callback for each triple matching a pattern */
+int
+lod_snapshot_foreach(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object, LODSNAPSHOTCB fn, void *userdata)
+{
+	LODSNAPROW *rows;
+	LODSNAPID key[3];
+	size_t start, end, c;
+	int nkey, order, r;
+
+	rows = lod_snapshot_plan_(snapshot, subject, predicate, object, key, &nkey, &order);
+	lod_snapshot_range_(rows, snapshot->ntriples, key, nkey, &start, &end);
+	for(c = start; c < end; c++)
+	{
+		switch(order)
+		{
+		case 0:
+			r = fn(snapshot, rows[c].k[0], rows[c].k[1], rows[c].k[2], userdata);
+			break;
+		case 1:
+			r = fn(snapshot, rows[c].k[2], rows[c].k[0], rows[c].k[1], userdata);
+			break;
+		default:
+			r = fn(snapshot, rows[c].k[1], rows[c].k[2], rows[c].k[0], userdata);
+			break;
+		}
+		if(r)
+		{
+			return r;
+		}
+	}
+	return 0;
+}
+
+/* Obtain the kind of a term in a snapshot */
+LODSNAPKIND
+lod_snapshot_kind(LODSNAPSHOT *snapshot, LODSNAPID id)
+{
+	return (LODSNAPKIND) snapshot->terms[id].kind;
+}
+
+/* Obtain the value of a term in a snapshot */
+const char *
+lod_snapshot_value(LODSNAPSHOT *snapshot, LODSNAPID id, size_t *len)
+{
+	if(len)
+	{
+		*len = snapshot->terms[id].length;
+	}
+	return snapshot->strings + snapshot->terms[id].value;
+}
+
+/* Obtain the language of a literal term in a snapshot */
+const char *
+lod_snapshot_language(LODSNAPSHOT *snapshot, LODSNAPID id)
+{
+	if(snapshot->terms[id].language == LODSNAP_NOSTR)
+	{
+		return NULL;
+	}
+	return snapshot->strings + snapshot->terms[id].language;
+}
+
+/* Obtain the datatype URI of a literal term in a snapshot */
+const char *
+lod_snapshot_datatype(LODSNAPSHOT *snapshot, LODSNAPID id)
+{
+	if(snapshot->terms[id].datatype == LODSNAP_NOSTR)
+	{
+		return NULL;
+	}
+	return snapshot->strings + snapshot->terms[id].datatype;
+}
+
+/* Create a new librdf node from a term in a snapshot */
+librdf_node *
+lod_snapshot_node(LODSNAPSHOT *snapshot, librdf_world *world, LODSNAPID id)
+{
+	return lod_snapterm_node_(snapshot->strings, &(snapshot->terms[id]), world);
+}
+
+/* Find the term in a snapshot's dictionary which is equal to a librdf
+ * node, returning LODSNAP_ANY if there is none
+ */
+LODSNAPID
+lod_snapshot_find_(LODSNAPSHOT *snapshot, librdf_node *node)
+{
+	LODSNAPTERM *term;
+	const char *value, *lang, *datatype;
+	librdf_uri *uri;
+	uint32_t lo, hi, mid, kind;
+	size_t len;
+	int r;
+
+	lang = NULL;
+	datatype = NULL;
+	if(librdf_node_is_resource(node))
+	{
+		kind = LODSNAP_URI;
+		value = (const char *) librdf_uri_as_counted_string(librdf_node_get_uri(node), &len);
+	}
+	else if(librdf_node_is_blank(node))
+	{
+		kind = LODSNAP_BLANK;
+		value = (const char *) librdf_node_get_blank_identifier(node);
+		len = value ? strlen(value) : 0;
+	}
+	else
+	{
+		kind = LODSNAP_LITERAL;
+		value = (const char *) librdf_node_get_literal_value_as_counted_string(node, &len);
+		lang = librdf_node_get_literal_value_language(node);
+		if(lang && !*lang)
+		{
+			lang = NULL;
+		}
+		uri = librdf_node_get_literal_value_datatype_uri(node);
+		if(uri)
+		{
+			datatype = (const char *) librdf_uri_as_string(uri);
+		}
+	}
+	if(!value)
+	{
+		return LODSNAP_ANY;
+	}
+	/* The same ordering as lod_snapterm_compare_(), within the terms of
+	 * the node's kind
+	 */
+	lo = snapshot->kinds[kind];
+	hi = snapshot->kinds[kind + 1];
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		term = &(snapshot->terms[mid]);
+		r = memcmp(snapshot->strings + term->value, value, term->length < len ? term->length : len);
+		if(!r && term->length != len)
+		{
+			r = term->length < len ? -1 : 1;
+		}
+		if(!r)
+		{
+			r = lod_snapstr_match_(snapshot->strings, term->language, lang);
+		}
+		if(!r)
+		{
+			r = lod_snapstr_match_(snapshot->strings, term->datatype, datatype);
+		}
+		if(!r)
+		{
+			return mid;
+		}
+		if(r < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return LODSNAP_ANY;
+}
+
+/* Find the rows of a snapshot which match a pattern, returning the index
+ * used (whose order is stored in *order, as 0 for SPO, 1 for POS and 2 for
+ * OSP) and the range of rows within it
+ */
+LODSNAPROW *
+lod_snapshot_match_(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object, size_t *start, size_t *end, int *order)
+{
+	LODSNAPROW *rows;
+	LODSNAPID key[3];
+	int nkey;
+
+	rows = lod_snapshot_plan_(snapshot, subject, predicate, object, key, &nkey, order);
+	lod_snapshot_range_(rows, snapshot->ntriples, key, nkey, start, end);
+	return rows;
+}
+
+/* Obtain the metadata of a document recorded in a snapshot */
+int
+lod_snapshot_document(LODSNAPSHOT *snapshot, const char *uri, LODDOCINFO *info)
+{
+	LODSNAPDOC *doc;
+	size_t lo, hi, mid;
+	int r;
+
+	memset(info, 0, sizeof(LODDOCINFO));
+	lo = 0;
+	hi = snapshot->ndocs;
+	while(lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		doc = &(snapshot->docs[mid]);
+		r = strcmp(snapshot->strings + doc->uri, uri);
+		if(!r)
+		{
+			info->uri = snapshot->strings + doc->uri;
+			info->fetched = (time_t) doc->fetched;
+			info->etag = doc->etag == LODSNAP_NOSTR ? NULL : snapshot->strings + doc->etag;
+			info->redirects = doc->redirects == LODSNAP_NOSTR ? NULL : snapshot->strings + doc->redirects;
+			return 1;
+		}
+		if(r < 0)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return 0;
+}
+
+/* Create a new librdf node from a dictionary term whose strings are held
+ * in the supplied pool
+ */
+librdf_node *
+lod_snapterm_node_(const char *strings, const LODSNAPTERM *term, librdf_world *world)
+{
+	const unsigned char *value;
+	const char *lang;
+	librdf_uri *uri;
+	librdf_node *node;
+
+	value = (const unsigned char *) strings + term->value;
+	switch(term->kind)
+	{
+	case LODSNAP_URI:
+		return librdf_new_node_from_uri_string(world, value);
+	case LODSNAP_BLANK:
+		return librdf_new_node_from_blank_identifier(world, value);
+	}
+	uri = NULL;
+	if(term->datatype != LODSNAP_NOSTR)
+	{
+		uri = librdf_new_uri(world, (const unsigned char *) strings + term->datatype);
+		if(!uri)
+		{
+			return NULL;
+		}
+	}
+	lang = term->language == LODSNAP_NOSTR ? NULL : strings + term->language;
+	node = librdf_new_node_from_typed_counted_literal(world, value, term->length,
+		lang, lang ? strlen(lang) : 0, uri);
+	if(uri)
+	{
+		librdf_free_uri(uri);
+	}
+	return node;
+}
+
+/* Add a statement to the triples being collected by a builder, which may
+ * be used to build a snapshot or simply as a compact batch of statements
+ * independent of any librdf world
+ */
+int
+lod_snapbuild_add_(LODSNAPBUILDER *b, librdf_statement *statement)
+{
+	LODSNAPROW *row;
+	size_t size;
+
+	if(b->ntriples == b->trsize)
+	{
+		size = b->trsize ? b->trsize * 2 : SNAPSHOT_MINTRIPLES;
+		row = (LODSNAPROW *) realloc(b->triples, size * sizeof(LODSNAPROW));
+		if(!row)
+		{
+			return -1;
+		}
+		b->triples = row;
+		b->trsize = size;
+	}
+	row = &(b->triples[b->ntriples]);
+	row->k[0] = lod_snapbuild_term_(b, librdf_statement_get_subject(statement));
+	row->k[1] = lod_snapbuild_term_(b, librdf_statement_get_predicate(statement));
+	row->k[2] = lod_snapbuild_term_(b, librdf_statement_get_object(statement));
+	if(row->k[0] == LODSNAP_ANY || row->k[1] == LODSNAP_ANY || row->k[2] == LODSNAP_ANY)
+	{
+		return -1;
+	}
+	b->ntriples++;
+	return 0;
+}
+
+/* Write a snapshot to a file */
+int
+lod_save_snapshot(LODSNAPSHOT *snapshot, const char *path)
+{
+	LODSNAPHEADER header;
+	struct stat sbuf;
+	FILE *f;
+	char *tmp;
+	mode_t mask, mode;
+	int fd, e;
+
+	tmp = (char *) malloc(strlen(path) + 8);
+	if(!tmp)
+	{
+		return -1;
+	}
+	/* Write to a temporary file alongside the target and then rename it,
+	 * so that readers never see a partial snapshot
+	 */
+	strcpy(tmp, path);
+	strcat(tmp, ".XXXXXX");
+	fd = mkstemp(tmp);
+	if(fd == -1)
+	{
+		e = errno;
+		free(tmp);
+		errno = e;
+		return -1;
+	}
+	f = fdopen(fd, "wb");
+	if(!f)
+	{
+		e = errno;
+		close(fd);
+		unlink(tmp);
+		free(tmp);
+		errno = e;
+		return -1;
+	}
+	memset(&header, 0, sizeof(LODSNAPHEADER));
+	strcpy(header.magic, LODSNAP_MAGIC);
+	header.version = LODSNAP_VERSION;
+	header.byteorder = LODSNAP_BYTEORDER;
+	header.nterms = snapshot->nterms;
+	memcpy(header.kinds, snapshot->kinds, sizeof(header.kinds));
+	header.stringlen = snapshot->stringlen;
+	header.ntriples = snapshot->ntriples;
+	header.ndocs = snapshot->ndocs;
+	/* The header is written twice: first as a placeholder, and then once
+	 * the offsets of the sections are known
+	 */
+	if(fwrite(&header, sizeof(LODSNAPHEADER), 1, f) != 1 ||
+	   lod_snapshot_write_(f, snapshot->terms, snapshot->nterms * sizeof(LODSNAPTERM), &(header.terms)) ||
+	   lod_snapshot_write_(f, snapshot->strings, snapshot->stringlen, &(header.strings)) ||
+	   lod_snapshot_write_(f, snapshot->spo, snapshot->ntriples * sizeof(LODSNAPROW), &(header.spo)) ||
+	   lod_snapshot_write_(f, snapshot->pos, snapshot->ntriples * sizeof(LODSNAPROW), &(header.pos)) ||
+	   lod_snapshot_write_(f, snapshot->osp, snapshot->ntriples * sizeof(LODSNAPROW), &(header.osp)) ||
+	   lod_snapshot_write_(f, snapshot->docs, snapshot->ndocs * sizeof(LODSNAPDOC), &(header.docs)) ||
+	   fseek(f, 0, SEEK_SET) ||
+	   fwrite(&header, sizeof(LODSNAPHEADER), 1, f) != 1 ||
+	   fflush(f) ||
+	   fsync(fileno(f)))
+	{
+		e = errno;
+		fclose(f);
+		unlink(tmp);
+		free(tmp);
+		errno = e;
+		return -1;
+	}
+	/* mkstemp() creates the file readable only by its owner; give it the
+	 * permissions of the snapshot it replaces, or of a newly-created file
+	 */
+	if(stat(path, &sbuf))
+	{
+		mask = umask(0);
+		umask(mask);
+		mode = 0666 & ~mask;
+	}
+	else
+	{
+		mode = sbuf.st_mode & 07777;
+	}
+	if(fchmod(fileno(f), mode))
+	{
+		e = errno;
+		fclose(f);
+		unlink(tmp);
+		free(tmp);
+		errno = e;
+		return -1;
+	}
+	if(fclose(f) || rename(tmp, path))
+	{
+		e = errno;
+		unlink(tmp);
+		free(tmp);
+		errno = e;
+		return -1;
+	}
+	free(tmp);
+	return 0;
+}
+
+/* Load a snapshot previously written by lod_save_snapshot() */
+LODSNAPSHOT *
+lod_load_snapshot(const char *path)
+{
+	LODSNAPSHOT *snapshot;
+	LODSNAPHEADER *header;
+	struct stat sbuf;
+	char *map;
+	int fd, e;
+
+	fd = open(path, O_RDONLY);
+	if(fd == -1)
+	{
+		return NULL;
+	}
+	if(fstat(fd, &sbuf))
+	{
+		e = errno;
+		close(fd);
+		errno = e;
+		return NULL;
+	}
+	if((size_t) sbuf.st_size < sizeof(LODSNAPHEADER))
+	{
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	map = (char *) mmap(NULL, (size_t) sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	e = errno;
+	close(fd);
+	if(map == MAP_FAILED)
+	{
+		errno = e;
+		return NULL;
+	}
+	snapshot = (LODSNAPSHOT *) calloc(1, sizeof(LODSNAPSHOT));
+	if(!snapshot)
+	{
+		munmap(map, (size_t) sbuf.st_size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	snapshot->refcount = 1;
+	snapshot->map = map;
+	snapshot->maplen = (size_t) sbuf.st_size;
+	header = (LODSNAPHEADER *) map;
+	if(memcmp(header->magic, LODSNAP_MAGIC, sizeof(LODSNAP_MAGIC)) ||
+	   header->version != LODSNAP_VERSION ||
+	   header->byteorder != LODSNAP_BYTEORDER ||
+	   lod_snapshot_section_(snapshot->maplen, header->terms, header->nterms, sizeof(LODSNAPTERM)) ||
+	   lod_snapshot_section_(snapshot->maplen, header->strings, header->stringlen, 1) ||
+	   lod_snapshot_section_(snapshot->maplen, header->spo, header->ntriples, sizeof(LODSNAPROW)) ||
+	   lod_snapshot_section_(snapshot->maplen, header->pos, header->ntriples, sizeof(LODSNAPROW)) ||
+	   lod_snapshot_section_(snapshot->maplen, header->osp, header->ntriples, sizeof(LODSNAPROW)) ||
+	   lod_snapshot_section_(snapshot->maplen, header->docs, header->ndocs, sizeof(LODSNAPDOC)))
+	{
+		lod_snapshot_free_(snapshot);
+		errno = EINVAL;
+		return NULL;
+	}
+	snapshot->nterms = header->nterms;
+	memcpy(snapshot->kinds, header->kinds, sizeof(snapshot->kinds));
+	snapshot->terms = (LODSNAPTERM *) (map + header->terms);
+	snapshot->strings = map + header->strings;
+	snapshot->stringlen = (size_t) header->stringlen;
+	snapshot->spo = (LODSNAPROW *) (map + header->spo);
+	snapshot->pos = (LODSNAPROW *) (map + header->pos);
+	snapshot->osp = (LODSNAPROW *) (map + header->osp);
+	snapshot->ntriples = (size_t) header->ntriples;
+	snapshot->docs = (LODSNAPDOC *) (map + header->docs);
+	snapshot->ndocs = (size_t) header->ndocs;
+	if(lod_snapshot_validate_(snapshot))
+	{
+		lod_snapshot_free_(snapshot);
+		errno = EINVAL;
+		return NULL;
+	}
+	return snapshot;
+}
+
+/* Add the triples in a snapshot to the context's model */
+int
+lod_thaw(LODCONTEXT *context, LODSNAPSHOT *snapshot)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_thaw_locked_(context, snapshot);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_thaw(), with the context lock held */
+static int
+lod_thaw_locked_(LODCONTEXT *context, LODSNAPSHOT *snapshot)
+{
+	librdf_world *world;
+	librdf_model *model;
+	librdf_node *s, *p, *o;
+	librdf_statement *st;
+	LODDOCINFO info;
+	size_t c;
+	int r;
+
+	lod_state_(context)->error = 0;
+	world = lod_world(context);
+	if(!world)
+	{
+		return -1;
+	}
+	model = lod_model(context);
+	if(!model)
+	{
+		return -1;
+	}
+	r = 0;
+	for(c = 0; c < snapshot->ntriples; c++)
+	{
+		s = lod_snapshot_node(snapshot, world, snapshot->spo[c].k[0]);
+		p = lod_snapshot_node(snapshot, world, snapshot->spo[c].k[1]);
+		o = lod_snapshot_node(snapshot, world, snapshot->spo[c].k[2]);
+		if(!s || !p || !o)
+		{
+			if(s)
+			{
+				librdf_free_node(s);
+			}
+			if(p)
+			{
+				librdf_free_node(p);
+			}
+			if(o)
+			{
+				librdf_free_node(o);
+			}
+			lod_set_error_(context, "failed to create librdf node from snapshot");
+			r = -1;
+			break;
+		}
+		/* Note: the nodes become owned by the statement */
+		st = librdf_new_statement_from_nodes(world, s, p, o);
+		if(!st)
+		{
+			lod_set_error_(context, "failed to create librdf statement");
+			r = -1;
+			break;
+		}
+		if(librdf_model_add_statement(model, st))
+		{
+			librdf_free_statement(st);
+			lod_set_error_(context, "failed to add statement to model");
+			r = -1;
+			break;
+		}
+		librdf_free_statement(st);
+	}
+	if(c)
+	{
+		/* The indexes will be rebuilt when next used */
+		lod_generation_bump_(context, model);
+	}
+	for(c = 0; !r && c < snapshot->ndocs; c++)
+	{
+		lod_snapshot_document(snapshot, snapshot->strings + snapshot->docs[c].uri, &info);
+		r = lod_document_record_(context, info.uri, info.fetched, info.etag, info.redirects);
+	}
+	return r;
+}
+
+/* Free a snapshot and its contents */
+void
+lod_snapshot_free_(LODSNAPSHOT *snapshot)
+{
+	if(snapshot->map)
+	{
+		munmap(snapshot->map, snapshot->maplen);
+		free(snapshot);
+		return;
+	}
+	free(snapshot->docs);
+	free(snapshot->terms);
+	free(snapshot->strings);
+	free(snapshot->spo);
+	free(snapshot->pos);
+	free(snapshot->osp);
+	free(snapshot);
+}
+
+/* Add a node to the dictionary being built, returning its (provisional)
+ * identifier, or LODSNAP_ANY on error
+ */
+static LODSNAPID
+lod_snapbuild_term_(LODSNAPBUILDER *b, librdf_node *node)
+{
+	LODSNAPTERM term;
+	const char *value, *lang, *datatype;
+	librdf_uri *uri;
+	size_t len, saved, slot;
+	uint64_t hash;
+	uint32_t id;
+
+	lang = NULL;
+	datatype = NULL;
+	if(librdf_node_is_resource(node))
+	{
+		term.kind = LODSNAP_URI;
+		value = (const char *) librdf_uri_as_counted_string(librdf_node_get_uri(node), &len);
+	}
+	else if(librdf_node_is_blank(node))
+	{
+		term.kind = LODSNAP_BLANK;
+		value = (const char *) librdf_node_get_blank_identifier(node);
+		len = value ? strlen(value) : 0;
+	}
+	else
+	{
+		term.kind = LODSNAP_LITERAL;
+		value = (const char *) librdf_node_get_literal_value_as_counted_string(node, &len);
+		lang = librdf_node_get_literal_value_language(node);
+		if(lang && !*lang)
+		{
+			lang = NULL;
+		}
+		uri = librdf_node_get_literal_value_datatype_uri(node);
+		if(uri)
+		{
+			datatype = (const char *) librdf_uri_as_string(uri);
+		}
+	}
+	if(!value)
+	{
+		return LODSNAP_ANY;
+	}
+	hash = lod_hash_(value, len) ^ term.kind;
+	if(lang)
+	{
+		hash ^= lod_hash_(lang, strlen(lang)) * 31;
+	}
+	if(datatype)
+	{
+		hash ^= lod_hash_(datatype, strlen(datatype)) * 131;
+	}
+	if(b->nterms == b->tsize || (b->nterms + 1) * 2 > b->nslots)
+	{
+		if(lod_snapbuild_grow_(b))
+		{
+			return LODSNAP_ANY;
+		}
+	}
+	/* The strings are added to the pool before looking for an existing
+	 * term so that the two can be compared, and discarded if one is found
+	 */
+	saved = b->stringlen;
+	term.length = (uint32_t) len;
+	term.value = lod_snapbuild_string_(b, value, len);
+	term.language = lang ? lod_snapbuild_string_(b, lang, strlen(lang)) : LODSNAP_NOSTR;
+	term.datatype = datatype ? lod_snapbuild_string_(b, datatype, strlen(datatype)) : LODSNAP_NOSTR;
+	if(term.value == LODSNAP_NOSTR || (lang && term.language == LODSNAP_NOSTR) ||
+	   (datatype && term.datatype == LODSNAP_NOSTR))
+	{
+		return LODSNAP_ANY;
+	}
+	slot = (size_t) (hash & (b->nslots - 1));
+	while((id = b->slots[slot]) != LODSNAP_ANY)
+	{
+		if(b->hashes[id] == hash && !lod_snapterm_compare_(b->strings, &(b->terms[id]), &term))
+		{
+			b->stringlen = saved;
+			return id;
+		}
+		slot = (slot + 1) & (b->nslots - 1);
+	}
+	id = (uint32_t) b->nterms;
+	b->terms[id] = term;
+	b->hashes[id] = hash;
+	b->slots[slot] = id;
+	b->nterms++;
+	return id;
+}
+
+/* Append a NUL-terminated string to the pool being built, returning its
+ * offset, or LODSNAP_NOSTR on error
+ */
+static uint32_t
+lod_snapbuild_string_(LODSNAPBUILDER *b, const char *str, size_t len)
+{
+	char *p;
+	size_t size, offset;
+
+	if(b->stringlen + len + 1 >= LODSNAP_NOSTR)
+	{
+		errno = EFBIG;
+		return LODSNAP_NOSTR;
+	}
+	if(b->stringlen + len + 1 > b->stringsize)
+	{
+		for(size = b->stringsize ? b->stringsize : SNAPSHOT_MINSTRINGS; size < b->stringlen + len + 1; size *= 2)
+		{
+		}
+		p = (char *) realloc(b->strings, size);
+		if(!p)
+		{
+			return LODSNAP_NOSTR;
+		}
+		b->strings = p;
+		b->stringsize = size;
+	}
+	offset = b->stringlen;
+	memcpy(b->strings + offset, str, len);
+	b->strings[offset + len] = 0;
+	b->stringlen += len + 1;
+	return (uint32_t) offset;
+}
+
+/* Enlarge the dictionary being built and its hash */
+static int
+lod_snapbuild_grow_(LODSNAPBUILDER *b)
+{
+	LODSNAPTERM *terms;
+	uint64_t *hashes;
+	uint32_t *slots;
+	size_t size, nslots, c, slot;
+
+	if(b->nterms == b->tsize)
+	{
+		size = b->tsize ? b->tsize * 2 : SNAPSHOT_MINTERMS;
+		if(size >= LODSNAP_ANY)
+		{
+			errno = EFBIG;
+			return -1;
+		}
+		terms = (LODSNAPTERM *) realloc(b->terms, size * sizeof(LODSNAPTERM));
+		if(terms)
+		{
+			b->terms = terms;
+		}
+		hashes = (uint64_t *) realloc(b->hashes, size * sizeof(uint64_t));
+		if(hashes)
+		{
+			b->hashes = hashes;
+		}
+		if(!terms || !hashes)
+		{
+			return -1;
+		}
+		b->tsize = size;
+	}
+	if((b->nterms + 1) * 2 > b->nslots)
+	{
+		nslots = b->nslots ? b->nslots * 2 : SNAPSHOT_MINSLOTS;
+		slots = (uint32_t *) malloc(nslots * sizeof(uint32_t));
+		if(!slots)
+		{
+			return -1;
+		}
+		for(c = 0; c < nslots; c++)
+		{
+			slots[c] = LODSNAP_ANY;
+		}
+		for(c = 0; c < b->nterms; c++)
+		{
+			slot = (size_t) (b->hashes[c] & (nslots - 1));
+			while(slots[slot] != LODSNAP_ANY)
+			{
+				slot = (slot + 1) & (nslots - 1);
+			}
+			slots[slot] = (uint32_t) c;
+		}
+		free(b->slots);
+		b->slots = slots;
+		b->nslots = nslots;
+	}
+	return 0;
+}
+
+/* Add the metadata of a context's documents to the snapshot being built */
+static int
+lod_snapbuild_docs_(LODSNAPBUILDER *b, LODDOCUMENTS *documents)
+{
+	LODDOCUMENT *src;
+	LODSNAPDOC *doc;
+	size_t c;
+
+	if(!documents->ndocs)
+	{
+		return 0;
+	}
+	b->docs = (LODSNAPDOC *) calloc(documents->ndocs, sizeof(LODSNAPDOC));
+	if(!b->docs)
+	{
+		return -1;
+	}
+	for(c = 0; c < documents->ndocs; c++)
+	{
+		src = &(documents->docs[c]);
+		doc = &(b->docs[c]);
+		doc->fetched = (uint64_t) src->fetched;
+		doc->uri = lod_snapbuild_string_(b, src->uri, strlen(src->uri));
+		doc->etag = src->etag ? lod_snapbuild_string_(b, src->etag, strlen(src->etag)) : LODSNAP_NOSTR;
+		doc->redirects = src->redirects ? lod_snapbuild_string_(b, src->redirects, strlen(src->redirects)) : LODSNAP_NOSTR;
+		if(doc->uri == LODSNAP_NOSTR || (src->etag && doc->etag == LODSNAP_NOSTR) ||
+		   (src->redirects && doc->redirects == LODSNAP_NOSTR))
+		{
+			return -1;
+		}
+		b->ndocs++;
+	}
+	return 0;
+}
+
+/* Discard the state used to build a snapshot */
+void
+lod_snapbuild_free_(LODSNAPBUILDER *b)
+{
+	free(b->docs);
+	free(b->terms);
+	free(b->hashes);
+	free(b->slots);
+	free(b->strings);
+	free(b->triples);
+	memset(b, 0, sizeof(LODSNAPBUILDER));
+}
+
+/* Sort the dictionary, renumber the triples to match, and build the
+ * indexes; the builder is consumed either way
+ */
+static LODSNAPSHOT *
+lod_snapshot_build_(LODSNAPBUILDER *b)
+{
+	LODSNAPSHOT *snapshot;
+	uint32_t *order, *tmp;
+	size_t c, n;
+	uint32_t k;
+
+	n = b->nterms > b->ndocs ? b->nterms : b->ndocs;
+	snapshot = (LODSNAPSHOT *) calloc(1, sizeof(LODSNAPSHOT));
+	order = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+	tmp = (uint32_t *) malloc((n + 1) * sizeof(uint32_t));
+	if(snapshot)
+	{
+		snapshot->terms = (LODSNAPTERM *) malloc((b->nterms + 1) * sizeof(LODSNAPTERM));
+		snapshot->pos = (LODSNAPROW *) malloc((b->ntriples + 1) * sizeof(LODSNAPROW));
+		snapshot->osp = (LODSNAPROW *) malloc((b->ntriples + 1) * sizeof(LODSNAPROW));
+		snapshot->docs = (LODSNAPDOC *) malloc((b->ndocs + 1) * sizeof(LODSNAPDOC));
+	}
+	if(!snapshot || !order || !tmp || !snapshot->terms || !snapshot->pos || !snapshot->osp || !snapshot->docs)
+	{
+		if(snapshot)
+		{
+			lod_snapshot_free_(snapshot);
+		}
+		free(order);
+		free(tmp);
+		lod_snapbuild_free_(b);
+		errno = ENOMEM;
+		return NULL;
+	}
+	snapshot->refcount = 1;
+	/* Sort the dictionary, and record where each kind of term begins */
+	for(c = 0; c < b->nterms; c++)
+	{
+		order[c] = (uint32_t) c;
+	}
+	lod_snapshot_sort_(order, tmp, b->nterms, lod_snapbuild_termcmp_, b);
+	k = 0;
+	for(c = 0; c < b->nterms; c++)
+	{
+		snapshot->terms[c] = b->terms[order[c]];
+		tmp[order[c]] = (uint32_t) c;
+		while(k <= snapshot->terms[c].kind)
+		{
+			snapshot->kinds[k++] = (uint32_t) c;
+		}
+	}
+	while(k <= LODSNAP_NKINDS)
+	{
+		snapshot->kinds[k++] = (uint32_t) b->nterms;
+	}
+	snapshot->nterms = (uint32_t) b->nterms;
+	/* Renumber the triples, sort them into SPO order and discard any
+	 * duplicates (which arise from statements in multiple contexts)
+	 */
+	for(c = 0; c < b->ntriples; c++)
+	{
+		b->triples[c].k[0] = tmp[b->triples[c].k[0]];
+		b->triples[c].k[1] = tmp[b->triples[c].k[1]];
+		b->triples[c].k[2] = tmp[b->triples[c].k[2]];
+	}
+	qsort(b->triples, b->ntriples, sizeof(LODSNAPROW), lod_snaprow_compare_);
+	for(c = n = 0; c < b->ntriples; c++)
+	{
+		if(n && !lod_snaprow_compare_(&(b->triples[c]), &(b->triples[n - 1])))
+		{
+			continue;
+		}
+		b->triples[n++] = b->triples[c];
+	}
+	snapshot->ntriples = n;
+	for(c = 0; c < n; c++)
+	{
+		snapshot->pos[c].k[0] = b->triples[c].k[1];
+		snapshot->pos[c].k[1] = b->triples[c].k[2];
+		snapshot->pos[c].k[2] = b->triples[c].k[0];
+		snapshot->osp[c].k[0] = b->triples[c].k[2];
+		snapshot->osp[c].k[1] = b->triples[c].k[0];
+		snapshot->osp[c].k[2] = b->triples[c].k[1];
+	}
+	qsort(snapshot->pos, n, sizeof(LODSNAPROW), lod_snaprow_compare_);
+	qsort(snapshot->osp, n, sizeof(LODSNAPROW), lod_snaprow_compare_);
+	/* Sort the document metadata by URI */
+	for(c = 0; c < b->ndocs; c++)
+	{
+		order[c] = (uint32_t) c;
+	}
+	lod_snapshot_sort_(order, tmp, b->ndocs, lod_snapbuild_doccmp_, b);
+	for(c = 0; c < b->ndocs; c++)
+	{
+		snapshot->docs[c] = b->docs[order[c]];
+	}
+	snapshot->ndocs = b->ndocs;
+	/* The triple array and string pool become the snapshot's own */
+	snapshot->spo = b->triples;
+	snapshot->strings = b->strings;
+	snapshot->stringlen = b->stringlen;
+	b->triples = NULL;
+	b->strings = NULL;
+	free(order);
+	free(tmp);
+	lod_snapbuild_free_(b);
+	return snapshot;
+}
+
+/* Merge sort a set of indices using a comparator; the sort is stable, and
+ * unlike qsort() needs no global state to reach the string pool
+ */
+static void
+lod_snapshot_sort_(uint32_t *ids, uint32_t *tmp, size_t n, int (*compare)(void *data, uint32_t a, uint32_t b), void *data)
+{
+	size_t mid, i, j, k;
+
+	if(n < 2)
+	{
+		return;
+	}
+	mid = n / 2;
+	lod_snapshot_sort_(ids, tmp, mid, compare, data);
+	lod_snapshot_sort_(ids + mid, tmp, n - mid, compare, data);
+	for(i = 0, j = mid, k = 0; i < mid && j < n; k++)
+	{
+		if(compare(data, ids[j], ids[i]) < 0)
+		{
+			tmp[k] = ids[j++];
+		}
+		else
+		{
+			tmp[k] = ids[i++];
+		}
+	}
+	while(i < mid)
+	{
+		tmp[k++] = ids[i++];
+	}
+	while(j < n)
+	{
+		tmp[k++] = ids[j++];
+	}
+	memcpy(ids, tmp, n * sizeof(uint32_t));
+}
+
+/* Compare two of the terms being built */
+static int
+lod_snapbuild_termcmp_(void *data, uint32_t a, uint32_t b)
+{
+	LODSNAPBUILDER *builder;
+
+	builder = (LODSNAPBUILDER *) data;
+	return lod_snapterm_compare_(builder->strings, &(builder->terms[a]), &(builder->terms[b]));
+}
+
+/* Compare the URIs of two of the documents being built */
+static int
+lod_snapbuild_doccmp_(void *data, uint32_t a, uint32_t b)
+{
+	LODSNAPBUILDER *builder;
+
+	builder = (LODSNAPBUILDER *) data;
+	return strcmp(builder->strings + builder->docs[a].uri, builder->strings + builder->docs[b].uri);
+}
+
+/* Compare two terms by kind, value, language and datatype */
+static int
+lod_snapterm_compare_(const char *strings, const LODSNAPTERM *a, const LODSNAPTERM *b)
+{
+	int r;
+
+	if(a->kind != b->kind)
+	{
+		return a->kind < b->kind ? -1 : 1;
+	}
+	r = memcmp(strings + a->value, strings + b->value, a->length < b->length ? a->length : b->length);
+	if(r)
+	{
+		return r;
+	}
+	if(a->length != b->length)
+	{
+		return a->length < b->length ? -1 : 1;
+	}
+	r = lod_snapstr_compare_(strings, a->language, b->language);
+	if(r)
+	{
+		return r;
+	}
+	return lod_snapstr_compare_(strings, a->datatype, b->datatype);
+}
+
+/* Compare two optional strings in a pool; absent strings sort first */
+static int
+lod_snapstr_compare_(const char *strings, uint32_t a, uint32_t b)
+{
+	if(a == b)
+	{
+		return 0;
+	}
+	if(a == LODSNAP_NOSTR)
+	{
+		return -1;
+	}
+	if(b == LODSNAP_NOSTR)
+	{
+		return 1;
+	}
+	return strcmp(strings + a, strings + b);
+}
+
+/* Compare an optional string in a pool with one which isn't, in the same
+ * order as lod_snapstr_compare_()
+ */
+static int
+lod_snapstr_match_(const char *strings, uint32_t a, const char *b)
+{
+	if(a == LODSNAP_NOSTR)
+	{
+		return b ? -1 : 0;
+	}
+	if(!b)
+	{
+		return 1;
+	}
+	return strcmp(strings + a, b);
+}
+
+/* qsort() comparator for index rows */
+static int
+lod_snaprow_compare_(const void *a, const void *b)
+{
+	const LODSNAPROW *ra, *rb;
+	int c;
+
+	ra = (const LODSNAPROW *) a;
+	rb = (const LODSNAPROW *) b;
+	for(c = 0; c < 3; c++)
+	{
+		if(ra->k[c] != rb->k[c])
+		{
+			return ra->k[c] < rb->k[c] ? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+/* Select the index whose order allows a pattern to be answered as a
+ * contiguous range, and the key prefix which identifies that range
+ */
+static LODSNAPROW *
+lod_snapshot_plan_(LODSNAPSHOT *snapshot, LODSNAPID subject, LODSNAPID predicate, LODSNAPID object, LODSNAPID *key, int *nkey, int *order)
+{
+	*nkey = 0;
+	if(subject != LODSNAP_ANY && (predicate != LODSNAP_ANY || object == LODSNAP_ANY))
+	{
+		*order = 0;
+		key[(*nkey)++] = subject;
+		if(predicate != LODSNAP_ANY)
+		{
+			key[(*nkey)++] = predicate;
+			if(object != LODSNAP_ANY)
+			{
+				key[(*nkey)++] = object;
+			}
+		}
+		return snapshot->spo;
+	}
+	if(predicate != LODSNAP_ANY)
+	{
+		*order = 1;
+		key[(*nkey)++] = predicate;
+		if(object != LODSNAP_ANY)
+		{
+			key[(*nkey)++] = object;
+		}
+		return snapshot->pos;
+	}
+	if(object != LODSNAP_ANY)
+	{
+		*order = 2;
+		key[(*nkey)++] = object;
+		if(subject != LODSNAP_ANY)
+		{
+			key[(*nkey)++] = subject;
+		}
+		return snapshot->osp;
+	}
+	*order = 0;
+	return snapshot->spo;
+}
+
+/* Find the range of rows whose leading terms match a key */
+static void
+lod_snapshot_range_(LODSNAPROW *rows, size_t nrows, const LODSNAPID *key, int nkey, size_t *start, size_t *end)
+{
+	size_t lo, hi, mid;
+	int c, r, upper;
+
+	for(upper = 0; upper < 2; upper++)
+	{
+		lo = 0;
+		hi = nrows;
+		while(lo < hi)
+		{
+			mid = lo + (hi - lo) / 2;
+			r = 0;
+			for(c = 0; c < nkey && !r; c++)
+			{
+				if(rows[mid].k[c] != key[c])
+				{
+					r = rows[mid].k[c] < key[c] ? -1 : 1;
+				}
+			}
+			/* The lower bound is the first row not less than the key; the
+			 * upper bound is the first row greater than it
+			 */
+			if(r < 0 || (upper && !r))
+			{
+				lo = mid + 1;
+			}
+			else
+			{
+				hi = mid;
+			}
+		}
+		if(upper)
+		{
+			*end = lo;
+		}
+		else
+		{
+			*start = lo;
+		}
+	}
+}
+
+/* Write a section of a snapshot file, aligned to 8 bytes, recording its
+ * offset
+ */
+static int
+lod_snapshot_write_(FILE *f, const void *buf, size_t len, uint64_t *offset)
+{
+	static const char zero[8] = { 0 };
+	long pos;
+
+	pos = ftell(f);
+	if(pos < 0)
+	{
+		return -1;
+	}
+	if(pos % 8 && fwrite(zero, 8 - pos % 8, 1, f) != 1)
+	{
+		return -1;
+	}
+	*offset = (uint64_t) (pos % 8 ? pos + 8 - pos % 8 : pos);
+	if(len && fwrite(buf, len, 1, f) != 1)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/* Check that a section of a snapshot file lies within the mapping and is
+ * suitably aligned
+ */
+static int
+lod_snapshot_section_(size_t maplen, uint64_t offset, uint64_t count, size_t size)
+{
+	if(offset % 8 || offset > maplen || count > (maplen - offset) / size)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/* Check that every reference within a loaded snapshot is in bounds, so
+ * that a damaged file can't cause accesses outside of the mapping
+ */
+static int
+lod_snapshot_validate_(LODSNAPSHOT *snapshot)
+{
+	LODSNAPTERM *term;
+	LODSNAPDOC *doc;
+	size_t c, len;
+	int k;
+
+	len = snapshot->stringlen;
+	if(len && snapshot->strings[len - 1])
+	{
+		return -1;
+	}
+	for(k = 0; k < LODSNAP_NKINDS; k++)
+	{
+		if(snapshot->kinds[k] > snapshot->kinds[k + 1])
+		{
+			return -1;
+		}
+	}
+	if(snapshot->kinds[0] || snapshot->kinds[LODSNAP_NKINDS] != snapshot->nterms)
+	{
+		return -1;
+	}
+	for(c = 0; c < snapshot->nterms; c++)
+	{
+		term = &(snapshot->terms[c]);
+		if(term->kind >= LODSNAP_NKINDS || term->value >= len || term->length >= len - term->value ||
+		   snapshot->strings[term->value + term->length] ||
+		   (term->language != LODSNAP_NOSTR && term->language >= len) ||
+		   (term->datatype != LODSNAP_NOSTR && term->datatype >= len))
+		{
+			return -1;
+		}
+	}
+	for(c = 0; c < snapshot->ntriples; c++)
+	{
+		for(k = 0; k < 3; k++)
+		{
+			if(snapshot->spo[c].k[k] >= snapshot->nterms ||
+			   snapshot->pos[c].k[k] >= snapshot->nterms ||
+			   snapshot->osp[c].k[k] >= snapshot->nterms)
+			{
+				return -1;
+			}
+		}
+	}
+	for(c = 0; c < snapshot->ndocs; c++)
+	{
+		doc = &(snapshot->docs[c]);
+		if(doc->uri >= len ||
+		   (doc->etag != LODSNAP_NOSTR && doc->etag >= len) ||
+		   (doc->redirects != LODSNAP_NOSTR && doc->redirects >= len))
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
@@ -40,7 +40,7 @@ lod_sniff_(LODCONTEXT *context, LODRESPONSE *response)
 		len--;
 		t++;
 	}
-	if(!*t || !len)
+	if(!len || !*t)
 	{
 		return 1;
 	}
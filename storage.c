@@ -0,0 +1,315 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+static int lod_storage_safe_(const char *str);
+static int lod_set_storage_config_locked_(LODCONTEXT *context, const LODSTORAGECONFIG *config);
+static int lod_set_bulk_load_locked_(LODCONTEXT *context, int enable);
+static int lod_sync_locked_(LODCONTEXT *context);
+
+/* Select the storage which the context will create for itself */
+int
+lod_set_storage_config(LODCONTEXT *context, const LODSTORAGECONFIG *config)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_storage_config_locked_(context, config);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_storage_config(), with the context lock held */
+static int
+lod_set_storage_config_locked_(LODCONTEXT *context, const LODSTORAGECONFIG *config)
+{
+	LODSTORE store;
+
+	lod_state_(context)->error = 0;
+	memset(&store, 0, sizeof(LODSTORE));
+	if(config)
+	{
+		if(config->type != LODSTORE_CLUSTERED && config->type != LODSTORE_MEMORY &&
+		   config->type != LODSTORE_BDB && config->type != LODSTORE_SQLITE)
+		{
+			lod_set_error_(context, "unsupported storage type");
+			return -1;
+		}
+		if((config->type == LODSTORE_BDB || config->type == LODSTORE_SQLITE) && (!config->path || !*(config->path)))
+		{
+			lod_set_error_(context, "a path is required for persistent storage");
+			return -1;
+		}
+		if(!lod_storage_safe_(config->path) || !lod_storage_safe_(config->name))
+		{
+			lod_set_error_(context, "storage paths and names may not contain quotes");
+			return -1;
+		}
+		store.type = config->type;
+		store.sync = config->sync;
+		store.create = config->create;
+		if((config->path && !(store.path = strdup(config->path))) ||
+		   (config->name && !(store.name = strdup(config->name))) ||
+		   (config->options && !(store.options = strdup(config->options))))
+		{
+			lod_set_error_(context, strerror(errno));
+			free(store.path);
+			free(store.name);
+			free(store.options);
+			return -1;
+		}
+	}
+	/* Discards the current storage, ending any bulk load */
+	lod_set_storage(context, NULL);
+	lod_storage_free_(context);
+	context->store = store;
+	if(!lod_storage(context))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/* Begin or end a bulk load */
+int
+lod_set_bulk_load(LODCONTEXT *context, int enable)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_set_bulk_load_locked_(context, enable);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_set_bulk_load(), with the context lock held */
+static int
+lod_set_bulk_load_locked_(LODCONTEXT *context, int enable)
+{
+	LODSTORE *store;
+	librdf_model *model;
+	int r;
+
+	lod_state_(context)->error = 0;
+	store = &(context->store);
+	if(!enable == !store->bulk)
+	{
+		return 0;
+	}
+	model = lod_model(context);
+	if(!model)
+	{
+		return -1;
+	}
+	if(enable)
+	{
+		store->bulk = 1;
+		/* Not every storage module supports transactions, but those which
+		 * do (such as SQLite) load far faster within one
+		 */
+		store->transaction = !librdf_model_transaction_start(model);
+		return 0;
+	}
+	r = 0;
+	store->bulk = 0;
+	if(store->transaction && librdf_model_transaction_commit(model))
+	{
+		lod_set_error_(context, "failed to commit bulk load");
+		r = -1;
+	}
+	store->transaction = 0;
+	/* The indexes weren't maintained during the load */
+	context->index.rebuild = 1;
+	if(lod_sync(context))
+	{
+		r = -1;
+	}
+	return r;
+}
+
+/* Flush any changes to the context's storage to disk */
+int
+lod_sync(LODCONTEXT *context)
+{
+	int r;
+
+	lod_lock_(context);
+	r = lod_sync_locked_(context);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_sync(), with the context lock held */
+static int
+lod_sync_locked_(LODCONTEXT *context)
+{
+	librdf_model *model;
+
+	lod_state_(context)->error = 0;
+	model = lod_model(context);
+	if(!model)
+	{
+		return -1;
+	}
+	if(librdf_model_sync(model))
+	{
+		lod_set_error_(context, "failed to flush storage");
+		return -1;
+	}
+	return 0;
+}
+
+/* Create the storage described by the context's configuration */
+librdf_storage *
+lod_storage_open_(LODCONTEXT *context, librdf_world *world)
+{
+	LODSTORE *store;
+	librdf_storage *storage;
+	struct stat sbuf;
+	const char *factory, *name, *sync;
+	char *options;
+	size_t len;
+	int create;
+
+	store = &(context->store);
+	create = store->create;
+	len = 128 + (store->path ? strlen(store->path) : 0) + (store->options ? strlen(store->options) : 0);
+	options = (char *) malloc(len);
+	if(!options)
+	{
+		lod_set_error_(context, strerror(errno));
+		return NULL;
+	}
+	/* An overlay's triples are always held in memory, above its base */
+	store->clustered = 0;
+	switch(context->overlay ? LODSTORE_CLUSTERED : store->type)
+	{
+	case LODSTORE_BDB:
+		factory = "hashes";
+		name = store->name ? store->name : "lod";
+		snprintf(options, len, "hash-type='bdb',dir='%s',contexts='yes',write='yes',new='%s'", store->path, create ? "yes" : "no");
+		break;
+	case LODSTORE_SQLITE:
+		factory = "sqlite";
+		name = store->path;
+		/* The SQLite module only creates its tables for a new database */
+		if(stat(store->path, &sbuf))
+		{
+			create = 1;
+		}
+		sync = store->sync == LODSYNC_NONE ? "off" : (store->sync == LODSYNC_FULL ? "full" : "normal");
+		snprintf(options, len, "contexts='yes',new='%s',synchronous='%s'", create ? "yes" : "no", sync);
+		break;
+	case LODSTORE_MEMORY:
+		factory = "hashes";
+		name = NULL;
+		strcpy(options, "hash-type='memory',contexts='yes'");
+		break;
+	default:
+		/* The world may have been supplied by the caller */
+		if(lod_clustered_register_(world))
+		{
+			lod_set_error_(context, "failed to register storage module");
+			free(options);
+			return NULL;
+		}
+		factory = LOD_CLUSTERED_STORAGE;
+		name = NULL;
+		strcpy(options, "contexts='yes'");
+		store->clustered = 1;
+		break;
+	}
+	if(store->options && *(store->options))
+	{
+		strcat(options, ",");
+		strcat(options, store->options);
+	}
+	storage = librdf_new_storage(world, factory, name, options);
+	free(options);
+	if(!storage)
+	{
+		lod_set_error_(context, "failed to open storage");
+		return NULL;
+	}
+	if(context->overlay)
+	{
+		lod_clustered_attach_(storage, context->overlay);
+	}
+	/* Only the first open discards existing contents */
+	store->create = 0;
+	return storage;
+}
+
+/* Flush the storage after a document has been processed, according to the
+ * context's sync policy
+ */
+int
+lod_storage_document_(LODCONTEXT *context)
+{
+	LODSTORE *store;
+
+	store = &(context->store);
+	if(context->overlay || store->type == LODSTORE_CLUSTERED || store->type == LODSTORE_MEMORY || store->bulk || store->sync == LODSYNC_NONE || !context->model)
+	{
+		return 0;
+	}
+	if(librdf_model_sync(context->model))
+	{
+		lod_set_error_(context, "failed to flush storage");
+		return -1;
+	}
+	return 0;
+}
+
+/* Obtain the count of changes made to the storage beneath a model, which
+ * catches every addition and removal, including those made directly
+ * through librdf; returns -1 unless the model is the context's own, on the
+ * clustered storage, which is the only one which keeps such a count
+ */
+int
+lod_storage_changes_(LODCONTEXT *context, librdf_model *model, unsigned long *changes)
+{
+	if(model != context->model || !context->model_alloc ||
+	   !context->storage_alloc || !context->storage || !context->store.clustered)
+	{
+		return -1;
+	}
+	*changes = lod_clustered_changes_(context->storage);
+	return 0;
+}
+
+/* Discard the context's storage configuration */
+void
+lod_storage_free_(LODCONTEXT *context)
+{
+	free(context->store.path);
+	free(context->store.name);
+	free(context->store.options);
+	memset(&(context->store), 0, sizeof(LODSTORE));
+}
+
+/* Determine whether a string can be embedded in librdf storage options */
+static int
+lod_storage_safe_(const char *str)
+{
+	return !str || !strchr(str, '\'');
+}
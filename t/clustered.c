@@ -0,0 +1,210 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test the clustered storage which a context uses by default, through
+ * librdf's model APIs: adding statements singly and in bulk (where
+ * duplicates, including those not adjacent in the stream, must be
+ * suppressed), finding statements with every combination of bound and
+ * unbound terms, and removing them.
+ */
+
+#define ex(x) \
+	"http://liblod.example.com/" x
+
+/* Duplicates both of a statement already present and of one earlier in
+ * the same stream
+ */
+#define bulk_ttl \
+"<" ex("s1") "> <" ex("p1") "> <" ex("o1") "> . \
+<" ex("s3") "> <" ex("p2") "> <" ex("o1") "> . \
+<" ex("s3") "> <" ex("p1") "> <" ex("o2") "> . \
+<" ex("s3") "> <" ex("p2") "> <" ex("o1") "> ."
+
+typedef struct
+{
+	const char *subject;
+	const char *predicate;
+	const char *object;
+	int expected;
+} PATTERN;
+
+/* The contents of the store after the bulk add:
+ *   s1 p1 o1, s1 p2 "literal", s2 p1 o1, s3 p2 o1, s3 p1 o2
+ */
+static const PATTERN patterns[] = {
+	{ NULL, NULL, NULL, 5 },
+	{ ex("s1"), NULL, NULL, 2 },
+	{ NULL, ex("p1"), NULL, 3 },
+	{ NULL, NULL, ex("o1"), 3 },
+	{ ex("s1"), ex("p1"), NULL, 1 },
+	{ ex("s1"), NULL, ex("o1"), 1 },
+	{ NULL, ex("p1"), ex("o1"), 2 },
+	{ ex("s1"), ex("p1"), ex("o1"), 1 },
+	{ ex("s3"), ex("p2"), NULL, 1 },
+	{ ex("s4"), NULL, NULL, 0 },
+	{ NULL, ex("p3"), NULL, 0 }
+};
+
+#define NPATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+static librdf_node *
+node(librdf_world *world, const char *uri)
+{
+	return uri ? librdf_new_node_from_uri_string(world, (const unsigned char *) uri) : NULL;
+}
+
+static librdf_statement *
+statement(librdf_world *world, const char *s, const char *p, const char *o)
+{
+	return librdf_new_statement_from_nodes(world, node(world, s), node(world, p), node(world, o));
+}
+
+/* Count the statements matching a pattern, or return -1 */
+static int
+count(librdf_world *world, librdf_model *model, const char *s, const char *p, const char *o)
+{
+	librdf_statement *query;
+	librdf_stream *stream;
+	int n;
+
+	query = statement(world, s, p, o);
+	if(!query)
+	{
+		return -1;
+	}
+	stream = librdf_model_find_statements(model, query);
+	if(!stream)
+	{
+		librdf_free_statement(query);
+		return -1;
+	}
+	for(n = 0; !librdf_stream_end(stream); librdf_stream_next(stream))
+	{
+		n++;
+	}
+	librdf_free_stream(stream);
+	librdf_free_statement(query);
+	return n;
+}
+
+static int
+add(librdf_model *model, librdf_statement *st)
+{
+	int r;
+
+	if(!st)
+	{
+		return -1;
+	}
+	r = librdf_model_add_statement(model, st);
+	librdf_free_statement(st);
+	return r;
+}
+
+int
+main(int argc, char **argv)
+{
+	LODCONTEXT *ctx;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_stream *stream;
+	librdf_statement *st;
+	librdf_uri *uri;
+	size_t c;
+	int r, n;
+
+	(void) argc;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	world = lod_world(ctx);
+	model = lod_model(ctx);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	/* Single additions, one of them repeated */
+	if(add(model, statement(world, ex("s1"), ex("p1"), ex("o1"))) ||
+	   add(model, librdf_new_statement_from_nodes(world, node(world, ex("s1")), node(world, ex("p2")),
+		   librdf_new_node_from_literal(world, (const unsigned char *) "literal", NULL, 0))) ||
+	   add(model, statement(world, ex("s2"), ex("p1"), ex("o1"))) ||
+	   add(model, statement(world, ex("s1"), ex("p1"), ex("o1"))))
+	{
+		fprintf(stderr, "%s: failed to add statements to model\n", argv[0]);
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	r = 0;
+	if(librdf_model_size(model) != 3)
+	{
+		fprintf(stderr, "%s: model has %d statements after single additions (expected 3)\n", argv[0], librdf_model_size(model));
+		r = 1;
+	}
+	/* A bulk addition from a stream */
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) ex(""));
+	stream = (parser && uri) ? librdf_parser_parse_string_as_stream(parser, (const unsigned char *) bulk_ttl, uri) : NULL;
+	if(!stream || librdf_model_add_statements(model, stream))
+	{
+		fprintf(stderr, "%s: failed to add stream to model\n", argv[0]);
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	librdf_free_stream(stream);
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	if(librdf_model_size(model) != 5)
+	{
+		fprintf(stderr, "%s: model has %d statements after bulk addition (expected 5)\n", argv[0], librdf_model_size(model));
+		r = 1;
+	}
+	for(c = 0; c < NPATTERNS; c++)
+	{
+		n = count(world, model, patterns[c].subject, patterns[c].predicate, patterns[c].object);
+		if(n != patterns[c].expected)
+		{
+			fprintf(stderr, "%s: pattern (%s, %s, %s) matched %d statements (expected %d)\n", argv[0],
+				patterns[c].subject ? patterns[c].subject : "?",
+				patterns[c].predicate ? patterns[c].predicate : "?",
+				patterns[c].object ? patterns[c].object : "?",
+				n, patterns[c].expected);
+			r = 1;
+		}
+	}
+	/* Removal, including of a statement which is no longer present */
+	st = statement(world, ex("s1"), ex("p1"), ex("o1"));
+	if(!st)
+	{
+		fprintf(stderr, "%s: failed to create statement\n", argv[0]);
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	librdf_model_remove_statement(model, st);
+	if(librdf_model_contains_statement(model, st) ||
+	   librdf_model_size(model) != 4 ||
+	   count(world, model, NULL, NULL, ex("o1")) != 2 ||
+	   count(world, model, ex("s1"), NULL, NULL) != 1)
+	{
+		fprintf(stderr, "%s: statement was not removed\n", argv[0]);
+		r = 1;
+	}
+	librdf_model_remove_statement(model, st);
+	if(librdf_model_size(model) != 4)
+	{
+		fprintf(stderr, "%s: removing an absent statement changed the model's size\n", argv[0]);
+		r = 1;
+	}
+	librdf_free_statement(st);
+	lod_destroy(ctx);
+	return r ? EXIT_FAILURE : 0;
+}
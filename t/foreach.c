@@ -0,0 +1,185 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test visiting an instance's triples with lod_instance_foreach() and
+ * lod_instance_foreach_predicate(), including ending the iteration early.
+ */
+
+#define visit_uri \
+	"http://liblod.example.com/things/1#id"
+#define visit_ns \
+	"http://liblod.example.com/ns#"
+
+#define visit_ttl \
+"@prefix ex: <" visit_ns "> . \
+\
+<" visit_uri "> \
+	ex:value \"1\", \"2\", \"3\"; \
+	ex:link <http://liblod.example.com/things/2#id>; \
+	ex:name \"Thing\" . \
+\
+<http://liblod.example.com/things/2#id> ex:value \"4\" ."
+
+#define MAXVISITS                       8
+
+typedef struct
+{
+	/* The predicates of the triples visited so far, in order */
+	const char *predicates[MAXVISITS];
+	int count;
+	/* If non-zero, the value returned on reaching this many visits */
+	int stop_after;
+	int stop_with;
+	int foreign;
+} VISITS;
+
+static int
+visit(LODINSTANCE *instance, librdf_node *predicate, librdf_node *object, void *userdata)
+{
+	VISITS *v;
+
+	(void) instance;
+
+	v = (VISITS *) userdata;
+	if(!librdf_node_is_resource(predicate) || !object)
+	{
+		v->foreign++;
+		return 0;
+	}
+	if(librdf_node_is_literal(object) && !strcmp((const char *) librdf_node_get_literal_value(object), "4"))
+	{
+		/* A triple belonging to a different subject */
+		v->foreign++;
+	}
+	if(v->count < MAXVISITS)
+	{
+		v->predicates[v->count] = (const char *) librdf_uri_as_string(librdf_node_get_uri(predicate));
+	}
+	v->count++;
+	if(v->stop_after && v->count == v->stop_after)
+	{
+		return v->stop_with;
+	}
+	return 0;
+}
+
+/* Check that the triples of each predicate were visited consecutively */
+static int
+grouped(VISITS *v)
+{
+	int c, d;
+
+	for(c = 1; c < v->count && c < MAXVISITS; c++)
+	{
+		if(!strcmp(v->predicates[c], v->predicates[c - 1]))
+		{
+			continue;
+		}
+		for(d = 0; d < c - 1; d++)
+		{
+			if(!strcmp(v->predicates[d], v->predicates[c]))
+			{
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *inst;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *uri;
+	VISITS v;
+	int r, c;
+
+	(void) argc;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	world = lod_world(ctx);
+	model = lod_model(ctx);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) visit_uri);
+	if(!parser || !uri || librdf_parser_parse_string_into_model(parser, (const unsigned char *) visit_ttl, uri, model))
+	{
+		fprintf(stderr, "%s: failed to parse string into model: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	inst = lod_locate(ctx, visit_uri);
+	if(!inst)
+	{
+		fprintf(stderr, "%s: failed to locate <%s>\n", argv[0], visit_uri);
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	r = 0;
+	/* Every triple, grouped by predicate */
+	memset(&v, 0, sizeof(VISITS));
+	if(lod_instance_foreach(inst, visit, &v) || v.count != 5 || v.foreign)
+	{
+		fprintf(stderr, "%s: lod_instance_foreach() visited %d triples (expected 5)\n", argv[0], v.count);
+		r = 1;
+	}
+	else if(!grouped(&v))
+	{
+		fprintf(stderr, "%s: lod_instance_foreach() didn't visit triples in order of predicate\n", argv[0]);
+		r = 1;
+	}
+	/* A non-zero return from the callback ends the iteration, and is
+	 * passed back to the caller
+	 */
+	memset(&v, 0, sizeof(VISITS));
+	v.stop_after = 2;
+	v.stop_with = 42;
+	if(lod_instance_foreach(inst, visit, &v) != 42 || v.count != 2)
+	{
+		fprintf(stderr, "%s: lod_instance_foreach() didn't stop when asked (visited %d triples)\n", argv[0], v.count);
+		r = 1;
+	}
+	/* Only the triples with the given predicate */
+	memset(&v, 0, sizeof(VISITS));
+	if(lod_instance_foreach_predicate(inst, visit_ns "value", visit, &v) || v.count != 3 || v.foreign)
+	{
+		fprintf(stderr, "%s: lod_instance_foreach_predicate() visited %d triples (expected 3)\n", argv[0], v.count);
+		r = 1;
+	}
+	for(c = 0; c < v.count && c < MAXVISITS; c++)
+	{
+		if(strcmp(v.predicates[c], visit_ns "value"))
+		{
+			fprintf(stderr, "%s: lod_instance_foreach_predicate() visited <%s>\n", argv[0], v.predicates[c]);
+			r = 1;
+		}
+	}
+	memset(&v, 0, sizeof(VISITS));
+	if(lod_instance_foreach_predicate(inst, visit_ns "missing", visit, &v) || v.count)
+	{
+		fprintf(stderr, "%s: lod_instance_foreach_predicate() visited %d triples of an absent predicate\n", argv[0], v.count);
+		r = 1;
+	}
+	lod_instance_destroy(inst);
+	lod_destroy(ctx);
+	return r ? EXIT_FAILURE : 0;
+}
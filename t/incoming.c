@@ -0,0 +1,132 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test lod_instance_incoming(), with and without a predicate, both from
+ * the inbound-link index and (with LODI_INCOMING disabled) by querying
+ * the model.
+ */
+
+#define ex(x) \
+	"http://liblod.example.com/things/" x "#id"
+#define prop(x) \
+	"http://liblod.example.com/ns#" x
+
+#define incoming_ttl \
+"@prefix ex: <http://liblod.example.com/ns#> . \
+\
+<" ex("a") "> ex:knows <" ex("b") "> . \
+<" ex("c") "> ex:knows <" ex("b") ">; ex:likes <" ex("b") "> . \
+<" ex("b") "> ex:knows <" ex("a") "> . \
+<" ex("d") "> ex:name \"" ex("b") "\" . \
+[] ex:knows <" ex("b") "> ."
+
+#define MAXURIS                         8
+
+/* Check the subjects referring to an instance, which must be those in
+ * expected (separated by spaces)
+ */
+static int
+check(const char *argv0, LODINSTANCE *inst, const char *predicate, long expect, const char *expected, unsigned int flags)
+{
+	const char *uris[MAXURIS];
+	long count, c;
+
+	count = lod_instance_incoming(inst, predicate, uris, MAXURIS);
+	if(count != expect)
+	{
+		fprintf(stderr, "%s: <%s> has %ld inbound links via <%s> (expected %ld, indexes 0x%x)\n", argv0,
+			(const char *) librdf_uri_as_string(lod_instance_uri(inst)), count, predicate ? predicate : "*", expect, flags);
+		return 1;
+	}
+	for(c = 0; c < count; c++)
+	{
+		if(!strstr(expected, uris[c]))
+		{
+			fprintf(stderr, "%s: unexpected inbound link from <%s> (indexes 0x%x)\n", argv0, uris[c], flags);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+run(const char *argv0, unsigned int flags)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *a, *b;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *uri;
+	int r;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv0, strerror(errno));
+		return 1;
+	}
+	lod_set_indexes(ctx, flags);
+	world = lod_world(ctx);
+	model = lod_model(ctx);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv0, lod_errmsg(ctx));
+		lod_destroy(ctx);
+		return 1;
+	}
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) ex("a"));
+	if(!parser || !uri || librdf_parser_parse_string_into_model(parser, (const unsigned char *) incoming_ttl, uri, model))
+	{
+		fprintf(stderr, "%s: failed to parse string into model: %s\n", argv0, lod_errmsg(ctx));
+		lod_destroy(ctx);
+		return 1;
+	}
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	a = lod_locate(ctx, ex("a"));
+	b = lod_locate(ctx, ex("b"));
+	if(!a || !b)
+	{
+		fprintf(stderr, "%s: failed to locate subjects\n", argv0);
+		if(a)
+		{
+			lod_instance_destroy(a);
+		}
+		if(b)
+		{
+			lod_instance_destroy(b);
+		}
+		lod_destroy(ctx);
+		return 1;
+	}
+	r = 0;
+	/* Each referring subject is reported once, however many links it has;
+	 * blank nodes and literals which merely look like the URI are not
+	 */
+	r |= check(argv0, b, NULL, 2, ex("a") " " ex("c"), flags);
+	r |= check(argv0, b, prop("knows"), 2, ex("a") " " ex("c"), flags);
+	r |= check(argv0, b, prop("likes"), 1, ex("c"), flags);
+	r |= check(argv0, b, prop("hates"), 0, "", flags);
+	r |= check(argv0, a, NULL, 1, ex("b"), flags);
+	lod_instance_destroy(a);
+	lod_instance_destroy(b);
+	lod_destroy(ctx);
+	return r;
+}
+
+int
+main(int argc, char **argv)
+{
+	int r;
+
+	(void) argc;
+
+	r = run(argv[0], LODI_DEFAULT|LODI_INCOMING);
+	r |= run(argv[0], LODI_DEFAULT);
+	return r ? EXIT_FAILURE : 0;
+}
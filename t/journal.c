@@ -0,0 +1,260 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+#include <sys/stat.h>
+
+/* Test the write-ahead journal: replaying it must restore the documents
+ * which were processed, compacting it must retain only the most recent
+ * record for each document, and reopening it must discard an incomplete
+ * record left at the end.
+ */
+
+#include "dbpl-oxford.h"
+
+#define test_doc                        "http://example.com/doc"
+#define test_uri                        "http://example.com/doc#id"
+#define test_ttl(value) \
+	"<" test_uri "> <http://www.w3.org/2000/01/rdf-schema#label> \"" value "\" ."
+
+static int
+process(const char *argv0, LODCONTEXT *ctx, const char *uri, const char *ttl)
+{
+	LODRESPONSE *resp;
+	LODRESULT r;
+
+	resp = lod_response_create();
+	if(!resp)
+	{
+		fprintf(stderr, "%s: failed to create response: %s\n", argv0, strerror(errno));
+		return -1;
+	}
+	lod_response_set_status(resp, 200);
+	lod_response_set_uri(resp, uri);
+	lod_response_set_type(resp, "text/turtle");
+	lod_response_set_payload_copy(resp, ttl, strlen(ttl));
+	r = lod_response_process(ctx, resp);
+	lod_response_destroy(resp);
+	if(r != LODR_COMPLETE)
+	{
+		fprintf(stderr, "%s: failed to process <%s>: %s\n", argv0, uri, lod_errmsg(ctx));
+		return -1;
+	}
+	return 0;
+}
+
+static int
+match(LODINSTANCE *instance, librdf_node *predicate, librdf_node *object, void *userdata)
+{
+	(void) instance;
+	(void) predicate;
+
+	return librdf_node_is_literal(object) &&
+		!strcmp((const char *) librdf_node_get_literal_value(object), (const char *) userdata);
+}
+
+/* Return 1 if the test document's subject has the supplied label in the
+ * context's model, 0 if not, or -1 on error
+ */
+static int
+has(LODCONTEXT *ctx, const char *value)
+{
+	LODINSTANCE *inst;
+	int r;
+
+	inst = lod_locate(ctx, test_uri);
+	if(!inst)
+	{
+		return 0;
+	}
+	r = lod_instance_foreach(inst, match, (void *) value);
+	lod_instance_destroy(inst);
+	return r < 0 ? -1 : (r ? 1 : 0);
+}
+
+/* Replay the journal into a new context, which must contain the Oxford
+ * document and exactly the expected labels of the test document
+ */
+static int
+replay(const char *argv0, const char *path, const char *what, const char **present, const char **absent)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *inst;
+	LODDOCINFO info;
+	int r;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv0, strerror(errno));
+		return -1;
+	}
+	if(lod_journal_replay(ctx, path))
+	{
+		fprintf(stderr, "%s: failed to replay %s journal: %s\n", argv0, what, lod_errmsg(ctx));
+		lod_destroy(ctx);
+		return -1;
+	}
+	r = 0;
+	inst = lod_locate(ctx, oxford_uri);
+	if(!inst || lod_document_info(ctx, oxford_doc, &info) != 1 || lod_document_info(ctx, test_doc, &info) != 1)
+	{
+		fprintf(stderr, "%s: the %s journal did not restore both documents\n", argv0, what);
+		r = -1;
+	}
+	if(inst)
+	{
+		lod_instance_destroy(inst);
+	}
+	for(; !r && *present; present++)
+	{
+		if(has(ctx, *present) != 1)
+		{
+			fprintf(stderr, "%s: the %s journal did not restore the label '%s'\n", argv0, what, *present);
+			r = -1;
+		}
+	}
+	for(; !r && *absent; absent++)
+	{
+		if(has(ctx, *absent) != 0)
+		{
+			fprintf(stderr, "%s: the %s journal restored the superseded label '%s'\n", argv0, what, *absent);
+			r = -1;
+		}
+	}
+	lod_destroy(ctx);
+	return r;
+}
+
+static off_t
+filesize(const char *path)
+{
+	struct stat sbuf;
+
+	if(stat(path, &sbuf))
+	{
+		return -1;
+	}
+	return sbuf.st_size;
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char *none[] = { NULL }, *both[] = { "1", "2", NULL };
+	static const char *latest[] = { "2", NULL }, *old[] = { "1", NULL };
+	static const char *after[] = { "2", "3", NULL };
+	LODCONTEXT *ctx;
+	char path[] = "journal.XXXXXX";
+	char head[100];
+	off_t full, compacted, size;
+	FILE *f;
+	int fd, r;
+
+	(void) argc;
+
+	fd = mkstemp(path);
+	if(fd == -1)
+	{
+		fprintf(stderr, "%s: failed to create temporary file: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv[0], strerror(errno));
+		unlink(path);
+		exit(EXIT_FAILURE);
+	}
+	r = 0;
+	/* Three records, the last of which supersedes the second */
+	if(lod_set_journal(ctx, path, 0) ||
+	   process(argv[0], ctx, oxford_doc, oxford_ttl) ||
+	   process(argv[0], ctx, test_doc, test_ttl("1")) ||
+	   process(argv[0], ctx, test_doc, test_ttl("2")))
+	{
+		fprintf(stderr, "%s: failed to write journal: %s\n", argv[0], lod_errmsg(ctx));
+		r = -1;
+	}
+	/* Replaying restores every record */
+	if(!r)
+	{
+		r = replay(argv[0], path, "original", both, none);
+	}
+	/* Compacting keeps only the most recent record for each document */
+	if(!r)
+	{
+		full = filesize(path);
+		if(lod_journal_compact(ctx))
+		{
+			fprintf(stderr, "%s: failed to compact journal: %s\n", argv[0], lod_errmsg(ctx));
+			r = -1;
+		}
+	}
+	if(!r)
+	{
+		compacted = filesize(path);
+		if(compacted <= 0 || compacted >= full)
+		{
+			fprintf(stderr, "%s: compaction did not shrink the journal\n", argv[0]);
+			r = -1;
+		}
+	}
+	if(!r)
+	{
+		r = replay(argv[0], path, "compacted", latest, old);
+	}
+	lod_destroy(ctx);
+	/* An incomplete record at the end is discarded when the journal is
+	 * reopened, so that later records can still be replayed
+	 */
+	if(!r)
+	{
+		f = fopen(path, "r+b");
+		if(!f || fread(head, sizeof(head), 1, f) != 1 || fseek(f, 0, SEEK_END) ||
+		   fwrite(head, sizeof(head), 1, f) != 1 || fclose(f))
+		{
+			fprintf(stderr, "%s: failed to damage journal: %s\n", argv[0], strerror(errno));
+			r = -1;
+		}
+	}
+	if(!r)
+	{
+		ctx = lod_create();
+		if(!ctx || lod_set_journal(ctx, path, 0))
+		{
+			fprintf(stderr, "%s: failed to reopen journal: %s\n", argv[0], ctx ? lod_errmsg(ctx) : strerror(errno));
+			r = -1;
+		}
+		else
+		{
+			size = filesize(path);
+			if(size != compacted)
+			{
+				fprintf(stderr, "%s: reopening left %ld bytes in the journal (expected %ld)\n", argv[0], (long) size, (long) compacted);
+				r = -1;
+			}
+			else
+			{
+				r = process(argv[0], ctx, test_doc, test_ttl("3"));
+			}
+		}
+		if(ctx)
+		{
+			lod_destroy(ctx);
+		}
+	}
+	if(!r)
+	{
+		r = replay(argv[0], path, "reopened", after, old);
+	}
+	unlink(path);
+	if(r)
+	{
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
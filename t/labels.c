@@ -0,0 +1,103 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test label selection according to language preferences and predicate
+ * priority
+ */
+
+#define labels_uri \
+	"http://liblod.example.com/things/1#id"
+
+#define labels_ttl \
+"@prefix rdfs: <http://www.w3.org/2000/01/rdf-schema#> . \
+@prefix skos: <http://www.w3.org/2004/02/skos/core#> . \
+@prefix foaf: <http://xmlns.com/foaf/0.1/> . \
+\
+<" labels_uri "> \
+	foaf:name \"Untagged name\"; \
+	rdfs:label \"Label\"@en, \"Etikett\"@de, \"Label (UK)\"@en-GB; \
+	skos:prefLabel \"Libellé\"@fr ."
+
+static const char *names[] = { "http://xmlns.com/foaf/0.1/name" };
+
+static int
+check(LODCONTEXT *ctx, LODINSTANCE *inst, const char *languages, const char *expected, const char *argv0)
+{
+	const char *label;
+
+	if(lod_set_languages(ctx, languages))
+	{
+		fprintf(stderr, "%s: failed to set languages: %s\n", argv0, lod_errmsg(ctx));
+		return 1;
+	}
+	label = lod_instance_label(inst, NULL);
+	if(!label || strcmp(label, expected))
+	{
+		fprintf(stderr, "%s: with languages '%s', label was '%s' (expected '%s')\n", argv0, languages ? languages : "", label ? label : "(null)", expected);
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *inst;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *uri;
+	int r;
+
+	(void) argc;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	world = lod_world(ctx);
+	model = lod_model(ctx);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) labels_uri);
+	if(!parser || !uri || librdf_parser_parse_string_into_model(parser, (const unsigned char *) labels_ttl, uri, model))
+	{
+		fprintf(stderr, "%s: failed to parse string into model: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	inst = lod_locate(ctx, labels_uri);
+	if(!inst)
+	{
+		fprintf(stderr, "%s: failed to locate <%s>\n", argv[0], labels_uri);
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	r = 0;
+	/* Without preferences, predicate priority decides */
+	r |= check(ctx, inst, NULL, "Libellé", argv[0]);
+	r |= check(ctx, inst, "de, en;q=0.5", "Etikett", argv[0]);
+	/* The most specific range determines the quality */
+	r |= check(ctx, inst, "en-GB;q=0.2, en;q=0.9", "Label", argv[0]);
+	r |= check(ctx, inst, "en-GB, en;q=0.9", "Label (UK)", argv[0]);
+	/* Untagged literals win over languages only matched by a wildcard */
+	r |= check(ctx, inst, "es, *;q=0.1", "Untagged name", argv[0]);
+	lod_set_label_predicates(ctx, names, 1);
+	r |= check(ctx, inst, "fr", "Untagged name", argv[0]);
+	lod_instance_destroy(inst);
+	lod_destroy(ctx);
+	return r ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,109 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test parsing a string into a liblod-created model using librdf's parsing
+ * APIs, then checking for the presence of several subjects at once using
+ * liblod's batch APIs (which must notice that the model was populated
+ * behind their back).
+ */
+
+#include "dbpl-oxford.h"
+
+static const char *uris[] = {
+	oxford_uri,
+	"http://liblod.example.com/xyzzy#id",
+	oxford_doc,
+	"http://www.wikidata.org/entity/Q34217",
+	/* Present only as an object */
+	"http://dbpedia.org/resource/Oxford"
+};
+
+static const int expected[] = { 1, 0, 1, 1, 0 };
+
+#define NURIS (sizeof(uris) / sizeof(uris[0]))
+
+int
+main(int argc, char **argv)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *inst[NURIS];
+	LODFILTERSTATS stats;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *uri;
+	unsigned char bitmap[1];
+	long found;
+	size_t c;
+	int r;
+
+	(void) argc;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	world = lod_world(ctx);
+	model = lod_model(ctx);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) oxford_doc);
+	if(!parser || !uri || librdf_parser_parse_string_into_model(parser, (const unsigned char *) oxford_ttl, uri, model))
+	{
+		fprintf(stderr, "%s: failed to parse string into model: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	found = lod_exists_many(ctx, uris, NURIS, bitmap);
+	if(found != 3)
+	{
+		fprintf(stderr, "%s: lod_exists_many() found %ld subjects (expected 3)\n", argv[0], found);
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	r = 0;
+	for(c = 0; c < NURIS; c++)
+	{
+		if(!(bitmap[c / 8] & (1 << (c % 8))) != !expected[c])
+		{
+			fprintf(stderr, "%s: incorrect membership reported for <%s>\n", argv[0], uris[c]);
+			r = 1;
+		}
+	}
+	found = lod_locate_many(ctx, uris, NURIS, NULL, inst);
+	for(c = 0; c < NURIS; c++)
+	{
+		if(!inst[c] != !expected[c])
+		{
+			fprintf(stderr, "%s: incorrect instance returned for <%s>\n", argv[0], uris[c]);
+			r = 1;
+		}
+		if(inst[c])
+		{
+			lod_instance_destroy(inst[c]);
+		}
+	}
+	lod_filter_stats(ctx, &stats);
+	if(lod_indexes(ctx) & LODI_SUBJECTS)
+	{
+		if(stats.queries != 2 * NURIS || stats.positives != 6)
+		{
+			fprintf(stderr, "%s: unexpected filter statistics (%lu queries, %lu positives)\n", argv[0], stats.queries, stats.positives);
+			r = 1;
+		}
+	}
+	lod_destroy(ctx);
+	return r ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,219 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test overlay contexts: an overlay created after lod_publish() sees the
+ * base's triples as well as its own, the base never sees the overlay's,
+ * an overlay doesn't see changes to the base made after it was
+ * published, and publishing an unchanged model re-uses the snapshot.
+ */
+
+#include "dbpl-oxford.h"
+
+#define overlay_uri \
+	"http://liblod.example.com/things/overlay#id"
+#define later_uri \
+	"http://liblod.example.com/things/later#id"
+#define note_uri \
+	"http://liblod.example.com/ns#note"
+
+/* Add a triple with a literal object to a context's model */
+static int
+add(LODCONTEXT *ctx, const char *subject, const char *value)
+{
+	librdf_world *world;
+	librdf_statement *st;
+	int r;
+
+	world = lod_world(ctx);
+	st = librdf_new_statement_from_nodes(world,
+		librdf_new_node_from_uri_string(world, (const unsigned char *) subject),
+		librdf_new_node_from_uri_string(world, (const unsigned char *) note_uri),
+		librdf_new_node_from_literal(world, (const unsigned char *) value, NULL, 0));
+	if(!st)
+	{
+		return -1;
+	}
+	r = librdf_model_add_statement(lod_model(ctx), st);
+	librdf_free_statement(st);
+	return r;
+}
+
+/* Determine whether a URI is a subject in a context, without fetching */
+static int
+exists(LODCONTEXT *ctx, const char *uri)
+{
+	unsigned char bitmap[1];
+
+	return (int) lod_exists_many(ctx, &uri, 1, bitmap);
+}
+
+/* Count the triples about a subject in a context */
+static long
+triples(LODCONTEXT *ctx, const char *uri)
+{
+	LODINSTANCE *inst;
+	long count;
+
+	inst = lod_locate(ctx, uri);
+	if(!inst)
+	{
+		return -1;
+	}
+	count = lod_instance_count(inst, NULL);
+	lod_instance_destroy(inst);
+	return count;
+}
+
+int
+main(int argc, char **argv)
+{
+	LODCONTEXT *base, *overlay;
+	LODSNAPSHOT *first, *second;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *uri;
+	int size, r;
+	long count;
+
+	(void) argc;
+
+	base = lod_create();
+	if(!base)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	world = lod_world(base);
+	model = lod_model(base);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv[0], lod_errmsg(base));
+		lod_destroy(base);
+		exit(EXIT_FAILURE);
+	}
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) oxford_doc);
+	if(!parser || !uri || librdf_parser_parse_string_into_model(parser, (const unsigned char *) oxford_ttl, uri, model))
+	{
+		fprintf(stderr, "%s: failed to parse string into model: %s\n", argv[0], lod_errmsg(base));
+		lod_destroy(base);
+		exit(EXIT_FAILURE);
+	}
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	size = librdf_model_size(model);
+	count = triples(base, oxford_uri);
+	r = 0;
+	/* Nothing has been published yet */
+	overlay = lod_create_overlay(base);
+	if(overlay || lod_published(base))
+	{
+		fprintf(stderr, "%s: an overlay was created before anything was published\n", argv[0]);
+		lod_destroy(base);
+		exit(EXIT_FAILURE);
+	}
+	if(lod_publish(base))
+	{
+		fprintf(stderr, "%s: failed to publish snapshot: %s\n", argv[0], lod_errmsg(base));
+		lod_destroy(base);
+		exit(EXIT_FAILURE);
+	}
+	first = lod_published(base);
+	if(!first || lod_snapshot_triples(first) != (size_t) size)
+	{
+		fprintf(stderr, "%s: the published snapshot doesn't hold the base's %d triples\n", argv[0], size);
+		r = 1;
+	}
+	/* Publishing an unchanged model re-uses the snapshot */
+	if(lod_publish(base))
+	{
+		fprintf(stderr, "%s: failed to re-publish snapshot: %s\n", argv[0], lod_errmsg(base));
+		r = 1;
+	}
+	second = lod_published(base);
+	if(!second || second != first)
+	{
+		fprintf(stderr, "%s: publishing an unchanged model created a new snapshot\n", argv[0]);
+		r = 1;
+	}
+	if(second)
+	{
+		lod_snapshot_release(second);
+	}
+	overlay = lod_create_overlay(base);
+	if(!overlay)
+	{
+		fprintf(stderr, "%s: failed to create overlay: %s\n", argv[0], lod_errmsg(base));
+		if(first)
+		{
+			lod_snapshot_release(first);
+		}
+		lod_destroy(base);
+		exit(EXIT_FAILURE);
+	}
+	/* The overlay sees the base's triples */
+	if(librdf_model_size(lod_model(overlay)) != size || triples(overlay, oxford_uri) != count)
+	{
+		fprintf(stderr, "%s: the overlay doesn't see the base's triples\n", argv[0]);
+		r = 1;
+	}
+	/* Additions to the overlay, about a new subject and one in the base */
+	if(add(overlay, overlay_uri, "new") || add(overlay, oxford_uri, "extra"))
+	{
+		fprintf(stderr, "%s: failed to add statements to overlay\n", argv[0]);
+		r = 1;
+	}
+	if(librdf_model_size(lod_model(overlay)) != size + 2 ||
+	   exists(overlay, overlay_uri) != 1 ||
+	   triples(overlay, oxford_uri) != count + 1)
+	{
+		fprintf(stderr, "%s: the overlay doesn't see its own triples\n", argv[0]);
+		r = 1;
+	}
+	/* The base is unchanged */
+	if(librdf_model_size(model) != size || exists(base, overlay_uri) != 0 ||
+	   triples(base, oxford_uri) != count)
+	{
+		fprintf(stderr, "%s: adding to the overlay modified the base\n", argv[0]);
+		r = 1;
+	}
+	/* Changes to the base after publishing aren't seen by the overlay,
+	 * and the next publish creates a new snapshot
+	 */
+	if(add(base, later_uri, "later"))
+	{
+		fprintf(stderr, "%s: failed to add statement to base\n", argv[0]);
+		r = 1;
+	}
+	if(exists(overlay, later_uri) != 0)
+	{
+		fprintf(stderr, "%s: the overlay sees a change made to the base after it was published\n", argv[0]);
+		r = 1;
+	}
+	if(lod_publish(base))
+	{
+		fprintf(stderr, "%s: failed to publish modified model: %s\n", argv[0], lod_errmsg(base));
+		r = 1;
+	}
+	second = lod_published(base);
+	if(!second || second == first || lod_snapshot_triples(second) != (size_t) size + 1)
+	{
+		fprintf(stderr, "%s: publishing a modified model didn't create a new snapshot\n", argv[0]);
+		r = 1;
+	}
+	if(second)
+	{
+		lod_snapshot_release(second);
+	}
+	if(first)
+	{
+		lod_snapshot_release(first);
+	}
+	lod_destroy(overlay);
+	lod_destroy(base);
+	return r ? EXIT_FAILURE : 0;
+}
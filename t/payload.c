@@ -0,0 +1,141 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test handing payloads to a response without copying them -- first as an
+ * externally-owned buffer, then as a mapped file -- and processing them
+ * into the context's model.
+ */
+
+#include "dbpl-oxford.h"
+
+static int released;
+
+static void
+release_payload(void *userdata, const char *payload, size_t length)
+{
+	(void) userdata;
+	(void) payload;
+	(void) length;
+
+	released++;
+}
+
+/* Process a response into a new context, and return the size of the
+ * resulting model, or -1
+ */
+static int
+process(const char *argv0, LODRESPONSE *resp)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *inst;
+	int size;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv0, strerror(errno));
+		return -1;
+	}
+	lod_response_set_status(resp, 200);
+	lod_response_set_uri(resp, oxford_doc);
+	lod_response_set_type(resp, "text/turtle");
+	if(lod_response_process(ctx, resp) != LODR_COMPLETE)
+	{
+		fprintf(stderr, "%s: failed to process response: %s\n", argv0, lod_errmsg(ctx));
+		lod_destroy(ctx);
+		return -1;
+	}
+	inst = lod_locate(ctx, oxford_uri);
+	if(!inst)
+	{
+		fprintf(stderr, "%s: failed to locate <%s> after processing response\n", argv0, oxford_uri);
+		lod_destroy(ctx);
+		return -1;
+	}
+	lod_instance_destroy(inst);
+	/* The last subject in the document */
+	inst = lod_locate(ctx, "http://www.wikidata.org/entity/Q34217");
+	if(!inst)
+	{
+		fprintf(stderr, "%s: the end of the payload was not parsed\n", argv0);
+		lod_destroy(ctx);
+		return -1;
+	}
+	lod_instance_destroy(inst);
+	size = librdf_model_size(lod_model(ctx));
+	lod_destroy(ctx);
+	return size;
+}
+
+int
+main(int argc, char **argv)
+{
+	LODRESPONSE *resp;
+	char path[] = "/tmp/lodpayloadXXXXXX";
+	int fd, external, mapped;
+
+	(void) argc;
+
+	resp = lod_response_create();
+	if(!resp)
+	{
+		fprintf(stderr, "%s: failed to create response: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	/* An externally-owned buffer */
+	lod_response_set_payload_external(resp, oxford_ttl, strlen(oxford_ttl), release_payload, NULL);
+	external = process(argv[0], resp);
+	if(external < 0)
+	{
+		lod_response_destroy(resp);
+		exit(EXIT_FAILURE);
+	}
+	lod_response_reset(resp);
+	if(released != 1)
+	{
+		fprintf(stderr, "%s: release callback was invoked %d times (expected 1)\n", argv[0], released);
+		lod_response_destroy(resp);
+		exit(EXIT_FAILURE);
+	}
+	/* A mapped file, processed into a fresh context so that nothing
+	 * parsed from the buffer above can stand in for it
+	 */
+	fd = mkstemp(path);
+	if(fd == -1)
+	{
+		fprintf(stderr, "%s: failed to create temporary file: %s\n", argv[0], strerror(errno));
+		lod_response_destroy(resp);
+		exit(EXIT_FAILURE);
+	}
+	unlink(path);
+	if(write(fd, oxford_ttl, strlen(oxford_ttl)) != (ssize_t) strlen(oxford_ttl))
+	{
+		fprintf(stderr, "%s: failed to write temporary file: %s\n", argv[0], strerror(errno));
+		close(fd);
+		lod_response_destroy(resp);
+		exit(EXIT_FAILURE);
+	}
+	if(lod_response_set_payload_fd(resp, fd))
+	{
+		fprintf(stderr, "%s: failed to map payload: %s\n", argv[0], strerror(errno));
+		close(fd);
+		lod_response_destroy(resp);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	mapped = process(argv[0], resp);
+	lod_response_destroy(resp);
+	if(mapped < 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	if(mapped != external)
+	{
+		fprintf(stderr, "%s: mapped payload produced %d triples (expected %d)\n", argv[0], mapped, external);
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
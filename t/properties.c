@@ -0,0 +1,175 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test the property accessors on an instance: single and multiple values,
+ * counts, absent predicates, and re-materialisation after the model is
+ * modified through librdf directly.
+ */
+
+#define props_uri \
+	"http://liblod.example.com/things/1#id"
+#define props_ns \
+	"http://liblod.example.com/ns#"
+
+#define props_ttl \
+"@prefix ex: <" props_ns "> . \
+\
+<" props_uri "> \
+	ex:value \"1\", \"2\", \"3\"; \
+	ex:link <http://liblod.example.com/things/2#id>; \
+	ex:name \"Thing\" ."
+
+/* Determine whether a node is a literal with one of the values 1-4, and
+ * if so record it in the seen mask
+ */
+static int
+digit(librdf_node *node, unsigned int *seen)
+{
+	const char *value;
+
+	if(!librdf_node_is_literal(node))
+	{
+		return 0;
+	}
+	value = (const char *) librdf_node_get_literal_value(node);
+	if(!value || value[0] < '1' || value[0] > '4' || value[1])
+	{
+		return 0;
+	}
+	*seen |= 1 << (value[0] - '1');
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *inst;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *uri;
+	librdf_node *node, *const *objects;
+	librdf_statement *st;
+	unsigned int seen;
+	size_t count, c;
+	int r;
+
+	(void) argc;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	world = lod_world(ctx);
+	model = lod_model(ctx);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) props_uri);
+	if(!parser || !uri || librdf_parser_parse_string_into_model(parser, (const unsigned char *) props_ttl, uri, model))
+	{
+		fprintf(stderr, "%s: failed to parse string into model: %s\n", argv[0], lod_errmsg(ctx));
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	inst = lod_locate(ctx, props_uri);
+	if(!inst)
+	{
+		fprintf(stderr, "%s: failed to locate <%s>\n", argv[0], props_uri);
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	r = 0;
+	if(lod_instance_count(inst, NULL) != 5)
+	{
+		fprintf(stderr, "%s: instance has %ld triples (expected 5)\n", argv[0], lod_instance_count(inst, NULL));
+		r = 1;
+	}
+	if(lod_instance_count(inst, props_ns "value") != 3)
+	{
+		fprintf(stderr, "%s: instance has %ld ex:value objects (expected 3)\n", argv[0], lod_instance_count(inst, props_ns "value"));
+		r = 1;
+	}
+	node = lod_instance_get(inst, props_ns "link");
+	if(!node || !librdf_node_is_resource(node) ||
+	   strcmp((const char *) librdf_uri_as_string(librdf_node_get_uri(node)), "http://liblod.example.com/things/2#id"))
+	{
+		fprintf(stderr, "%s: ex:link was not the expected URI\n", argv[0]);
+		r = 1;
+	}
+	node = lod_instance_get(inst, props_ns "name");
+	if(!node || !librdf_node_is_literal(node) ||
+	   strcmp((const char *) librdf_node_get_literal_value(node), "Thing"))
+	{
+		fprintf(stderr, "%s: ex:name was not the expected literal\n", argv[0]);
+		r = 1;
+	}
+	/* All of the objects of a predicate are returned together */
+	objects = lod_instance_get_all(inst, props_ns "value", &count);
+	seen = 0;
+	for(c = 0; objects && c < count; c++)
+	{
+		if(!digit(objects[c], &seen))
+		{
+			fprintf(stderr, "%s: unexpected ex:value object\n", argv[0]);
+			r = 1;
+		}
+	}
+	if(count != 3 || seen != 7)
+	{
+		fprintf(stderr, "%s: lod_instance_get_all() returned %lu ex:value objects (expected 1, 2 and 3)\n", argv[0], (unsigned long) count);
+		r = 1;
+	}
+	objects = lod_instance_get_all(inst, NULL, &count);
+	if(!objects || count != 5)
+	{
+		fprintf(stderr, "%s: lod_instance_get_all() returned %lu objects (expected 5)\n", argv[0], (unsigned long) count);
+		r = 1;
+	}
+	/* A predicate which doesn't appear anywhere is absent, not an error */
+	if(lod_instance_get(inst, props_ns "missing") || lod_error(ctx) ||
+	   lod_instance_count(inst, props_ns "missing") != 0)
+	{
+		fprintf(stderr, "%s: an absent predicate was reported as present\n", argv[0]);
+		r = 1;
+	}
+	/* Modifying the model behind liblod's back must be noticed */
+	st = librdf_new_statement_from_nodes(world,
+		librdf_new_node_from_uri_string(world, (const unsigned char *) props_uri),
+		librdf_new_node_from_uri_string(world, (const unsigned char *) props_ns "value"),
+		librdf_new_node_from_literal(world, (const unsigned char *) "4", NULL, 0));
+	if(!st || librdf_model_add_statement(model, st))
+	{
+		fprintf(stderr, "%s: failed to add statement to model\n", argv[0]);
+		lod_instance_destroy(inst);
+		lod_destroy(ctx);
+		exit(EXIT_FAILURE);
+	}
+	librdf_free_statement(st);
+	objects = lod_instance_get_all(inst, props_ns "value", &count);
+	seen = 0;
+	for(c = 0; objects && c < count; c++)
+	{
+		digit(objects[c], &seen);
+	}
+	if(count != 4 || seen != 15)
+	{
+		fprintf(stderr, "%s: after adding a statement, instance has %lu ex:value objects (expected 4)\n", argv[0], (unsigned long) count);
+		r = 1;
+	}
+	lod_instance_destroy(inst);
+	lod_destroy(ctx);
+	return r ? EXIT_FAILURE : 0;
+}
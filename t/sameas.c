@@ -0,0 +1,210 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test owl:sameAs identity sets: co-reference must follow chains of
+ * statements in either direction, agree on a canonical member, and
+ * extend lod_instance_foreach_smushed() to every member. Each check is
+ * made with the owl:sameAs index, and again with it disabled so that the
+ * model is queried instead.
+ */
+
+#define ex(x) \
+	"http://liblod.example.com/things/" x "#id"
+
+#define sameas_ttl \
+"@prefix owl: <http://www.w3.org/2002/07/owl#> . \
+@prefix ex: <http://liblod.example.com/ns#> . \
+\
+<" ex("a") "> owl:sameAs <" ex("b") ">; ex:p \"a\" . \
+<" ex("c") "> owl:sameAs <" ex("b") ">, <" ex("d") "> . \
+<" ex("d") "> ex:p \"d\" . \
+<" ex("e") "> ex:p \"e\" . \
+<" ex("f") "> owl:sameAs <" ex("g") "> ."
+
+#define MAXURIS                         8
+
+static const char *chain[] = { ex("a"), ex("b"), ex("c"), ex("d") };
+
+#define NCHAIN (sizeof(chain) / sizeof(chain[0]))
+
+static int
+count_triple(LODINSTANCE *instance, librdf_node *predicate, librdf_node *object, void *userdata)
+{
+	(void) instance;
+	(void) predicate;
+	(void) object;
+
+	(*(int *) userdata)++;
+	return 0;
+}
+
+/* Check the URIs co-referent with a subject, which must come first */
+static int
+check_sameas(const char *argv0, LODCONTEXT *ctx, const char *subject, const char *const *expected, size_t nexpected)
+{
+	LODINSTANCE *inst;
+	const char *uris[MAXURIS];
+	long count;
+	size_t c, d;
+	int r;
+
+	inst = lod_locate(ctx, subject);
+	if(!inst)
+	{
+		fprintf(stderr, "%s: failed to locate <%s>\n", argv0, subject);
+		return 1;
+	}
+	count = lod_instance_sameas(inst, uris, MAXURIS);
+	r = 0;
+	if(count != (long) nexpected || strcmp(uris[0], subject))
+	{
+		fprintf(stderr, "%s: <%s> has %ld co-referents (expected %lu)\n", argv0, subject, count, (unsigned long) nexpected);
+		r = 1;
+	}
+	for(c = 0; !r && c < nexpected; c++)
+	{
+		for(d = 0; d < (size_t) count && strcmp(uris[d], expected[c]); d++)
+		{
+		}
+		if(d == (size_t) count)
+		{
+			fprintf(stderr, "%s: <%s> is not co-referent with <%s>\n", argv0, expected[c], subject);
+			r = 1;
+		}
+	}
+	lod_instance_destroy(inst);
+	return r;
+}
+
+/* Obtain the URI of the canonical member of a subject's set */
+static const char *
+canonical(const char *argv0, LODCONTEXT *ctx, const char *subject, char *buf, size_t len)
+{
+	LODINSTANCE *inst, *canon;
+
+	inst = lod_locate(ctx, subject);
+	if(!inst)
+	{
+		fprintf(stderr, "%s: failed to locate <%s>\n", argv0, subject);
+		return NULL;
+	}
+	canon = lod_instance_canonical(inst);
+	lod_instance_destroy(inst);
+	if(!canon)
+	{
+		fprintf(stderr, "%s: no canonical member for <%s>: %s\n", argv0, subject, lod_errmsg(ctx));
+		return NULL;
+	}
+	strncpy(buf, (const char *) librdf_uri_as_string(lod_instance_uri(canon)), len - 1);
+	buf[len - 1] = 0;
+	lod_instance_destroy(canon);
+	return buf;
+}
+
+static int
+check(const char *argv0, unsigned int flags)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *inst;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *uri;
+	const char *pair[2] = { ex("f"), ex("g") };
+	const char *single[1] = { ex("e") };
+	char ca[256], cd[256], ce[256];
+	size_t c;
+	int r, triples;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv0, strerror(errno));
+		return 1;
+	}
+	lod_set_indexes(ctx, flags);
+	world = lod_world(ctx);
+	model = lod_model(ctx);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv0, lod_errmsg(ctx));
+		lod_destroy(ctx);
+		return 1;
+	}
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) ex("a"));
+	if(!parser || !uri || librdf_parser_parse_string_into_model(parser, (const unsigned char *) sameas_ttl, uri, model))
+	{
+		fprintf(stderr, "%s: failed to parse string into model: %s\n", argv0, lod_errmsg(ctx));
+		lod_destroy(ctx);
+		return 1;
+	}
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	r = 0;
+	/* <b> is only ever an object, so can't be located */
+	r |= check_sameas(argv0, ctx, ex("a"), chain, NCHAIN);
+	r |= check_sameas(argv0, ctx, ex("d"), chain, NCHAIN);
+	r |= check_sameas(argv0, ctx, ex("f"), pair, 2);
+	r |= check_sameas(argv0, ctx, ex("e"), single, 1);
+	/* Every member of a set agrees on which is canonical */
+	if(!canonical(argv0, ctx, ex("a"), ca, sizeof(ca)) ||
+	   !canonical(argv0, ctx, ex("d"), cd, sizeof(cd)) ||
+	   !canonical(argv0, ctx, ex("e"), ce, sizeof(ce)))
+	{
+		r = 1;
+	}
+	else
+	{
+		for(c = 0; c < NCHAIN && strcmp(ca, chain[c]); c++)
+		{
+		}
+		if(c == NCHAIN || strcmp(ca, cd))
+		{
+			fprintf(stderr, "%s: <%s> and <%s> have different canonical members\n", argv0, ex("a"), ex("d"));
+			r = 1;
+		}
+		if(strcmp(ce, ex("e")))
+		{
+			fprintf(stderr, "%s: <%s> is not its own canonical member\n", argv0, ex("e"));
+			r = 1;
+		}
+	}
+	/* The smushed view holds the triples of <a>, <c> and <d> */
+	inst = lod_locate(ctx, ex("a"));
+	if(inst)
+	{
+		triples = 0;
+		if(lod_instance_foreach_smushed(inst, count_triple, &triples) || triples != 5)
+		{
+			fprintf(stderr, "%s: smushed view of <%s> has %d triples (expected 5)\n", argv0, ex("a"), triples);
+			r = 1;
+		}
+		lod_instance_destroy(inst);
+	}
+	else
+	{
+		r = 1;
+	}
+	if(r)
+	{
+		fprintf(stderr, "%s: (with indexes 0x%x)\n", argv0, flags);
+	}
+	lod_destroy(ctx);
+	return r;
+}
+
+int
+main(int argc, char **argv)
+{
+	int r;
+
+	(void) argc;
+
+	r = check(argv[0], LODI_DEFAULT);
+	r |= check(argv[0], 0);
+	return r ? EXIT_FAILURE : 0;
+}
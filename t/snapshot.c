@@ -0,0 +1,206 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test freezing a context into a snapshot, saving it and loading it again:
+ * the loaded snapshot must hold the same triples and document metadata,
+ * and must be usable both directly and through a context, while a file
+ * which has been truncated or damaged must be rejected with EINVAL.
+ */
+
+#include "dbpl-oxford.h"
+
+static char *
+slurp(const char *path, size_t *len)
+{
+	FILE *f;
+	char *buf;
+	long size;
+
+	f = fopen(path, "rb");
+	if(!f)
+	{
+		return NULL;
+	}
+	buf = NULL;
+	if(!fseek(f, 0, SEEK_END) && (size = ftell(f)) > 0 && !fseek(f, 0, SEEK_SET))
+	{
+		buf = (char *) malloc(size);
+		if(buf && fread(buf, size, 1, f) != 1)
+		{
+			free(buf);
+			buf = NULL;
+		}
+		*len = (size_t) size;
+	}
+	fclose(f);
+	return buf;
+}
+
+/* Write len bytes of buf to path and attempt to load it, which must fail
+ * with EINVAL
+ */
+static int
+rejected(const char *argv0, const char *path, const char *buf, size_t len, const char *what)
+{
+	LODSNAPSHOT *snapshot;
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if(!f || fwrite(buf, len, 1, f) != 1 || fclose(f))
+	{
+		fprintf(stderr, "%s: failed to write %s: %s\n", argv0, path, strerror(errno));
+		return -1;
+	}
+	errno = 0;
+	snapshot = lod_load_snapshot(path);
+	if(snapshot)
+	{
+		fprintf(stderr, "%s: a %s snapshot was loaded\n", argv0, what);
+		lod_snapshot_release(snapshot);
+		return -1;
+	}
+	if(errno != EINVAL)
+	{
+		fprintf(stderr, "%s: loading a %s snapshot failed with %s rather than EINVAL\n", argv0, what, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	LODCONTEXT *ctx, *thawed, *frozen;
+	LODRESPONSE *resp;
+	LODSNAPSHOT *snapshot, *loaded;
+	LODINSTANCE *inst;
+	LODDOCINFO before, after;
+	char path[] = "snapshot.XXXXXX";
+	char *buf;
+	size_t len;
+	int fd, size, r;
+
+	(void) argc;
+
+	ctx = lod_create();
+	resp = lod_response_create();
+	if(!ctx || !resp)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	lod_response_set_status(resp, 200);
+	lod_response_set_uri(resp, oxford_doc);
+	lod_response_set_type(resp, "text/turtle");
+	lod_response_set_payload_copy(resp, oxford_ttl, strlen(oxford_ttl));
+	if(lod_response_process(ctx, resp) != LODR_COMPLETE)
+	{
+		fprintf(stderr, "%s: failed to process response: %s\n", argv[0], lod_errmsg(ctx));
+		exit(EXIT_FAILURE);
+	}
+	lod_response_destroy(resp);
+	size = librdf_model_size(lod_model(ctx));
+	if(lod_document_info(ctx, oxford_doc, &before) != 1)
+	{
+		fprintf(stderr, "%s: the document was not recorded\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	snapshot = lod_freeze(ctx);
+	if(!snapshot)
+	{
+		fprintf(stderr, "%s: failed to freeze context: %s\n", argv[0], lod_errmsg(ctx));
+		exit(EXIT_FAILURE);
+	}
+	fd = mkstemp(path);
+	if(fd == -1)
+	{
+		fprintf(stderr, "%s: failed to create temporary file: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	if(lod_save_snapshot(snapshot, path))
+	{
+		fprintf(stderr, "%s: failed to save snapshot: %s\n", argv[0], strerror(errno));
+		unlink(path);
+		exit(EXIT_FAILURE);
+	}
+	lod_snapshot_release(snapshot);
+	loaded = lod_load_snapshot(path);
+	buf = slurp(path, &len);
+	unlink(path);
+	if(!loaded || !buf)
+	{
+		fprintf(stderr, "%s: failed to load snapshot: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	/* The loaded snapshot can be queried directly... */
+	if((int) lod_snapshot_triples(loaded) != size || !lod_snapshot_exists(loaded, oxford_uri))
+	{
+		fprintf(stderr, "%s: the loaded snapshot holds %lu triples (expected %d)\n", argv[0], (unsigned long) lod_snapshot_triples(loaded), size);
+		exit(EXIT_FAILURE);
+	}
+	if(lod_snapshot_document(loaded, oxford_doc, &after) != 1 ||
+	   strcmp(after.uri, oxford_doc) || after.fetched != before.fetched)
+	{
+		fprintf(stderr, "%s: the document's metadata did not survive the round trip\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	/* ...through a context layered over it... */
+	frozen = lod_create_from_snapshot(loaded);
+	if(!frozen)
+	{
+		fprintf(stderr, "%s: failed to create context from snapshot: %s\n", argv[0], strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	inst = lod_locate(frozen, oxford_uri);
+	if(!inst)
+	{
+		fprintf(stderr, "%s: failed to locate <%s> in the snapshot\n", argv[0], oxford_uri);
+		exit(EXIT_FAILURE);
+	}
+	lod_instance_destroy(inst);
+	lod_destroy(frozen);
+	/* ...or added back into a model */
+	thawed = lod_create();
+	if(!thawed || lod_thaw(thawed, loaded))
+	{
+		fprintf(stderr, "%s: failed to thaw snapshot: %s\n", argv[0], thawed ? lod_errmsg(thawed) : strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if(librdf_model_size(lod_model(thawed)) != size ||
+	   lod_document_info(thawed, oxford_doc, &after) != 1 || after.fetched != before.fetched)
+	{
+		fprintf(stderr, "%s: the thawed context does not match the original\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	lod_destroy(thawed);
+	lod_snapshot_release(loaded);
+	lod_destroy(ctx);
+	/* Damaged files */
+	r = rejected(argv[0], path, buf, len / 2, "truncated");
+	if(!r)
+	{
+		r = rejected(argv[0], path, buf, 8, "truncated header");
+	}
+	if(!r)
+	{
+		buf[0] ^= 0xff;
+		r = rejected(argv[0], path, buf, len, "mislabelled");
+		buf[0] ^= 0xff;
+	}
+	if(!r)
+	{
+		memset(buf + len / 2, 0xff, len - len / 2);
+		r = rejected(argv[0], path, buf, len, "corrupted");
+	}
+	unlink(path);
+	free(buf);
+	if(r)
+	{
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
@@ -0,0 +1,112 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test spilling payloads larger than the threshold to a temporary file:
+ * the whole document must be parsed from the file, and enough of it
+ * retained in memory for content sniffing, whether the payload spills
+ * after several small appends or on the very first one.
+ */
+
+#include "dbpl-oxford.h"
+
+#define THRESHOLD                       64
+
+/* Append the document to a response in chunks, the first of which is
+ * first bytes long, then process it into a new context and return the
+ * size of the resulting model, or -1
+ */
+static int
+spill(const char *argv0, size_t first, size_t chunk, const char *type)
+{
+	LODCONTEXT *ctx;
+	LODRESPONSE *resp;
+	LODINSTANCE *inst;
+	size_t len, pos, n;
+	int size;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv0, strerror(errno));
+		return -1;
+	}
+	resp = lod_response_create();
+	if(!resp)
+	{
+		fprintf(stderr, "%s: failed to create response: %s\n", argv0, strerror(errno));
+		lod_destroy(ctx);
+		return -1;
+	}
+	lod_response_set_spill_threshold(resp, THRESHOLD);
+	len = strlen(oxford_ttl);
+	for(pos = 0, n = first; pos < len; pos += n, n = chunk)
+	{
+		if(n > len - pos)
+		{
+			n = len - pos;
+		}
+		if(lod_response_append_payload(resp, oxford_ttl + pos, n))
+		{
+			fprintf(stderr, "%s: failed to append payload\n", argv0);
+			lod_response_destroy(resp);
+			lod_destroy(ctx);
+			return -1;
+		}
+	}
+	lod_response_set_status(resp, 200);
+	lod_response_set_uri(resp, oxford_doc);
+	lod_response_set_type(resp, type);
+	if(lod_response_process(ctx, resp) != LODR_COMPLETE)
+	{
+		fprintf(stderr, "%s: failed to process spilled response: %s\n", argv0, lod_errmsg(ctx));
+		lod_response_destroy(resp);
+		lod_destroy(ctx);
+		return -1;
+	}
+	lod_response_destroy(resp);
+	/* The last subject in the document */
+	inst = lod_locate(ctx, "http://www.wikidata.org/entity/Q34217");
+	if(!inst)
+	{
+		fprintf(stderr, "%s: the end of the spilled payload was not parsed\n", argv0);
+		lod_destroy(ctx);
+		return -1;
+	}
+	lod_instance_destroy(inst);
+	size = librdf_model_size(lod_model(ctx));
+	lod_destroy(ctx);
+	return size;
+}
+
+int
+main(int argc, char **argv)
+{
+	int expected, size;
+
+	(void) argc;
+
+	/* The whole payload, held in memory */
+	expected = spill(argv[0], strlen(oxford_ttl), 0, "text/turtle");
+	if(expected <= 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	/* Spilled after several appends */
+	size = spill(argv[0], 16, 16, "text/turtle");
+	if(size != expected)
+	{
+		fprintf(stderr, "%s: spilled after several appends, %d triples were parsed (expected %d)\n", argv[0], size, expected);
+		exit(EXIT_FAILURE);
+	}
+	/* Spilled on the first append, relying on sniffing */
+	size = spill(argv[0], THRESHOLD + 1, 100, "application/octet-stream");
+	if(size != expected)
+	{
+		fprintf(stderr, "%s: spilled on the first append, %d triples were parsed (expected %d)\n", argv[0], size, expected);
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
@@ -0,0 +1,169 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_tests.h"
+
+/* Test class membership queries: lod_subjects_of_type() must follow the
+ * rdfs:subClassOf hierarchy when LODI_SUBCLASSES is enabled and only
+ * then, whether it is answered from the type index or (with LODI_TYPES
+ * disabled) by querying the model.
+ */
+
+#define things \
+	"http://liblod.example.com/things/"
+#define ex(x) \
+	things x "#id"
+#define cls(x) \
+	"http://liblod.example.com/ns#" x
+
+#define types_ttl \
+"@prefix rdfs: <http://www.w3.org/2000/01/rdf-schema#> . \
+@prefix ex: <http://liblod.example.com/ns#> . \
+\
+ex:Dog rdfs:subClassOf ex:Mammal . \
+ex:Cat rdfs:subClassOf ex:Mammal . \
+ex:Mammal rdfs:subClassOf ex:Animal . \
+ex:Bird rdfs:subClassOf ex:Animal . \
+\
+<" ex("rex") "> a ex:Dog . \
+<" ex("tom") "> a ex:Cat . \
+<" ex("polly") "> a ex:Bird . \
+<" ex("nemo") "> a ex:Fish . \
+[] a ex:Dog ."
+
+#define MAXURIS                         8
+
+typedef struct
+{
+	unsigned int flags;
+	/* The expected members of ex:Animal, ex:Mammal and ex:Dog */
+	long animals;
+	long mammals;
+	long dogs;
+	/* The expected number of classes of <rex> */
+	long rextypes;
+} EXPECTED;
+
+static const EXPECTED expected[] = {
+	{ LODI_DEFAULT|LODI_SUBCLASSES, 3, 2, 1, 3 },
+	{ LODI_DEFAULT, 0, 0, 1, 1 },
+	/* Without the type index, the model is queried */
+	{ LODI_SUBCLASSES, 3, 2, 1, 1 },
+	{ 0, 0, 0, 1, 1 }
+};
+
+#define NEXPECTED (sizeof(expected) / sizeof(expected[0]))
+
+static int
+members(const char *argv0, LODCONTEXT *ctx, const char *type, long expect, unsigned int flags)
+{
+	const char *uris[MAXURIS];
+	long count, c;
+
+	count = lod_subjects_of_type(ctx, type, uris, MAXURIS);
+	if(count != expect)
+	{
+		fprintf(stderr, "%s: <%s> has %ld members (expected %ld, indexes 0x%x): %s\n", argv0, type, count, expect, flags, lod_error(ctx) ? lod_errmsg(ctx) : "no error");
+		return 1;
+	}
+	for(c = 0; c < count; c++)
+	{
+		if(strncmp(uris[c], things, strlen(things)))
+		{
+			fprintf(stderr, "%s: <%s> is not an expected member of <%s>\n", argv0, uris[c], type);
+			return 1;
+		}
+	}
+	/* The total is returned even if fewer can be stored */
+	if(count && lod_subjects_of_type(ctx, type, uris, 1) != count)
+	{
+		fprintf(stderr, "%s: <%s> has a different number of members when max is 1\n", argv0, type);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+check(const char *argv0, const EXPECTED *e)
+{
+	LODCONTEXT *ctx;
+	LODINSTANCE *inst;
+	librdf_world *world;
+	librdf_model *model;
+	librdf_parser *parser;
+	librdf_uri *uri;
+	const char *types[MAXURIS];
+	long count;
+	int r;
+
+	ctx = lod_create();
+	if(!ctx)
+	{
+		fprintf(stderr, "%s: failed to create liblod context: %s\n", argv0, strerror(errno));
+		return 1;
+	}
+	lod_set_indexes(ctx, e->flags);
+	world = lod_world(ctx);
+	model = lod_model(ctx);
+	if(!world || !model)
+	{
+		fprintf(stderr, "%s: failed to obtain librdf_model for context: %s\n", argv0, lod_errmsg(ctx));
+		lod_destroy(ctx);
+		return 1;
+	}
+	parser = librdf_new_parser(world, "turtle", NULL, NULL);
+	uri = librdf_new_uri(world, (const unsigned char *) ex("rex"));
+	if(!parser || !uri || librdf_parser_parse_string_into_model(parser, (const unsigned char *) types_ttl, uri, model))
+	{
+		fprintf(stderr, "%s: failed to parse string into model: %s\n", argv0, lod_errmsg(ctx));
+		lod_destroy(ctx);
+		return 1;
+	}
+	librdf_free_parser(parser);
+	librdf_free_uri(uri);
+	r = 0;
+	r |= members(argv0, ctx, cls("Animal"), e->animals, e->flags);
+	r |= members(argv0, ctx, cls("Mammal"), e->mammals, e->flags);
+	/* The blank node which is also a dog isn't included */
+	r |= members(argv0, ctx, cls("Dog"), e->dogs, e->flags);
+	r |= members(argv0, ctx, cls("Fish"), 1, e->flags);
+	r |= members(argv0, ctx, cls("Unicorn"), 0, e->flags);
+	inst = lod_locate(ctx, ex("rex"));
+	if(!inst)
+	{
+		fprintf(stderr, "%s: failed to locate <%s>\n", argv0, ex("rex"));
+		lod_destroy(ctx);
+		return 1;
+	}
+	count = lod_instance_types(inst, types, MAXURIS);
+	if(count != e->rextypes)
+	{
+		fprintf(stderr, "%s: <%s> has %ld classes (expected %ld, indexes 0x%x)\n", argv0, ex("rex"), count, e->rextypes, e->flags);
+		r = 1;
+	}
+	if(lod_instance_is_a(inst, cls("Dog")) != 1 || lod_instance_is_a(inst, cls("Cat")) != 0)
+	{
+		fprintf(stderr, "%s: <%s> has the wrong class membership (indexes 0x%x)\n", argv0, ex("rex"), e->flags);
+		r = 1;
+	}
+	lod_instance_destroy(inst);
+	lod_destroy(ctx);
+	return r;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t c;
+	int r;
+
+	(void) argc;
+
+	r = 0;
+	for(c = 0; c < NEXPECTED; c++)
+	{
+		r |= check(argv[0], &(expected[c]));
+	}
+	return r ? EXIT_FAILURE : 0;
+}
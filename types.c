@@ -0,0 +1,458 @@
+/* Author: Mo McRoberts <mo.mcroberts@bbc.co.uk>
+ *
+ * Copyright (c) 2014-2016 BBC
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "p_liblod.h"
+
+/* Class membership: rdf:type statements are indexed in both directions as
+ * they are added, and rdfs:subClassOf statements are recorded so that the
+ * transitive closure of the class hierarchy can be precomputed (once per
+ * change to the hierarchy) rather than walked by every query.
+ */
+
+static int lod_types_ready_(LODCONTEXT *context, int *closure);
+static int lod_types_closure_(LODCONTEXT *context);
+static long lod_subjects_of_type_locked_(LODCONTEXT *context, const char *type, const char **uris, size_t max);
+static long lod_subjects_of_type_model_(LODCONTEXT *context, const char *type, const char **uris, size_t max);
+static long lod_instance_types_locked_(LODINSTANCE *instance, const char **types, size_t max);
+static int lod_instance_is_a_locked_(LODINSTANCE *instance, const char *type);
+
+/* Obtain the subjects which are instances of a class */
+long
+lod_subjects_of_type(LODCONTEXT *context, const char *type, const char **uris, size_t max)
+{
+	long r;
+
+	lod_lock_(context);
+	r = lod_subjects_of_type_locked_(context, type, uris, max);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_subjects_of_type(), with the context lock held */
+static long
+lod_subjects_of_type_locked_(LODCONTEXT *context, const char *type, const char **uris, size_t max)
+{
+	LODINDEXES *index;
+	LODTERMID tid, *ids;
+	uint32_t e, d;
+	size_t count, size;
+	int closure;
+
+	lod_state_(context)->error = 0;
+	index = &(context->index);
+	if(!lod_types_ready_(context, &closure))
+	{
+		if(lod_state_(context)->error)
+		{
+			return -1;
+		}
+		return lod_subjects_of_type_model_(context, type, uris, max);
+	}
+	tid = lod_intern_find_(context, type, strlen(type));
+	if(tid == LOD_NOTERM)
+	{
+		return 0;
+	}
+	ids = NULL;
+	count = size = 0;
+	for(e = lod_edges_first_(&(index->members), tid); e != LOD_NOEDGE; e = index->members.edges[e].next)
+	{
+		if(lod_termids_append_(&ids, &count, &size, index->members.edges[e].to))
+		{
+			goto failed;
+		}
+	}
+	if(closure)
+	{
+		for(d = lod_edges_first_(&(index->descendants), tid); d != LOD_NOEDGE; d = index->descendants.edges[d].next)
+		{
+			for(e = lod_edges_first_(&(index->members), index->descendants.edges[d].to); e != LOD_NOEDGE; e = index->members.edges[e].next)
+			{
+				if(lod_termids_append_(&ids, &count, &size, index->members.edges[e].to))
+				{
+					goto failed;
+				}
+			}
+		}
+	}
+	return lod_termids_uris_(context, ids, count, uris, max);
+failed:
+	lod_set_error_(context, strerror(errno));
+	free(ids);
+	return -1;
+}
+
+/* lod_subjects_of_type(), answered by querying the model when the type
+ * index is not available; subclasses are followed if LODI_SUBCLASSES is
+ * enabled
+ */
+static long
+lod_subjects_of_type_model_(LODCONTEXT *context, const char *type, const char **uris, size_t max)
+{
+	librdf_model *model;
+	librdf_node *node;
+	LODTERMID *ids, *classes, *found;
+	size_t count, size, nclasses, csize, nfound, fsize, c, f, k;
+	int r;
+
+	model = lod_model(context);
+	if(!model)
+	{
+		return -1;
+	}
+	node = lod_intern_probe_(context, type);
+	if(!node)
+	{
+		return -1;
+	}
+	ids = classes = found = NULL;
+	count = size = nclasses = csize = nfound = fsize = 0;
+	r = lod_model_related_(context, model, node, LOD_RDF_TYPE, 1, &ids, &count, &size);
+	if(!r && (context->index.flags & LODI_SUBCLASSES))
+	{
+		r = lod_model_related_(context, model, node, LOD_RDFS_SUBCLASSOF, 1, &found, &nfound, &fsize);
+	}
+	librdf_free_node(node);
+	/* Breadth-first traversal of the subclasses, each of which is visited
+	 * once even if the hierarchy contains cycles
+	 */
+	for(c = 0; !r; c++)
+	{
+		for(f = 0; f < nfound; f++)
+		{
+			for(k = 0; k < nclasses && classes[k] != found[f]; k++)
+			{
+			}
+			if(k == nclasses && lod_termids_append_(&classes, &nclasses, &csize, found[f]))
+			{
+				lod_set_error_(context, strerror(errno));
+				r = -1;
+				break;
+			}
+		}
+		nfound = 0;
+		if(r || c >= nclasses)
+		{
+			break;
+		}
+		node = lod_intern_node_(context, classes[c]);
+		if(!node ||
+		   lod_model_related_(context, model, node, LOD_RDF_TYPE, 1, &ids, &count, &size) ||
+		   lod_model_related_(context, model, node, LOD_RDFS_SUBCLASSOF, 1, &found, &nfound, &fsize))
+		{
+			r = -1;
+		}
+	}
+	free(classes);
+	free(found);
+	if(r)
+	{
+		free(ids);
+		return -1;
+	}
+	return lod_termids_uris_(context, ids, count, uris, max);
+}
+
+/* Obtain the classes of which an instance is a member */
+long
+lod_instance_types(LODINSTANCE *instance, const char **types, size_t max)
+{
+	LODCONTEXT *context;
+	long r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_types_locked_(instance, types, max);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_types(), with the context lock held */
+static long
+lod_instance_types_locked_(LODINSTANCE *instance, const char **types, size_t max)
+{
+	LODCONTEXT *context;
+	LODINDEXES *index;
+	LODTERMID sid, *ids;
+	librdf_node *const *objects;
+	uint32_t e, a;
+	size_t count, size, n;
+	int closure;
+
+	context = instance->context;
+	lod_state_(context)->error = 0;
+	index = &(context->index);
+	ids = NULL;
+	count = size = 0;
+	if(librdf_node_is_resource(instance->subject) && lod_types_ready_(context, &closure))
+	{
+		sid = lod_intern_node_id_(context, instance->subject, 0);
+		if(sid == LOD_NOTERM)
+		{
+			return 0;
+		}
+		for(e = lod_edges_first_(&(index->types), sid); e != LOD_NOEDGE; e = index->types.edges[e].next)
+		{
+			if(lod_termids_append_(&ids, &count, &size, index->types.edges[e].to))
+			{
+				goto failed;
+			}
+			if(!closure)
+			{
+				continue;
+			}
+			for(a = lod_edges_first_(&(index->ancestors), index->types.edges[e].to); a != LOD_NOEDGE; a = index->ancestors.edges[a].next)
+			{
+				if(lod_termids_append_(&ids, &count, &size, index->ancestors.edges[a].to))
+				{
+					goto failed;
+				}
+			}
+		}
+		return lod_termids_uris_(context, ids, count, types, max);
+	}
+	if(lod_state_(context)->error)
+	{
+		return -1;
+	}
+	/* Fall back to the instance's own rdf:type properties */
+	if(!lod_intern_node_(context, LOD_RDF_TYPE))
+	{
+		return -1;
+	}
+	objects = lod_instance_get_all(instance, context->intern.terms[LOD_RDF_TYPE].str, &n);
+	if(lod_state_(context)->error)
+	{
+		return -1;
+	}
+	for(; n; n--, objects++)
+	{
+		sid = lod_intern_node_id_(context, *objects, 1);
+		if(sid != LOD_NOTERM && lod_termids_append_(&ids, &count, &size, sid))
+		{
+			goto failed;
+		}
+	}
+	return lod_termids_uris_(context, ids, count, types, max);
+failed:
+	lod_set_error_(context, strerror(errno));
+	free(ids);
+	return -1;
+}
+
+/* Determine whether an instance is a member of a class */
+int
+lod_instance_is_a(LODINSTANCE *instance, const char *type)
+{
+	LODCONTEXT *context;
+	int r;
+
+	context = instance->context;
+	lod_lock_(context);
+	r = lod_instance_is_a_locked_(instance, type);
+	lod_unlock_(context);
+	return r;
+}
+
+/* lod_instance_is_a(), with the context lock held */
+static int
+lod_instance_is_a_locked_(LODINSTANCE *instance, const char *type)
+{
+	LODCONTEXT *context;
+	LODINDEXES *index;
+	LODTERMID sid, tid;
+	librdf_node *const *objects;
+	uint32_t e;
+	size_t n;
+	int closure;
+
+	context = instance->context;
+	lod_state_(context)->error = 0;
+	index = &(context->index);
+	/* The type isn't interned merely to look it up; an indexed type
+	 * always is
+	 */
+	tid = lod_intern_find_(context, type, strlen(type));
+	if(librdf_node_is_resource(instance->subject) && lod_types_ready_(context, &closure))
+	{
+		sid = lod_intern_node_id_(context, instance->subject, 0);
+		if(sid == LOD_NOTERM || tid == LOD_NOTERM)
+		{
+			return 0;
+		}
+		for(e = lod_edges_first_(&(index->types), sid); e != LOD_NOEDGE; e = index->types.edges[e].next)
+		{
+			if(index->types.edges[e].to == tid ||
+			   (closure && lod_edges_exists_(&(index->ancestors), index->types.edges[e].to, LOD_RDFS_SUBCLASSOF, tid)))
+			{
+				return 1;
+			}
+		}
+		return 0;
+	}
+	if(lod_state_(context)->error || !lod_intern_node_(context, LOD_RDF_TYPE))
+	{
+		return -1;
+	}
+	objects = lod_instance_get_all(instance, context->intern.terms[LOD_RDF_TYPE].str, &n);
+	if(lod_state_(context)->error)
+	{
+		return -1;
+	}
+	for(; n; n--, objects++)
+	{
+		if(librdf_node_is_resource(*objects) &&
+		   !strcmp((const char *) librdf_uri_as_string(librdf_node_get_uri(*objects)), type))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Update the type index to reflect an rdf:type or rdfs:subClassOf
+ * statement
+ */
+int
+lod_types_add_(LODCONTEXT *context, LODTERMID subject, LODTERMID predicate, LODTERMID object)
+{
+	LODINDEXES *index;
+
+	index = &(context->index);
+	if(predicate == LOD_RDFS_SUBCLASSOF)
+	{
+		index->closure_valid = 0;
+		return lod_edges_add_(&(index->superclasses), subject, predicate, object);
+	}
+	if(lod_edges_add_(&(index->types), subject, predicate, object))
+	{
+		return -1;
+	}
+	return lod_edges_add_(&(index->members), object, predicate, subject);
+}
+
+/* Discard the contents of the type index */
+void
+lod_types_reset_(LODINDEXES *index)
+{
+	lod_edges_reset_(&(index->types));
+	lod_edges_reset_(&(index->members));
+	lod_edges_reset_(&(index->superclasses));
+	lod_edges_reset_(&(index->ancestors));
+	lod_edges_reset_(&(index->descendants));
+	index->closure_valid = 0;
+}
+
+/* Determine whether the type index can be used, and whether the subclass
+ * closure should be consulted (computing it if needed)
+ */
+static int
+lod_types_ready_(LODCONTEXT *context, int *closure)
+{
+	librdf_model *model;
+
+	*closure = 0;
+	model = lod_model(context);
+	if(!model || !lod_index_ready_(context, model, LODI_TYPES))
+	{
+		return 0;
+	}
+	if(!(context->index.flags & LODI_SUBCLASSES))
+	{
+		return 1;
+	}
+	if(!context->index.closure_valid && lod_types_closure_(context))
+	{
+		/* The direct types are still usable */
+		return 1;
+	}
+	*closure = 1;
+	return 1;
+}
+
+/* Compute the transitive closure of the class hierarchy */
+static int
+lod_types_closure_(LODCONTEXT *context)
+{
+	LODINDEXES *index;
+	LODTERMID *mark, *stack, from, c;
+	size_t nstack, e, n;
+	uint32_t s;
+
+	index = &(context->index);
+	lod_edges_reset_(&(index->ancestors));
+	lod_edges_reset_(&(index->descendants));
+	n = context->intern.nterms;
+	/* mark[c] is the class whose ancestors are being computed when c has
+	 * already been visited; the stack can't exceed the number of edges
+	 */
+	mark = (LODTERMID *) malloc(n * sizeof(LODTERMID));
+	stack = (LODTERMID *) malloc((index->superclasses.nedges + 1) * sizeof(LODTERMID));
+	if(!mark || !stack)
+	{
+		free(mark);
+		free(stack);
+		lod_set_error_(context, strerror(errno));
+		return -1;
+	}
+	for(c = 0; c < n; c++)
+	{
+		mark[c] = LOD_NOTERM;
+	}
+	for(e = 0; e < index->superclasses.nedges; e++)
+	{
+		from = index->superclasses.edges[e].from;
+		if(lod_edges_first_(&(index->ancestors), from) != LOD_NOEDGE)
+		{
+			/* Already computed */
+			continue;
+		}
+		mark[from] = from;
+		stack[0] = from;
+		nstack = 1;
+		while(nstack)
+		{
+			c = stack[--nstack];
+			for(s = lod_edges_first_(&(index->superclasses), c); s != LOD_NOEDGE; s = index->superclasses.edges[s].next)
+			{
+				c = index->superclasses.edges[s].to;
+				if(mark[c] == from)
+				{
+					continue;
+				}
+				mark[c] = from;
+				stack[nstack++] = c;
+				if(lod_edges_add_(&(index->ancestors), from, LOD_RDFS_SUBCLASSOF, c) ||
+				   lod_edges_add_(&(index->descendants), c, LOD_RDFS_SUBCLASSOF, from))
+				{
+					free(mark);
+					free(stack);
+					lod_set_error_(context, strerror(errno));
+					return -1;
+				}
+			}
+		}
+	}
+	free(mark);
+	free(stack);
+	index->closure_valid = 1;
+	return 0;
+}